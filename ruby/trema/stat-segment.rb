@@ -0,0 +1,122 @@
+#
+# Reads the statistics that a trema process publishes into
+# TREMA_TMP/<name>.stats (see stat.h for the layout).
+#
+# Copyright (C) 2008-2011 NEC Corporation
+#
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU General Public License, version 2, as
+# published by the Free Software Foundation.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License along
+# with this program; if not, write to the Free Software Foundation, Inc.,
+# 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+#
+
+
+require "trema/path"
+
+
+module Trema
+  class StatSegment
+    MAGIC = 0x54415453
+    VERSION = 1
+    HEADER = "LLQQLLLLLLQQ"
+    HEADER_LENGTH = 64
+    RETRIES = 1000
+
+
+    attr_reader :pid
+    attr_reader :updated_at
+    attr_reader :counters
+    attr_reader :histograms
+
+
+    def self.path name
+      File.join Trema.tmp, "#{ name }.stats"
+    end
+
+
+    def self.exist? name
+      FileTest.exist? path( name )
+    end
+
+
+    def initialize name
+      @path = self.class.path( name )
+      load
+    end
+
+
+    def percentile histogram, percent
+      return 0 if histogram[ :count ] == 0
+      rank = [ ( percent / 100.0 * histogram[ :count ] ).ceil, 1 ].max
+      seen = 0
+      histogram[ :buckets ].each_with_index do | each, index |
+        seen += each
+        next if seen < rank
+        return histogram[ :max ] if index == histogram[ :buckets ].size - 1
+        return [ bucket_limit( index ), histogram[ :max ] ].min
+      end
+      histogram[ :max ]
+    end
+
+
+    ############################################################################
+    private
+    ############################################################################
+
+
+    def load
+      RETRIES.times do
+        data = File.open( @path, "rb" ) { | f | f.read }
+        sequence = data[ 0, HEADER_LENGTH ].unpack( HEADER )[ 2 ]
+        next if sequence.odd?
+        again = File.open( @path, "rb" ) { | f | f.read( HEADER_LENGTH ) }
+        next if again.unpack( HEADER )[ 2 ] != sequence
+        parse data
+        return
+      end
+      raise "Failed to read #{ @path }."
+    end
+
+
+    def parse data
+      magic, version, _sequence, updated_at, @pid, key_length, n_counters, n_histograms, n_buckets, @sub_bits, counters_offset, histograms_offset = data.unpack( HEADER )
+      raise "#{ @path } is not a statistics segment." if magic != MAGIC
+      raise "Unsupported statistics segment version #{ version }." if version != VERSION
+      @updated_at = Time.at( updated_at / 1000000000, updated_at % 1000000000 / 1000 )
+
+      counter_length = key_length + 8
+      @counters = ( 0...n_counters ).collect do | i |
+        data[ counters_offset + counter_length * i, counter_length ].unpack( "Z#{ key_length }Q" )
+      end
+
+      histogram_length = key_length + 8 * ( 3 + n_buckets )
+      @histograms = ( 0...n_histograms ).collect do | i |
+        fields = data[ histograms_offset + histogram_length * i, histogram_length ].unpack( "Z#{ key_length }Q3Q#{ n_buckets }" )
+        { :key => fields[ 0 ], :count => fields[ 1 ], :sum => fields[ 2 ], :max => fields[ 3 ], :buckets => fields[ 4..-1 ] }
+      end
+    end
+
+
+    def bucket_limit index
+      shift = ( index >> @sub_bits ) - 1
+      return index if shift < 0
+      low = ( ( 1 << @sub_bits ) | ( index & ( ( 1 << @sub_bits ) - 1 ) ) ) << shift
+      low + ( 1 << shift ) - 1
+    end
+  end
+end
+
+
+### Local variables:
+### mode: Ruby
+### coding: utf-8
+### indent-tabs-mode: nil
+### End:
@@ -26,6 +26,7 @@ require "trema/cli"
 require "trema/common-commands"
 require "trema/dsl"
 require "trema/ofctl"
+require "trema/stat-segment"
 require "trema/util"
 
 
@@ -201,6 +202,11 @@ EOF
 
     @options.parse! ARGV
 
+    if stats.nil? and Trema::StatSegment.exist?( ARGV[ 0 ] )
+      show_process_stats ARGV[ 0 ]
+      return
+    end
+
     host = @dsl_parser.load_current.hosts[ ARGV[ 0 ] ]
     case stats
     when :tx
@@ -259,7 +265,7 @@ Available commands:
   run            - runs a trema application.
   killall        - terminates all trema processes.
   send_packets   - sends UDP packets to destination host.
-  show_stats     - shows stats of packets.
+  show_stats     - shows stats of packets or of a trema process.
   reset_stats    - resets stats of packets.
   dump_flows     - print all flow entries.
 EOL
@@ -292,6 +298,22 @@ EOL
   end
 
 
+  def show_process_stats name
+    segment = Trema::StatSegment.new( name )
+    puts "#{ name } (pid = #{ segment.pid }, updated at #{ segment.updated_at })"
+    segment.counters.each do | key, value |
+      puts "#{ key }: #{ value }"
+    end
+    segment.histograms.each do | each |
+      next if each[ :count ] == 0
+      percentiles = [ 50, 90, 99, 99.9 ].collect do | p |
+        "p#{ p } = #{ segment.percentile( each, p ) }"
+      end
+      puts "#{ each[ :key ] }: count = #{ each[ :count ] }, mean = #{ each[ :sum ] / each[ :count ] }, #{ percentiles.join ', ' }, max = #{ each[ :max ] }"
+    end
+  end
+
+
   def load_config
     config = nil
 
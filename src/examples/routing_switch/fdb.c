@@ -138,33 +138,33 @@ is_ether_multicast( const uint8_t mac[ OFP_ETH_ALEN ] ) {
 }
 
 
-hash_table *
+mac_hash_map *
 create_fdb() {
-  return create_hash( compare_mac, hash_mac );
+  return create_mac_hash_map( 0 );
 }
 
 
 void
-delete_fdb( hash_table *fdb ) {
+delete_fdb( mac_hash_map *fdb ) {
   if ( fdb != NULL ) {
-    hash_iterator iter;
-    hash_entry *e;
-    init_hash_iterator( fdb, &iter );
-    while ( ( e = iterate_hash_next( &iter ) ) != NULL ) {
+    mac_hash_map_iterator iter;
+    mac_hash_map_entry *e;
+    init_mac_hash_map_iterator( fdb, &iter );
+    while ( ( e = iterate_mac_hash_map_next( &iter ) ) != NULL ) {
       xfree( e->value );
     }
-    delete_hash( fdb );
+    delete_mac_hash_map( fdb );
   }
 }
 
 
 bool
-update_fdb( hash_table *fdb, const uint8_t mac[ OFP_ETH_ALEN ], uint64_t dpid, uint16_t port ) {
+update_fdb( mac_hash_map *fdb, const uint8_t mac[ OFP_ETH_ALEN ], uint64_t dpid, uint16_t port ) {
   assert( fdb != NULL );
   assert( mac != NULL );
   assert( port != 0 );
 
-  fdb_entry *entry = lookup_hash_entry( fdb, mac );
+  fdb_entry *entry = lookup_mac_hash_map_entry( fdb, ( const mac_address * ) mac );
 
   debug( "Updating fdb (mac: %02x:%02x:%02x:%02x:%02x:%02x, dpid = %#" PRIx64 ", port = %u)",
          mac[ 0 ], mac[ 1 ], mac[ 2 ], mac[ 3 ], mac[ 4 ], mac[ 5 ],
@@ -188,10 +188,8 @@ update_fdb( hash_table *fdb, const uint8_t mac[ OFP_ETH_ALEN ], uint64_t dpid, u
       return true;
     }
 
-    warn( "Failed to update fdb because host move detected in %d sec.",
-          HOST_MOVE_GUARD_SEC );
-    warn( "mac: %02x:%02x:%02x:%02x:%02x:%02x",
-          mac[ 0 ], mac[ 1 ], mac[ 2 ], mac[ 3 ], mac[ 4 ], mac[ 5 ] );
+    LOG_RATE_LIMITED( warn, "Failed to update fdb because host move detected in %d sec ( mac = %02x:%02x:%02x:%02x:%02x:%02x ).",
+                      HOST_MOVE_GUARD_SEC, mac[ 0 ], mac[ 1 ], mac[ 2 ], mac[ 3 ], mac[ 4 ], mac[ 5 ] );
 
     return false;
   }
@@ -202,14 +200,14 @@ update_fdb( hash_table *fdb, const uint8_t mac[ OFP_ETH_ALEN ], uint64_t dpid, u
   entry->port = port;
   entry->created_at = time( NULL );
   entry->updated_at = entry->created_at;
-  insert_hash_entry( fdb, entry->mac, entry );
+  insert_mac_hash_map_entry( fdb, ( const mac_address * ) entry->mac, entry );
 
   return true;
 }
 
 
 bool
-lookup_fdb( hash_table *fdb, const uint8_t mac[ OFP_ETH_ALEN ], uint64_t *dpid, uint16_t *port ) {
+lookup_fdb( mac_hash_map *fdb, const uint8_t mac[ OFP_ETH_ALEN ], uint64_t *dpid, uint16_t *port ) {
   assert( fdb != NULL );
   assert( mac != NULL );
   assert( dpid != NULL );
@@ -220,7 +218,7 @@ lookup_fdb( hash_table *fdb, const uint8_t mac[ OFP_ETH_ALEN ], uint64_t *dpid,
     return false;
   }
 
-  fdb_entry *entry = lookup_hash_entry( fdb, mac );
+  fdb_entry *entry = lookup_mac_hash_map_entry( fdb, ( const mac_address * ) mac );
 
   debug( "Lookup mac:%02x:%02x:%02x:%02x:%02x:%02x", 
          mac[ 0 ], mac[ 1 ], mac[ 2 ], mac[ 3 ], mac[ 4 ], mac[ 5 ] );
@@ -239,7 +237,7 @@ lookup_fdb( hash_table *fdb, const uint8_t mac[ OFP_ETH_ALEN ], uint64_t *dpid,
 
 
 void
-delete_fdb_entries( hash_table *fdb, uint64_t dpid, uint16_t port ) {
+delete_fdb_entries( mac_hash_map *fdb, uint64_t dpid, uint16_t port ) {
   if ( fdb == NULL ) {
     return;
   }
@@ -247,16 +245,13 @@ delete_fdb_entries( hash_table *fdb, uint64_t dpid, uint16_t port ) {
   debug( "Deleting fdb entries ( dpid = %#" PRIx64 ", port = %u ).", dpid, port );
 
   fdb_entry *entry = NULL;
-  hash_iterator iter;
-  hash_entry *e;
-  init_hash_iterator( fdb, &iter );
-  while ( ( e = iterate_hash_next( &iter ) ) != NULL ) {
-    if ( e->value == NULL ) {
-      continue;
-    }
+  mac_hash_map_iterator iter;
+  mac_hash_map_entry *e;
+  init_mac_hash_map_iterator( fdb, &iter );
+  while ( ( e = iterate_mac_hash_map_next( &iter ) ) != NULL ) {
     entry = e->value;
     if ( entry->dpid == dpid && entry->port == port ) {
-      delete_hash_entry( fdb, entry->mac );
+      delete_mac_hash_map_entry( fdb, &e->key );
       xfree( entry );
     }
   }
@@ -264,13 +259,13 @@ delete_fdb_entries( hash_table *fdb, uint64_t dpid, uint16_t port ) {
 
 
 static void
-age_fdb_entry( void *key, void *value, void *user_data ) {
-  hash_table *fdb = user_data;
+age_fdb_entry( const mac_address *key, void *value, void *user_data ) {
+  mac_hash_map *fdb = user_data;
   fdb_entry *entry = value;
 
   if ( entry->updated_at + FDB_ENTRY_TIMEOUT < time( NULL ) ) {
     debug( "Age out" );
-    void *deleted = delete_hash_entry( fdb, key );
+    void *deleted = delete_mac_hash_map_entry( fdb, key );
     xfree( deleted ); // free fdb_entry
   }
 }
@@ -278,13 +273,13 @@ age_fdb_entry( void *key, void *value, void *user_data ) {
 
 static void
 age_fdb( void *user_data ) {
-  hash_table *fdb = user_data;
-  foreach_hash( fdb, age_fdb_entry, fdb );
+  mac_hash_map *fdb = user_data;
+  foreach_mac_hash_map( fdb, age_fdb_entry, fdb );
 }
 
 
 void
-init_age_fdb( hash_table *fdb ) {
+init_age_fdb( mac_hash_map *fdb ) {
   assert( fdb != NULL );
   add_periodic_event_callback( FDB_AGING_INTERVAL, age_fdb, fdb );
 }
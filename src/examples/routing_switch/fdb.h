@@ -30,12 +30,12 @@
 #include "trema.h"
 
 
-hash_table *create_fdb( void );
-void delete_fdb( hash_table *fdb );
-bool update_fdb( hash_table *fdb, const uint8_t mac[ OFP_ETH_ALEN ], uint64_t dpid, uint16_t port );
-bool lookup_fdb( hash_table *fdb, const uint8_t mac[ OFP_ETH_ALEN ], uint64_t *dpid, uint16_t *port );
-void init_age_fdb( hash_table *fdb );
-void delete_fdb_entries( hash_table *fdb, uint64_t dpid, uint16_t port );
+mac_hash_map *create_fdb( void );
+void delete_fdb( mac_hash_map *fdb );
+bool update_fdb( mac_hash_map *fdb, const uint8_t mac[ OFP_ETH_ALEN ], uint64_t dpid, uint16_t port );
+bool lookup_fdb( mac_hash_map *fdb, const uint8_t mac[ OFP_ETH_ALEN ], uint64_t *dpid, uint16_t *port );
+void init_age_fdb( mac_hash_map *fdb );
+void delete_fdb_entries( mac_hash_map *fdb, uint64_t dpid, uint16_t port );
 
 
 #endif // FDB_H
@@ -19,7 +19,7 @@
 
 
 #include "libpathresolver.h"
-#include "hash_table.h"
+#include "hash_map.h"
 #include "doubly_linked_list.h"
 
 
@@ -27,7 +27,7 @@ struct edge;
 
 typedef struct node {
   uint64_t dpid;                // key
-  hash_table *edges;            // node * -> edge
+  uint64_hash_map *edges;       // peer dpid -> edge
   uint32_t distance;            // distance from root node
   bool visited;
   struct {
@@ -46,7 +46,7 @@ typedef struct edge {
 
 
 struct resolve_path_param {
-  hash_table *node_table;
+  uint64_hash_map *node_table;
   uint64_t in_dpid;
   uint16_t in_port_no;
   uint64_t out_dpid;
@@ -88,70 +88,32 @@ void mock_get_all_link_status( void ( *callback )(), void *user_data );
 #endif  // UNIT_TESTING
 
 
-static bool
-comp_node( const void *x0, const void *y0 ) {
-  const node *x = x0;
-  const node *y = y0;
-
-  return ( x->dpid == y->dpid );
-}
-
-
-static unsigned int
-hash_node( const void *key0 ) {
-  const node *key = key0;
-
-  return ( unsigned int )(( key->dpid >> 32 ) ^ ( key->dpid & 0xffffffffUL ));
-}
-
-
-static bool
-comp_edge( const void *x0, const void *y0 ) {
-  const uint64_t *x = x0;
-  const uint64_t *y = y0;
-
-  return ( *x == *y );
-}
-
-
-static unsigned int
-hash_edge( const void *key0 ) {
-  const uint64_t *key = key0;
-
-  return ( unsigned int ) ( ( *key >> 32 ) ^ ( *key & 0xffffffffUL ) );
-}
-
-
 static edge *
 lookup_edge( const node *from, const node *to ) {
-  return ( edge * ) lookup_hash_entry( from->edges, &to->dpid );
+  return ( edge * ) lookup_uint64_hash_map_entry( from->edges, &to->dpid );
 }
 
 
 static node *
-lookup_node( hash_table *node_table, const uint64_t dpid ) {
-  node key;
-
-  key.dpid = dpid;
-
-  return ( node * )lookup_hash_entry( node_table, &key );
+lookup_node( uint64_hash_map *node_table, const uint64_t dpid ) {
+  return ( node * )lookup_uint64_hash_map_entry( node_table, &dpid );
 }
 
 
 static node *
-allocate_node( hash_table *node_table, const uint64_t dpid ) {
+allocate_node( uint64_hash_map *node_table, const uint64_t dpid ) {
   node *n = lookup_node( node_table, dpid );
   if ( n == NULL ) {
     n = xmalloc( sizeof( node ) );
 
     n->dpid = dpid;
-    n->edges = create_hash( comp_edge, hash_edge );
+    n->edges = create_uint64_hash_map( 0 );
     n->distance = UINT32_MAX;
     n->visited = false;
     n->from.node = NULL;
     n->from.edge = NULL;
 
-    insert_hash_entry( node_table, n, n );
+    insert_uint64_hash_map_entry( node_table, &n->dpid, n );
   }
 
   return n;
@@ -162,7 +124,7 @@ static void
 free_edge( node *n, edge *e ) {
   assert( n != NULL );
   assert( e != NULL );
-  edge *delete_me = delete_hash_entry( n->edges, &e->peer_dpid );
+  edge *delete_me = delete_uint64_hash_map_entry( n->edges, &e->peer_dpid );
   if ( delete_me != NULL ) {
     xfree( delete_me );
   }
@@ -170,7 +132,7 @@ free_edge( node *n, edge *e ) {
 
 
 static void
-add_edge( hash_table *node_table, const uint64_t from_dpid,
+add_edge( uint64_hash_map *node_table, const uint64_t from_dpid,
           const uint16_t from_port_no, const uint64_t to_dpid,
           const uint16_t to_port_no, const uint32_t cost ) {
   node *from = allocate_node( node_table, from_dpid );
@@ -186,7 +148,7 @@ add_edge( hash_table *node_table, const uint64_t from_dpid,
   e->peer_port_no = to_port_no;
   e->cost = cost;
 
-  insert_hash_entry( from->edges, &e->peer_dpid, e );
+  insert_uint64_hash_map_entry( from->edges, &e->peer_dpid, e );
 }
 
 
@@ -198,17 +160,17 @@ calculate_link_cost( const topology_link_status *l ) {
 
 
 static node *
-pickup_next_candidate( hash_table *node_table ) {
+pickup_next_candidate( uint64_hash_map *node_table ) {
   node *candidate = NULL;
   uint32_t min_cost = UINT32_MAX;
 
-  hash_iterator iter;
-  hash_entry *entry = NULL;
+  uint64_hash_map_iterator iter;
+  uint64_hash_map_entry *entry = NULL;
   node *n = NULL;
 
   // pickup candidate node whose distance is minimum from visited nodes
-  init_hash_iterator( node_table, &iter );
-  while ( ( entry = iterate_hash_next( &iter ) ) != NULL ) {
+  init_uint64_hash_map_iterator( node_table, &iter );
+  while ( ( entry = iterate_uint64_hash_map_next( &iter ) ) != NULL ) {
     n = ( node * )entry->value;
     if ( !n->visited && n->distance < min_cost ) {
       min_cost = n->distance;
@@ -221,13 +183,13 @@ pickup_next_candidate( hash_table *node_table ) {
 
 
 static void
-update_distance( hash_table *node_table, node *candidate ) {
-  hash_iterator iter;
-  hash_entry *entry = NULL;
+update_distance( uint64_hash_map *node_table, node *candidate ) {
+  uint64_hash_map_iterator iter;
+  uint64_hash_map_entry *entry = NULL;
 
   // update distance
-  init_hash_iterator( node_table, &iter );
-  while ( ( entry = iterate_hash_next( &iter ) ) != NULL ) {
+  init_uint64_hash_map_iterator( node_table, &iter );
+  while ( ( entry = iterate_uint64_hash_map_next( &iter ) ) != NULL ) {
     node *n = ( node * )entry->value;
     edge *e;
     if ( n->visited || ( e = lookup_edge( candidate, n ) ) == NULL ) {
@@ -288,7 +250,7 @@ build_hop_list( node *src_node, uint16_t src_port_no,
 
 
 static void
-build_topology_table( hash_table *node_table, const topology_link_status links[], size_t nelems ) {
+build_topology_table( uint64_hash_map *node_table, const topology_link_status links[], size_t nelems ) {
   for ( size_t i = 0; i < nelems; i++ ) {
     topology_link_status const *l = &links[ i ];
     add_edge( node_table, l->from_dpid, l->from_portno, l->to_dpid,
@@ -298,7 +260,7 @@ build_topology_table( hash_table *node_table, const topology_link_status links[]
 
 
 static dlist_element *
-dijkstra( hash_table *node_table, uint64_t in_dpid, uint16_t in_port_no,
+dijkstra( uint64_hash_map *node_table, uint64_t in_dpid, uint16_t in_port_no,
           uint64_t out_dpid, uint16_t out_port_no ) {
   node *src_node = lookup_node( node_table, in_dpid );
   if ( src_node == NULL ) {
@@ -326,49 +288,49 @@ dijkstra( hash_table *node_table, uint64_t in_dpid, uint16_t in_port_no,
 
 
 static void
-free_node( hash_table *node_table, node *n ) {
+free_node( uint64_hash_map *node_table, node *n ) {
   if ( n == NULL ) {
     return;
   }
 
-  hash_iterator iter;
-  hash_entry *entry;
+  uint64_hash_map_iterator iter;
+  uint64_hash_map_entry *entry;
 
-  init_hash_iterator( n->edges, &iter );
-  while ( ( entry = iterate_hash_next( &iter ) ) != NULL ) {
+  init_uint64_hash_map_iterator( n->edges, &iter );
+  while ( ( entry = iterate_uint64_hash_map_next( &iter ) ) != NULL ) {
     edge *e = ( edge * )entry->value;
     free_edge( n, e );
   }
 
-  delete_hash( n->edges );
-  delete_hash_entry( node_table, n );
+  delete_uint64_hash_map( n->edges );
+  delete_uint64_hash_map_entry( node_table, &n->dpid );
   xfree( n );
 }
 
 
 static void
-flush_topology_table( hash_table *node_table ) {
-  hash_iterator iter;
-  hash_entry *e;
+flush_topology_table( uint64_hash_map *node_table ) {
+  uint64_hash_map_iterator iter;
+  uint64_hash_map_entry *e;
 
-  init_hash_iterator( node_table, &iter );
-  while ( ( e = iterate_hash_next( &iter ) ) != NULL ) {
+  init_uint64_hash_map_iterator( node_table, &iter );
+  while ( ( e = iterate_uint64_hash_map_next( &iter ) ) != NULL ) {
     node *n = ( node * )e->value;
     free_node( node_table, n );
   }
 }
 
 
-static hash_table *
+static uint64_hash_map *
 create_node_table() {
-  return create_hash( comp_node, hash_node );
+  return create_uint64_hash_map( 0 );
 }
 
 
 static void
-delete_node_table( hash_table *node_table ) {
+delete_node_table( uint64_hash_map *node_table ) {
   flush_topology_table( node_table );
-  delete_hash( node_table );
+  delete_uint64_hash_map( node_table );
 }
 
 
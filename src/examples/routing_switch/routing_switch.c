@@ -230,31 +230,31 @@ void mock_usage( void );
 #undef init_age_fdb
 #endif
 #define init_age_fdb mock_init_age_fdb
-void mock_init_age_fdb( hash_table *fdb );
+void mock_init_age_fdb( mac_hash_map *fdb );
 
 #ifdef update_fdb
 #undef update_fdb
 #endif
 #define update_fdb mock_update_fdb
-bool mock_update_fdb( hash_table *fdb, const uint8_t mac[ OFP_ETH_ALEN ], uint64_t dpid, uint16_t port );
+bool mock_update_fdb( mac_hash_map *fdb, const uint8_t mac[ OFP_ETH_ALEN ], uint64_t dpid, uint16_t port );
 
 #ifdef lookup_fdb
 #undef lookup_fdb
 #endif
 #define lookup_fdb mock_lookup_fdb
-bool mock_lookup_fdb( hash_table *fdb, const uint8_t mac[ OFP_ETH_ALEN ], uint64_t *dpid, uint16_t *port );
+bool mock_lookup_fdb( mac_hash_map *fdb, const uint8_t mac[ OFP_ETH_ALEN ], uint64_t *dpid, uint16_t *port );
 
 #ifdef create_fdb
 #undef create_fdb
 #endif
 #define create_fdb mock_create_fdb
-hash_table * mock_create_fdb( void );
+mac_hash_map * mock_create_fdb( void );
 
 #ifdef delete_fdb
 #undef delete_fdb
 #endif
 #define delete_fdb mock_delete_fdb
-void mock_delete_fdb( hash_table *fdb );
+void mock_delete_fdb( mac_hash_map *fdb );
 
 #ifdef delete_outbound_port
 #undef delete_outbound_port
@@ -320,7 +320,7 @@ typedef struct routing_switch_options {
 typedef struct routing_switch {
   uint16_t idle_timeout;
   list_element *switches;
-  hash_table *fdb;
+  mac_hash_map *fdb;
 } routing_switch;
 
 
@@ -402,8 +402,6 @@ discard_packet_in( uint64_t datapath_id, uint16_t in_port, const buffer *packet
   const uint32_t wildcards = 0;
   struct ofp_match match;
   set_match_from_packet( &match, in_port, wildcards, packet );
-  char match_str[ 1024 ];
-  match_to_string( &match, match_str, sizeof( match_str ) );
 
   const uint16_t idle_timeout = 0;
   const uint16_t hard_timeout = PACKET_IN_DISCARD_DURATION;
@@ -411,8 +409,12 @@ discard_packet_in( uint64_t datapath_id, uint16_t in_port, const buffer *packet
   const uint32_t buffer_id = UINT32_MAX;
   const uint16_t flags = 0;
 
-  info( "Discarding packets for a certain period ( datapath_id = %#" PRIx64
-        ", match = [%s], duration = %u [sec] ).", datapath_id, match_str, hard_timeout );
+  if ( LOG_LEVEL_ENABLED( LOG_INFO ) ) {
+    char match_str[ 1024 ];
+    match_to_string( &match, match_str, sizeof( match_str ) );
+    info( "Discarding packets for a certain period ( datapath_id = %#" PRIx64
+          ", match = [%s], duration = %u [sec] ).", datapath_id, match_str, hard_timeout );
+  }
 
   buffer *flow_mod = create_flow_mod( get_transaction_id(), match, get_cookie(),
                                       OFPFC_ADD, idle_timeout, hard_timeout,
@@ -436,7 +438,6 @@ resolve_path_replied( void *user_data, dlist_element *hops ) {
   uint16_t out_port = param->out_port;
   buffer *original_packet = param->original_packet;
 
-  original_packet->user_data = NULL;
   if ( !parse_packet( original_packet ) ) {
     warn( "Received unsupported packet." );
     free_packet( original_packet );
@@ -634,7 +635,7 @@ handle_packet_in( uint64_t datapath_id, uint32_t transaction_id,
     return;
   }
 
-  buffer *original_packet = duplicate_buffer( data );
+  buffer *original_packet = retain_buffer( data );
   uint16_t out_port;
   uint64_t out_datapath_id;
 
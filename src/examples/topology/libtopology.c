@@ -39,13 +39,12 @@ static void ( *port_status_updated_callback )( void *,
                                               const topology_port_status * ) = NULL;
 static void *port_status_updated_callback_param = NULL;
 
-static hash_table *transaction_table = NULL;
+static const struct timespec request_timeout = { 60, 0 };
 
 
 struct send_request_param {
   void ( *callback )();
   void *user_data;
-  uint32_t transaction_id;
   uint16_t message_type;
   struct timeval called_at;
 };
@@ -61,42 +60,24 @@ create_request_message( const char *name ) {
 }
 
 
-static uint32_t
-get_request_transaction_id() {
-  static pid_t pid = 0;
-
-  if ( pid == 0 ) {
-    pid = getpid();
-  }
-
-  struct timeval now;
-  gettimeofday( &now, NULL );
-
-  return ( ( uint32_t ) ( pid << 16 ) ^  ( uint32_t ) now.tv_sec ^ ( uint32_t ) now.tv_usec );
-}
-
-
 static void
-mark_transaction( struct send_request_param *param, uint16_t message_type ) {
-  gettimeofday( &param->called_at, NULL );
-  param->transaction_id = get_request_transaction_id();
-  param->message_type = message_type;
-  insert_hash_entry( transaction_table, &param->transaction_id, param );
-}
-
+request_timed_out( void *user_data ) {
+  struct send_request_param *param = user_data;
 
-static void
-unmark_transaction( struct send_request_param *param ) {
-  void *deleted = delete_hash_entry( transaction_table, &param->transaction_id );
-  assert( deleted != NULL );
+  char buf[ 32 ];
+  warn( "Request to topology timed out ( message type = %u, called at %s ).",
+        param->message_type, ctime_r( ( time_t * ) &param->called_at.tv_sec, buf ) );
+  xfree( param );
 }
 
 
 struct send_request_param *
-create_request_param( void ( *callback )(), void *user_data ) {
+create_request_param( void ( *callback )(), void *user_data, uint16_t message_type ) {
   struct send_request_param *param = xmalloc( sizeof( *param ) );
   param->callback = callback;
   param->user_data = user_data;
+  param->message_type = message_type;
+  gettimeofday( &param->called_at, NULL );
 
   return param;
 }
@@ -108,12 +89,11 @@ send_request( uint16_t message_type, void ( *callback )(), void *user_data ) {
   // make request header
   buffer *buf = create_request_message( libtopology_queue_name );
 
-  void *param = create_request_param( callback, user_data );
-  mark_transaction( param, message_type );
+  void *param = create_request_param( callback, user_data, message_type );
 
-  bool ret = send_request_message( topology_name, libtopology_queue_name,
-                              message_type, buf->data, buf->length,
-                              param );
+  bool ret = send_request_message_with_timeout( topology_name, libtopology_queue_name,
+                                                message_type, buf->data, buf->length,
+                                                param, &request_timeout, request_timed_out );
 
   assert( ret );
   free_buffer( buf );
@@ -142,12 +122,12 @@ send_update_link_status( const topology_update_link_status *link_status,
   // make request header
   buffer *buf = create_update_link_status_message( link_status );
 
-  void *param = create_request_param( callback, user_data );
-  mark_transaction( param, TD_MSGTYPE_UPDATE_LINK_STATUS );
+  void *param = create_request_param( callback, user_data, TD_MSGTYPE_UPDATE_LINK_STATUS );
 
-  bool ret = send_request_message( topology_name, libtopology_queue_name,
-                              TD_MSGTYPE_UPDATE_LINK_STATUS,
-                              buf->data, buf->length, param );
+  bool ret = send_request_message_with_timeout( topology_name, libtopology_queue_name,
+                                                TD_MSGTYPE_UPDATE_LINK_STATUS,
+                                                buf->data, buf->length,
+                                                param, &request_timeout, request_timed_out );
 
   assert( ret );
   free_buffer( buf );
@@ -308,8 +288,6 @@ subscribe_topology( void ( *callback )( void *user_data ), void *user_data ) {
 
 static void
 recv_reply( uint16_t tag, void *data, size_t len, void *user_data ) {
-  unmark_transaction( user_data );
-
   switch ( tag ) {
   case TD_MSGTYPE_RESPONSE:
     recv_subscribe_reply( tag, data, len, user_data );
@@ -350,23 +328,6 @@ recv_status_notification( uint16_t tag, void *data, size_t len ) {
 }
 
 
-static void
-check_transaction_table( void *user_data ) {
-  hash_table *transaction_table = user_data;
-
-  hash_iterator iter;
-  init_hash_iterator( transaction_table, &iter );
-  hash_entry *e;
-  while (( e = iterate_hash_next( &iter ) ) != NULL ) {
-    struct send_request_param *param = e->value;
-    warn( "Outstanding transaction still remains: %#x", param->transaction_id );
-    warn( " message type is %u", param->message_type );
-    char buf[ 32 ];
-    warn( " called at %s", ctime_r( ( time_t * ) &param->called_at.tv_sec, buf ) );
-  }
-}
-
-
 bool
 init_libtopology( const char *service_name ) {
   if ( topology_name != NULL || libtopology_queue_name != NULL ) {
@@ -384,9 +345,6 @@ init_libtopology( const char *service_name ) {
   add_message_replied_callback( libtopology_queue_name, recv_reply );
   add_message_received_callback( libtopology_queue_name, recv_status_notification );
 
-  transaction_table = create_hash( compare_uint32, hash_uint32 );
-  add_periodic_event_callback( 60, check_transaction_table, transaction_table );
-
   return true;
 }
 
@@ -419,8 +377,6 @@ finalize_libtopology() {
   topology_name = NULL;
   xfree( libtopology_queue_name );
   libtopology_queue_name = NULL;
-  delete_hash( transaction_table );
-  transaction_table = NULL;
 
   return true;
 }
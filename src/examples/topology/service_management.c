@@ -343,13 +343,23 @@ recv_request( const messenger_context_handle *handle,
 
 
 static void
-notify_link_status( subscriber_entry *entry, void *user_data ) {
-  buffer *notify = user_data;
+add_subscriber_name( subscriber_entry *entry, void *user_data ) {
+  list_element **names = user_data;
 
-  send_message( entry->name, TD_MSGTYPE_LINK_STATUS,
-                notify->data, notify->length );
+  insert_in_front( names, entry->name );
+}
+
+
+static void
+notify_all_user( uint16_t tag, buffer *notify ) {
+  list_element *names;
+  create_list( &names );
+  foreach_subscriber( add_subscriber_name, &names );
+
+  debug( "notify %#x to %u users", tag, list_length_of( names ) );
 
-  debug( "notify link status to %s", entry->name );
+  multicast_message( names, tag, notify->data, notify->length );
+  delete_list( names );
 }
 
 
@@ -358,22 +368,11 @@ notify_link_status_for_all_user( port_entry *port ) {
   buffer *notify = create_link_status_message();
   add_link_status_message( notify, port );
 
-  foreach_subscriber( notify_link_status, notify );
+  notify_all_user( TD_MSGTYPE_LINK_STATUS, notify );
   free_buffer( notify );
 }
 
 
-static void
-notify_port_status( subscriber_entry *entry, void *user_data ) {
-  buffer *notify = user_data;
-
-  send_message( entry->name, TD_MSGTYPE_PORT_STATUS,
-                notify->data, notify->length );
-
-  debug( "notify port status to %s", entry->name );
-}
-
-
 void
 notify_port_status_for_all_user( port_entry *port ) {
   debug( "notify port status" );
@@ -381,7 +380,7 @@ notify_port_status_for_all_user( port_entry *port ) {
   buffer *notify = create_port_status_message();
   add_port_status_message( notify, port );
 
-  foreach_subscriber( notify_port_status, notify );
+  notify_all_user( TD_MSGTYPE_PORT_STATUS, notify );
   free_buffer( notify );
 }
 
@@ -20,6 +20,7 @@
 
 #include <assert.h>
 #include <pthread.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -73,10 +74,52 @@ typedef struct private_buffer {
   buffer public;
   size_t real_length;
   void *top; // pointer to the head of user data area. only valid if public.data is allocated.
-  pthread_mutex_t *mutex;
+  pthread_mutex_t mutex;
+  struct private_buffer *storage; // block whose embedded data area contains top
+  unsigned int refcount; // references to this block, including the buffer itself
+  size_t capacity; // length of the data area embedded right after this structure
+  struct private_buffer *next; // next free block in the pool
+  bool borrowed; // top points to memory given to wrap_buffer(), not to a block
 } private_buffer;
 
 
+/*
+ * Each buffer is a block allocated together with an embedded data area
+ * whose length is one of the size classes below (or the exact length
+ * requested if it exceeds the largest class). The data of a buffer
+ * lives in the embedded area of its storage block, which is usually the
+ * buffer itself. Buffers that outgrow their own area, and clones and
+ * slices made by clone_buffer() and slice_buffer(), point to the area of
+ * another block instead.
+ *
+ * A block is referenced by its own buffer until free_buffer() and by
+ * every buffer using it as storage. When the last reference goes away,
+ * it is put back on a per-thread free list for its size class, so that
+ * allocating and freeing buffers in a steady state does not call malloc
+ * at all. Data areas referenced by more than one buffer are copied
+ * before they are modified through the buffer API.
+ *
+ * A buffer made by wrap_buffer() has no storage block. Its data area is
+ * borrowed from the caller and is treated as shared, so that it is
+ * never written through the buffer API. Its clones and slices borrow
+ * the same area, and retain_buffer() copies it.
+ */
+#define NUMBER_OF_SIZE_CLASSES 5
+
+static const size_t size_classes[ NUMBER_OF_SIZE_CLASSES ] = { 128, 512, 2048, 8192, 65536 };
+
+static __thread private_buffer *free_buffers[ NUMBER_OF_SIZE_CLASSES ];
+static __thread unsigned int number_of_free_buffers[ NUMBER_OF_SIZE_CLASSES ];
+
+#ifdef UNIT_TESTING
+// Pooling is disabled by default in unit tests, so that cmockery can
+// detect leaked buffers.
+unsigned int max_free_buffers_per_size_class = 0;
+#else // UNIT_TESTING
+static const unsigned int max_free_buffers_per_size_class = 64;
+#endif // UNIT_TESTING
+
+
 static size_t
 front_length_of( const private_buffer *pbuf ) {
   assert( pbuf != NULL );
@@ -85,6 +128,12 @@ front_length_of( const private_buffer *pbuf ) {
 }
 
 
+static void *
+embedded_data_of( private_buffer *pbuf ) {
+  return pbuf + 1;
+}
+
+
 static bool
 already_allocated( private_buffer *pbuf, size_t length ) {
   assert( pbuf != NULL );
@@ -95,50 +144,155 @@ already_allocated( private_buffer *pbuf, size_t length ) {
 }
 
 
+static int
+size_class_of( size_t length ) {
+  for ( int i = 0; i < NUMBER_OF_SIZE_CLASSES; i++ ) {
+    if ( length <= size_classes[ i ] ) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+
+static private_buffer *
+alloc_block( size_t length ) {
+  int size_class = size_class_of( length );
+  size_t capacity = size_class >= 0 ? size_classes[ size_class ] : length;
+
+  private_buffer *block = NULL;
+  if ( size_class >= 0 && free_buffers[ size_class ] != NULL ) {
+    block = free_buffers[ size_class ];
+    free_buffers[ size_class ] = block->next;
+    number_of_free_buffers[ size_class ]--;
+  }
+  else {
+    block = xmalloc( sizeof( private_buffer ) + capacity );
+  }
+
+  block->capacity = capacity;
+  block->refcount = 1;
+  block->next = NULL;
+
+  return block;
+}
+
+
+static void
+release_block( private_buffer *block ) {
+  if ( __atomic_sub_fetch( &block->refcount, 1, __ATOMIC_ACQ_REL ) > 0 ) {
+    return;
+  }
+
+  int size_class = size_class_of( block->capacity );
+  if ( size_class < 0 || number_of_free_buffers[ size_class ] >= max_free_buffers_per_size_class ) {
+    xfree( block );
+    return;
+  }
+
+  block->next = free_buffers[ size_class ];
+  free_buffers[ size_class ] = block;
+  number_of_free_buffers[ size_class ]++;
+}
+
+
+static bool
+is_shared( const private_buffer *pbuf ) {
+  if ( pbuf->borrowed ) {
+    return true;
+  }
+  return pbuf->storage != NULL && __atomic_load_n( &pbuf->storage->refcount, __ATOMIC_ACQUIRE ) > 1;
+}
+
+
+/*
+ * Gives the buffer a new data area of at least length bytes, preferring
+ * its own embedded area if nobody else uses it. Returns the previous
+ * storage, which must be passed to detach_storage() once the data has
+ * been copied out of it.
+ */
+static private_buffer *
+replace_storage( private_buffer *pbuf, size_t length ) {
+  private_buffer *old_storage = pbuf->storage;
+
+  private_buffer *storage;
+  if ( old_storage != pbuf && pbuf->capacity >= length
+       && __atomic_load_n( &pbuf->refcount, __ATOMIC_ACQUIRE ) == 1 ) {
+    storage = pbuf;
+  }
+  else {
+    storage = alloc_block( length );
+  }
+
+  pbuf->storage = storage;
+  pbuf->top = embedded_data_of( storage );
+  pbuf->real_length = storage->capacity;
+  pbuf->borrowed = false;
+
+  return old_storage;
+}
+
+
+static void
+detach_storage( private_buffer *pbuf, private_buffer *storage ) {
+  // a buffer's reference to its own block is dropped by free_buffer()
+  if ( storage != NULL && storage != pbuf ) {
+    release_block( storage );
+  }
+}
+
+
 static private_buffer *
 alloc_new_data( private_buffer *pbuf, size_t length ) {
   assert( pbuf != NULL );
 
-  pbuf->public.data = xmalloc( length );
+  detach_storage( pbuf, replace_storage( pbuf, length ) );
+  pbuf->public.data = pbuf->top;
   pbuf->public.length = length;
-  pbuf->top = pbuf->public.data;
-  pbuf->real_length = length;
 
   return pbuf;
 }
 
 
 static private_buffer *
-alloc_private_buffer() {
-  private_buffer *new_buf = xcalloc( 1, sizeof( private_buffer ) );
+alloc_private_buffer_with_capacity( size_t length ) {
+  private_buffer *new_buf = alloc_block( length );
 
   new_buf->public.data = NULL;
   new_buf->public.length = 0;
   new_buf->public.user_data = NULL;
   new_buf->top = NULL;
   new_buf->real_length = 0;
+  new_buf->storage = NULL;
+  new_buf->borrowed = false;
 
   pthread_mutexattr_t attr;
   pthread_mutexattr_init( &attr );
   pthread_mutexattr_settype( &attr, PTHREAD_MUTEX_RECURSIVE_NP );
-  new_buf->mutex = xmalloc( sizeof( pthread_mutex_t ) );
-  pthread_mutex_init( new_buf->mutex, &attr );
+  pthread_mutex_init( &new_buf->mutex, &attr );
 
   return new_buf;
 }
 
 
+static private_buffer *
+alloc_private_buffer() {
+  return alloc_private_buffer_with_capacity( 0 );
+}
+
+
 static private_buffer *
 append_front( private_buffer *pbuf, size_t length ) {
   assert( pbuf != NULL );
 
-  void *new_data = xmalloc( front_length_of( pbuf ) + pbuf->public.length + length );
-  memcpy( ( char * ) new_data + front_length_of( pbuf ) + length, pbuf->public.data, pbuf->public.length );
-  xfree( pbuf->top );
+  size_t front_length = front_length_of( pbuf );
+  void *old_data = pbuf->public.data;
+  private_buffer *old_storage = replace_storage( pbuf, front_length + pbuf->public.length + length );
+  memcpy( ( char * ) pbuf->top + front_length + length, old_data, pbuf->public.length );
+  detach_storage( pbuf, old_storage );
 
-  pbuf->public.data = ( char * ) new_data + front_length_of( pbuf );
-  pbuf->real_length = sizeof( new_data );
-  pbuf->top = new_data;
+  pbuf->public.data = ( char * ) pbuf->top + front_length;
+  memset( pbuf->public.data, 0, length );
 
   return pbuf;
 }
@@ -148,13 +302,13 @@ static private_buffer *
 append_back( private_buffer *pbuf, size_t length ) {
   assert( pbuf != NULL );
 
-  void *new_data = xmalloc( front_length_of( pbuf ) + pbuf->public.length + length );
-  memcpy( ( char * ) new_data + front_length_of( pbuf ), pbuf->public.data, pbuf->public.length );
-  xfree( pbuf->top );
+  size_t front_length = front_length_of( pbuf );
+  void *old_data = pbuf->public.data;
+  private_buffer *old_storage = replace_storage( pbuf, front_length + pbuf->public.length + length );
+  memcpy( ( char * ) pbuf->top + front_length, old_data, pbuf->public.length );
+  detach_storage( pbuf, old_storage );
 
-  pbuf->public.data = ( char * ) new_data + front_length_of( pbuf );
-  pbuf->real_length = sizeof( new_data );
-  pbuf->top = new_data;
+  pbuf->public.data = ( char * ) pbuf->top + front_length;
 
   return pbuf;
 }
@@ -170,18 +324,45 @@ buffer *
 alloc_buffer_with_length( size_t length ) {
   assert( length != 0 );
 
-  private_buffer *new_buf = xcalloc( 1, sizeof( private_buffer ) );
-  new_buf->public.data = xmalloc( length );
-  new_buf->public.length = 0;
-  new_buf->public.user_data = NULL;
-  new_buf->top = new_buf->public.data;
-  new_buf->real_length = length;
+  return alloc_buffer_with_headroom( length, 0 );
+}
 
-  pthread_mutexattr_t attr;
-  pthread_mutexattr_init( &attr );
-  pthread_mutexattr_settype( &attr, PTHREAD_MUTEX_RECURSIVE_NP );
-  new_buf->mutex = xmalloc( sizeof( pthread_mutex_t ) );
-  pthread_mutex_init( new_buf->mutex, &attr );
+
+/*
+ * Allocates a buffer that can hold length bytes and reserves headroom
+ * bytes in front of them, so that up to headroom bytes can be added by
+ * append_front_buffer() without moving the data.
+ */
+buffer *
+alloc_buffer_with_headroom( size_t length, size_t headroom ) {
+  assert( length != 0 );
+
+  private_buffer *new_buf = alloc_private_buffer_with_capacity( headroom + length );
+  new_buf->storage = new_buf;
+  new_buf->top = embedded_data_of( new_buf );
+  new_buf->real_length = new_buf->capacity;
+  new_buf->public.data = ( char * ) new_buf->top + headroom;
+
+  return ( buffer * ) new_buf;
+}
+
+
+/*
+ * Returns a buffer whose data is the length bytes at data, without
+ * copying them. The buffer must be freed before data goes away; use
+ * retain_buffer() to keep the data longer.
+ */
+buffer *
+wrap_buffer( void *data, size_t length ) {
+  assert( data != NULL );
+  assert( length != 0 );
+
+  private_buffer *new_buf = alloc_private_buffer();
+  new_buf->top = data;
+  new_buf->real_length = length;
+  new_buf->borrowed = true;
+  new_buf->public.data = data;
+  new_buf->public.length = length;
 
   return ( buffer * ) new_buf;
 }
@@ -191,15 +372,29 @@ void
 free_buffer( buffer *buf ) {
   assert( buf != NULL );
 
-  pthread_mutex_lock( ( ( private_buffer * ) buf )->mutex );
+  pthread_mutex_lock( &( ( private_buffer * ) buf )->mutex );
   private_buffer *delete_me = ( private_buffer * ) buf;
-  if ( delete_me->top != NULL ) {
-    xfree( delete_me->top );
+  detach_storage( delete_me, delete_me->storage );
+  delete_me->storage = NULL;
+  pthread_mutex_unlock( &delete_me->mutex );
+  pthread_mutex_destroy( &delete_me->mutex );
+  release_block( delete_me );
+}
+
+
+/*
+ * Releases the buffers kept for reuse by the calling thread.
+ */
+void
+flush_buffer_pool() {
+  for ( int i = 0; i < NUMBER_OF_SIZE_CLASSES; i++ ) {
+    while ( free_buffers[ i ] != NULL ) {
+      private_buffer *delete_me = free_buffers[ i ];
+      free_buffers[ i ] = delete_me->next;
+      xfree( delete_me );
+    }
+    number_of_free_buffers[ i ] = 0;
   }
-  pthread_mutex_unlock( delete_me->mutex );
-  pthread_mutex_destroy( delete_me->mutex );
-  xfree( delete_me->mutex );
-  xfree( delete_me );
 }
 
 
@@ -208,18 +403,26 @@ append_front_buffer( buffer *buf, size_t length ) {
   assert( buf != NULL );
   assert( length != 0 );
 
-  pthread_mutex_lock( ( ( private_buffer * ) buf )->mutex );
+  pthread_mutex_lock( &( ( private_buffer * ) buf )->mutex );
 
   private_buffer *pbuf = ( private_buffer * ) buf;
 
   if ( pbuf->top == NULL ) {
     alloc_new_data( pbuf, length );
-    pthread_mutex_unlock( pbuf->mutex );
+    pthread_mutex_unlock( &pbuf->mutex );
     return pbuf->public.data;
   }
 
   buffer *b = &( pbuf->public );
-  if ( already_allocated( pbuf, length ) ) {
+  if ( is_shared( pbuf ) ) {
+    append_front( pbuf, length );
+  }
+  else if ( front_length_of( pbuf ) >= length ) {
+    // prepend into the headroom
+    b->data = ( char * ) b->data - length;
+    memset( b->data, 0, length );
+  }
+  else if ( already_allocated( pbuf, length ) ) {
     memmove( ( char * ) b->data + length, b->data, b->length );
     memset( b->data, 0, length );
   } else {
@@ -227,7 +430,7 @@ append_front_buffer( buffer *buf, size_t length ) {
   }
   b->length += length;
 
-  pthread_mutex_unlock( pbuf->mutex );
+  pthread_mutex_unlock( &pbuf->mutex );
 
   return b->data;
 }
@@ -238,7 +441,7 @@ remove_front_buffer( buffer *buf, size_t length ) {
   assert( buf != NULL );
   assert( length != 0 );
 
-  pthread_mutex_lock( ( ( private_buffer * ) buf )->mutex );
+  pthread_mutex_lock( &( ( private_buffer * ) buf )->mutex );
 
   private_buffer *pbuf = ( private_buffer * ) buf;
   assert( pbuf->public.length >= length );
@@ -246,7 +449,7 @@ remove_front_buffer( buffer *buf, size_t length ) {
   pbuf->public.data = ( char * ) pbuf->public.data + length;
   pbuf->public.length -= length;
 
-  pthread_mutex_unlock( pbuf->mutex );
+  pthread_mutex_unlock( &pbuf->mutex );
 
   return pbuf->public.data;
 }
@@ -257,24 +460,24 @@ append_back_buffer( buffer *buf, size_t length ) {
   assert( buf != NULL );
   assert( length != 0 );
 
-  pthread_mutex_lock( ( ( private_buffer * ) buf )->mutex );
+  pthread_mutex_lock( &( ( private_buffer * ) buf )->mutex );
 
   private_buffer *pbuf = ( private_buffer * ) buf;
 
   if ( pbuf->real_length == 0 ) {
     alloc_new_data( pbuf, length );
-    pthread_mutex_unlock( pbuf->mutex );
+    pthread_mutex_unlock( &pbuf->mutex );
     return ( char * ) pbuf->public.data;
   }
  
-  if ( !already_allocated( pbuf, length ) ) {
+  if ( is_shared( pbuf ) || !already_allocated( pbuf, length ) ) {
     append_back( pbuf, length );
   }
 
   void *appended = ( char * ) pbuf->public.data + pbuf->public.length;
   pbuf->public.length += length;
 
-  pthread_mutex_unlock( pbuf->mutex );
+  pthread_mutex_unlock( &pbuf->mutex );
 
   return appended;
 }
@@ -284,13 +487,14 @@ buffer *
 duplicate_buffer( const buffer *buf ) {
   assert( buf != NULL );
 
-  pthread_mutex_lock( ( ( const private_buffer * ) buf )->mutex );
+  private_buffer *old_buffer = ( private_buffer * ) ( uintptr_t ) buf;
 
-  private_buffer *new_buffer = alloc_private_buffer();
-  const private_buffer *old_buffer = ( const private_buffer * ) buf;
+  pthread_mutex_lock( &old_buffer->mutex );
+
+  private_buffer *new_buffer = alloc_private_buffer_with_capacity( old_buffer->real_length );
 
   if ( old_buffer->real_length == 0 ) {
-    pthread_mutex_unlock( old_buffer->mutex );
+    pthread_mutex_unlock( &old_buffer->mutex );
     return ( buffer * ) new_buffer;
   }
 
@@ -301,17 +505,88 @@ duplicate_buffer( const buffer *buf ) {
   new_buffer->public.user_data = old_buffer->public.user_data;
   new_buffer->public.data = ( char * ) ( new_buffer->public.data ) + front_length_of( old_buffer );
 
-  pthread_mutex_unlock( old_buffer->mutex );
+  pthread_mutex_unlock( &old_buffer->mutex );
 
   return ( buffer * ) new_buffer;
 }
 
 
+/*
+ * Returns a buffer that shares the data of buf instead of copying it.
+ * Either buffer may be freed first, and changes made through the
+ * buffer API to one of them are not visible to the other, but the
+ * shared bytes must not be written directly through the data pointer.
+ */
+buffer *
+clone_buffer( const buffer *buf ) {
+  assert( buf != NULL );
+
+  private_buffer *old_buffer = ( private_buffer * ) ( uintptr_t ) buf;
+
+  pthread_mutex_lock( &old_buffer->mutex );
+
+  private_buffer *new_buffer = alloc_private_buffer();
+  if ( old_buffer->storage != NULL ) {
+    __atomic_add_fetch( &old_buffer->storage->refcount, 1, __ATOMIC_ACQ_REL );
+    new_buffer->storage = old_buffer->storage;
+  }
+  if ( old_buffer->storage != NULL || old_buffer->borrowed ) {
+    new_buffer->top = old_buffer->top;
+    new_buffer->real_length = old_buffer->real_length;
+    new_buffer->borrowed = old_buffer->borrowed;
+  }
+  new_buffer->public = old_buffer->public;
+
+  pthread_mutex_unlock( &old_buffer->mutex );
+
+  return ( buffer * ) new_buffer;
+}
+
+
+/*
+ * Returns a clone of buf that only contains length bytes from offset.
+ */
+buffer *
+slice_buffer( const buffer *buf, size_t offset, size_t length ) {
+  assert( buf != NULL );
+  assert( offset + length <= buf->length );
+
+  buffer *slice = clone_buffer( buf );
+  slice->data = ( char * ) slice->data + offset;
+  slice->length = length;
+  slice->user_data = NULL;
+
+  return slice;
+}
+
+
+/*
+ * Returns a buffer with the same data as buf that stays valid after
+ * the memory given to wrap_buffer() goes away. Data is copied only if
+ * buf borrows it; otherwise this is clone_buffer(). user_data is not
+ * carried over since it may point into the data, as packet_info() does.
+ */
+buffer *
+retain_buffer( const buffer *buf ) {
+  assert( buf != NULL );
+
+  private_buffer *old_buffer = ( private_buffer * ) ( uintptr_t ) buf;
+
+  pthread_mutex_lock( &old_buffer->mutex );
+  buffer *retained = old_buffer->borrowed ? duplicate_buffer( buf ) : clone_buffer( buf );
+  retained->user_data = NULL;
+  pthread_mutex_unlock( &old_buffer->mutex );
+
+  return retained;
+}
+
+
 void
 dump_buffer( const buffer *buf, void dump_function( const char *format, ... ) ) {
   assert( dump_function != NULL );
 
-  pthread_mutex_lock( ( ( const private_buffer * ) buf )->mutex );
+  private_buffer *pbuf = ( private_buffer * ) ( uintptr_t ) buf;
+  pthread_mutex_lock( &pbuf->mutex );
 
   char *hex = xmalloc( sizeof( char ) * ( buf->length * 2 + 1 ) );
   char *datap = buf->data;
@@ -323,7 +598,7 @@ dump_buffer( const buffer *buf, void dump_function( const char *format, ... ) )
 
   xfree( hex );
 
-  pthread_mutex_unlock( ( ( const private_buffer * ) buf )->mutex );
+  pthread_mutex_unlock( &pbuf->mutex );
 }
 
 
@@ -36,11 +36,17 @@ typedef struct buffer {
 
 buffer *alloc_buffer( void );
 buffer *alloc_buffer_with_length( size_t length );
+buffer *alloc_buffer_with_headroom( size_t length, size_t headroom );
+buffer *wrap_buffer( void *data, size_t length );
 void free_buffer( buffer *buf );
+void flush_buffer_pool( void );
 void *append_front_buffer( buffer *buf, size_t length );
 void *remove_front_buffer( buffer *buf, size_t length );
 void *append_back_buffer( buffer *buf, size_t length );
 buffer *duplicate_buffer( const buffer *buf );
+buffer *clone_buffer( const buffer *buf );
+buffer *slice_buffer( const buffer *buf, size_t offset, size_t length );
+buffer *retain_buffer( const buffer *buf );
 void dump_buffer( const buffer *buf, void dump_function( const char *format, ... ) );
 
 
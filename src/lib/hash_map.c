@@ -0,0 +1,73 @@
+/*
+ * Copyright (C) 2008-2011 NEC Corporation
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License, version 2, as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+#include <assert.h>
+#include <string.h>
+#include "hash_map.h"
+#include "wrapper.h"
+
+
+static inline uint64_t
+hash_uint32_key( const uint32_t *key ) {
+  return mix_hash_uint64( *key );
+}
+
+
+static inline bool
+compare_uint32_key( const uint32_t *x, const uint32_t *y ) {
+  return *x == *y;
+}
+
+
+static inline uint64_t
+hash_uint64_key( const uint64_t *key ) {
+  return mix_hash_uint64( *key );
+}
+
+
+static inline bool
+compare_uint64_key( const uint64_t *x, const uint64_t *y ) {
+  return *x == *y;
+}
+
+
+static inline uint64_t
+hash_mac_key( const mac_address *key ) {
+  uint64_t value = 0;
+  memcpy( &value, key->addr, OFP_ETH_ALEN );
+  return mix_hash_uint64( value );
+}
+
+
+static inline bool
+compare_mac_key( const mac_address *x, const mac_address *y ) {
+  return memcmp( x->addr, y->addr, OFP_ETH_ALEN ) == 0;
+}
+
+
+DEFINE_HASH_MAP( uint32_hash_map, uint32_t, hash_uint32_key, compare_uint32_key )
+DEFINE_HASH_MAP( uint64_hash_map, uint64_t, hash_uint64_key, compare_uint64_key )
+DEFINE_HASH_MAP( mac_hash_map, mac_address, hash_mac_key, compare_mac_key )
+
+
+/*
+ * Local variables:
+ * c-basic-offset: 2
+ * indent-tabs-mode: nil
+ * End:
+ */
@@ -0,0 +1,282 @@
+/*
+ * Type-specialized hash maps with inline keys.
+ *
+ * Copyright (C) 2008-2011 NEC Corporation
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License, version 2, as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+#ifndef HASH_MAP_H
+#define HASH_MAP_H
+
+
+#include <stdint.h>
+#include "bool.h"
+#include "openflow.h"
+
+
+/*
+ * Unlike hash_table, a hash map copies its keys into its own slots and
+ * calls hash and compare functions known at compile time, so that they
+ * can be inlined into the probe loop. Each key is stored at most once
+ * and values must not be NULL. Hash maps are not thread safe.
+ *
+ * DECLARE_HASH_MAP( name, key_type ) declares the following:
+ *
+ *   name *create_name( unsigned int size );
+ *   void delete_name( name *map );
+ *   void *insert_name_entry( name *map, const key_type *key, void *value );
+ *   void *lookup_name_entry( const name *map, const key_type *key );
+ *   void *delete_name_entry( name *map, const key_type *key );
+ *   void foreach_name( name *map, void function( const key_type *key, void *value, void *user_data ), void *user_data );
+ *   void init_name_iterator( name *map, name_iterator *iter );
+ *   name_entry *iterate_name_next( name_iterator *iter );
+ *
+ * As with hash_table, only the entry most recently returned by the
+ * iterator may be deleted while iterating.
+ */
+#define DECLARE_HASH_MAP( _name, _key_type )                                                         \
+  typedef struct {                                                                                   \
+    _key_type key;                                                                                   \
+    void *value;                                                                                     \
+  } _name##_entry;                                                                                   \
+                                                                                                     \
+  typedef struct {                                                                                   \
+    unsigned int number_of_buckets;                                                                  \
+    unsigned int length;                                                                             \
+    unsigned int shift;                                                                              \
+    _name##_entry *entries;                                                                          \
+  } _name;                                                                                           \
+                                                                                                     \
+  typedef struct {                                                                                   \
+    _name *map;                                                                                      \
+    unsigned int index;                                                                              \
+    unsigned int remaining;                                                                          \
+  } _name##_iterator;                                                                                \
+                                                                                                     \
+  _name *create_##_name( unsigned int size );                                                        \
+  void delete_##_name( _name *map );                                                                 \
+  void *insert_##_name##_entry( _name *map, const _key_type *key, void *value );                     \
+  void *lookup_##_name##_entry( const _name *map, const _key_type *key );                            \
+  void *delete_##_name##_entry( _name *map, const _key_type *key );                                  \
+  void foreach_##_name( _name *map, void function( const _key_type *key, void *value, void *user_data ), \
+                        void *user_data );                                                           \
+  void init_##_name##_iterator( _name *map, _name##_iterator *iter );                                \
+  _name##_entry *iterate_##_name##_next( _name##_iterator *iter )
+
+
+/*
+ * DEFINE_HASH_MAP( name, key_type, hash, compare ) defines the functions
+ * declared by DECLARE_HASH_MAP(). hash( const key_type * ) must return
+ * a well mixed uint64_t (see mix_hash_uint64()), and compare( const
+ * key_type *, const key_type * ) must return true for equal keys. Both
+ * should be static inline functions.
+ *
+ * Maps use open addressing with linear probing. Capacity is a power of
+ * two indexed by the upper bits of the hash value, doubled whenever the
+ * load factor exceeds 3/4, and deleted entries are removed by shifting
+ * their cluster backwards so that no tombstones are needed.
+ */
+#define DEFINE_HASH_MAP( _name, _key_type, _hash, _compare )                                         \
+  static unsigned int                                                                                \
+  _name##_home( const _name *map, const _key_type *key ) {                                           \
+    return ( unsigned int ) ( _hash( key ) >> map->shift );                                          \
+  }                                                                                                  \
+                                                                                                     \
+  static void                                                                                        \
+  _name##_allocate( _name *map, unsigned int size ) {                                                \
+    map->entries = xcalloc( size, sizeof( _name##_entry ) );                                         \
+    map->number_of_buckets = size;                                                                   \
+    map->length = 0;                                                                                 \
+    map->shift = 64;                                                                                 \
+    unsigned int i;                                                                                  \
+    for ( i = size; i > 1; i >>= 1 ) {                                                               \
+      map->shift--;                                                                                  \
+    }                                                                                                \
+  }                                                                                                  \
+                                                                                                     \
+  static unsigned int                                                                                \
+  _name##_find( const _name *map, const _key_type *key ) {                                           \
+    unsigned int mask = map->number_of_buckets - 1;                                                  \
+    unsigned int i;                                                                                  \
+    for ( i = _name##_home( map, key ); map->entries[ i ].value != NULL; i = ( i + 1 ) & mask ) {    \
+      if ( _compare( &map->entries[ i ].key, key ) ) {                                               \
+        break;                                                                                       \
+      }                                                                                              \
+    }                                                                                                \
+    return i;                                                                                        \
+  }                                                                                                  \
+                                                                                                     \
+  static void                                                                                        \
+  _name##_grow( _name *map ) {                                                                       \
+    _name##_entry *entries = map->entries;                                                           \
+    unsigned int size = map->number_of_buckets;                                                      \
+    _name##_allocate( map, size * 2 );                                                               \
+    unsigned int i;                                                                                  \
+    for ( i = 0; i < size; i++ ) {                                                                   \
+      if ( entries[ i ].value != NULL ) {                                                            \
+        map->entries[ _name##_find( map, &entries[ i ].key ) ] = entries[ i ];                       \
+        map->length++;                                                                               \
+      }                                                                                              \
+    }                                                                                                \
+    xfree( entries );                                                                                \
+  }                                                                                                  \
+                                                                                                     \
+  _name *                                                                                            \
+  create_##_name( unsigned int size ) {                                                              \
+    _name *map = xmalloc( sizeof( _name ) );                                                         \
+    unsigned int number_of_buckets = 8;                                                              \
+    while ( number_of_buckets / 4 * 3 < size ) {                                                     \
+      number_of_buckets <<= 1;                                                                       \
+    }                                                                                                \
+    _name##_allocate( map, number_of_buckets );                                                      \
+    return map;                                                                                      \
+  }                                                                                                  \
+                                                                                                     \
+  void                                                                                               \
+  delete_##_name( _name *map ) {                                                                     \
+    assert( map != NULL );                                                                           \
+    xfree( map->entries );                                                                           \
+    xfree( map );                                                                                    \
+  }                                                                                                  \
+                                                                                                     \
+  void *                                                                                             \
+  insert_##_name##_entry( _name *map, const _key_type *key, void *value ) {                           \
+    assert( map != NULL );                                                                           \
+    assert( key != NULL );                                                                           \
+    assert( value != NULL );                                                                         \
+    if ( map->length + 1 > map->number_of_buckets / 4 * 3 ) {                                        \
+      _name##_grow( map );                                                                           \
+    }                                                                                                \
+    _name##_entry *entry = &map->entries[ _name##_find( map, key ) ];                                \
+    void *previous = entry->value;                                                                   \
+    if ( previous == NULL ) {                                                                        \
+      entry->key = *key;                                                                             \
+      map->length++;                                                                                 \
+    }                                                                                                \
+    entry->value = value;                                                                            \
+    return previous;                                                                                 \
+  }                                                                                                  \
+                                                                                                     \
+  void *                                                                                             \
+  lookup_##_name##_entry( const _name *map, const _key_type *key ) {                                 \
+    assert( map != NULL );                                                                           \
+    assert( key != NULL );                                                                           \
+    return map->entries[ _name##_find( map, key ) ].value;                                           \
+  }                                                                                                  \
+                                                                                                     \
+  void *                                                                                             \
+  delete_##_name##_entry( _name *map, const _key_type *key ) {                                       \
+    assert( map != NULL );                                                                           \
+    assert( key != NULL );                                                                           \
+    unsigned int mask = map->number_of_buckets - 1;                                                  \
+    unsigned int i = _name##_find( map, key );                                                       \
+    void *deleted = map->entries[ i ].value;                                                         \
+    if ( deleted == NULL ) {                                                                         \
+      return NULL;                                                                                   \
+    }                                                                                                \
+    unsigned int j = i;                                                                              \
+    for ( ;; ) {                                                                                     \
+      j = ( j + 1 ) & mask;                                                                          \
+      if ( map->entries[ j ].value == NULL ) {                                                       \
+        break;                                                                                       \
+      }                                                                                              \
+      unsigned int home = _name##_home( map, &map->entries[ j ].key );                               \
+      if ( ( ( j - home ) & mask ) < ( ( j - i ) & mask ) ) {                                        \
+        continue;                                                                                    \
+      }                                                                                              \
+      map->entries[ i ] = map->entries[ j ];                                                         \
+      i = j;                                                                                         \
+    }                                                                                                \
+    memset( &map->entries[ i ], 0, sizeof( _name##_entry ) );                                        \
+    map->length--;                                                                                   \
+    return deleted;                                                                                  \
+  }                                                                                                  \
+                                                                                                     \
+  void                                                                                               \
+  init_##_name##_iterator( _name *map, _name##_iterator *iter ) {                                    \
+    assert( map != NULL );                                                                           \
+    assert( iter != NULL );                                                                          \
+    iter->map = map;                                                                                 \
+    iter->index = 0;                                                                                 \
+    iter->remaining = 0;                                                                             \
+    if ( map->length == 0 ) {                                                                        \
+      return;                                                                                        \
+    }                                                                                                \
+    while ( map->entries[ iter->index ].value != NULL ) {                                            \
+      iter->index++;                                                                                 \
+    }                                                                                                \
+    iter->remaining = map->number_of_buckets - 1;                                                    \
+  }                                                                                                  \
+                                                                                                     \
+  _name##_entry *                                                                                    \
+  iterate_##_name##_next( _name##_iterator *iter ) {                                                 \
+    assert( iter != NULL );                                                                          \
+    unsigned int mask = iter->map->number_of_buckets - 1;                                            \
+    while ( iter->remaining > 0 ) {                                                                  \
+      iter->index = ( iter->index - 1 ) & mask;                                                      \
+      iter->remaining--;                                                                             \
+      if ( iter->map->entries[ iter->index ].value != NULL ) {                                       \
+        return &iter->map->entries[ iter->index ];                                                   \
+      }                                                                                              \
+    }                                                                                                \
+    return NULL;                                                                                     \
+  }                                                                                                  \
+                                                                                                     \
+  void                                                                                               \
+  foreach_##_name( _name *map, void function( const _key_type *key, void *value, void *user_data ),  \
+                   void *user_data ) {                                                               \
+    _name##_iterator iter;                                                                           \
+    _name##_entry *e;                                                                                \
+    init_##_name##_iterator( map, &iter );                                                           \
+    while ( ( e = iterate_##_name##_next( &iter ) ) != NULL ) {                                      \
+      function( &e->key, e->value, user_data );                                                      \
+    }                                                                                                \
+  }
+
+
+/*
+ * Finalizer of MurmurHash3.
+ */
+static inline uint64_t
+mix_hash_uint64( uint64_t key ) {
+  key ^= key >> 33;
+  key *= 0xff51afd7ed558ccdULL;
+  key ^= key >> 33;
+  key *= 0xc4ceb9fe1a85ec53ULL;
+  key ^= key >> 33;
+  return key;
+}
+
+
+typedef struct {
+  uint8_t addr[ OFP_ETH_ALEN ];
+} mac_address;
+
+
+DECLARE_HASH_MAP( uint32_hash_map, uint32_t );
+DECLARE_HASH_MAP( uint64_hash_map, uint64_t );
+DECLARE_HASH_MAP( mac_hash_map, mac_address );
+
+
+#endif // HASH_MAP_H
+
+
+/*
+ * Local variables:
+ * c-basic-offset: 2
+ * indent-tabs-mode: nil
+ * End:
+ */
@@ -19,17 +19,68 @@
 
 
 #include <assert.h>
+#include <limits.h>
 #include <pthread.h>
 #include <string.h>
 #include "hash_table.h"
+#include "rcu.h"
 #include "wrapper.h"
 
 
-static const unsigned int default_hash_size = 65521;
+/*
+ * Open addressing hash table with linear probing.
+ *
+ * Capacity is always a power of two and the home slot of a key is
+ * taken from the upper bits of its hash value multiplied by the
+ * golden ratio (Fibonacci hashing), so that weak hash functions such
+ * as hash_atom() still spread over the table. Deleted entries are
+ * removed by shifting the rest of their cluster backwards, so no
+ * tombstones are ever left behind.
+ *
+ * When the load factor exceeds 3/4, a table of twice the size is
+ * allocated and entries are migrated from the old one a few slots at
+ * a time on each subsequent insert, so that no single insert pays for
+ * the whole rehash. Lookups and deletes consult both tables while a
+ * migration is in progress.
+ *
+ * In HASH_TABLE_READ_MOSTLY mode, writers instead modify a private
+ * copy of the slots and publish it atomically, and the previous copy
+ * is released through defer_rcu_free(), so that readers never take
+ * the mutex nor see a partially updated table.
+ *
+ * Entries with the same key are kept in insertion order (newest
+ * first) along the probe sequence, which preserves the semantics of
+ * the former chained implementation for lookup_hash_entry() and
+ * map_hash().
+ */
+
+
+static const unsigned int minimum_hash_size = 8;
+static const unsigned int migration_steps = 4;
+static const unsigned int golden_ratio = 2654435769U;
+
+
+typedef struct {
+  hash_entry entry;
+  unsigned int hash;
+} hash_slot;
+
+
+typedef struct {
+  unsigned int size;
+  unsigned int shift;
+  unsigned int length;
+  hash_slot slots[];
+} slot_array;
 
 
 typedef struct {
   hash_table public;
+  slot_array *current;
+  slot_array *old;
+  unsigned int migrate_index;
+  unsigned int migrate_remaining;
+  hash_table_concurrency concurrency;
   pthread_mutex_t *mutex;
 } private_hash_table;
 
@@ -52,23 +103,290 @@ hash_atom( const void *key ) {
 }
 
 
+static void
+lock_for_write( const private_hash_table *table ) {
+  if ( table->concurrency != HASH_TABLE_UNLOCKED ) {
+    pthread_mutex_lock( table->mutex );
+  }
+}
+
+
+static void
+unlock_for_write( const private_hash_table *table ) {
+  if ( table->concurrency != HASH_TABLE_UNLOCKED ) {
+    pthread_mutex_unlock( table->mutex );
+  }
+}
+
+
+static void
+lock_for_read( const private_hash_table *table ) {
+  if ( table->concurrency == HASH_TABLE_LOCKED ) {
+    pthread_mutex_lock( table->mutex );
+  }
+}
+
+
+static void
+unlock_for_read( const private_hash_table *table ) {
+  if ( table->concurrency == HASH_TABLE_LOCKED ) {
+    pthread_mutex_unlock( table->mutex );
+  }
+}
+
+
+static slot_array *
+current_slot_array( const private_hash_table *table ) {
+  return __atomic_load_n( &table->current, __ATOMIC_ACQUIRE );
+}
+
+
+static slot_array *
+allocate_slot_array( unsigned int size ) {
+  assert( size >= minimum_hash_size );
+  assert( ( size & ( size - 1 ) ) == 0 );
+
+  slot_array *array = xcalloc( 1, sizeof( slot_array ) + sizeof( hash_slot ) * size );
+  array->size = size;
+  array->shift = sizeof( unsigned int ) * CHAR_BIT;
+  for ( unsigned int i = size; i > 1; i >>= 1 ) {
+    array->shift--;
+  }
+  array->length = 0;
+
+  return array;
+}
+
+
+static unsigned int
+home_index( const slot_array *array, unsigned int hash ) {
+  return hash >> array->shift;
+}
+
+
+static unsigned int
+get_hash_value( const hash_table *table, const void *key ) {
+  assert( table != NULL );
+  assert( key != NULL );
+
+  return ( *table->hash )( key ) * golden_ratio;
+}
+
+
+static hash_slot *
+find_slot( const hash_table *table, slot_array *array, const void *key, unsigned int hash ) {
+  if ( array == NULL ) {
+    return NULL;
+  }
+
+  unsigned int mask = array->size - 1;
+  unsigned int i;
+  for ( i = home_index( array, hash ); array->slots[ i ].entry.key != NULL; i = ( i + 1 ) & mask ) {
+    hash_slot *slot = &array->slots[ i ];
+    if ( slot->hash == hash && ( *table->compare )( key, slot->entry.key ) ) {
+      return slot;
+    }
+  }
+  return NULL;
+}
+
+
+static unsigned int
+find_empty_slot( const slot_array *array ) {
+  assert( array->length < array->size );
+
+  unsigned int i;
+  for ( i = 0; array->slots[ i ].entry.key != NULL; i++ ) {
+  }
+  return i;
+}
+
+
+/*
+ * Empties slot i and moves the following entries of its cluster
+ * backwards as long as that keeps them reachable from their home slot.
+ */
+static void
+remove_slot( slot_array *array, unsigned int i ) {
+  unsigned int mask = array->size - 1;
+  unsigned int j = i;
+  for ( ;; ) {
+    j = ( j + 1 ) & mask;
+    hash_slot *slot = &array->slots[ j ];
+    if ( slot->entry.key == NULL ) {
+      break;
+    }
+    unsigned int home = home_index( array, slot->hash );
+    if ( ( ( j - home ) & mask ) < ( ( j - i ) & mask ) ) {
+      continue;
+    }
+    array->slots[ i ] = *slot;
+    i = j;
+  }
+  array->slots[ i ].entry.key = NULL;
+  array->slots[ i ].entry.value = NULL;
+  array->length--;
+}
+
+
+/*
+ * Puts an entry behind all other entries in its probe sequence.
+ */
+static void
+append_slot( slot_array *array, const hash_slot *slot ) {
+  unsigned int mask = array->size - 1;
+  unsigned int i;
+  for ( i = home_index( array, slot->hash ); array->slots[ i ].entry.key != NULL; i = ( i + 1 ) & mask ) {
+  }
+  array->slots[ i ] = *slot;
+  array->length++;
+}
+
+
+/*
+ * Puts an entry in front of the existing entries that have the same
+ * key, pushing each of them one position further along the probe
+ * sequence. Returns true and sets *previous to the value of the most
+ * recent entry with the same key if there is one.
+ */
+static bool
+push_slot( const hash_table *table, slot_array *array, hash_slot carry, void **previous ) {
+  bool found = false;
+  unsigned int mask = array->size - 1;
+  unsigned int i;
+  for ( i = home_index( array, carry.hash ); array->slots[ i ].entry.key != NULL; i = ( i + 1 ) & mask ) {
+    hash_slot *slot = &array->slots[ i ];
+    if ( slot->hash == carry.hash && ( *table->compare )( carry.entry.key, slot->entry.key ) ) {
+      if ( !found ) {
+        *previous = slot->entry.value;
+        found = true;
+      }
+      hash_slot swap = *slot;
+      *slot = carry;
+      carry = swap;
+    }
+  }
+  array->slots[ i ] = carry;
+  array->length++;
+
+  return found;
+}
+
+
+/*
+ * Returns the slot index right after an empty slot. Walking a slot
+ * array from there visits the entries of each cluster in probe order,
+ * since clusters never extend over an empty slot.
+ */
+static unsigned int
+cluster_start( const slot_array *array ) {
+  return ( find_empty_slot( array ) + 1 ) & ( array->size - 1 );
+}
+
+
+static slot_array *
+copy_slot_array( const slot_array *array, unsigned int size ) {
+  slot_array *copy = allocate_slot_array( size );
+  if ( size == array->size ) {
+    memcpy( copy->slots, array->slots, sizeof( hash_slot ) * size );
+    copy->length = array->length;
+    return copy;
+  }
+
+  unsigned int mask = array->size - 1;
+  unsigned int i = cluster_start( array );
+  for ( unsigned int n = 0; n < array->size; n++, i = ( i + 1 ) & mask ) {
+    if ( array->slots[ i ].entry.key != NULL ) {
+      append_slot( copy, &array->slots[ i ] );
+    }
+  }
+  return copy;
+}
+
+
+static void
+migrate_slots( private_hash_table *table, unsigned int steps ) {
+  slot_array *old = table->old;
+  if ( old == NULL ) {
+    return;
+  }
+
+  unsigned int mask = old->size - 1;
+  while ( steps > 0 && table->migrate_remaining > 0 ) {
+    hash_slot *slot = &old->slots[ table->migrate_index ];
+    if ( slot->entry.key != NULL ) {
+      hash_slot moving = *slot;
+      remove_slot( old, table->migrate_index );
+      append_slot( table->current, &moving );
+      continue;
+    }
+    table->migrate_index = ( table->migrate_index + 1 ) & mask;
+    table->migrate_remaining--;
+    steps--;
+  }
+
+  if ( table->migrate_remaining == 0 ) {
+    assert( old->length == 0 );
+    xfree( old );
+    table->old = NULL;
+  }
+}
+
+
+/*
+ * Migration walks the old slots from cluster_start(), so entries are
+ * moved in probe order, and entries not yet migrated can never be
+ * shifted into the part of the old table that has already been walked.
+ */
+static void
+start_rehash( private_hash_table *table ) {
+  assert( table->old == NULL );
+
+  table->old = table->current;
+  table->current = allocate_slot_array( table->old->size * 2 );
+  table->public.number_of_buckets = table->current->size;
+
+  table->migrate_index = cluster_start( table->old );
+  table->migrate_remaining = table->old->size;
+}
+
+
+static bool
+needs_rehash( const slot_array *array ) {
+  return array->length + 1 > array->size / 4 * 3;
+}
+
+
+/*
+ * Replaces the slots seen by readers in HASH_TABLE_READ_MOSTLY mode.
+ */
+static void
+publish_slot_array( private_hash_table *table, slot_array *array ) {
+  slot_array *retired = table->current;
+  __atomic_store_n( &table->current, array, __ATOMIC_RELEASE );
+  table->public.number_of_buckets = array->size;
+  defer_rcu_free( retired, xfree );
+}
+
+
 hash_table *
-create_hash( const compare_function compare, const hash_function hash ) {
+create_hash_with_size( const compare_function compare, const hash_function hash, unsigned int size ) {
   private_hash_table *table = xmalloc( sizeof( private_hash_table ) );
 
-  table->public.number_of_buckets = default_hash_size;
+  unsigned int number_of_buckets = minimum_hash_size;
+  while ( number_of_buckets / 4 * 3 < size ) {
+    number_of_buckets <<= 1;
+  }
+
+  table->public.number_of_buckets = number_of_buckets;
   table->public.compare = compare ? compare : compare_atom;
   table->public.hash = hash ? hash : hash_atom;
   table->public.length = 0;
-  table->public.buckets = xmalloc( sizeof( list_element * ) * default_hash_size );
-  unsigned int i;
-  bool list_created = false;
-  for ( i = 0; i < table->public.number_of_buckets; i++ ) {
-    list_created = create_list( &table->public.buckets[ i ] );
-    assert( list_created == true );
-  }
-  list_created = create_list( &table->public.nonempty_bucket_index );
-  assert( list_created == true );
+  table->current = allocate_slot_array( number_of_buckets );
+  table->old = NULL;
+  table->migrate_index = 0;
+  table->migrate_remaining = 0;
+  table->concurrency = HASH_TABLE_LOCKED;
 
   pthread_mutexattr_t attr;
   pthread_mutexattr_init( &attr );
@@ -80,28 +398,39 @@ create_hash( const compare_function compare, const hash_function hash ) {
 }
 
 
-static unsigned int
-get_bucket_index( const hash_table *table, const void *key ) {
+hash_table *
+create_hash( const compare_function compare, const hash_function hash ) {
+  return create_hash_with_size( compare, hash, 0 );
+}
+
+
+/*
+ * Must be called while no other thread accesses the table.
+ */
+void
+set_hash_concurrency( hash_table *table, hash_table_concurrency concurrency ) {
   assert( table != NULL );
-  assert( key != NULL );
 
-  return ( *table->hash )( key ) % table->number_of_buckets;
+  private_hash_table *private_table = ( private_hash_table * ) table;
+
+  pthread_mutex_lock( private_table->mutex );
+  migrate_slots( private_table, UINT_MAX );
+  private_table->concurrency = concurrency;
+  pthread_mutex_unlock( private_table->mutex );
 }
 
 
 static void *
-find_list_element_from_buckets( const hash_table *table, const void *key ) {
-  assert( table != NULL );
-  assert( key != NULL );
+insert_hash_entry_read_mostly( private_hash_table *table, hash_slot slot ) {
+  slot_array *current = table->current;
+  unsigned int size = needs_rehash( current ) ? current->size * 2 : current->size;
+  slot_array *copy = copy_slot_array( current, size );
 
-  list_element *e = NULL;
-  unsigned int i = get_bucket_index( table, key );
-  for ( e = table->buckets[ i ]; e; e = e->next ) {
-    if ( ( *table->compare )( key, ( ( hash_entry * ) e->data )->key ) ) {
-      break;
-    }
-  }
-  return e;
+  void *previous = NULL;
+  push_slot( &table->public, copy, slot, &previous );
+  publish_slot_array( table, copy );
+
+  return previous;
 }
 
 
@@ -110,29 +439,35 @@ insert_hash_entry( hash_table *table, void *key, void *value ) {
   assert( table != NULL );
   assert( key != NULL );
 
-  pthread_mutex_lock( ( ( private_hash_table * ) table )->mutex );
+  private_hash_table *private_table = ( private_hash_table * ) table;
 
-  unsigned int i = get_bucket_index( table, key );
-  if ( table->buckets[ i ] == NULL ) {
-    insert_in_front( &table->nonempty_bucket_index, ( void * ) ( unsigned long ) i );
-  }
+  lock_for_write( private_table );
 
-  list_element *old_elem = find_list_element_from_buckets( table, key );
+  hash_slot slot = { { key, value }, get_hash_value( table, key ) };
+  void *previous = NULL;
+  if ( private_table->concurrency == HASH_TABLE_READ_MOSTLY ) {
+    previous = insert_hash_entry_read_mostly( private_table, slot );
+  }
+  else {
+    migrate_slots( private_table, migration_steps );
+    if ( needs_rehash( private_table->current ) ) {
+      migrate_slots( private_table, UINT_MAX );
+      start_rehash( private_table );
+      migrate_slots( private_table, migration_steps );
+    }
 
-  hash_entry *new_entry = xmalloc( sizeof( hash_entry ) );
-  new_entry->key = key;
-  new_entry->value = value;
-  insert_in_front( &table->buckets[ i ], new_entry );
+    if ( !push_slot( table, private_table->current, slot, &previous ) ) {
+      hash_slot *old_slot = find_slot( table, private_table->old, key, slot.hash );
+      if ( old_slot != NULL ) {
+        previous = old_slot->entry.value;
+      }
+    }
+  }
   table->length++;
 
-  pthread_mutex_unlock( ( ( private_hash_table * ) table )->mutex );
+  unlock_for_write( private_table );
 
-  if ( old_elem == NULL ) {
-    return NULL;
-  }
-  else {
-    return ( ( hash_entry * ) old_elem->data )->value;
-  }
+  return previous;
 }
 
 
@@ -141,16 +476,20 @@ lookup_hash_entry( hash_table *table, const void *key ) {
   assert( table != NULL );
   assert( key != NULL );
 
-  pthread_mutex_lock( ( ( private_hash_table * ) table )->mutex );
+  private_hash_table *private_table = ( private_hash_table * ) table;
+
+  lock_for_read( private_table );
 
-  list_element *e = find_list_element_from_buckets( table, key );
-  if ( e != NULL ) {
-    pthread_mutex_unlock( ( ( private_hash_table * ) table )->mutex );
-    return ( ( hash_entry * ) e->data )->value;
+  unsigned int hash = get_hash_value( table, key );
+  hash_slot *slot = find_slot( table, current_slot_array( private_table ), key, hash );
+  if ( slot == NULL ) {
+    slot = find_slot( table, private_table->old, key, hash );
   }
+  void *value = slot != NULL ? slot->entry.value : NULL;
 
-  pthread_mutex_unlock( ( ( private_hash_table * ) table )->mutex );
-  return NULL;
+  unlock_for_read( private_table );
+
+  return value;
 }
 
 
@@ -159,25 +498,54 @@ delete_hash_entry( hash_table *table, const void *key ) {
   assert( table != NULL );
   assert( key != NULL );
 
-  pthread_mutex_lock( ( ( private_hash_table * ) table )->mutex );
-
-  unsigned int i = get_bucket_index( table, key );
-  list_element *e = find_list_element_from_buckets( table, key );
-  if ( e != NULL ) {
-    hash_entry *delete_me = e->data;
-    void *deleted = delete_me->value;
-    delete_element( &table->buckets[ i ], delete_me );
-    xfree( delete_me );
-    if ( table->buckets[ i ] == NULL ) {
-      delete_element( &table->nonempty_bucket_index, ( void * ) ( unsigned long ) i );
+  private_hash_table *private_table = ( private_hash_table * ) table;
+
+  lock_for_write( private_table );
+
+  unsigned int hash = get_hash_value( table, key );
+  slot_array *array = private_table->current;
+  hash_slot *slot = find_slot( table, array, key, hash );
+  if ( slot == NULL ) {
+    array = private_table->old;
+    slot = find_slot( table, array, key, hash );
+  }
+
+  void *deleted = NULL;
+  if ( slot != NULL ) {
+    deleted = slot->entry.value;
+    unsigned int index = ( unsigned int ) ( slot - array->slots );
+    if ( private_table->concurrency == HASH_TABLE_READ_MOSTLY ) {
+      slot_array *copy = copy_slot_array( array, array->size );
+      remove_slot( copy, index );
+      publish_slot_array( private_table, copy );
+    }
+    else {
+      remove_slot( array, index );
     }
     table->length--;
-    pthread_mutex_unlock( ( ( private_hash_table * ) table )->mutex );
-    return deleted;
   }
 
-  pthread_mutex_unlock( ( ( private_hash_table * ) table )->mutex );
-  return NULL;
+  unlock_for_write( private_table );
+
+  return deleted;
+}
+
+
+static void
+map_slot_array( const hash_table *table, const slot_array *array, const void *key, unsigned int hash,
+                void function( void *value, void *user_data ), void *user_data ) {
+  if ( array == NULL ) {
+    return;
+  }
+
+  unsigned int mask = array->size - 1;
+  unsigned int i;
+  for ( i = home_index( array, hash ); array->slots[ i ].entry.key != NULL; i = ( i + 1 ) & mask ) {
+    const hash_slot *slot = &array->slots[ i ];
+    if ( slot->hash == hash && ( *table->compare )( key, slot->entry.key ) ) {
+      function( slot->entry.value, user_data );
+    }
+  }
 }
 
 
@@ -185,17 +553,15 @@ void
 map_hash( hash_table *table, const void *key, void function( void *value, void *user_data ), void *user_data ) {
   assert( table != NULL );
 
-  pthread_mutex_lock( ( ( private_hash_table * ) table )->mutex );
+  private_hash_table *private_table = ( private_hash_table * ) table;
 
-  unsigned int i = get_bucket_index( table, key );
-  list_element *e = NULL;
-  for ( e = table->buckets[ i ]; e; e = e->next ) {
-    if ( ( table->compare )( key, ( ( hash_entry * ) e->data )->key ) ) {
-      function( ( ( hash_entry * ) e->data )->value, user_data );
-    }
-  }
+  lock_for_read( private_table );
+
+  unsigned int hash = get_hash_value( table, key );
+  map_slot_array( table, current_slot_array( private_table ), key, hash, function, user_data );
+  map_slot_array( table, private_table->old, key, hash, function, user_data );
 
-  pthread_mutex_unlock( ( ( private_hash_table * ) table )->mutex );
+  unlock_for_read( private_table );
 }
 
 
@@ -203,19 +569,38 @@ void
 foreach_hash( hash_table *table, void function( void *key, void *value, void *user_data ), void *user_data ) {
   assert( table != NULL );
 
-  pthread_mutex_lock( ( ( private_hash_table * ) table )->mutex );
+  private_hash_table *private_table = ( private_hash_table * ) table;
 
-  unsigned int i;
-  for ( i = 0; i < table->number_of_buckets; i++ ) {
-    list_element *e = NULL;
-    for ( e = table->buckets[ i ]; e; ) {
-      hash_entry *he = e->data;
-      e = e->next;
-      function( he->key, he->value, user_data );
-    }
+  lock_for_read( private_table );
+
+  hash_iterator iter;
+  hash_entry *e;
+  init_hash_iterator( table, &iter );
+  while ( ( e = iterate_hash_next( &iter ) ) != NULL ) {
+    function( e->key, e->value, user_data );
+  }
+
+  unlock_for_read( private_table );
+}
+
+
+/*
+ * Slots are walked backwards starting from an empty one, so deleting
+ * the entry just returned only shifts entries that were already
+ * visited into slots that will not be visited again. In read-mostly
+ * mode deletion leaves the walked copy untouched altogether.
+ */
+static void
+start_iterating_slot_array( hash_iterator *iter ) {
+  const slot_array *array = iter->phase < 2 ? iter->arrays[ iter->phase ] : NULL;
+  if ( array == NULL || array->length == 0 ) {
+    iter->index = 0;
+    iter->remaining = 0;
+    return;
   }
 
-  pthread_mutex_unlock( ( ( private_hash_table * ) table )->mutex );
+  iter->index = find_empty_slot( array );
+  iter->remaining = array->size - 1;
 }
 
 
@@ -224,16 +609,12 @@ init_hash_iterator( hash_table *table, hash_iterator *iter ) {
   assert( table != NULL );
   assert( iter != NULL );
 
-  iter->buckets = table->buckets;
-  if ( table->nonempty_bucket_index ) {
-    iter->bucket_index = table->nonempty_bucket_index;
-    iter->next_bucket_index = table->nonempty_bucket_index->next;
-    iter->element = iter->buckets[ ( int ) ( unsigned long ) iter->bucket_index->data ];
-  }
-  else {
-    iter->bucket_index = NULL;
-    iter->element = NULL;
-  }
+  private_hash_table *private_table = ( private_hash_table * ) table;
+
+  iter->arrays[ 0 ] = current_slot_array( private_table );
+  iter->arrays[ 1 ] = private_table->old;
+  iter->phase = 0;
+  start_iterating_slot_array( iter );
 }
 
 
@@ -242,24 +623,22 @@ iterate_hash_next( hash_iterator *iter ) {
   assert( iter != NULL );
 
   for ( ;; ) {
-    if ( iter->bucket_index == NULL ) {
+    if ( iter->phase >= 2 ) {
       return NULL;
     }
 
-    list_element *e = iter->element;
-    if ( e == NULL ) { 
-      if ( iter->next_bucket_index != NULL ) {
-        iter->bucket_index = iter->next_bucket_index;
-        iter->next_bucket_index = iter->next_bucket_index->next;
-        iter->element = iter->buckets[ ( int ) ( unsigned long ) iter->bucket_index->data ];
-      }
-      else {
-        return NULL;
-      }
+    if ( iter->remaining == 0 ) {
+      iter->phase++;
+      start_iterating_slot_array( iter );
+      continue;
     }
-    else {
-      iter->element = e->next;
-      return e->data;
+
+    slot_array *array = iter->arrays[ iter->phase ];
+    iter->index = ( iter->index - 1 ) & ( array->size - 1 );
+    iter->remaining--;
+    hash_slot *slot = &array->slots[ iter->index ];
+    if ( slot->entry.key != NULL ) {
+      return &slot->entry;
     }
   }
 }
@@ -269,29 +648,15 @@ void
 delete_hash( hash_table *table ) {
   assert( table != NULL );
 
-  pthread_mutex_lock( ( ( private_hash_table * ) table )->mutex );
-  pthread_mutex_t *mutex = ( ( private_hash_table * ) table )->mutex;
+  private_hash_table *private_table = ( private_hash_table * ) table;
+  pthread_mutex_t *mutex = private_table->mutex;
 
-  bool list_deleted = false;
+  pthread_mutex_lock( mutex );
 
-  if ( table->length > 0 ) {
-    unsigned int i;
-    for ( i = 0; i < table->number_of_buckets; i++ ) {
-      list_element *e = NULL;
-      for ( e = table->buckets[ i ]; e != NULL; ) {
-        list_element *delete_me = e;
-        e = e->next;
-        xfree( delete_me->data );
-      }
-      list_deleted = delete_list( table->buckets[ i ] );
-      assert( list_deleted == true );
-    }
+  xfree( private_table->current );
+  if ( private_table->old != NULL ) {
+    xfree( private_table->old );
   }
-  xfree( table->buckets );
-
-  list_deleted = delete_list( table->nonempty_bucket_index );
-  assert( list_deleted == true );
-
   xfree( table );
 
   pthread_mutex_unlock( mutex );
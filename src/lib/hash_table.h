@@ -42,20 +42,41 @@ typedef struct {
   compare_function compare;
   hash_function hash;
   unsigned int length;
-  list_element **buckets;
-  list_element *nonempty_bucket_index;
 } hash_table;
 
 
+/*
+ * Only the entry most recently returned by iterate_hash_next() may be
+ * deleted while iterating. Inserting during iteration is not allowed.
+ */
 typedef struct {
-  list_element **buckets;
-  list_element *bucket_index;
-  list_element *next_bucket_index;
-  list_element *element;
+  void *arrays[ 2 ];
+  unsigned int phase;
+  unsigned int index;
+  unsigned int remaining;
 } hash_iterator;
 
 
+/*
+ * HASH_TABLE_LOCKED serializes every operation with a recursive mutex.
+ * HASH_TABLE_UNLOCKED does no synchronization at all and is meant for
+ * tables used by a single thread or protected by an outer lock.
+ * HASH_TABLE_READ_MOSTLY lets lookups, map_hash(), foreach_hash() and
+ * iterators run without any lock or atomic read-modify-write while
+ * writers are serialized by the mutex and copy the table on each
+ * update; threads reading such a table concurrently with writers must
+ * be registered with register_rcu_reader() (see rcu.h).
+ */
+typedef enum {
+  HASH_TABLE_LOCKED,
+  HASH_TABLE_UNLOCKED,
+  HASH_TABLE_READ_MOSTLY,
+} hash_table_concurrency;
+
+
 hash_table *create_hash( const compare_function compare, const hash_function hash );
+hash_table *create_hash_with_size( const compare_function compare, const hash_function hash, unsigned int size );
+void set_hash_concurrency( hash_table *table, hash_table_concurrency concurrency );
 void *insert_hash_entry( hash_table *table, void *key, void *value );
 void *lookup_hash_entry( hash_table *table, const void *key );
 void *delete_hash_entry( hash_table *table, const void *key );
@@ -19,18 +19,28 @@
 
 
 #include <assert.h>
+#include <errno.h>
+#include <inttypes.h>
 #include <linux/limits.h>
 #include <pthread.h>
 #include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
 #include "bool.h"
 #include "checks.h"
 #include "log.h"
 #include "wrapper.h"
 
 
+// The functions behind the level-checking macros in log.h.
+#undef notice
+#undef info
+#undef debug
+
+
 // If this is being built for a unit test.
 #ifdef UNIT_TESTING
 
@@ -81,6 +91,38 @@ static pthread_mutex_t mutex = PTHREAD_RECURSIVE_MUTEX_INITIALIZER_NP;
 static char ident[ PATH_MAX ];
 
 
+/*
+ * In asynchronous mode log messages are formatted by the caller into a
+ * bounded multi-producer single-consumer ring and written out by a
+ * writer thread, so that no caller waits for syslog or stdout. Each
+ * record carries a sequence number that tells whether it is free for
+ * the producer that claimed its position or ready for the consumer.
+ * Records are consumed only with the mutex held. A message that finds
+ * the ring full is dropped and counted.
+ */
+#define LOG_RING_SIZE 1024
+#define LOG_RECORD_LENGTH 512
+
+typedef struct {
+  uint64_t sequence;
+  int priority;
+  char message[ LOG_RECORD_LENGTH ];
+} log_record;
+
+static log_record log_ring[ LOG_RING_SIZE ];
+static uint64_t log_ring_head = 0;
+static uint64_t log_ring_tail = 0;
+static bool log_ring_initialized = false;
+static bool async_logging = false;
+static bool log_writer_running = false;
+static int log_writer_sleeping = 0;
+static int log_writer_fd = -1;
+static pthread_t log_writer;
+static uint64_t dropped_log_count = 0;
+static uint64_t reported_dropped_log_count = 0;
+static bool flush_log_at_exit = false;
+
+
 #ifndef _DOXYGEN
 
 typedef struct priority {
@@ -189,6 +231,220 @@ logging_started( void ) {
 }
 
 
+static void
+write_log( int priority, const char *format, ... ) {
+  va_list args;
+  va_start( args, format );
+  ( *do_log )( priority, format, args );
+  va_end( args );
+}
+
+
+static void
+init_log_ring( void ) {
+  uint64_t i;
+  for ( i = 0; i < LOG_RING_SIZE; i++ ) {
+    log_ring[ i ].sequence = i;
+  }
+  log_ring_head = 0;
+  log_ring_tail = 0;
+  log_ring_initialized = true;
+}
+
+
+static void
+wake_up_log_writer( void ) {
+  __atomic_thread_fence( __ATOMIC_SEQ_CST );
+  if ( __atomic_load_n( &log_writer_sleeping, __ATOMIC_RELAXED ) != 0
+       && __atomic_exchange_n( &log_writer_sleeping, 0, __ATOMIC_SEQ_CST ) != 0 ) {
+    uint64_t count = 1;
+    ssize_t ret = write( log_writer_fd, &count, sizeof( count ) );
+    UNUSED( ret );
+  }
+}
+
+
+static void
+enqueue_log_record( int priority, const char *format, va_list ap ) {
+  log_record *record;
+  uint64_t position = __atomic_load_n( &log_ring_head, __ATOMIC_RELAXED );
+  for ( ;; ) {
+    record = &log_ring[ position % LOG_RING_SIZE ];
+    uint64_t sequence = __atomic_load_n( &record->sequence, __ATOMIC_ACQUIRE );
+    if ( sequence == position ) {
+      if ( __atomic_compare_exchange_n( &log_ring_head, &position, position + 1, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED ) ) {
+        break;
+      }
+    }
+    else if ( sequence < position ) {
+      __atomic_fetch_add( &dropped_log_count, 1, __ATOMIC_RELAXED );
+      return;
+    }
+    else {
+      position = __atomic_load_n( &log_ring_head, __ATOMIC_RELAXED );
+    }
+  }
+
+  record->priority = priority;
+  vsnprintf( record->message, sizeof( record->message ), format, ap );
+  __atomic_store_n( &record->sequence, position + 1, __ATOMIC_RELEASE );
+
+  wake_up_log_writer();
+}
+
+
+static bool
+log_ring_is_empty( void ) {
+  log_record *record = &log_ring[ log_ring_tail % LOG_RING_SIZE ];
+  return __atomic_load_n( &record->sequence, __ATOMIC_ACQUIRE ) != log_ring_tail + 1;
+}
+
+
+// Must be called with mutex held.
+static void
+drain_log_ring( void ) {
+  if ( !log_ring_initialized ) {
+    return;
+  }
+  while ( !log_ring_is_empty() ) {
+    log_record *record = &log_ring[ log_ring_tail % LOG_RING_SIZE ];
+    write_log( record->priority, "%s", record->message );
+    __atomic_store_n( &record->sequence, log_ring_tail + LOG_RING_SIZE, __ATOMIC_RELEASE );
+    log_ring_tail++;
+  }
+
+  uint64_t dropped = __atomic_load_n( &dropped_log_count, __ATOMIC_RELAXED );
+  if ( dropped != reported_dropped_log_count ) {
+    write_log( LOG_WARNING, "%" PRIu64 " log messages were dropped.", dropped - reported_dropped_log_count );
+    reported_dropped_log_count = dropped;
+  }
+}
+
+
+static void *
+run_log_writer( void *arg ) {
+  UNUSED( arg );
+
+  while ( __atomic_load_n( &log_writer_running, __ATOMIC_ACQUIRE ) ) {
+    pthread_mutex_lock( &mutex );
+    drain_log_ring();
+    pthread_mutex_unlock( &mutex );
+
+    __atomic_store_n( &log_writer_sleeping, 1, __ATOMIC_SEQ_CST );
+    if ( !log_ring_is_empty() || !__atomic_load_n( &log_writer_running, __ATOMIC_ACQUIRE ) ) {
+      __atomic_store_n( &log_writer_sleeping, 0, __ATOMIC_RELAXED );
+      continue;
+    }
+    uint64_t count;
+    ssize_t ret = read( log_writer_fd, &count, sizeof( count ) );
+    UNUSED( ret );
+  }
+
+  return NULL;
+}
+
+
+/**
+ * switches to asynchronous logging. Messages below critical are handed
+ * to a writer thread from now on; call this after daemonizing, since
+ * the thread does not survive fork().
+ */
+bool
+start_async_logging( void ) {
+  pthread_mutex_lock( &mutex );
+
+  if ( log_writer_running ) {
+    pthread_mutex_unlock( &mutex );
+    return true;
+  }
+  if ( !log_ring_initialized ) {
+    init_log_ring();
+  }
+  log_writer_fd = eventfd( 0, EFD_CLOEXEC );
+  if ( log_writer_fd < 0 ) {
+    pthread_mutex_unlock( &mutex );
+    error( "Failed to create an eventfd for the log writer ( errno = %s [%d] ).", strerror( errno ), errno );
+    return false;
+  }
+  log_writer_sleeping = 0;
+  log_writer_running = true;
+  if ( pthread_create( &log_writer, NULL, run_log_writer, NULL ) != 0 ) {
+    log_writer_running = false;
+    close( log_writer_fd );
+    log_writer_fd = -1;
+    pthread_mutex_unlock( &mutex );
+    error( "Failed to start the log writer." );
+    return false;
+  }
+  async_logging = true;
+
+  if ( !flush_log_at_exit ) {
+    atexit( flush_log );
+    flush_log_at_exit = true;
+  }
+
+  pthread_mutex_unlock( &mutex );
+
+  return true;
+}
+
+
+/**
+ * writes out pending messages and goes back to synchronous logging.
+ */
+void
+stop_async_logging( void ) {
+  pthread_mutex_lock( &mutex );
+  if ( !log_writer_running ) {
+    pthread_mutex_unlock( &mutex );
+    return;
+  }
+  async_logging = false;
+  __atomic_store_n( &log_writer_running, false, __ATOMIC_RELEASE );
+  __atomic_store_n( &log_writer_sleeping, 1, __ATOMIC_SEQ_CST );
+  wake_up_log_writer();
+  pthread_mutex_unlock( &mutex );
+
+  pthread_join( log_writer, NULL );
+  close( log_writer_fd );
+  log_writer_fd = -1;
+
+  flush_log();
+}
+
+
+/**
+ * writes out every message queued so far from the calling thread.
+ */
+void
+flush_log( void ) {
+  pthread_mutex_lock( &mutex );
+  drain_log_ring();
+  pthread_mutex_unlock( &mutex );
+}
+
+
+uint64_t
+get_dropped_log_count( void ) {
+  return __atomic_load_n( &dropped_log_count, __ATOMIC_RELAXED );
+}
+
+
+static void
+log_message( int priority, const char *format, va_list ap ) {
+  if ( __atomic_load_n( &async_logging, __ATOMIC_RELAXED ) && priority > LOG_CRIT ) {
+    enqueue_log_record( priority, format, ap );
+    return;
+  }
+
+  pthread_mutex_lock( &mutex );
+  // a critical message is usually followed by exit, so keep the order.
+  drain_log_ring();
+  ( *do_log )( priority, format, ap );
+  pthread_mutex_unlock( &mutex );
+}
+
+
 #ifndef _DOXYGEN
 
 #define DO_LOG( _priority, _format )                \
@@ -196,12 +452,10 @@ logging_started( void ) {
     assert( do_log != NULL );                       \
     assert( _format != NULL );                      \
     if ( level >= _priority ) {                     \
-      pthread_mutex_lock( &mutex );                 \
       va_list _args;                                \
       va_start( _args, _format );                   \
-      ( *do_log )( _priority, _format, _args );     \
+      log_message( _priority, _format, _args );     \
       va_end( _args );                              \
-      pthread_mutex_unlock( &mutex );               \
     }                                               \
   } while ( 0 )
 
@@ -248,7 +502,7 @@ static void
 log_stdout( int priority, const char *format, va_list ap ) {
   UNUSED( priority );
 
-  char format_newline[ strlen( format ) + 1 ];
+  char format_newline[ strlen( format ) + 2 ];
   sprintf( format_newline, "%s\n", format );
   vprintf( format_newline, ap );
 }
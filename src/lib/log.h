@@ -27,7 +27,9 @@
 #define LOG_H
 
 
+#include <stdint.h>
 #include <syslog.h>
+#include <time.h>
 #include "bool.h"
 
 
@@ -42,6 +44,92 @@ void notice( const char *format, ... );
 void info( const char *format, ... );
 void debug( const char *format, ... );
 
+/*
+ * Messages less severe than TREMA_MIN_LOG_LEVEL are compiled out, e.g.
+ * -DTREMA_MIN_LOG_LEVEL=LOG_INFO removes every debug() call together
+ * with its arguments.
+ */
+#ifndef TREMA_MIN_LOG_LEVEL
+#define TREMA_MIN_LOG_LEVEL LOG_DEBUG
+#endif
+
+/*
+ * True if a message of _priority would be logged. Guard the
+ * preparation of expensive arguments with it, e.g.
+ *
+ *   if ( LOG_LEVEL_ENABLED( LOG_DEBUG ) ) {
+ *     match_to_string( &match, match_string, sizeof( match_string ) );
+ *     debug( "match = [%s]", match_string );
+ *   }
+ */
+#define LOG_LEVEL_ENABLED( _priority ) \
+  ( ( _priority ) <= TREMA_MIN_LOG_LEVEL && get_logging_level() >= ( _priority ) )
+
+// Arguments of the verbose levels are not evaluated unless logged.
+#define notice( ... ) do { if ( LOG_LEVEL_ENABLED( LOG_NOTICE ) ) ( notice )( __VA_ARGS__ ); } while ( 0 )
+#define info( ... ) do { if ( LOG_LEVEL_ENABLED( LOG_INFO ) ) ( info )( __VA_ARGS__ ); } while ( 0 )
+#define debug( ... ) do { if ( LOG_LEVEL_ENABLED( LOG_DEBUG ) ) ( debug )( __VA_ARGS__ ); } while ( 0 )
+
+bool start_async_logging( void );
+void stop_async_logging( void );
+void flush_log( void );
+uint64_t get_dropped_log_count( void );
+
+
+/*
+ * Lets a call site log at most LOG_RATE_LIMIT_BURST messages every
+ * LOG_RATE_LIMIT_INTERVAL seconds, e.g.
+ *
+ *   LOG_RATE_LIMITED( warn, "Queue is full ( name = %s ).", name );
+ *
+ * The number of messages suppressed is logged with the next message
+ * that gets through. Threads sharing a call site share its limit, and
+ * the count is not exact if they race.
+ */
+#define LOG_RATE_LIMIT_BURST 10
+#define LOG_RATE_LIMIT_INTERVAL 5
+
+typedef struct {
+  time_t window_started_at;
+  unsigned int count;
+  unsigned int suppressed;
+} log_rate_limit;
+
+
+static inline bool
+log_rate_limit_allows( log_rate_limit *limit, unsigned int *suppressed ) {
+  struct timespec now;
+  clock_gettime( CLOCK_MONOTONIC_COARSE, &now );
+
+  *suppressed = 0;
+  if ( limit->count == 0 || now.tv_sec - limit->window_started_at >= LOG_RATE_LIMIT_INTERVAL ) {
+    *suppressed = limit->suppressed;
+    limit->window_started_at = now.tv_sec;
+    limit->count = 0;
+    limit->suppressed = 0;
+  }
+  if ( limit->count >= LOG_RATE_LIMIT_BURST ) {
+    limit->suppressed++;
+    return false;
+  }
+  limit->count++;
+
+  return true;
+}
+
+
+#define LOG_RATE_LIMITED( _log, ... )                                   \
+  do {                                                                  \
+    static log_rate_limit _limit = { 0, 0, 0 };                         \
+    unsigned int _suppressed;                                           \
+    if ( log_rate_limit_allows( &_limit, &_suppressed ) ) {             \
+      if ( _suppressed > 0 ) {                                          \
+        _log( "%u similar messages were suppressed.", _suppressed );    \
+      }                                                                 \
+      _log( __VA_ARGS__ );                                              \
+    }                                                                   \
+  } while ( 0 )
+
 
 #endif // LOG_H
 
@@ -27,6 +27,7 @@
 #include "match_table.h"
 #include "match.h"
 #include "log.h"
+#include "rcu.h"
 #include "wrapper.h"
 
 
@@ -38,6 +39,7 @@
 typedef struct match_table {
   hash_table *exact_table; // no wildcards are set
   list_element *wildcard_table; // wildcard flags are set
+  hash_table_concurrency concurrency;
   pthread_mutex_t *mutex;
 } match_table;
 
@@ -101,6 +103,18 @@ free_match_entry( match_entry *free_entry ) {
 }
 
 
+static void
+free_match_entry_deferred( void *data ) {
+  free_match_entry( data );
+}
+
+
+static void
+free_wildcard_table_deferred( void *data ) {
+  delete_list( data );
+}
+
+
 static void
 free_match_table_walker( void *key, void *value, void *user_data ) {
   match_entry *entry = value;
@@ -112,10 +126,88 @@ free_match_table_walker( void *key, void *value, void *user_data ) {
 }
 
 
+static void
+lock_match_table_for_read( void ) {
+  if ( match_table_head.concurrency == HASH_TABLE_LOCKED ) {
+    pthread_mutex_lock( match_table_head.mutex );
+  }
+}
+
+
+static void
+unlock_match_table_for_read( void ) {
+  if ( match_table_head.concurrency == HASH_TABLE_LOCKED ) {
+    pthread_mutex_unlock( match_table_head.mutex );
+  }
+}
+
+
+static void
+lock_match_table_for_write( void ) {
+  if ( match_table_head.concurrency != HASH_TABLE_UNLOCKED ) {
+    pthread_mutex_lock( match_table_head.mutex );
+  }
+}
+
+
+static void
+unlock_match_table_for_write( void ) {
+  if ( match_table_head.concurrency != HASH_TABLE_UNLOCKED ) {
+    pthread_mutex_unlock( match_table_head.mutex );
+  }
+}
+
+
+/*
+ * In read-mostly mode the wildcard table is never modified in place.
+ * Writers update a copy of the list and publish it with
+ * publish_wildcard_table(), and the old list is released once all
+ * readers have passed a quiescent state.
+ */
+static list_element *
+begin_wildcard_table_update( void ) {
+  if ( match_table_head.concurrency != HASH_TABLE_READ_MOSTLY ) {
+    return match_table_head.wildcard_table;
+  }
+
+  list_element *copy;
+  create_list( &copy );
+  list_element *list;
+  for ( list = match_table_head.wildcard_table; list != NULL; list = list->next ) {
+    append_to_tail( &copy, list->data );
+  }
+  return copy;
+}
+
+
+static void
+publish_wildcard_table( list_element *wildcard_table ) {
+  list_element *retired = match_table_head.wildcard_table;
+  __atomic_store_n( &match_table_head.wildcard_table, wildcard_table, __ATOMIC_RELEASE );
+  if ( match_table_head.concurrency == HASH_TABLE_READ_MOSTLY ) {
+    defer_rcu_free( retired, free_wildcard_table_deferred );
+  }
+}
+
+
+static void
+retire_match_entry( match_entry *entry ) {
+  if ( match_table_head.concurrency == HASH_TABLE_READ_MOSTLY ) {
+    defer_rcu_free( entry, free_match_entry_deferred );
+  }
+  else {
+    free_match_entry( entry );
+  }
+}
+
+
 void
 init_match_table( void ) {
   match_table_head.exact_table = create_hash( compare_match_entry, hash_match_entry );
+  // the exact table is protected by our own mutex
+  set_hash_concurrency( match_table_head.exact_table, HASH_TABLE_UNLOCKED );
   create_list( &match_table_head.wildcard_table );
+  match_table_head.concurrency = HASH_TABLE_LOCKED;
 
   pthread_mutexattr_t attr;
   pthread_mutexattr_init( &attr );
@@ -125,6 +217,28 @@ init_match_table( void ) {
 }
 
 
+/*
+ * Must be called right after init_match_table(), before the table is
+ * shared with other threads.
+ */
+void
+set_match_table_concurrency( hash_table_concurrency concurrency ) {
+  assert( match_table_head.mutex != NULL );
+
+  pthread_mutex_lock( match_table_head.mutex );
+
+  match_table_head.concurrency = concurrency;
+  if ( concurrency == HASH_TABLE_READ_MOSTLY ) {
+    set_hash_concurrency( match_table_head.exact_table, HASH_TABLE_READ_MOSTLY );
+  }
+  else {
+    set_hash_concurrency( match_table_head.exact_table, HASH_TABLE_UNLOCKED );
+  }
+
+  pthread_mutex_unlock( match_table_head.mutex );
+}
+
+
 void
 finalize_match_table( void ) {
   list_element *list;
@@ -151,9 +265,9 @@ finalize_match_table( void ) {
 void
 insert_match_entry( struct ofp_match *ofp_match, uint16_t priority, const char *service_name, const char *entry_name ) {
   match_entry *new_entry, *entry;
-  list_element *list;
+  list_element *list, *wildcard_table;
 
-  pthread_mutex_lock( match_table_head.mutex );
+  lock_match_table_for_write();
 
   new_entry = allocate_match_entry( ofp_match, priority, service_name, entry_name );
 
@@ -162,16 +276,17 @@ insert_match_entry( struct ofp_match *ofp_match, uint16_t priority, const char *
     if ( entry != NULL ) {
       warn( "insert entry exits" );
       free_match_entry( new_entry );
-      pthread_mutex_unlock( match_table_head.mutex );
+      unlock_match_table_for_write();
       return;
     }
     insert_hash_entry( match_table_head.exact_table, &new_entry->ofp_match, new_entry );
-    pthread_mutex_unlock( match_table_head.mutex );
+    unlock_match_table_for_write();
     return;
   }
 
   // wildcard flags are set
-  for ( list = match_table_head.wildcard_table; list != NULL; list = list->next ) {
+  wildcard_table = begin_wildcard_table_update();
+  for ( list = wildcard_table; list != NULL; list = list->next ) {
     entry = list->data;
     if ( entry->priority <= new_entry->priority ) {
       break;
@@ -179,35 +294,33 @@ insert_match_entry( struct ofp_match *ofp_match, uint16_t priority, const char *
   }
   if ( list == NULL ) {
     // wildcard_table is null or tail
-    append_to_tail( &match_table_head.wildcard_table, new_entry );
-    pthread_mutex_unlock( match_table_head.mutex );
-    return;
+    append_to_tail( &wildcard_table, new_entry );
   }
-  if ( list == match_table_head.wildcard_table ) {
+  else if ( list == wildcard_table ) {
     // head
-    insert_in_front( &match_table_head.wildcard_table, new_entry );
-    pthread_mutex_unlock( match_table_head.mutex );
-    return;
+    insert_in_front( &wildcard_table, new_entry );
   }
-
-  // insert brefore
-  insert_before( &match_table_head.wildcard_table, list->data, new_entry );
-  pthread_mutex_unlock( match_table_head.mutex );
+  else {
+    // insert brefore
+    insert_before( &wildcard_table, list->data, new_entry );
+  }
+  publish_wildcard_table( wildcard_table );
+  unlock_match_table_for_write();
 }
 
 
 void
 delete_match_entry( struct ofp_match *ofp_match ) {
   match_entry *delete_entry;
-  list_element *list;
+  list_element *list, *wildcard_table;
 
-  pthread_mutex_lock( match_table_head.mutex );
+  lock_match_table_for_write();
 
   assert( ofp_match != NULL );
   if ( !ofp_match->wildcards ) {
     delete_entry = delete_hash_entry( match_table_head.exact_table, ofp_match );
     if ( delete_entry == NULL ) {
-      pthread_mutex_unlock( match_table_head.mutex );
+      unlock_match_table_for_write();
       return;
     }
   }
@@ -220,38 +333,45 @@ delete_match_entry( struct ofp_match *ofp_match ) {
       }
     }
     if ( list == NULL ) {
-      pthread_mutex_unlock( match_table_head.mutex );
+      unlock_match_table_for_write();
       return;
     }
-    delete_element( &match_table_head.wildcard_table, delete_entry );
+    wildcard_table = begin_wildcard_table_update();
+    delete_element( &wildcard_table, delete_entry );
+    publish_wildcard_table( wildcard_table );
   }
-  free_match_entry( delete_entry );
-  pthread_mutex_unlock( match_table_head.mutex );
+  retire_match_entry( delete_entry );
+  unlock_match_table_for_write();
 }
 
 
+/*
+ * Does not take any lock unless the table is in HASH_TABLE_LOCKED
+ * mode. In HASH_TABLE_READ_MOSTLY mode, the returned entry stays valid
+ * until the calling thread reports a quiescent state.
+ */
 match_entry *
 lookup_match_entry( struct ofp_match *ofp_match ) {
   match_entry *entry;
   list_element *list;
 
-  pthread_mutex_lock( match_table_head.mutex );
+  lock_match_table_for_read();
 
   entry = lookup_hash_entry( match_table_head.exact_table, ofp_match );
   if ( entry != NULL ) {
-    pthread_mutex_unlock( match_table_head.mutex );
+    unlock_match_table_for_read();
     return entry;
   }
 
-  for ( list = match_table_head.wildcard_table; list != NULL; list = list->next ) {
+  for ( list = __atomic_load_n( &match_table_head.wildcard_table, __ATOMIC_ACQUIRE ); list != NULL; list = list->next ) {
     entry = list->data;
     if ( compare_match( &entry->ofp_match, ofp_match ) ) {
-      pthread_mutex_unlock( match_table_head.mutex );
+      unlock_match_table_for_read();
       return entry;
     }
   }
 
-  pthread_mutex_unlock( match_table_head.mutex );
+  unlock_match_table_for_read();
 
   return NULL;
 }
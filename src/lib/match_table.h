@@ -38,6 +38,7 @@ typedef struct match_entry {
 
 void init_match_table( void );
 void finalize_match_table( void );
+void set_match_table_concurrency( hash_table_concurrency concurrency );
 void insert_match_entry( struct ofp_match *ofp_match, uint16_t priority, const char *service_name, const char *entry_name );
 void delete_match_entry( struct ofp_match *ofp_match );
 match_entry *lookup_match_entry( struct ofp_match *match );
@@ -21,17 +21,28 @@
 #include <arpa/inet.h>
 #include <assert.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <limits.h>
 #include <linux/limits.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
 #include <sys/socket.h>
+#include <sys/stat.h>
 #include <sys/types.h>
 #include <sys/un.h>
 #include <unistd.h>
 #include "doubly_linked_list.h"
+#include "hash_map.h"
 #include "hash_table.h"
 #include "log.h"
 #include "messenger.h"
+#include "rcu.h"
+#include "shm_ring.h"
+#include "stat.h"
 #include "timer.h"
 #include "wrapper.h"
 
@@ -71,11 +82,11 @@ extern int mock_close( int fd );
 #define connect mock_connect
 extern int mock_connect( int sockfd, const struct sockaddr *addr, socklen_t addrlen );
 
-#ifdef select
-#undef select
+#ifdef epoll_wait
+#undef epoll_wait
 #endif
-#define select mock_select
-extern int mock_select( int nfds, fd_set *readfds, fd_set *writefds, fd_set *exceptfds, struct timeval *timeout );
+#define epoll_wait mock_epoll_wait
+extern int mock_epoll_wait( int epfd, struct epoll_event *events, int maxevents, int timeout );
 
 #ifdef accept
 #undef accept
@@ -125,11 +136,17 @@ extern void mock_debug( const char *format, ... );
 #define warn mock_warn
 extern void mock_warn( const char *format, ... );
 
-#ifdef add_periodic_event_callback
-#undef add_periodic_event_callback
+#ifdef add_timer_event
+#undef add_timer_event
 #endif
-#define add_periodic_event_callback mock_add_periodic_event_callback
-extern bool mock_add_periodic_event_callback( const time_t seconds, void ( *callback )( void *user_data ), void *user_data );
+#define add_timer_event mock_add_timer_event
+extern timer_handle mock_add_timer_event( struct itimerspec *interval, void ( *callback )( void *user_data ), void *user_data );
+
+#ifdef cancel_timer_event
+#undef cancel_timer_event
+#endif
+#define cancel_timer_event mock_cancel_timer_event
+extern bool mock_cancel_timer_event( timer_handle handle );
 
 #ifdef execute_timer_events
 #undef execute_timer_events
@@ -137,6 +154,30 @@ extern bool mock_add_periodic_event_callback( const time_t seconds, void ( *call
 #define execute_timer_events mock_execute_timer_events
 extern void mock_execute_timer_events( void );
 
+#ifdef register_stat_counter
+#undef register_stat_counter
+#endif
+#define register_stat_counter mock_register_stat_counter
+extern int mock_register_stat_counter( const char *key );
+
+#ifdef add_stat_id
+#undef add_stat_id
+#endif
+#define add_stat_id mock_add_stat_id
+extern void mock_add_stat_id( int id, uint64_t value );
+
+#ifdef next_timer_deadline
+#undef next_timer_deadline
+#endif
+#define next_timer_deadline mock_next_timer_deadline
+extern bool mock_next_timer_deadline( struct timespec *deadline );
+
+#ifdef get_timer_fd
+#undef get_timer_fd
+#endif
+#define get_timer_fd mock_get_timer_fd
+extern int mock_get_timer_fd( void );
+
 #endif // UNIT_TESTING
 
 
@@ -144,6 +185,7 @@ enum {
   MESSAGE_TYPE_NOTIFY,
   MESSAGE_TYPE_REQUEST,
   MESSAGE_TYPE_REPLY,
+  MESSAGE_TYPE_RING_SETUP, // carries the fds of a shared-memory ring
 };
 
 typedef struct message_header {
@@ -154,6 +196,23 @@ typedef struct message_header {
   uint8_t value[ 0 ];
 } message_header;
 
+// A payload that multicast_message() shares among send queues.
+typedef struct shared_payload {
+  unsigned int refcount;
+  size_t length;
+  uint8_t data[ 0 ];
+} shared_payload;
+
+// A send queue entry that stands for a message whose payload is shared.
+// It is never sent as is; the message header and the payload are.
+#define MESSAGE_VERSION_SHARED 1
+
+typedef struct shared_message_entry {
+  message_header entry;   // version = MESSAGE_VERSION_SHARED
+  message_header header;  // header of the message to send
+  shared_payload *payload;
+} shared_message_entry;
+
 typedef struct message_buffer {
   void *buffer;
   size_t data_length;
@@ -163,12 +222,29 @@ typedef struct message_buffer {
 
 typedef struct messenger_socket {
   int fd;
+  struct receive_queue *queue;
+  shm_ring *ring;
+  bool dispatching;
 } messenger_socket;
 
+typedef struct event_fd {
+  int fd;
+  event_fd_callback read_callback;
+  event_fd_callback write_callback;
+  void *data;
+  uint32_t events;
+} event_fd;
+
+// Outstanding requests live in a slab indexed by the low bits of the
+// transaction id. The remaining bits hold a generation that changes
+// every time a slot is reused, so a late reply to a request that has
+// already timed out finds no context.
 typedef struct messenger_context {
-  uint32_t transaction_id;
-  int life_count;
+  uint32_t transaction_id; // zero while the slot is free
   void *user_data;
+  timer_handle timeout;
+  request_timeout_callback timeout_callback;
+  struct messenger_context *next_free;
 } messenger_context;
 
 typedef struct receive_queue_callback {
@@ -182,7 +258,8 @@ typedef struct receive_queue {
   int listen_socket;
   struct sockaddr_un listen_addr;
   dlist_element *client_sockets;
-  message_buffer *buffer;
+  struct receive_batch *batch;
+  int dropped_stat_id; // registered on the first drop
 } receive_queue;
 
 typedef struct send_queue {
@@ -192,12 +269,51 @@ typedef struct send_queue {
   struct timespec reconnect_at;
   struct sockaddr_un server_addr;
   message_buffer *buffer;
+  size_t max_length;
+  size_t high_watermark;
+  size_t low_watermark;
+  send_queue_watermark_callback watermark_callback;
+  void *watermark_user_data;
+  bool above_high_watermark;
+  shm_ring *ring;
+  size_t shared_length; // bytes of shared payloads referred to from buffer
+  int dropped_stat_id; // registered on the first drop
 } send_queue;
 
 
 #define MESSENGER_RECV_BUFFER 100000
+#define MESSENGER_RECV_BATCH 8
+#define MESSENGER_RECV_BUDGET 128
+#define MESSENGER_SEND_BATCH 32
+#define MESSENGER_SEND_BUDGET 128
+#define MESSENGER_RING_SIZE ( 1024 * 1024 )
+#define MESSENGER_RING_FDS 3
+#define MESSENGER_MAX_EVENTS 64
+
+
+/*
+ * Datagrams taken by one recvmmsg() call. Whichever on_recv() call on
+ * the queue comes first dispatches the rest of them, so that a callback
+ * re-entering the event loop neither repeats nor loses the messages its
+ * caller has not dispatched yet.
+ */
+typedef struct receive_batch {
+  uint8_t *slots; // MESSENGER_RECV_BATCH slots of MESSENGER_RECV_BUFFER bytes
+  struct mmsghdr messages[ MESSENGER_RECV_BATCH ];
+  struct iovec iovs[ MESSENGER_RECV_BATCH ];
+  char controls[ MESSENGER_RECV_BATCH ][ CMSG_SPACE( sizeof( int ) * MESSENGER_RING_FDS ) ];
+  messenger_socket *socket; // where the datagrams came from
+  int count;
+  int next; // first datagram not dispatched yet
+  unsigned int generation; // incremented on every recvmmsg()
+} receive_batch;
+#define MESSENGER_CLOCK_RETRY_MSEC 1000
+#define MESSENGER_CONTEXT_INDEX_BITS 14
+#define MESSENGER_CONTEXTS ( 1U << MESSENGER_CONTEXT_INDEX_BITS )
+#define MESSENGER_CONTEXT_INDEX_MASK ( MESSENGER_CONTEXTS - 1 )
+#define MESSENGER_REQUEST_TIMEOUT_SEC 100
 static const uint32_t messenger_send_queue_length = 100000;
-static const uint32_t messenger_recv_queue_length = 200000;
+static const uint32_t messenger_send_queue_max_length = 1600000;
 
 char socket_directory[ PATH_MAX ];
 static bool running = false;
@@ -205,58 +321,291 @@ static bool initialized = false;
 static bool finalized = false;
 static hash_table *receive_queues = NULL;
 static hash_table *send_queues = NULL;
-static hash_table *context_db = NULL;
+static messenger_context *contexts = NULL;
+static messenger_context *free_contexts = NULL;
+static uint32_t context_generation = 0;
 static char *_dump_service_name = NULL;
 static char *_dump_app_name = NULL;
-static void ( *external_fd_set )( fd_set *read_set, fd_set *write_set ) = NULL;
-static void ( *external_check_fd_isset )( fd_set *read_set, fd_set *write_set ) = NULL;
-static uint32_t last_transaction_id = 0;
+static messenger_trace_header *trace = NULL;
+static char *_trace_app_name = NULL;
+static int epoll_fd = -1;
+static uint32_hash_map *event_fds = NULL;
+static struct epoll_event ready_events[ MESSENGER_MAX_EVENTS ];
+static int ready_event_count = 0;
+static int ready_event_index = 0;
+static bool timer_fd_watched = false;
+static int wakeup_fd = -1;
+static bool send_queue_reconnect_pending = false;
+static bool shared_memory_transport = true;
 static void ( *external_callback )( void ) = NULL;
 
 
-static void
-_delete_context( void *key, void *value, void *user_data ) {
-  assert( value != NULL );
-  UNUSED( key );
-  UNUSED( user_data );
-  messenger_context *context = value;
+static void on_accept( int fd, void *data );
+static void on_recv( int fd, void *data );
+static void on_send( int fd, void *data );
+static void on_send_queue_readable( int fd, void *data );
+static void on_send_queue_ring_space( int fd, void *data );
+static void on_ring_data( int fd, void *data );
+static void flush_send_queue_to_ring( send_queue *sq );
+static void release_shared_payloads( send_queue *sq, size_t len );
+static void kick_send_queue( send_queue *sq );
+
+
+static messenger_context *
+get_context( uint32_t transaction_id ) {
+  debug( "Looking up a context ( transaction_id = %#x ).", transaction_id );
 
-  debug( "Deleting a context ( transaction_id = %#x, life_count = %d, user_data = %p ).",
-         context->transaction_id, context->life_count, context->user_data );
+  if ( contexts == NULL || transaction_id == 0 ) {
+    return NULL;
+  }
+  messenger_context *context = &contexts[ transaction_id & MESSENGER_CONTEXT_INDEX_MASK ];
+  if ( context->transaction_id != transaction_id ) {
+    return NULL;
+  }
 
-  delete_hash_entry( context_db, &context->transaction_id );
-  xfree( context );
+  return context;
 }
 
 
 static void
 delete_context( messenger_context *context ) {
   assert( context != NULL );
+  assert( context->transaction_id != 0 );
+
+  debug( "Deleting a context ( transaction_id = %#x, user_data = %p ).",
+         context->transaction_id, context->user_data );
 
-  _delete_context( &context->transaction_id, context, NULL );
+  if ( context->timeout != 0 ) {
+    cancel_timer_event( context->timeout );
+    context->timeout = 0;
+  }
+  context->transaction_id = 0;
+  context->user_data = NULL;
+  context->timeout_callback = NULL;
+  context->next_free = free_contexts;
+  free_contexts = context;
 }
 
 
 static void
-_age_context( void *key, void *value, void *user_data ) {
-  assert( value != NULL );
-  UNUSED( key );
-  UNUSED( user_data );
-  messenger_context *context = value;
-  context->life_count--;
-  if ( context->life_count <= 0 ) {
-    delete_context( context );
+on_request_timeout( void *user_data ) {
+  uint32_t transaction_id = ( uint32_t ) ( uintptr_t ) user_data;
+
+  messenger_context *context = get_context( transaction_id );
+  if ( context == NULL ) {
+    return;
+  }
+  // The timer is one-shot and released by the timer library.
+  context->timeout = 0;
+
+  request_timeout_callback callback = context->timeout_callback;
+  void *request_user_data = context->user_data;
+  delete_context( context );
+
+  if ( callback != NULL ) {
+    callback( request_user_data );
+  }
+  else {
+    warn( "Request timed out ( transaction_id = %#x, user_data = %p ).", transaction_id, request_user_data );
+  }
+}
+
+
+static bool
+update_event_fd( event_fd *efd, uint32_t events ) {
+  assert( efd != NULL );
+
+  if ( efd->events == events ) {
+    return true;
+  }
+
+  struct epoll_event event;
+  memset( &event, 0, sizeof( struct epoll_event ) );
+  event.events = events;
+  event.data.ptr = efd;
+  if ( epoll_ctl( epoll_fd, EPOLL_CTL_MOD, efd->fd, &event ) == -1 ) {
+    error( "Failed to modify events ( fd = %d, events = %#x, errno = %s [%d] ).",
+           efd->fd, events, strerror( errno ), errno );
+    return false;
+  }
+  efd->events = events;
+
+  return true;
+}
+
+
+/**
+ * registers fd to the event loop. read_callback is called while fd is
+ * readable, and write_callback while fd is writable and writable interest
+ * is set by set_writable_interest(). Errors and hangups are reported to
+ * read_callback if any, otherwise to write_callback. Events are level
+ * triggered, so callbacks may do a bounded amount of I/O per call.
+ */
+bool
+add_fd_event_callback( int fd, event_fd_callback read_callback, event_fd_callback write_callback, void *data ) {
+  assert( fd >= 0 );
+
+  debug( "Adding an event callback ( fd = %d, read_callback = %p, write_callback = %p, data = %p ).",
+         fd, read_callback, write_callback, data );
+
+  if ( event_fds == NULL ) {
+    error( "Messenger is not initialized yet." );
+    return false;
+  }
+
+  uint32_t key = ( uint32_t ) fd;
+  if ( lookup_uint32_hash_map_entry( event_fds, &key ) != NULL ) {
+    error( "Event callback for fd ( %d ) is already added.", fd );
+    return false;
+  }
+
+  event_fd *efd = xmalloc( sizeof( event_fd ) );
+  efd->fd = fd;
+  efd->read_callback = read_callback;
+  efd->write_callback = write_callback;
+  efd->data = data;
+  efd->events = read_callback != NULL ? EPOLLIN : 0;
+
+  struct epoll_event event;
+  memset( &event, 0, sizeof( struct epoll_event ) );
+  event.events = efd->events;
+  event.data.ptr = efd;
+  if ( epoll_ctl( epoll_fd, EPOLL_CTL_ADD, fd, &event ) == -1 ) {
+    error( "Failed to add fd ( %d ) to epoll set ( errno = %s [%d] ).", fd, strerror( errno ), errno );
+    xfree( efd );
+    return false;
+  }
+  insert_uint32_hash_map_entry( event_fds, &key, efd );
+
+  return true;
+}
+
+
+bool
+delete_fd_event_callback( int fd ) {
+  debug( "Deleting an event callback ( fd = %d ).", fd );
+
+  if ( event_fds == NULL ) {
+    error( "Messenger is not initialized yet." );
+    return false;
+  }
+
+  uint32_t key = ( uint32_t ) fd;
+  event_fd *efd = delete_uint32_hash_map_entry( event_fds, &key );
+  if ( efd == NULL ) {
+    error( "No event callback for fd ( %d ) found.", fd );
+    return false;
+  }
+
+  if ( epoll_ctl( epoll_fd, EPOLL_CTL_DEL, fd, NULL ) == -1 ) {
+    error( "Failed to delete fd ( %d ) from epoll set ( errno = %s [%d] ).", fd, strerror( errno ), errno );
+  }
+
+  // Forget events not yet dispatched in this round since efd is freed here.
+  int i;
+  for ( i = ready_event_index; i < ready_event_count; i++ ) {
+    if ( ready_events[ i ].data.ptr == efd ) {
+      ready_events[ i ].data.ptr = NULL;
+    }
+  }
+  xfree( efd );
+
+  return true;
+}
+
+
+static bool
+set_event_interest( int fd, uint32_t event, bool state ) {
+  if ( event_fds == NULL ) {
+    error( "Messenger is not initialized yet." );
+    return false;
   }
+
+  uint32_t key = ( uint32_t ) fd;
+  event_fd *efd = lookup_uint32_hash_map_entry( event_fds, &key );
+  if ( efd == NULL ) {
+    error( "No event callback for fd ( %d ) found.", fd );
+    return false;
+  }
+
+  return update_event_fd( efd, state ? ( efd->events | event ) : ( efd->events & ~event ) );
+}
+
+
+bool
+set_readable_interest( int fd, bool state ) {
+  debug( "Setting readable interest ( fd = %d, state = %d ).", fd, state );
+
+  return set_event_interest( fd, EPOLLIN, state );
+}
+
+
+bool
+set_writable_interest( int fd, bool state ) {
+  debug( "Setting writable interest ( fd = %d, state = %d ).", fd, state );
+
+  return set_event_interest( fd, EPOLLOUT, state );
 }
 
 
 static void
-age_context_db( void *user_data ) {
+_delete_event_fd( const uint32_t *fd, void *value, void *user_data ) {
   UNUSED( user_data );
+  event_fd *efd = value;
+
+  debug( "Deleting an event callback ( fd = %d ).", *fd );
+
+  xfree( efd );
+}
+
+
+static void
+delete_event_fds( void ) {
+  debug( "Deleting event fds ( event_fds = %p, epoll_fd = %d ).", event_fds, epoll_fd );
+
+  if ( event_fds != NULL ) {
+    foreach_uint32_hash_map( event_fds, _delete_event_fd, NULL );
+    delete_uint32_hash_map( event_fds );
+    event_fds = NULL;
+  }
+  if ( epoll_fd != -1 ) {
+    close( epoll_fd );
+    epoll_fd = -1;
+  }
+  if ( wakeup_fd != -1 ) {
+    close( wakeup_fd );
+    wakeup_fd = -1;
+  }
+  ready_event_count = 0;
+  ready_event_index = 0;
+  timer_fd_watched = false;
+}
+
+
+static void
+on_wakeup( int fd, void *data ) {
+  UNUSED( data );
 
-  debug( "Aging context database ( context_db = %p ).", context_db );
+  uint64_t count;
+  if ( read( fd, &count, sizeof( count ) ) < 0 && errno != EAGAIN ) {
+    error( "Failed to read a wakeup event ( fd = %d, errno = %s [%d] ).", fd, strerror( errno ), errno );
+  }
+}
 
-  foreach_hash( context_db, _age_context, NULL );
+
+/*
+ * Makes a blocking epoll_wait() return. Async-signal-safe, so signal
+ * handlers may stop the event loop or set an external callback without
+ * waiting for another event.
+ */
+static void
+wake_up_messenger( void ) {
+  if ( wakeup_fd == -1 ) {
+    return;
+  }
+  uint64_t count = 1;
+  ssize_t ret = write( wakeup_fd, &count, sizeof( count ) );
+  UNUSED( ret );
 }
 
 
@@ -272,9 +621,30 @@ init_messenger( const char *working_directory ) {
   strcpy( socket_directory, working_directory );
   debug( "Initializing messenger (working_directory = %s).", socket_directory );
 
+  epoll_fd = epoll_create1( EPOLL_CLOEXEC );
+  if ( epoll_fd == -1 ) {
+    error( "Failed to create an epoll instance ( errno = %s [%d] ).", strerror( errno ), errno );
+    return false;
+  }
+  event_fds = create_uint32_hash_map( 0 );
+  send_queue_reconnect_pending = false;
+
+  wakeup_fd = eventfd( 0, EFD_NONBLOCK | EFD_CLOEXEC );
+  if ( wakeup_fd == -1 || !add_fd_event_callback( wakeup_fd, on_wakeup, NULL, NULL ) ) {
+    error( "Failed to create a wakeup event ( errno = %s [%d] ).", strerror( errno ), errno );
+    if ( wakeup_fd != -1 ) {
+      close( wakeup_fd );
+      wakeup_fd = -1;
+    }
+  }
+
+  // Same-host peers exchange messages through shared memory unless
+  // MESSENGER_TRANSPORT=socket is given.
+  const char *transport = getenv( "MESSENGER_TRANSPORT" );
+  shared_memory_transport = ( transport == NULL || strcmp( transport, "socket" ) != 0 );
+
   receive_queues = create_hash( compare_string, hash_string );
   send_queues = create_hash( compare_string, hash_string );
-  context_db = create_hash( compare_uint32, hash_uint32 );
 
   initialized = true;
   finalized = false;
@@ -283,15 +653,33 @@ init_messenger( const char *working_directory ) {
 }
 
 
+static void
+create_context_db( void ) {
+  assert( contexts == NULL );
+
+  contexts = xcalloc( MESSENGER_CONTEXTS, sizeof( messenger_context ) );
+  for ( uint32_t i = 0; i < MESSENGER_CONTEXTS - 1; i++ ) {
+    contexts[ i ].next_free = &contexts[ i + 1 ];
+  }
+  free_contexts = &contexts[ 0 ];
+}
+
+
 static void
 delete_context_db( void ) {
-  debug( "Deleting context database ( context_db = %p ).", context_db );
+  debug( "Deleting context database ( contexts = %p ).", contexts );
 
-  if ( context_db != NULL ) {
-    foreach_hash( context_db, _delete_context, NULL );
-    delete_hash( context_db );
-    context_db = NULL;
+  if ( contexts == NULL ) {
+    return;
+  }
+  for ( uint32_t i = 0; i < MESSENGER_CONTEXTS; i++ ) {
+    if ( contexts[ i ].transaction_id != 0 ) {
+      delete_context( &contexts[ i ] );
+    }
   }
+  xfree( contexts );
+  contexts = NULL;
+  free_contexts = NULL;
 }
 
 
@@ -310,14 +698,49 @@ get_message_buffer_head( message_buffer *buf ) {
 }
 
 
+static void
+release_send_queue_ring( send_queue *sq ) {
+  assert( sq != NULL );
+
+  if ( sq->ring == NULL ) {
+    return;
+  }
+
+  debug( "Releasing a send queue ring ( service_name = %s, memfd = %d ).", sq->service_name, sq->ring->memfd );
+
+  delete_fd_event_callback( sq->ring->space_eventfd );
+  delete_shm_ring( sq->ring );
+  sq->ring = NULL;
+}
+
+
+static void
+release_client_socket_ring( messenger_socket *socket ) {
+  assert( socket != NULL );
+
+  if ( socket->ring == NULL ) {
+    return;
+  }
+
+  debug( "Releasing a client socket ring ( fd = %d, memfd = %d ).", socket->fd, socket->ring->memfd );
+
+  delete_fd_event_callback( socket->ring->data_eventfd );
+  delete_shm_ring( socket->ring );
+  socket->ring = NULL;
+}
+
+
 static void
 delete_send_queue( send_queue *sq ) {
   assert( NULL != sq );
 
   debug( "Deleting a send queue ( service_name = %s, fd = %d ).", sq->service_name, sq->server_socket );
 
+  release_shared_payloads( sq, sq->buffer->data_length );
   free_message_buffer( sq->buffer );
+  release_send_queue_ring( sq );
   if ( sq->server_socket != -1 ) {
+    delete_fd_event_callback( sq->server_socket );
     close( sq->server_socket );
   }
   if ( send_queues != NULL ) {
@@ -351,6 +774,106 @@ delete_all_send_queues() {
 }
 
 
+static char *
+trace_ring( void ) {
+  return ( char * ) ( trace + 1 );
+}
+
+
+static void
+copy_to_trace_ring( char **p, const void *data, size_t len ) {
+  memcpy( *p, data, len );
+  *p += len;
+}
+
+
+/**
+ * appends a record to the trace ring. The message is given in two pieces
+ * ( e.g. a message header and its payload ) and cut at snapshot_length
+ * bytes. Only the messenger thread writes, so no lock is taken; readers
+ * rely on oldest_offset being moved before old records are overwritten
+ * and write_offset being moved after a new record is complete.
+ */
+static void
+write_trace_record( uint16_t dump_type, const char *service_name,
+                    const void *data1, size_t len1, const void *data2, size_t len2 ) {
+  assert( trace != NULL );
+
+  struct timespec now;
+  clock_gettime( CLOCK_REALTIME, &now );
+
+  size_t original_length = len1 + len2;
+  size_t snapshot_length = original_length < trace->snapshot_length ? original_length : trace->snapshot_length;
+  size_t app_name_len = strlen( _trace_app_name ) + 1;
+  size_t service_name_len = strlen( service_name ) + 1;
+  size_t length = sizeof( messenger_trace_record ) + sizeof( message_dump_header ) + app_name_len + service_name_len + snapshot_length;
+  length = ( length + 7 ) & ~( size_t ) 7;
+  uint32_t ring_size = trace->ring_size;
+  if ( length > ring_size ) {
+    debug( "Too long trace record ( length = %zu, ring_size = %u ).", length, ring_size );
+    return;
+  }
+
+  uint64_t end = trace->write_offset;
+  uint64_t start = end;
+  size_t remaining = ring_size - ( size_t ) ( end % ring_size );
+  if ( length > remaining ) {
+    start += remaining;
+  }
+
+  // Forget records that are about to be overwritten. The padding before a
+  // wrapped record is not written yet, so stop at the last record written.
+  uint64_t oldest = trace->oldest_offset;
+  while ( oldest + ring_size < start + length ) {
+    if ( oldest >= end ) {
+      oldest = start;
+      break;
+    }
+    size_t position = ( size_t ) ( oldest % ring_size );
+    if ( ring_size - position < sizeof( messenger_trace_record ) ) {
+      oldest += ring_size - position;
+    }
+    else {
+      oldest += ( ( messenger_trace_record * ) ( trace_ring() + position ) )->length;
+    }
+  }
+  trace->oldest_offset = oldest;
+  __sync_synchronize();
+
+  if ( start != end && remaining >= sizeof( messenger_trace_record ) ) {
+    messenger_trace_record *padding = ( messenger_trace_record * ) ( trace_ring() + ( end % ring_size ) );
+    memset( padding, 0, sizeof( messenger_trace_record ) );
+    padding->length = ( uint32_t ) remaining;
+    padding->dump_type = MESSENGER_TRACE_PADDING;
+  }
+
+  char *p = trace_ring() + ( start % ring_size );
+  messenger_trace_record record;
+  memset( &record, 0, sizeof( messenger_trace_record ) );
+  record.length = ( uint32_t ) length;
+  record.dump_type = dump_type;
+  record.original_length = ( uint32_t ) original_length;
+  copy_to_trace_ring( &p, &record, sizeof( messenger_trace_record ) );
+
+  message_dump_header dump_hdr;
+  dump_hdr.sent_time.sec = htonl( ( uint32_t ) now.tv_sec );
+  dump_hdr.sent_time.nsec = htonl( ( uint32_t ) now.tv_nsec );
+  dump_hdr.app_name_length = htons( ( uint16_t ) app_name_len );
+  dump_hdr.service_name_length = htons( ( uint16_t ) service_name_len );
+  dump_hdr.data_length = htonl( ( uint32_t ) snapshot_length );
+  copy_to_trace_ring( &p, &dump_hdr, sizeof( message_dump_header ) );
+  copy_to_trace_ring( &p, _trace_app_name, app_name_len );
+  copy_to_trace_ring( &p, service_name, service_name_len );
+
+  size_t len = len1 < snapshot_length ? len1 : snapshot_length;
+  copy_to_trace_ring( &p, data1, len );
+  copy_to_trace_ring( &p, data2, snapshot_length - len );
+
+  __sync_synchronize();
+  trace->write_offset = start + length;
+}
+
+
 static void
 send_dump_message( uint16_t dump_type, const char *service_name, const void *data, uint32_t data_len ) {
   assert( service_name != NULL );
@@ -363,12 +886,15 @@ send_dump_message( uint16_t dump_type, const char *service_name, const void *dat
   message_dump_header *dump_hdr;
   size_t dump_buf_len;
 
-  if ( _dump_service_name == NULL ) {
-    debug( "Dump service name is not set." );
+  if ( _dump_service_name != NULL && strcmp( service_name, _dump_service_name ) == 0 ) {
+    debug( "Source service name and destination service name are the same ( service name = %s ).", service_name );
     return;
   }
-  if ( strcmp( service_name, _dump_service_name ) == 0 ) {
-    debug( "Source service name and destination service name are the same ( service name = %s ).", service_name );
+  if ( trace != NULL ) {
+    write_trace_record( dump_type, service_name, data, data_len, NULL, 0 );
+  }
+  if ( _dump_service_name == NULL ) {
+    debug( "Dump service name is not set." );
     return;
   }
 
@@ -436,14 +962,18 @@ delete_receive_queue( void *service_name, void *_rq, void *user_data ) {
 
     debug( "Closing a client socket ( fd = %d ).", client_socket->fd );
 
+    release_client_socket_ring( client_socket );
+    delete_fd_event_callback( client_socket->fd );
     close( client_socket->fd );
     xfree( client_socket );
     send_dump_message( MESSENGER_DUMP_RECV_CLOSED, rq->service_name, NULL, 0 );
   }
   delete_dlist( rq->client_sockets );
 
+  delete_fd_event_callback( rq->listen_socket );
   close( rq->listen_socket );
-  free_message_buffer( rq->buffer );
+  xfree( rq->batch->slots );
+  xfree( rq->batch );
   unlink( rq->listen_addr.sun_path );
 
   if ( receive_queues != NULL ) {
@@ -487,18 +1017,18 @@ finalize_messenger() {
   if ( messenger_dump_enabled() ) {
     stop_messenger_dump();
   }
+  if ( messenger_trace_enabled() ) {
+    stop_messenger_trace();
+  }
   if ( receive_queues != NULL ) {
     delete_all_receive_queues();
   }
   if ( send_queues != NULL ) {
     delete_all_send_queues();
   }
-  if ( context_db != NULL ) {
-    delete_context_db();
-  }
+  delete_context_db();
 
-  set_fd_set_callback( NULL );
-  set_check_fd_isset_callback( NULL );
+  delete_event_fds();
 
   running = false;
   initialized = false;
@@ -581,9 +1111,17 @@ create_receive_queue( const char *service_name ) {
     return NULL;
   }
 
+  if ( !add_fd_event_callback( rq->listen_socket, on_accept, NULL, rq ) ) {
+    close( rq->listen_socket );
+    xfree( rq );
+    return NULL;
+  }
+
   rq->message_callbacks = create_dlist();
   rq->client_sockets = create_dlist();
-  rq->buffer = create_message_buffer( messenger_recv_queue_length );
+  rq->batch = xcalloc( 1, sizeof( receive_batch ) );
+  rq->batch->slots = xmalloc( MESSENGER_RECV_BATCH * MESSENGER_RECV_BUFFER );
+  rq->dropped_stat_id = -1;
 
   insert_hash_entry( receive_queues, rq->service_name, rq );
 
@@ -774,6 +1312,64 @@ message_buffer_remain_bytes( message_buffer *buf ) {
 }
 
 
+/**
+ * creates a shared-memory ring for a connected send queue and passes its
+ * fds to the receiver over the socket. From then on messages are carried
+ * by the ring and the socket only tells us when the receiver goes away.
+ * If anything fails, the send queue keeps using the socket.
+ */
+static void
+setup_send_queue_ring( send_queue *sq ) {
+  assert( sq != NULL );
+  assert( sq->server_socket != -1 );
+  assert( sq->ring == NULL );
+
+  shm_ring *ring = create_shm_ring( MESSENGER_RING_SIZE );
+  if ( ring == NULL ) {
+    warn( "Failed to create a ring. Falling back to socket ( service_name = %s ).", sq->service_name );
+    return;
+  }
+  if ( !add_fd_event_callback( ring->space_eventfd, on_send_queue_ring_space, NULL, sq ) ) {
+    delete_shm_ring( ring );
+    return;
+  }
+
+  message_header header;
+  memset( &header, 0, sizeof( message_header ) );
+  header.message_type = MESSAGE_TYPE_RING_SETUP;
+  header.message_length = sizeof( message_header );
+
+  int fds[ MESSENGER_RING_FDS ] = { ring->memfd, ring->data_eventfd, ring->space_eventfd };
+  char control[ CMSG_SPACE( sizeof( fds ) ) ];
+  memset( control, 0, sizeof( control ) );
+  struct iovec iov = { &header, sizeof( message_header ) };
+  struct msghdr msg;
+  memset( &msg, 0, sizeof( struct msghdr ) );
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control;
+  msg.msg_controllen = sizeof( control );
+
+  struct cmsghdr *cmsg = CMSG_FIRSTHDR( &msg );
+  cmsg->cmsg_level = SOL_SOCKET;
+  cmsg->cmsg_type = SCM_RIGHTS;
+  cmsg->cmsg_len = CMSG_LEN( sizeof( fds ) );
+  memcpy( CMSG_DATA( cmsg ), fds, sizeof( fds ) );
+
+  if ( sendmsg( sq->server_socket, &msg, MSG_DONTWAIT ) != ( ssize_t ) sizeof( message_header ) ) {
+    warn( "Failed to pass a ring. Falling back to socket ( service_name = %s, fd = %d, errno = %s [%d] ).",
+          sq->service_name, sq->server_socket, strerror( errno ), errno );
+    delete_fd_event_callback( ring->space_eventfd );
+    delete_shm_ring( ring );
+    return;
+  }
+
+  debug( "A ring is set up ( service_name = %s, memfd = %d ).", sq->service_name, ring->memfd );
+
+  sq->ring = ring;
+}
+
+
 /**
  * connects send_queue to the service
  * return value: -1:error, 0:refused (retry), 1:connected
@@ -815,6 +1411,7 @@ send_queue_connect( send_queue *sq ) {
     close( sq->server_socket );
     sq->server_socket = -1;
     sq->refused_count++;
+    send_queue_reconnect_pending = true;
     sq->reconnect_at.tv_sec = now.tv_sec + ( 1 << ( sq->refused_count > 4 ? 4 : sq->refused_count - 1 ) );
 
     debug( "refused_count = %d, reconnect_at = %u.", sq->refused_count, sq->reconnect_at.tv_sec );
@@ -825,12 +1422,25 @@ send_queue_connect( send_queue *sq ) {
   debug( "Connection established ( service_name = %s, sun_path = %s, fd = %d ).",
          sq->service_name, sq->server_addr.sun_path, sq->server_socket );
 
+  if ( !add_fd_event_callback( sq->server_socket, on_send_queue_readable, on_send, sq ) ) {
+    close( sq->server_socket );
+    sq->server_socket = -1;
+    return -1;
+  }
+  if ( shared_memory_transport ) {
+    setup_send_queue_ring( sq );
+  }
+
   sq->refused_count = 0;
   sq->reconnect_at.tv_sec = 0;
   sq->reconnect_at.tv_nsec = 0;
 
   send_dump_message( MESSENGER_DUMP_SEND_CONNECTED, sq->service_name, NULL, 0 );
 
+  if ( sq->buffer->data_length > 0 ) {
+    kick_send_queue( sq );
+  }
+
   return 1;
 }
 
@@ -868,14 +1478,24 @@ create_send_queue( const char *service_name ) {
   sq->refused_count = 0;
   sq->reconnect_at.tv_sec = 0;
   sq->reconnect_at.tv_nsec = 0;
+  sq->buffer = create_message_buffer( messenger_send_queue_length );
+  sq->max_length = messenger_send_queue_max_length;
+  sq->high_watermark = 0;
+  sq->low_watermark = 0;
+  sq->watermark_callback = NULL;
+  sq->watermark_user_data = NULL;
+  sq->above_high_watermark = false;
+  sq->ring = NULL;
+  sq->shared_length = 0;
+  sq->dropped_stat_id = -1;
 
   if ( send_queue_connect( sq ) == -1 ) {
+    free_message_buffer( sq->buffer );
     xfree( sq );
     error( "Failed to create a send queue for %s.", service_name );
     return NULL;
   }
 
-  sq->buffer = create_message_buffer( messenger_send_queue_length );
 
   insert_hash_entry( send_queues, sq->service_name, sq );
 
@@ -905,45 +1525,242 @@ write_message_buffer( message_buffer *buf, const void *data, size_t len ) {
 }
 
 
-static bool
-push_message_to_send_queue( const char *service_name, const uint8_t message_type, const uint16_t tag, const void *data, size_t len ) {
-  assert( service_name != NULL );
+static void
+count_dropped_messages( int *stat_id, const char *direction, const char *service_name, unsigned int count ) {
+  if ( *stat_id < 0 ) {
+    char key[ STAT_KEY_LENGTH ];
+    snprintf( key, sizeof( key ), "messenger.%s_dropped.%s", direction, service_name );
+    *stat_id = register_stat_counter( key );
+  }
+  add_stat_id( *stat_id, count );
+}
 
-  debug( "Pushing a message to send queue ( service_name = %s, message_type = %#x, tag = %#x, data = %p, len = %u ).",
-         service_name, message_type, tag, data, len );
 
-  message_header header;
+static void
+grow_message_buffer( message_buffer *buf, size_t size ) {
+  assert( buf != NULL );
+  assert( size > buf->size );
 
-  if ( send_queues == NULL ) {
-    error( "All send queues are already deleted or not created yet." );
-    return false;
-  }
+  void *new_buffer = xmalloc( size );
+  memcpy( new_buffer, get_message_buffer_head( buf ), buf->data_length );
+  xfree( buf->buffer );
+  buf->buffer = new_buffer;
+  buf->size = size;
+  buf->head_offset = 0;
+}
 
-  send_queue *sq = lookup_hash_entry( send_queues, service_name );
 
-  if ( NULL == sq ) {
-    sq = create_send_queue( service_name );
+/**
+ * makes room for len bytes in a send queue, growing its buffer up to
+ * max_length if needed.
+ */
+static bool
+reserve_send_queue( send_queue *sq, size_t len ) {
+  assert( sq != NULL );
+
+  message_buffer *buf = sq->buffer;
+  if ( message_buffer_remain_bytes( buf ) >= len ) {
+    return true;
+  }
+
+  size_t required = buf->data_length + len;
+  if ( required + sq->shared_length > sq->max_length ) {
+    return false;
+  }
+  size_t size = buf->size;
+  while ( size < required ) {
+    size *= 2;
+  }
+  if ( size > sq->max_length ) {
+    size = sq->max_length;
+  }
+
+  debug( "Growing a send queue ( service_name = %s, size = %u -> %u ).", sq->service_name, buf->size, size );
+
+  grow_message_buffer( buf, size );
+
+  return true;
+}
+
+
+static void
+check_high_watermark( send_queue *sq ) {
+  assert( sq != NULL );
+
+  size_t length = sq->buffer->data_length + sq->shared_length;
+  if ( sq->watermark_callback == NULL || sq->above_high_watermark || length < sq->high_watermark ) {
+    return;
+  }
+
+  debug( "Send queue is above high watermark ( service_name = %s, length = %u, high_watermark = %u ).",
+         sq->service_name, length, sq->high_watermark );
+
+  sq->above_high_watermark = true;
+  sq->watermark_callback( sq->service_name, MESSENGER_SEND_QUEUE_HIGH_WATERMARK, sq->watermark_user_data );
+}
+
+
+static void
+check_low_watermark( send_queue *sq ) {
+  assert( sq != NULL );
+
+  size_t length = sq->buffer->data_length + sq->shared_length;
+  if ( sq->watermark_callback == NULL || !sq->above_high_watermark || length > sq->low_watermark ) {
+    return;
+  }
+
+  debug( "Send queue is below low watermark ( service_name = %s, length = %u, low_watermark = %u ).",
+         sq->service_name, length, sq->low_watermark );
+
+  sq->above_high_watermark = false;
+  sq->watermark_callback( sq->service_name, MESSENGER_SEND_QUEUE_LOW_WATERMARK, sq->watermark_user_data );
+}
+
+
+static send_queue *
+get_send_queue( const char *service_name ) {
+  assert( service_name != NULL );
+
+  if ( send_queues == NULL ) {
+    error( "All send queues are already deleted or not created yet." );
+    return NULL;
+  }
+
+  send_queue *sq = lookup_hash_entry( send_queues, service_name );
+  if ( NULL == sq ) {
+    sq = create_send_queue( service_name );
     assert( sq != NULL );
   }
 
+  return sq;
+}
+
+
+static void
+write_message_to_send_queue( send_queue *sq, const uint8_t message_type, const uint16_t tag, const void *data, size_t len ) {
+  assert( sq != NULL );
+
+  message_header header;
   header.version = 0;
   header.message_type = message_type;
   header.tag = tag;
   header.message_length = ( uint32_t ) ( sizeof( message_header ) + len );
 
-  if ( message_buffer_remain_bytes( sq->buffer ) < header.message_length ) {
-    warn( "Could not write a message to send queue due to overflow ( service_name = %s ).", sq->service_name );
+  write_message_buffer( sq->buffer, &header, sizeof( message_header ) );
+  write_message_buffer( sq->buffer, data, len );
+}
+
+
+/**
+ * gets newly queued messages going.
+ */
+static void
+kick_send_queue( send_queue *sq ) {
+  assert( sq != NULL );
+
+  if ( sq->ring != NULL ) {
+    flush_send_queue_to_ring( sq );
+  }
+  else if ( sq->server_socket != -1 ) {
+    set_writable_interest( sq->server_socket, true );
+  }
+}
+
+
+/**
+ * writes a message straight into the ring of a send queue if nothing is
+ * queued ahead of it. Dumping needs the message in one piece, hence the
+ * buffer.
+ */
+static bool
+write_message_to_ring( send_queue *sq, const message_header *header, const void *data, size_t len ) {
+  if ( sq->ring == NULL || sq->buffer->data_length > 0 || messenger_dump_enabled() ) {
+    return false;
+  }
+  if ( sizeof( message_header ) + len > shm_ring_max_length( sq->ring ) ) {
+    return false;
+  }
+  if ( !write_shm_ring( sq->ring, header, sizeof( message_header ), data, len ) ) {
+    return false;
+  }
+  if ( trace != NULL ) {
+    write_trace_record( MESSENGER_DUMP_SENT, sq->service_name, header, sizeof( message_header ), data, len );
+  }
+
+  return true;
+}
+
+
+static bool
+push_message( send_queue *sq, const uint8_t message_type, const uint16_t tag, const void *data, size_t len ) {
+  assert( sq != NULL );
+
+  debug( "Pushing a message to send queue ( service_name = %s, message_type = %#x, tag = %#x, data = %p, len = %u ).",
+         sq->service_name, message_type, tag, data, len );
+
+  message_header header;
+  header.version = 0;
+  header.message_type = message_type;
+  header.tag = tag;
+  header.message_length = ( uint32_t ) ( sizeof( message_header ) + len );
+  if ( write_message_to_ring( sq, &header, data, len ) ) {
+    return true;
+  }
+
+  if ( !reserve_send_queue( sq, sizeof( message_header ) + len ) ) {
+    LOG_RATE_LIMITED( warn, "Could not write a message to send queue due to overflow ( service_name = %s ).", sq->service_name );
     send_dump_message( MESSENGER_DUMP_SEND_OVERFLOW, sq->service_name, NULL, 0 );
+    count_dropped_messages( &sq->dropped_stat_id, "send", sq->service_name, 1 );
     return false;
   }
 
-  write_message_buffer( sq->buffer, &header, sizeof( message_header ) );
-  write_message_buffer( sq->buffer, data, len );
+  bool was_empty = ( sq->buffer->data_length == 0 );
+  write_message_to_send_queue( sq, message_type, tag, data, len );
+  if ( was_empty ) {
+    kick_send_queue( sq );
+  }
+  check_high_watermark( sq );
 
   return true;
 }
 
 
+static bool
+push_message_to_send_queue( const char *service_name, const uint8_t message_type, const uint16_t tag, const void *data, size_t len ) {
+  assert( service_name != NULL );
+
+  send_queue *sq = get_send_queue( service_name );
+  if ( sq == NULL ) {
+    return false;
+  }
+
+  return push_message( sq, message_type, tag, data, len );
+}
+
+
+/**
+ * opens a channel to a service. Sending on a channel saves looking up
+ * the service by name for each message. A channel stays valid until
+ * finalize_messenger() is called.
+ */
+messenger_channel *
+open_channel( const char *service_name ) {
+  assert( service_name != NULL );
+
+  debug( "Opening a channel ( service_name = %s ).", service_name );
+
+  return get_send_queue( service_name );
+}
+
+
+bool
+send_channel_message( messenger_channel *channel, const uint16_t tag, const void *data, size_t len ) {
+  assert( channel != NULL );
+
+  return push_message( channel, MESSAGE_TYPE_NOTIFY, tag, data, len );
+}
+
+
 bool
 send_message( const char *service_name, const uint16_t tag, const void *data, size_t len ) {
   assert( service_name != NULL );
@@ -955,18 +1772,257 @@ send_message( const char *service_name, const uint16_t tag, const void *data, si
 }
 
 
+/**
+ * queues count messages for a service in one go. Either all of them are
+ * queued or, if the send queue cannot hold them all, none is.
+ */
+bool
+send_messages( const char *service_name, const message_vector *messages, size_t count ) {
+  assert( service_name != NULL );
+  assert( messages != NULL || count == 0 );
+
+  debug( "Sending messages ( service_name = %s, messages = %p, count = %u ).", service_name, messages, count );
+
+  send_queue *sq = get_send_queue( service_name );
+  if ( sq == NULL ) {
+    return false;
+  }
+
+  size_t total_length = 0;
+  size_t i;
+  for ( i = 0; i < count; i++ ) {
+    total_length += sizeof( message_header ) + messages[ i ].len;
+  }
+  if ( !reserve_send_queue( sq, total_length ) ) {
+    LOG_RATE_LIMITED( warn, "Could not write messages to send queue due to overflow ( service_name = %s, count = %u ).", sq->service_name, count );
+    send_dump_message( MESSENGER_DUMP_SEND_OVERFLOW, sq->service_name, NULL, 0 );
+    count_dropped_messages( &sq->dropped_stat_id, "send", sq->service_name, ( unsigned int ) count );
+    return false;
+  }
+
+  bool was_empty = ( sq->buffer->data_length == 0 );
+  for ( i = 0; i < count; i++ ) {
+    write_message_to_send_queue( sq, MESSAGE_TYPE_NOTIFY, messages[ i ].tag, messages[ i ].data, messages[ i ].len );
+  }
+  if ( was_empty && count > 0 ) {
+    kick_send_queue( sq );
+  }
+  check_high_watermark( sq );
+
+  return true;
+}
+
+
+static shared_payload *
+create_shared_payload( const void *data, size_t len ) {
+  shared_payload *payload = xmalloc( sizeof( shared_payload ) + len );
+  payload->refcount = 1;
+  payload->length = len;
+  memcpy( payload->data, data, len );
+
+  return payload;
+}
+
+
+static void
+release_shared_payload( shared_payload *payload ) {
+  assert( payload != NULL );
+  assert( payload->refcount > 0 );
+
+  if ( --payload->refcount == 0 ) {
+    xfree( payload );
+  }
+}
+
+
+/**
+ * releases the shared payloads referred to from the first len bytes of
+ * a send queue, which are about to be dropped or have been sent.
+ */
+static void
+release_shared_payloads( send_queue *sq, size_t len ) {
+  assert( sq != NULL );
+
+  size_t offset = 0;
+  while ( len - offset >= sizeof( message_header ) ) {
+    message_header *header = ( message_header * ) ( ( char * ) get_message_buffer_head( sq->buffer ) + offset );
+    if ( header->version == MESSAGE_VERSION_SHARED ) {
+      shared_message_entry entry;
+      memcpy( &entry, header, sizeof( shared_message_entry ) );
+      sq->shared_length -= entry.payload->length;
+      release_shared_payload( entry.payload );
+    }
+    offset += header->message_length;
+  }
+}
+
+
+static bool
+push_shared_message( send_queue *sq, const message_header *header, shared_payload *payload ) {
+  assert( sq != NULL );
+  assert( header != NULL );
+  assert( payload != NULL );
+
+  size_t length = sq->buffer->data_length + sq->shared_length + sizeof( shared_message_entry ) + payload->length;
+  if ( length > sq->max_length || !reserve_send_queue( sq, sizeof( shared_message_entry ) ) ) {
+    LOG_RATE_LIMITED( warn, "Could not write a message to send queue due to overflow ( service_name = %s ).", sq->service_name );
+    send_dump_message( MESSENGER_DUMP_SEND_OVERFLOW, sq->service_name, NULL, 0 );
+    count_dropped_messages( &sq->dropped_stat_id, "send", sq->service_name, 1 );
+    return false;
+  }
+
+  shared_message_entry entry;
+  memset( &entry, 0, sizeof( shared_message_entry ) );
+  entry.entry.version = MESSAGE_VERSION_SHARED;
+  entry.entry.message_type = header->message_type;
+  entry.entry.tag = header->tag;
+  entry.entry.message_length = sizeof( shared_message_entry );
+  entry.header = *header;
+  entry.payload = payload;
+  payload->refcount++;
+
+  bool was_empty = ( sq->buffer->data_length == 0 );
+  write_message_buffer( sq->buffer, &entry, sizeof( shared_message_entry ) );
+  sq->shared_length += payload->length;
+  if ( was_empty ) {
+    kick_send_queue( sq );
+  }
+  check_high_watermark( sq );
+
+  return true;
+}
+
+
+/**
+ * sends a message to every service in service_names. Send queues that
+ * cannot pass the message on right away share a single copy of it
+ * until it is sent. Returns false if the message could not be queued
+ * for some of the services.
+ */
+bool
+multicast_message( list_element *service_names, const uint16_t tag, const void *data, size_t len ) {
+  debug( "Multicasting a message ( service_names = %p, tag = %#x, data = %p, len = %u ).", service_names, tag, data, len );
+
+  message_header header;
+  header.version = 0;
+  header.message_type = MESSAGE_TYPE_NOTIFY;
+  header.tag = tag;
+  header.message_length = ( uint32_t ) ( sizeof( message_header ) + len );
+
+  shared_payload *payload = NULL;
+  bool ret = true;
+  for ( list_element *element = service_names; element != NULL; element = element->next ) {
+    send_queue *sq = get_send_queue( element->data );
+    if ( sq == NULL ) {
+      ret = false;
+      continue;
+    }
+    if ( write_message_to_ring( sq, &header, data, len ) ) {
+      continue;
+    }
+    if ( payload == NULL ) {
+      payload = create_shared_payload( data, len );
+    }
+    if ( !push_shared_message( sq, &header, payload ) ) {
+      ret = false;
+    }
+  }
+  if ( payload != NULL ) {
+    release_shared_payload( payload );
+  }
+
+  return ret;
+}
+
+
+/**
+ * lets the send queue for a service grow up to max_length bytes before
+ * messages are dropped.
+ */
+bool
+set_send_queue_max_length( const char *service_name, size_t max_length ) {
+  assert( service_name != NULL );
+
+  debug( "Setting max length of a send queue ( service_name = %s, max_length = %u ).", service_name, max_length );
+
+  send_queue *sq = get_send_queue( service_name );
+  if ( sq == NULL ) {
+    return false;
+  }
+  if ( max_length < sq->buffer->size ) {
+    error( "Max length must not be smaller than current size ( service_name = %s, max_length = %u, size = %u ).",
+           service_name, max_length, sq->buffer->size );
+    return false;
+  }
+  sq->max_length = max_length;
+
+  return true;
+}
+
+
+/**
+ * sets a callback that is called with MESSENGER_SEND_QUEUE_HIGH_WATERMARK
+ * when the send queue for a service has reached high bytes, and with
+ * MESSENGER_SEND_QUEUE_LOW_WATERMARK when it has drained to low bytes
+ * afterwards. Producers are expected to hold off in between. Passing
+ * NULL as callback removes it.
+ */
+bool
+set_send_queue_watermarks( const char *service_name, size_t high, size_t low, send_queue_watermark_callback callback, void *user_data ) {
+  assert( service_name != NULL );
+
+  debug( "Setting watermarks of a send queue ( service_name = %s, high = %u, low = %u, callback = %p, user_data = %p ).",
+         service_name, high, low, callback, user_data );
+
+  if ( callback != NULL && low >= high ) {
+    error( "Low watermark must be smaller than high watermark ( high = %u, low = %u ).", high, low );
+    return false;
+  }
+
+  send_queue *sq = get_send_queue( service_name );
+  if ( sq == NULL ) {
+    return false;
+  }
+  sq->high_watermark = high;
+  sq->low_watermark = low;
+  sq->watermark_callback = callback;
+  sq->watermark_user_data = user_data;
+  sq->above_high_watermark = false;
+
+  return true;
+}
+
+
 static messenger_context *
-insert_context( void *user_data ) {
-  messenger_context *context = xmalloc( sizeof( messenger_context ) );
+insert_context( void *user_data, const struct timespec *timeout, request_timeout_callback timeout_callback ) {
+  assert( timeout != NULL );
+
+  if ( contexts == NULL ) {
+    create_context_db();
+  }
+  messenger_context *context = free_contexts;
+  if ( context == NULL ) {
+    error( "Too many outstanding requests ( max = %u ).", MESSENGER_CONTEXTS );
+    return NULL;
+  }
+  free_contexts = context->next_free;
 
-  context->transaction_id = ++last_transaction_id;
-  context->life_count = 10;
+  context_generation = ( context_generation + 1 ) & ( UINT32_MAX >> MESSENGER_CONTEXT_INDEX_BITS );
+  if ( context_generation == 0 ) {
+    context_generation = 1;
+  }
+  context->transaction_id = ( context_generation << MESSENGER_CONTEXT_INDEX_BITS ) | ( uint32_t ) ( context - contexts );
   context->user_data = user_data;
+  context->timeout_callback = timeout_callback;
+  context->next_free = NULL;
 
-  debug( "Inserting a new context ( transaction_id = %#x, life_count = %d, user_data = %p ).",
-         context->transaction_id, context->life_count, context->user_data );
+  struct itimerspec interval;
+  memset( &interval, 0, sizeof( interval ) );
+  interval.it_value = *timeout;
+  context->timeout = add_timer_event( &interval, on_request_timeout, ( void * ) ( uintptr_t ) context->transaction_id );
 
-  insert_hash_entry( context_db, &context->transaction_id, context );
+  debug( "Inserting a new context ( transaction_id = %#x, user_data = %p, timeout = %u.%09u ).",
+         context->transaction_id, context->user_data, ( unsigned int ) timeout->tv_sec, ( unsigned int ) timeout->tv_nsec );
 
   return context;
 }
@@ -974,8 +2030,19 @@ insert_context( void *user_data ) {
 
 bool
 send_request_message( const char *to_service_name, const char *from_service_name, const uint16_t tag, const void *data, size_t len, void *user_data ) {
+  struct timespec timeout = { MESSENGER_REQUEST_TIMEOUT_SEC, 0 };
+
+  return send_request_message_with_timeout( to_service_name, from_service_name, tag, data, len, user_data, &timeout, NULL );
+}
+
+
+bool
+send_request_message_with_timeout( const char *to_service_name, const char *from_service_name, const uint16_t tag,
+                                   const void *data, size_t len, void *user_data,
+                                   const struct timespec *timeout, request_timeout_callback timeout_callback ) {
   assert( to_service_name != NULL );
   assert( from_service_name != NULL );
+  assert( timeout != NULL );
 
   debug( "Sending a request message ( to_service_name = %s, from_service_name = %s, tag = %#x, data = %p, len = %u, user_data = %p ).",
          to_service_name, from_service_name, tag, data, len, user_data );
@@ -987,7 +2054,10 @@ send_request_message( const char *to_service_name, const char *from_service_name
   messenger_context_handle *handle;
   bool return_value;
 
-  context = insert_context( user_data );
+  context = insert_context( user_data, timeout, timeout_callback );
+  if ( context == NULL ) {
+    return false;
+  }
 
   request_data = xmalloc( handle_len + len );
   handle = ( messenger_context_handle * ) request_data;
@@ -998,6 +2068,9 @@ send_request_message( const char *to_service_name, const char *from_service_name
   memcpy( p, data, len );
 
   return_value = push_message_to_send_queue( to_service_name, MESSAGE_TYPE_REQUEST, tag, request_data, handle_len + len );
+  if ( !return_value ) {
+    delete_context( context );
+  }
 
   xfree( request_data );
 
@@ -1079,40 +2152,6 @@ number_of_send_queue( int *connected_count, int *sending_count, int *reconnectin
 }
 
 
-static void
-set_recv_queue_fd_set( fd_set *read_set ) {
-  assert( read_set != NULL );
-
-  debug( "Setting fds to a fd_set ( read_set = %p ).", read_set );
-
-  hash_iterator iter;
-  hash_entry *e;
-
-  assert( receive_queues != NULL );
-
-  init_hash_iterator( receive_queues, &iter );
-  while ( ( e = iterate_hash_next( &iter ) ) != NULL ) {
-    receive_queue *rq = e->value;
-    dlist_element *element;
-    /*
-     * A hacky workaround to avoid the bug of glibc (#431)
-     * See also: http://www.linuxquestions.org/questions/programming-9/impossible-to-use-gcc-with-wconversion-and-standard-socket-macros-841935/
-     */
-    debug( "Setting a fd ( %d ) to fd_set ( read_set = %p ).", rq->listen_socket, read_set );
-#define sizeof( X ) ( ( int ) sizeof( X ) )
-    FD_SET( rq->listen_socket, read_set );
-#undef sizeof
-    for ( element = rq->client_sockets->next; element; element = element->next ) {
-      messenger_socket *socket_item = element->data;
-      debug( "Setting a fd ( %d ) to fd_set ( read_set = %p ).", socket_item->fd, read_set );
-#define sizeof( X ) ( ( int ) sizeof( X ) )
-      FD_SET( socket_item->fd, read_set );
-#undef sizeof
-    }
-  }
-}
-
-
 static void
 add_recv_queue_client_fd( receive_queue *rq, int fd ) {
   assert( rq != NULL );
@@ -1120,18 +2159,27 @@ add_recv_queue_client_fd( receive_queue *rq, int fd ) {
 
   debug( "Adding a client fd to receive queue ( fd = %d, service_name = %s ).", fd, rq->service_name );
 
-  messenger_socket *socket;
-
-  socket = xmalloc( sizeof( messenger_socket ) );
+  messenger_socket *socket = xmalloc( sizeof( messenger_socket ) );
   socket->fd = fd;
+  socket->queue = rq;
+  socket->ring = NULL;
+  socket->dispatching = false;
+
+  if ( !add_fd_event_callback( fd, on_recv, NULL, socket ) ) {
+    xfree( socket );
+    close( fd );
+    return;
+  }
+
   insert_after_dlist( rq->client_sockets, socket );
 }
 
 
 static void
-on_accept( int fd, receive_queue *rq ) {
-  assert( rq != NULL );
+on_accept( int fd, void *data ) {
+  assert( data != NULL );
 
+  receive_queue *rq = data;
   int client_fd;
   struct sockaddr_un addr;
 
@@ -1161,6 +2209,8 @@ del_recv_queue_client_fd( receive_queue *rq, int fd ) {
     socket = element->data;
     if ( socket->fd == fd ) {
       debug( "Deleting fd ( %d ).", fd );
+      release_client_socket_ring( socket );
+      delete_fd_event_callback( fd );
       delete_dlist_element( element );
       xfree( socket );
       return 1;
@@ -1171,6 +2221,22 @@ del_recv_queue_client_fd( receive_queue *rq, int fd ) {
 }
 
 
+static unsigned int
+count_queued_messages( message_buffer *buf ) {
+  assert( buf != NULL );
+
+  unsigned int count = 0;
+  size_t offset = 0;
+  while ( buf->data_length - offset >= sizeof( message_header ) ) {
+    message_header *header = ( message_header * ) ( ( char * ) get_message_buffer_head( buf ) + offset );
+    offset += header->message_length;
+    count++;
+  }
+
+  return count;
+}
+
+
 static void
 truncate_message_buffer( message_buffer *buf, size_t len ) {
   assert( buf != NULL );
@@ -1194,58 +2260,6 @@ truncate_message_buffer( message_buffer *buf, size_t len ) {
 }
 
 
-/**
- * pulls message data from recv_queue.
- * returns 1 if succeeded, otherwise 0.
- */
-static int
-pull_from_recv_queue( receive_queue *rq, uint8_t *message_type, uint16_t *tag, void *data, size_t *len, size_t maxlen ) {
-  assert( rq != NULL );
-  assert( message_type != NULL );
-  assert( tag != NULL );
-  assert( data != NULL );
-  assert( len != NULL );
-
-  debug( "Pulling a message from receive queue ( service_name = %s ).", rq->service_name );
-
-  message_header *header;
-
-  if ( rq->buffer->data_length < sizeof( message_header ) ) {
-    debug( "Queue length is smaller than a message header ( queue length = %u ).", rq->buffer->data_length );
-    return 0;
-  }
-
-  header = ( message_header * ) get_message_buffer_head( rq->buffer );
-
-  assert( header->message_length != 0 );
-  assert( header->message_length < messenger_recv_queue_length );
-  if ( rq->buffer->data_length < header->message_length ) {
-    debug( "Queue length is smaller than message length ( queue length = %u, message length = %u ).",
-           rq->buffer->data_length, header->message_length );
-    return 0;
-  }
-
-  *message_type = header->message_type;
-  *tag = header->tag;
-  *len = header->message_length - sizeof( message_header );
-  memcpy( data, header->value, *len > maxlen ? maxlen : *len );
-  truncate_message_buffer( rq->buffer, header->message_length );
-
-  debug( "A message is retrieved from receive queue ( message_type = %#x, tag = %#x, len = %u, data = %p ).",
-         *message_type, *tag, *len, data );
-
-  return 1;
-}
-
-
-static messenger_context *
-get_context( uint32_t transaction_id ) {
-  debug( "Looking up a context ( transaction_id = %#x ).", transaction_id );
-
-  return lookup_hash_entry( context_db, &transaction_id );
-}
-
-
 static void
 call_message_callbacks( receive_queue *rq, const uint8_t message_type, const uint16_t tag, void *data, size_t len ) {
   assert( rq != NULL );
@@ -1324,204 +2338,652 @@ call_message_callbacks( receive_queue *rq, const uint8_t message_type, const uin
       assert( 0 );
     }
   }
-}
-
-
-static void
-on_recv( int fd, receive_queue *rq ) {
-  assert( rq != NULL );
-  assert( fd >= 0 );
-
-  debug( "Receiving data from remote ( fd = %d, service_name = %s ).", fd, rq->service_name );
+}
+
+
+/**
+ * delivers messages in the ring of a client socket to callbacks, up to
+ * budget messages. Callbacks are given a pointer into the ring, and a
+ * record is released only after they return. returns true if the ring
+ * is drained and we are going to be woken up by the sender.
+ */
+static bool
+pull_from_ring( messenger_socket *client_socket, int budget ) {
+  assert( client_socket != NULL );
+  assert( client_socket->ring != NULL );
+
+  receive_queue *rq = client_socket->queue;
+  shm_ring *ring = client_socket->ring;
+  message_header *header;
+  size_t length;
+  int count;
+
+  if ( client_socket->dispatching ) {
+    // A callback has re-entered the event loop. The record it is working
+    // on must not be delivered again, so the outer call keeps going.
+    return true;
+  }
+
+  for ( count = 0; count < budget; count++ ) {
+    header = peek_shm_ring( ring, &length );
+    if ( header == NULL ) {
+      if ( wait_shm_ring_data( ring ) ) {
+        continue;
+      }
+      return true;
+    }
+    if ( length < sizeof( message_header ) || header->message_length != length ) {
+      error( "Invalid message in ring ( service_name = %s, length = %u ).", rq->service_name, length );
+      count_dropped_messages( &rq->dropped_stat_id, "recv", rq->service_name, 1 );
+      consume_shm_ring( ring );
+      continue;
+    }
+
+    send_dump_message( MESSENGER_DUMP_RECEIVED, rq->service_name, header, ( uint32_t ) length );
+
+    client_socket->dispatching = true;
+    call_message_callbacks( rq, header->message_type, header->tag, header->value, length - sizeof( message_header ) );
+    client_socket->dispatching = false;
+    consume_shm_ring( ring );
+  }
+
+  return false;
+}
+
+
+static void
+on_ring_data( int fd, void *data ) {
+  assert( data != NULL );
+
+  messenger_socket *client_socket = data;
+
+  debug( "Receiving data from ring ( fd = %d, service_name = %s ).", fd, client_socket->queue->service_name );
+
+  clear_shm_ring_event( fd );
+  if ( !pull_from_ring( client_socket, MESSENGER_RECV_BUDGET ) ) {
+    // Lets other fds have their turn, and comes back in the next round.
+    notify_shm_ring_event( fd );
+  }
+}
+
+
+static void
+close_fds( int *fds, int fd_count ) {
+  int i;
+  for ( i = 0; i < fd_count; i++ ) {
+    close( fds[ i ] );
+  }
+}
+
+
+static void
+close_client_socket( receive_queue *rq, int fd ) {
+  assert( rq != NULL );
+
+  send_dump_message( MESSENGER_DUMP_RECV_CLOSED, rq->service_name, NULL, 0 );
+  del_recv_queue_client_fd( rq, fd );
+  close( fd );
+}
+
+
+/**
+ * attaches a ring passed by the sender. If it fails, the connection is
+ * closed so that the sender reconnects rather than writing to a ring
+ * nobody reads, and false is returned.
+ */
+static bool
+attach_client_socket_ring( messenger_socket *client_socket, int *fds, int fd_count ) {
+  assert( client_socket != NULL );
+
+  receive_queue *rq = client_socket->queue;
+  shm_ring *ring = NULL;
+
+  if ( fd_count == MESSENGER_RING_FDS && client_socket->ring == NULL ) {
+    ring = attach_shm_ring( fds[ 0 ], fds[ 1 ], fds[ 2 ] );
+  }
+  else {
+    error( "Unexpected ring setup message ( fd = %d, fd_count = %d ).", client_socket->fd, fd_count );
+    close_fds( fds, fd_count );
+  }
+  if ( ring != NULL && !add_fd_event_callback( ring->data_eventfd, on_ring_data, NULL, client_socket ) ) {
+    delete_shm_ring( ring );
+    ring = NULL;
+  }
+  if ( ring == NULL ) {
+    close_client_socket( rq, client_socket->fd );
+    return false;
+  }
+
+  debug( "A ring is attached ( fd = %d, service_name = %s, memfd = %d ).", client_socket->fd, rq->service_name, ring->memfd );
+
+  client_socket->ring = ring;
+
+  return true;
+}
+
+
+static int
+take_received_fds( struct msghdr *msg, int *fds ) {
+  assert( msg != NULL );
+  assert( fds != NULL );
+
+  struct cmsghdr *cmsg;
+  int fd_count = 0;
+
+  for ( cmsg = CMSG_FIRSTHDR( msg ); cmsg != NULL; cmsg = CMSG_NXTHDR( msg, cmsg ) ) {
+    if ( cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS ) {
+      continue;
+    }
+    size_t i;
+    for ( i = 0; i < ( cmsg->cmsg_len - CMSG_LEN( 0 ) ) / sizeof( int ); i++ ) {
+      int received;
+      memcpy( &received, CMSG_DATA( cmsg ) + i * sizeof( int ), sizeof( int ) );
+      if ( fd_count < MESSENGER_RING_FDS ) {
+        fds[ fd_count++ ] = received;
+      }
+      else {
+        close( received );
+      }
+    }
+  }
 
-  uint8_t buf[ MESSENGER_RECV_BUFFER ];
-  ssize_t recv_len;
-  size_t buf_len;
-  uint8_t message_type;
-  uint16_t tag;
+  return fd_count;
+}
 
-  recv_len = recv( fd, buf, sizeof( buf ), 0 );
-  if ( recv_len == -1 ) {
-    error( "Failed to recv ( fd = %d, errno = %s [%d] ).", fd, strerror( errno ), errno );
-  }
-  else if ( recv_len == 0 ) {
-    debug( "Connection closed ( fd = %d, service_name = %s ).", fd, rq->service_name );
-    send_dump_message( MESSENGER_DUMP_RECV_CLOSED, rq->service_name, NULL, 0 );
-    del_recv_queue_client_fd( rq, fd );
-    close( fd );
-  }
-  else {
-    if ( !write_message_buffer( rq->buffer, buf, ( size_t ) recv_len ) ) {
-      warn( "Could not write a message to receive queue due to overflow ( service_name = %s ).", rq->service_name );
-      send_dump_message( MESSENGER_DUMP_RECV_OVERFLOW, rq->service_name, buf, ( uint32_t ) recv_len );
-      // FIXME: remove fragmented message from buffer and notify it
-    }
 
-    send_dump_message( MESSENGER_DUMP_RECEIVED, rq->service_name, buf, ( uint32_t ) recv_len );
-    while ( pull_from_recv_queue( rq, &message_type, &tag, buf, &buf_len, sizeof( buf ) ) == 1 ) {
-      call_message_callbacks( rq, message_type, tag, buf, buf_len );
+/**
+ * handles a datagram received from a client socket. Each datagram
+ * carries exactly one message. returns false if the connection has been
+ * closed.
+ */
+static bool
+handle_received_message( messenger_socket *client_socket, struct msghdr *msg, size_t length ) {
+  assert( client_socket != NULL );
+  assert( msg != NULL );
+
+  receive_queue *rq = client_socket->queue;
+  message_header *header = msg->msg_iov->iov_base;
+  int fds[ MESSENGER_RING_FDS ];
+  int fd_count = take_received_fds( msg, fds );
+
+  if ( length == 0 ) {
+    debug( "Connection closed ( fd = %d, service_name = %s ).", client_socket->fd, rq->service_name );
+    close_fds( fds, fd_count );
+    if ( client_socket->ring != NULL ) {
+      // Messages written before the sender went away are still there.
+      pull_from_ring( client_socket, INT_MAX );
     }
+    close_client_socket( rq, client_socket->fd );
+    return false;
   }
-}
 
+  if ( ( msg->msg_flags & MSG_TRUNC ) != 0 || length < sizeof( message_header ) || header->message_length != length ) {
+    LOG_RATE_LIMITED( warn, "Could not receive a message due to overflow ( service_name = %s, length = %u ).", rq->service_name, length );
+    send_dump_message( MESSENGER_DUMP_RECV_OVERFLOW, rq->service_name, header, ( uint32_t ) length );
+    count_dropped_messages( &rq->dropped_stat_id, "recv", rq->service_name, 1 );
+    close_fds( fds, fd_count );
+    return true;
+  }
 
-static void
-check_recv_queue_fd_isset( fd_set *read_set ) {
-  assert( read_set != NULL );
+  if ( header->message_type == MESSAGE_TYPE_RING_SETUP ) {
+    return attach_client_socket_ring( client_socket, fds, fd_count );
+  }
+  close_fds( fds, fd_count );
 
-  hash_iterator iter;
-  hash_entry *e;
+  send_dump_message( MESSENGER_DUMP_RECEIVED, rq->service_name, header, ( uint32_t ) length );
+  call_message_callbacks( rq, header->message_type, header->tag, header->value, length - sizeof( message_header ) );
 
-  debug( "Checking a fd_set for receiving data from remotes ( read_set = %p ).", read_set );
+  return true;
+}
 
-  assert( receive_queues != NULL );
 
-  init_hash_iterator( receive_queues, &iter );
-  while ( ( e = iterate_hash_next( &iter ) ) != NULL ) {
-    receive_queue *rq = e->value;
-    if ( FD_ISSET( rq->listen_socket, read_set ) ) {
-      on_accept( rq->listen_socket, rq );
-    }
-    dlist_element *element = rq->client_sockets->next, *next_element;
-    while ( element != NULL ) {
-      next_element = element->next;
-      messenger_socket *socket_item = element->data;
-      if ( FD_ISSET( socket_item->fd, read_set ) ) {
-        on_recv( socket_item->fd, rq );
-      }
-      element = next_element;
+/**
+ * dispatches the datagrams left in the batch. returns false if the
+ * connection they came from has been closed.
+ */
+static bool
+dispatch_receive_batch( receive_batch *batch ) {
+  while ( batch->next < batch->count ) {
+    struct mmsghdr *message = &batch->messages[ batch->next++ ];
+    if ( !handle_received_message( batch->socket, &message->msg_hdr, message->msg_len ) ) {
+      batch->count = batch->next = 0;
+      return false;
     }
   }
+
+  return true;
 }
 
 
+/**
+ * receives datagrams in batches straight into the slots of the receive
+ * queue, and hands them to callbacks where they are. At most
+ * MESSENGER_RECV_BUDGET messages are taken per call so that a busy peer
+ * does not starve the others; the event loop calls us again while data
+ * is left.
+ */
 static void
-set_send_queue_fd_set( fd_set *read_set, fd_set *write_set ) {
-  hash_iterator iter;
-  hash_entry *e;
-
-  debug( "Setting fds to fd_sets ( read_set = %p, write_set = %p ).", read_set, write_set );
+on_recv( int fd, void *data ) {
+  assert( data != NULL );
+  assert( fd >= 0 );
 
-  assert( send_queues != NULL );
+  messenger_socket *client_socket = data;
+  receive_queue *rq = client_socket->queue;
+  receive_batch *batch = rq->batch;
+  debug( "Receiving data from remote ( fd = %d, service_name = %s ).", fd, rq->service_name );
 
-  init_hash_iterator( send_queues, &iter );
-  while ( ( e = iterate_hash_next( &iter ) ) != NULL ) {
-    send_queue *sq = e->value;
-    int ret_val = 1;
-    struct timespec now;
+  // An outer call may have been interrupted by a callback that re-entered
+  // the event loop. Its messages come first.
+  if ( !dispatch_receive_batch( batch ) ) {
+    return;
+  }
 
-    assert( clock_gettime( CLOCK_MONOTONIC, &now ) == 0 );
+  int received_total = 0;
+  int received, i;
 
-    if ( ( sq->refused_count > 0 ) && ( sq->reconnect_at.tv_sec > now.tv_sec ) ) {
-      continue;
+  while ( received_total < MESSENGER_RECV_BUDGET ) {
+    memset( batch->messages, 0, sizeof( batch->messages ) );
+    for ( i = 0; i < MESSENGER_RECV_BATCH; i++ ) {
+      batch->iovs[ i ].iov_base = batch->slots + i * MESSENGER_RECV_BUFFER;
+      batch->iovs[ i ].iov_len = MESSENGER_RECV_BUFFER;
+      batch->messages[ i ].msg_hdr.msg_iov = &batch->iovs[ i ];
+      batch->messages[ i ].msg_hdr.msg_iovlen = 1;
+      batch->messages[ i ].msg_hdr.msg_control = batch->controls[ i ];
+      batch->messages[ i ].msg_hdr.msg_controllen = sizeof( batch->controls[ i ] );
     }
 
-    if ( sq->server_socket == -1 ) {
-      ret_val = send_queue_connect( sq );
+    received = recvmmsg( fd, batch->messages, MESSENGER_RECV_BATCH, MSG_DONTWAIT | MSG_CMSG_CLOEXEC, NULL );
+    if ( received == -1 ) {
+      if ( errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR ) {
+        error( "Failed to recv ( fd = %d, errno = %s [%d] ).", fd, strerror( errno ), errno );
+      }
+      return;
     }
-    switch ( ret_val == 1 ) {
-    case 0: // refused
-      break;
 
-    case 1: // connected
-      if ( sq->buffer->data_length > 0 ) {
-        debug( "Adding a fd ( %d ) to fd_sets.", sq->server_socket );
-#define sizeof( X ) ( ( int ) sizeof( X ) )
-        FD_SET( sq->server_socket, read_set );
-        FD_SET( sq->server_socket, write_set );
-#undef sizeof
-      }
-      break;
+    debug( "%d messages received ( fd = %d, service_name = %s ).", received, fd, rq->service_name );
 
-    case -1: // error
+    batch->socket = client_socket;
+    batch->count = received;
+    batch->next = 0;
+    unsigned int generation = ++batch->generation;
+    if ( !dispatch_receive_batch( batch ) ) {
+      return;
+    }
+    if ( batch->generation != generation ) {
+      // A nested call has received more, and may have closed this
+      // socket. The event loop calls us again if data is left.
+      return;
+    }
+    if ( received < MESSENGER_RECV_BATCH ) {
       return;
     }
+    received_total += received;
   }
 }
 
 
 static void
-on_send( int fd, send_queue *sq ) {
+close_send_queue_socket( send_queue *sq ) {
   assert( sq != NULL );
+  assert( sq->server_socket != -1 );
+
+  debug( "Closing a send queue socket ( service_name = %s, fd = %d ).", sq->service_name, sq->server_socket );
+
+  send_dump_message( MESSENGER_DUMP_SEND_CLOSED, sq->service_name, NULL, 0 );
+  release_send_queue_ring( sq );
+  delete_fd_event_callback( sq->server_socket );
+  close( sq->server_socket );
+  sq->server_socket = -1;
+  send_queue_reconnect_pending = true;
+}
+
+
+/**
+ * dumps a message that has been sent. A message with a shared payload
+ * is put in one piece only if someone is watching.
+ */
+static void
+dump_sent_message( send_queue *sq, const message_header *header, const shared_payload *payload ) {
+  if ( payload == NULL ) {
+    send_dump_message( MESSENGER_DUMP_SENT, sq->service_name, header, header->message_length );
+    return;
+  }
+  if ( !messenger_dump_enabled() && trace == NULL ) {
+    return;
+  }
+
+  char *message = xmalloc( header->message_length );
+  memcpy( message, header, sizeof( message_header ) );
+  memcpy( message + sizeof( message_header ), payload->data, payload->length );
+  send_dump_message( MESSENGER_DUMP_SENT, sq->service_name, message, header->message_length );
+  xfree( message );
+}
+
+
+static void
+on_send( int fd, void *data ) {
+  assert( data != NULL );
   assert( fd >= 0 );
 
+  send_queue *sq = data;
+
   debug( "Sending data to remote ( fd = %d, service_name = %s, buffer = %p, data_length = %u ).",
          fd, sq->service_name, get_message_buffer_head( sq->buffer ), sq->buffer->data_length );
 
   if ( sq->buffer->data_length < sizeof( message_header ) ) {
+    set_writable_interest( fd, false );
     return;
   }
 
+  struct mmsghdr messages[ MESSENGER_SEND_BATCH ];
+  struct iovec iovs[ MESSENGER_SEND_BATCH ][ 2 ];
+  shared_message_entry shared[ MESSENGER_SEND_BATCH ];
+  size_t entry_lengths[ MESSENGER_SEND_BATCH ];
   message_header *header;
-  size_t send_len;
-  ssize_t sent_len;
+  size_t offset;
   size_t sent_total = 0;
   int sent_count = 0;
+  int count, sent, i;
+
+  while ( ( ( sq->buffer->data_length - sent_total ) >= sizeof( message_header ) ) && ( sent_count < MESSENGER_SEND_BUDGET ) ) {
+    memset( messages, 0, sizeof( messages ) );
+    offset = sent_total;
+    for ( count = 0; count < MESSENGER_SEND_BATCH && ( sq->buffer->data_length - offset ) >= sizeof( message_header ); count++ ) {
+      header = ( message_header * ) ( ( char * ) get_message_buffer_head( sq->buffer ) + offset );
+      entry_lengths[ count ] = header->message_length;
+      messages[ count ].msg_hdr.msg_iov = iovs[ count ];
+      if ( header->version == MESSAGE_VERSION_SHARED ) {
+        memcpy( &shared[ count ], header, sizeof( shared_message_entry ) );
+        iovs[ count ][ 0 ].iov_base = &shared[ count ].header;
+        iovs[ count ][ 0 ].iov_len = sizeof( message_header );
+        iovs[ count ][ 1 ].iov_base = shared[ count ].payload->data;
+        iovs[ count ][ 1 ].iov_len = shared[ count ].payload->length;
+        messages[ count ].msg_hdr.msg_iovlen = 2;
+      }
+      else {
+        shared[ count ].payload = NULL;
+        iovs[ count ][ 0 ].iov_base = header;
+        iovs[ count ][ 0 ].iov_len = header->message_length;
+        messages[ count ].msg_hdr.msg_iovlen = 1;
+      }
+      offset += header->message_length;
+    }
 
-  while ( ( ( sq->buffer->data_length - sent_total ) >= sizeof( message_header ) ) && ( sent_count < 128 ) ) {
-    header = ( message_header * ) ( ( char * ) get_message_buffer_head( sq->buffer ) + sent_total );
-    send_len = ( size_t ) header->message_length;
-    sent_len = send( fd, header, send_len, MSG_DONTWAIT );
-    if ( sent_len == -1 ) {
+    sent = sendmmsg( fd, messages, ( unsigned int ) count, MSG_DONTWAIT );
+    if ( sent == -1 ) {
       int err = errno;
       if ( err != EAGAIN && err != EWOULDBLOCK ) {
         error( "Failed to send ( fd = %d, errno = %s [%d] ).", fd, strerror( err ), err );
-        send_dump_message( MESSENGER_DUMP_SEND_CLOSED, sq->service_name, NULL, 0 );
-        close( sq->server_socket );
-        sq->server_socket = -1;
+        close_send_queue_socket( sq );
         sq->refused_count = 0;
       }
       truncate_message_buffer( sq->buffer, sent_total );
       if ( err == EMSGSIZE || err == ENOBUFS || err == ENOMEM ) {
-        warn( "Dropping %u bytes data in send queue ( service_name = %s ).", sq->buffer->data_length, sq->service_name );
+        warn( "Dropping %u bytes data in send queue ( service_name = %s ).", sq->buffer->data_length + sq->shared_length, sq->service_name );
+        count_dropped_messages( &sq->dropped_stat_id, "send", sq->service_name, count_queued_messages( sq->buffer ) );
+        release_shared_payloads( sq, sq->buffer->data_length );
         truncate_message_buffer( sq->buffer, sq->buffer->data_length );
       }
+      check_low_watermark( sq );
       return;
     }
-    send_dump_message( MESSENGER_DUMP_SENT, sq->service_name, header, ( uint32_t ) sent_len );
-    sent_total += ( size_t ) sent_len;
-    sent_count++;
+    for ( i = 0; i < sent; i++ ) {
+      if ( shared[ i ].payload != NULL ) {
+        dump_sent_message( sq, &shared[ i ].header, shared[ i ].payload );
+        sq->shared_length -= shared[ i ].payload->length;
+        release_shared_payload( shared[ i ].payload );
+      }
+      else {
+        dump_sent_message( sq, iovs[ i ][ 0 ].iov_base, NULL );
+      }
+      sent_total += entry_lengths[ i ];
+    }
+    sent_count += sent;
+    if ( sent < count ) {
+      // The socket is full. We will be called again when it drains.
+      break;
+    }
+  }
+  truncate_message_buffer( sq->buffer, sent_total );
+  check_low_watermark( sq );
+
+  if ( sq->buffer->data_length == 0 ) {
+    set_writable_interest( fd, false );
+  }
+}
+
+
+/**
+ * moves messages buffered in a send queue into its ring. What does not
+ * fit is moved when the receiver has made room. A message that can never
+ * fit is dropped.
+ */
+static void
+flush_send_queue_to_ring( send_queue *sq ) {
+  assert( sq != NULL );
+  assert( sq->ring != NULL );
+
+  message_header *header;
+  size_t sent_total = 0;
+
+  while ( ( sq->buffer->data_length - sent_total ) >= sizeof( message_header ) ) {
+    header = ( message_header * ) ( ( char * ) get_message_buffer_head( sq->buffer ) + sent_total );
+    shared_message_entry entry;
+    const message_header *message = header;
+    const void *payload = NULL;
+    size_t payload_length = 0;
+    if ( header->version == MESSAGE_VERSION_SHARED ) {
+      memcpy( &entry, header, sizeof( shared_message_entry ) );
+      message = &entry.header;
+      payload = entry.payload->data;
+      payload_length = entry.payload->length;
+    }
+    if ( message->message_length > shm_ring_max_length( sq->ring ) ) {
+      LOG_RATE_LIMITED( warn, "Dropping a message too large for a ring ( service_name = %s, length = %u ).",
+                        sq->service_name, message->message_length );
+      send_dump_message( MESSENGER_DUMP_SEND_OVERFLOW, sq->service_name, NULL, 0 );
+      count_dropped_messages( &sq->dropped_stat_id, "send", sq->service_name, 1 );
+      if ( payload != NULL ) {
+        sq->shared_length -= payload_length;
+        release_shared_payload( entry.payload );
+      }
+      sent_total += header->message_length;
+      continue;
+    }
+    size_t length = message->message_length - payload_length;
+    if ( !write_shm_ring( sq->ring, message, length, payload, payload_length ) ) {
+      if ( wait_shm_ring_space( sq->ring, message->message_length ) ) {
+        continue;
+      }
+      break;
+    }
+    if ( payload != NULL ) {
+      dump_sent_message( sq, message, entry.payload );
+      sq->shared_length -= payload_length;
+      release_shared_payload( entry.payload );
+    }
+    else {
+      dump_sent_message( sq, message, NULL );
+    }
+    sent_total += header->message_length;
   }
   truncate_message_buffer( sq->buffer, sent_total );
+  check_low_watermark( sq );
 }
 
 
 static void
-check_send_queue_fd_isset( fd_set *read_set, fd_set *write_set ) {
-  hash_iterator iter;
-  hash_entry *e;
+on_send_queue_ring_space( int fd, void *data ) {
+  assert( data != NULL );
+
+  send_queue *sq = data;
+
+  debug( "Ring space is available ( fd = %d, service_name = %s, data_length = %u ).",
+         fd, sq->service_name, sq->buffer->data_length );
+
+  clear_shm_ring_event( fd );
+  flush_send_queue_to_ring( sq );
+}
 
-  debug( "Checking fd_sets for sending/receiving data to/from remotes ( read_set = %p, write_set = %p ).", read_set, write_set );
 
+/**
+ * a send queue socket never receives data, so it becomes readable only
+ * when the remote side has closed the connection.
+ */
+static void
+on_send_queue_readable( int fd, void *data ) {
+  assert( data != NULL );
+
+  send_queue *sq = data;
+  char buf[ 256 ];
+
+  ssize_t recv_len = recv( fd, buf, sizeof( buf ), MSG_DONTWAIT );
+  if ( recv_len > 0 || ( recv_len == -1 && ( errno == EAGAIN || errno == EWOULDBLOCK ) ) ) {
+    return;
+  }
+  close_send_queue_socket( sq );
+}
+
+
+/**
+ * reconnects send queues that lost their servers.
+ * return value: true if a send queue is waiting to reconnect, and sets
+ * the earliest time to retry to reconnect_at.
+ */
+static bool
+reconnect_send_queues( struct timespec *reconnect_at ) {
+  assert( reconnect_at != NULL );
   assert( send_queues != NULL );
 
+  debug( "Reconnecting send queues." );
+
+  hash_iterator iter;
+  hash_entry *e;
+  struct timespec now;
+  bool waiting = false;
+
+  if ( clock_gettime( CLOCK_MONOTONIC, &now ) != 0 ) {
+    error( "Failed to retrieve monotonic time ( %s [%d] ).", strerror( errno ), errno );
+    return false;
+  }
+
+  send_queue_reconnect_pending = false;
   init_hash_iterator( send_queues, &iter );
   while ( ( e = iterate_hash_next( &iter ) ) != NULL ) {
     send_queue *sq = e->value;
-    if ( sq->server_socket == -1 ) {
+    if ( sq->server_socket != -1 ) {
       continue;
     }
-    if ( FD_ISSET( sq->server_socket, read_set ) ) {
-      char buf[ 256 ];
-      if ( recv( sq->server_socket, buf, sizeof( buf ), 0 ) <= 0 ) {
-        send_dump_message( MESSENGER_DUMP_SEND_CLOSED, sq->service_name, NULL, 0 );
-        close( sq->server_socket );
-        sq->server_socket = -1;
+    if ( ( sq->refused_count == 0 ) || ( sq->reconnect_at.tv_sec <= now.tv_sec ) ) {
+      if ( send_queue_connect( sq ) == 1 ) {
         continue;
       }
+      send_queue_reconnect_pending = true;
+    }
+    else {
+      send_queue_reconnect_pending = true;
+    }
+    if ( sq->refused_count > 0 && ( !waiting || sq->reconnect_at.tv_sec < reconnect_at->tv_sec ) ) {
+      reconnect_at->tv_sec = sq->reconnect_at.tv_sec;
+      reconnect_at->tv_nsec = 0;
+      waiting = true;
+    }
+  }
+
+  return waiting;
+}
+
+
+/**
+ * returns how long the event loop may sleep until deadline, in
+ * milliseconds as epoll_wait() takes it.
+ */
+static int
+get_wait_timeout( const struct timespec *deadline ) {
+  assert( deadline != NULL );
+
+  struct timespec now;
+  if ( clock_gettime( CLOCK_MONOTONIC, &now ) != 0 ) {
+    error( "Failed to retrieve monotonic time ( %s [%d] ).", strerror( errno ), errno );
+    return MESSENGER_CLOCK_RETRY_MSEC;
+  }
+
+  if ( ( deadline->tv_sec < now.tv_sec )
+    || ( ( deadline->tv_sec == now.tv_sec ) && ( deadline->tv_nsec <= now.tv_nsec ) ) ) {
+    return 0;
+  }
+  if ( deadline->tv_sec - now.tv_sec >= INT_MAX / 1000 ) {
+    return INT_MAX;
+  }
+
+  // rounds up so that we do not wake up just before the deadline.
+  long msec = ( deadline->tv_sec - now.tv_sec ) * 1000 + ( deadline->tv_nsec - now.tv_nsec + 999999 ) / 1000000;
+
+  return ( int ) msec;
+}
+
+
+static void
+dispatch_events( void ) {
+  for ( ready_event_index = 0; ready_event_index < ready_event_count; ready_event_index++ ) {
+    struct epoll_event *event = &ready_events[ ready_event_index ];
+    event_fd *efd = event->data.ptr;
+    if ( efd == NULL ) {
+      continue;
+    }
+    bool error_or_hangup = ( event->events & ( EPOLLERR | EPOLLHUP ) ) != 0;
+    if ( ( ( event->events & EPOLLIN ) || error_or_hangup ) && efd->read_callback != NULL ) {
+      efd->read_callback( efd->fd, efd->data );
+      error_or_hangup = false;
+    }
+    // the read callback might have deleted the event callback.
+    efd = event->data.ptr;
+    if ( efd == NULL ) {
+      continue;
     }
-    if ( FD_ISSET( sq->server_socket, write_set ) ) {
-      on_send( sq->server_socket, sq );
+    if ( ( ( event->events & EPOLLOUT ) || error_or_hangup ) && efd->write_callback != NULL ) {
+      efd->write_callback( efd->fd, efd->data );
     }
   }
+  ready_event_count = 0;
+  ready_event_index = 0;
+}
+
+
+static void
+on_timer_fd( int fd, void *data ) {
+  UNUSED( data );
+
+  // only clears the expiration, timers run at the top of run_once().
+  uint64_t expirations;
+  if ( read( fd, &expirations, sizeof( expirations ) ) < 0 && errno != EAGAIN ) {
+    error( "Failed to read a timerfd ( fd = %d, errno = %s [%d] ).", fd, strerror( errno ), errno );
+  }
+}
+
+
+/*
+ * Waits on the timerfd of timer.c, so that the event loop sleeps until
+ * the next timer or I/O event. Until it is available, the loop falls
+ * back to a wait timeout computed from next_timer_deadline().
+ */
+static void
+watch_timer_fd( void ) {
+  int fd = get_timer_fd();
+  if ( fd < 0 ) {
+    return;
+  }
+  timer_fd_watched = add_fd_event_callback( fd, on_timer_fd, NULL, NULL );
 }
 
 
 static bool
 run_once( void ) {
-  fd_set read_set, write_set;
-  struct timeval timeout;
-  int set_count;
+  struct timespec deadline, reconnect_at;
+  bool has_deadline;
+  int timeout;
+
+  report_rcu_quiescent_state();
 
   execute_timer_events();
 
@@ -1530,37 +2992,30 @@ run_once( void ) {
     external_callback = NULL;
   }
 
-  FD_ZERO( &read_set );
-  FD_ZERO( &write_set );
-  set_recv_queue_fd_set( &read_set );
-  set_send_queue_fd_set( &read_set, &write_set );
-  if ( external_fd_set ) {
-    external_fd_set( &read_set, &write_set );
+  if ( !timer_fd_watched ) {
+    watch_timer_fd();
   }
+  has_deadline = !timer_fd_watched && next_timer_deadline( &deadline );
+  if ( send_queue_reconnect_pending && reconnect_send_queues( &reconnect_at ) ) {
+    if ( !has_deadline || reconnect_at.tv_sec < deadline.tv_sec ) {
+      deadline = reconnect_at;
+      has_deadline = true;
+    }
+  }
+  timeout = has_deadline ? get_wait_timeout( &deadline ) : -1;
 
-  timeout.tv_sec = 0;
-  timeout.tv_usec = 100 * 1000;
-
-  set_count = select( FD_SETSIZE, &read_set, &write_set, NULL, &timeout );
-
-  if ( set_count == -1 ) {
+  ready_event_count = epoll_wait( epoll_fd, ready_events, MESSENGER_MAX_EVENTS, timeout );
+  if ( ready_event_count == -1 ) {
+    ready_event_count = 0;
     if ( errno == EINTR ) {
       return true;
     }
-    error( "Failed to select ( errno = %s [%d] ).", strerror( errno ), errno );
+    error( "Failed to wait for events ( errno = %s [%d] ).", strerror( errno ), errno );
     running = false;
     return false;
   }
-  else if ( set_count == 0 ) {
-    // timed out
-    return true;
-  }
 
-  check_recv_queue_fd_isset( &read_set );
-  check_send_queue_fd_isset( &read_set, &write_set );
-  if ( external_check_fd_isset ) {
-    external_check_fd_isset( &read_set, &write_set );
-  }
+  dispatch_events();
 
   return true;
 }
@@ -1586,16 +3041,19 @@ bool
 start_messenger() {
   debug( "Starting messenger." );
 
-  add_periodic_event_callback( 10, age_context_db, NULL );
+  register_rcu_reader();
 
   running = true;
   while ( running ) {
     if ( !run_once() ) {
       error( "Failed to run main loop." );
+      unregister_rcu_reader();
       return false;
     }
   }
 
+  unregister_rcu_reader();
+
   debug( "Messenger terminated." );
 
   return true;
@@ -1605,6 +3063,7 @@ start_messenger() {
 bool
 stop_messenger() {
   running = false;
+  wake_up_messenger();
 
   debug( "Terminating messenger." );
 
@@ -1660,19 +3119,159 @@ messenger_dump_enabled( void ) {
 }
 
 
-void
-set_fd_set_callback( void ( *callback )( fd_set *read_set, fd_set *write_set ) ) {
-  debug( "Setting an external FD_SET callback ( callback = %p ).", callback );
+bool
+start_messenger_trace( const char *path, const char *app_name, size_t ring_size, size_t snapshot_length ) {
+  assert( path != NULL );
+  assert( app_name != NULL );
+
+  debug( "Starting a message tracer ( path = %s, app_name = %s, ring_size = %zu, snapshot_length = %zu ).",
+         path, app_name, ring_size, snapshot_length );
+
+  if ( ring_size % 8 != 0 || ring_size < 1024 || ring_size > UINT32_MAX || snapshot_length > UINT32_MAX ) {
+    error( "Invalid trace ring size or snapshot length ( ring_size = %zu, snapshot_length = %zu ).", ring_size, snapshot_length );
+    return false;
+  }
+  size_t record_length = sizeof( messenger_trace_record ) + sizeof( message_dump_header ) + strlen( app_name ) + 1 + snapshot_length;
+  if ( record_length > ring_size / 2 ) {
+    error( "Too long snapshot length for a trace ring ( ring_size = %zu, snapshot_length = %zu ).", ring_size, snapshot_length );
+    return false;
+  }
+  if ( messenger_trace_enabled() ) {
+    stop_messenger_trace();
+  }
+
+  int fd = open( path, O_RDWR | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH );
+  if ( fd == -1 ) {
+    error( "Failed to open a trace file ( path = %s, errno = %s [%d] ).", path, strerror( errno ), errno );
+    return false;
+  }
+  size_t length = sizeof( messenger_trace_header ) + ring_size;
+  if ( ftruncate( fd, ( off_t ) length ) == -1 ) {
+    error( "Failed to resize a trace file ( path = %s, errno = %s [%d] ).", path, strerror( errno ), errno );
+    close( fd );
+    return false;
+  }
+  void *mapped = mmap( NULL, length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0 );
+  close( fd );
+  if ( mapped == MAP_FAILED ) {
+    error( "Failed to map a trace file ( path = %s, errno = %s [%d] ).", path, strerror( errno ), errno );
+    return false;
+  }
 
-  external_fd_set = callback;
+  trace = mapped;
+  trace->version = MESSENGER_TRACE_VERSION;
+  trace->ring_size = ( uint32_t ) ring_size;
+  trace->snapshot_length = ( uint32_t ) snapshot_length;
+  trace->oldest_offset = 0;
+  trace->write_offset = 0;
+  trace->pid = ( uint32_t ) getpid();
+  __sync_synchronize();
+  trace->magic = MESSENGER_TRACE_MAGIC;
+  _trace_app_name = xstrdup( app_name );
+
+  return true;
 }
 
 
 void
-set_check_fd_isset_callback( void ( *callback )( fd_set *read_set, fd_set *write_set ) ) {
-  debug( "Setting an external FD_ISSET callback ( callback = %p ).", callback );
+stop_messenger_trace( void ) {
+  assert( trace != NULL );
+  assert( _trace_app_name != NULL );
+
+  debug( "Terminating a message tracer ( app_name = %s ).", _trace_app_name );
+
+  munmap( trace, sizeof( messenger_trace_header ) + trace->ring_size );
+  trace = NULL;
+
+  xfree( _trace_app_name );
+  _trace_app_name = NULL;
+}
+
+
+bool
+messenger_trace_enabled( void ) {
+  return trace != NULL;
+}
+
+
+/**
+ * calls back with every record still held in a trace file, oldest
+ * first. The file may be written concurrently: the ring is copied
+ * between reading write_offset and oldest_offset, so every record in
+ * between was complete and not yet overwritten while it was copied.
+ */
+bool
+read_messenger_trace( const char *path, messenger_trace_callback callback, void *user_data ) {
+  assert( path != NULL );
+  assert( callback != NULL );
+
+  int fd = open( path, O_RDONLY );
+  if ( fd == -1 ) {
+    error( "Failed to open a trace file ( path = %s, errno = %s [%d] ).", path, strerror( errno ), errno );
+    return false;
+  }
+  struct stat st;
+  if ( fstat( fd, &st ) == -1 || ( size_t ) st.st_size < sizeof( messenger_trace_header ) ) {
+    error( "Invalid trace file ( path = %s ).", path );
+    close( fd );
+    return false;
+  }
+  size_t length = ( size_t ) st.st_size;
+  void *mapped = mmap( NULL, length, PROT_READ, MAP_SHARED, fd, 0 );
+  close( fd );
+  if ( mapped == MAP_FAILED ) {
+    error( "Failed to map a trace file ( path = %s, errno = %s [%d] ).", path, strerror( errno ), errno );
+    return false;
+  }
+
+  const messenger_trace_header *header = mapped;
+  if ( header->magic != MESSENGER_TRACE_MAGIC || header->version != MESSENGER_TRACE_VERSION
+       || sizeof( messenger_trace_header ) + header->ring_size != length ) {
+    error( "Invalid trace file ( path = %s ).", path );
+    munmap( mapped, length );
+    return false;
+  }
+
+  uint32_t ring_size = header->ring_size;
+  uint64_t end = header->write_offset;
+  __sync_synchronize();
+  char *ring = xmalloc( ring_size );
+  memcpy( ring, header + 1, ring_size );
+  __sync_synchronize();
+  uint64_t offset = header->oldest_offset;
+  munmap( mapped, length );
+
+  bool ret = true;
+  while ( offset < end ) {
+    size_t position = ( size_t ) ( offset % ring_size );
+    size_t remaining = ring_size - position;
+    if ( remaining < sizeof( messenger_trace_record ) ) {
+      offset += remaining;
+      continue;
+    }
+    messenger_trace_record *record = ( messenger_trace_record * ) ( ring + position );
+    if ( record->length < sizeof( messenger_trace_record ) || record->length > remaining || record->length % 8 != 0 ) {
+      error( "Corrupted trace record ( path = %s, offset = %" PRIu64 " ).", path, offset );
+      ret = false;
+      break;
+    }
+    if ( record->dump_type != MESSENGER_TRACE_PADDING ) {
+      message_dump_header *dump_hdr = ( message_dump_header * ) ( record + 1 );
+      size_t len = sizeof( message_dump_header ) + ntohs( dump_hdr->app_name_length )
+                   + ntohs( dump_hdr->service_name_length ) + ntohl( dump_hdr->data_length );
+      if ( sizeof( messenger_trace_record ) + len > record->length ) {
+        error( "Corrupted trace record ( path = %s, offset = %" PRIu64 " ).", path, offset );
+        ret = false;
+        break;
+      }
+      callback( record->dump_type, dump_hdr, len, record->original_length, user_data );
+    }
+    offset += record->length;
+  }
+
+  xfree( ring );
 
-  external_check_fd_isset = callback;
+  return ret;
 }
 
 
@@ -1683,6 +3282,7 @@ set_external_callback( void ( *callback ) ( void ) ) {
   }
 
   external_callback = callback;
+  wake_up_messenger();
 
   return true;
 }
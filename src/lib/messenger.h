@@ -29,6 +29,7 @@
 #include <time.h>
 #include "checks.h"
 #include "bool.h"
+#include "linked_list.h"
 
 
 #define MESSENGER_SERVICE_NAME_LENGTH 32
@@ -70,8 +71,70 @@ enum {
   MESSENGER_DUMP_SEND_CLOSED,
 };
 
+/* message trace file format:
+ * +----------------------+----------------------------------------+
+ * |messenger_trace_header|ring of records ( ring_size bytes )     |
+ * +----------------------+----------------------------------------+
+ *
+ * record format:
+ * +----------------------+-------------------+--------+------------+----+
+ * |messenger_trace_record|message_dump_header|app_name|service_name|data|
+ * +----------------------+-------------------+--------+------------+----+
+ *
+ * Everything after messenger_trace_record is laid out as a dump message
+ * ( in network byte order ) except that data is cut at snapshot_length
+ * bytes. Records are 8-byte aligned and never wrap; the space left at
+ * the end of the ring is skipped, and holds a MESSENGER_TRACE_PADDING
+ * record if it is large enough. Records from oldest_offset up to
+ * write_offset are valid. Both offsets count bytes ever written.
+ */
+
+#define MESSENGER_TRACE_MAGIC 0x43525454
+#define MESSENGER_TRACE_VERSION 1
+#define MESSENGER_TRACE_RING_SIZE ( 4 * 1024 * 1024 )
+#define MESSENGER_TRACE_SNAPSHOT_LENGTH 256
+#define MESSENGER_TRACE_PADDING 0xffff
+
+typedef struct messenger_trace_header {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t ring_size;
+  uint32_t snapshot_length;
+  volatile uint64_t oldest_offset;
+  volatile uint64_t write_offset;
+  uint32_t pid;
+  uint32_t pad;
+} messenger_trace_header;
+
+typedef struct messenger_trace_record {
+  uint32_t length;          // record length including this header
+  uint16_t dump_type;       // MESSENGER_DUMP_* or MESSENGER_TRACE_PADDING
+  uint16_t pad;
+  uint32_t original_length; // data length before the snapshot was cut
+  uint32_t pad2;
+} messenger_trace_record;
+
+enum {
+  MESSENGER_SEND_QUEUE_HIGH_WATERMARK,
+  MESSENGER_SEND_QUEUE_LOW_WATERMARK,
+};
+
+
+typedef struct send_queue messenger_channel;
+
+
+typedef struct message_vector {
+  uint16_t tag;
+  const void *data;
+  size_t len;
+} message_vector;
+
 
 typedef void ( *callback_message_received )( uint16_t tag, void *data, size_t len );
+typedef void ( *event_fd_callback )( int fd, void *data );
+typedef void ( *send_queue_watermark_callback )( const char *service_name, int watermark, void *user_data );
+typedef void ( *request_timeout_callback )( void *user_data );
+typedef void ( *messenger_trace_callback )( uint16_t dump_type, void *data, size_t len, uint32_t original_length, void *user_data );
 
 
 bool init_messenger( const char *working_directory );
@@ -87,7 +150,14 @@ bool delete_timer_event_callback( void ( *callback )( void *user_data ) );
 bool delete_periodic_event_callback( void ( *callback )( void *user_data ) );
 bool rename_message_received_callback( const char *old_service_name, const char *new_service_name );
 bool send_message( const char *service_name, const uint16_t tag, const void *data, size_t len );
+bool send_messages( const char *service_name, const message_vector *messages, size_t count );
+bool multicast_message( list_element *service_names, const uint16_t tag, const void *data, size_t len );
+messenger_channel *open_channel( const char *service_name );
+bool send_channel_message( messenger_channel *channel, const uint16_t tag, const void *data, size_t len );
+bool set_send_queue_max_length( const char *service_name, size_t max_length );
+bool set_send_queue_watermarks( const char *service_name, size_t high, size_t low, send_queue_watermark_callback callback, void *user_data );
 bool send_request_message( const char *to_service_name, const char *from_service_name, const uint16_t tag, const void *data, size_t len, void *user_data );
+bool send_request_message_with_timeout( const char *to_service_name, const char *from_service_name, const uint16_t tag, const void *data, size_t len, void *user_data, const struct timespec *timeout, request_timeout_callback timeout_callback );
 bool send_reply_message( const messenger_context_handle *handle, const uint16_t tag, const void *data, size_t len );
 int flush_messenger( void );
 bool start_messenger( void );
@@ -96,8 +166,14 @@ bool finalize_messenger( void );
 void start_messenger_dump( const char *dump_app_name, const char *dump_service_name );
 void stop_messenger_dump( void );
 bool messenger_dump_enabled( void );
-void set_fd_set_callback( void ( *callback )( fd_set *read_set, fd_set *write_set ) );
-void set_check_fd_isset_callback( void ( *callback )( fd_set *read_set, fd_set *write_set ) );
+bool start_messenger_trace( const char *path, const char *app_name, size_t ring_size, size_t snapshot_length );
+void stop_messenger_trace( void );
+bool messenger_trace_enabled( void );
+bool read_messenger_trace( const char *path, messenger_trace_callback callback, void *user_data );
+bool add_fd_event_callback( int fd, event_fd_callback read_callback, event_fd_callback write_callback, void *data );
+bool delete_fd_event_callback( int fd );
+bool set_readable_interest( int fd, bool state );
+bool set_writable_interest( int fd, bool state );
 bool set_external_callback( void ( *callback ) ( void ) );
 
 
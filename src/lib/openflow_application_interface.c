@@ -19,11 +19,16 @@
 
 
 #include <assert.h>
+#include <errno.h>
 #include <inttypes.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <string.h>
+#include <sys/eventfd.h>
+#include <time.h>
 #include <unistd.h>
 #include "trema.h"
+#include "hash_map.h"
 #include "log.h"
 #include "messenger.h"
 #include "openflow_application_interface.h"
@@ -43,11 +48,17 @@
 #define get_trema_name mock_get_trema_name
 const char *mock_get_trema_name( void );
 
-#ifdef send_message
-#undef send_message
+#ifdef open_channel
+#undef open_channel
 #endif
-#define send_message mock_send_message
-bool mock_send_message( char *service_name, uint16_t tag, void *data, size_t len );
+#define open_channel mock_open_channel
+messenger_channel *mock_open_channel( const char *service_name );
+
+#ifdef send_channel_message
+#undef send_channel_message
+#endif
+#define send_channel_message mock_send_channel_message
+bool mock_send_channel_message( messenger_channel *channel, uint16_t tag, const void *data, size_t len );
 
 #ifdef init_openflow_message
 #undef init_openflow_message
@@ -69,6 +80,18 @@ bool mock_add_message_received_callback( char *service_name,
 bool mock_delete_message_received_callback( char *service_name,
                                                    void ( *callback )( uint16_t tag, void *data, size_t len ) );
 
+#ifdef add_fd_event_callback
+#undef add_fd_event_callback
+#endif
+#define add_fd_event_callback mock_add_fd_event_callback
+bool mock_add_fd_event_callback( int fd, event_fd_callback read_callback, event_fd_callback write_callback, void *data );
+
+#ifdef delete_fd_event_callback
+#undef delete_fd_event_callback
+#endif
+#define delete_fd_event_callback mock_delete_fd_event_callback
+bool mock_delete_fd_event_callback( int fd );
+
 #ifdef getpid
 #undef getpid
 #endif
@@ -122,9 +145,43 @@ extern void mock_critical( const char *format, ... );
 static bool openflow_application_interface_initialized = false;
 static openflow_event_handlers_t event_handlers;
 static char service_name[ MESSENGER_SERVICE_NAME_LENGTH ];
+static size_t service_name_length = 0;
+static uint64_hash_map *switch_channels = NULL;
+
+
+/*
+ * Event handler threads. Once started, messages from switches are
+ * handed over to one of the threads chosen by datapath id, so that
+ * events from a switch are handled in order while different switches
+ * are handled concurrently. Messages sent from a handler thread are
+ * queued and passed to the messenger on the messenger thread.
+ */
+typedef struct openflow_event {
+  struct openflow_event *next;
+  uint16_t type; // messenger tag if inbound, OpenFlow message type if outbound
+  uint64_t datapath_id;
+  buffer *data;
+} openflow_event;
+
+typedef struct {
+  pthread_t thread;
+  pthread_mutex_t mutex;
+  pthread_cond_t cond;
+  openflow_event *inbound;
+  openflow_event **inbound_tail;
+  bool stopping;
+  openflow_event *outbound;
+  openflow_event **outbound_tail;
+  int outbound_fd;
+} openflow_worker;
+
+static openflow_worker *workers = NULL;
+static unsigned int number_of_workers = 0;
+static __thread openflow_worker *current_worker = NULL;
 
 
 static void handle_message( uint16_t message_type, void *data, size_t length );
+static void hand_over_to_worker( uint16_t type, uint64_t datapath_id, buffer *data );
 
 
 enum {
@@ -133,6 +190,52 @@ enum {
 };
 
 
+#define STAT_KEY_PREFIX "openflow_application_interface."
+#define OPENFLOW_STAT_TYPES ( OFPT_QUEUE_GET_CONFIG_REPLY + 2 ) // the last one counts unknown types
+#define SWITCH_EVENT_STAT_TYPES 4
+
+static const char *openflow_stat_names[ OPENFLOW_STAT_TYPES ] = {
+  [ OFPT_HELLO ] = "hello",
+  [ OFPT_ERROR ] = "error",
+  [ OFPT_ECHO_REQUEST ] = "echo_request",
+  [ OFPT_ECHO_REPLY ] = "echo_reply",
+  [ OFPT_VENDOR ] = "vendor",
+  [ OFPT_FEATURES_REQUEST ] = "features_request",
+  [ OFPT_FEATURES_REPLY ] = "features_reply",
+  [ OFPT_GET_CONFIG_REQUEST ] = "get_config_request",
+  [ OFPT_GET_CONFIG_REPLY ] = "get_config_reply",
+  [ OFPT_SET_CONFIG ] = "set_config",
+  [ OFPT_PACKET_IN ] = "packet_in",
+  [ OFPT_FLOW_REMOVED ] = "flow_removed",
+  [ OFPT_PORT_STATUS ] = "port_status",
+  [ OFPT_PACKET_OUT ] = "packet_out",
+  [ OFPT_FLOW_MOD ] = "flow_mod",
+  [ OFPT_PORT_MOD ] = "port_mod",
+  [ OFPT_STATS_REQUEST ] = "stats_request",
+  [ OFPT_STATS_REPLY ] = "stats_reply",
+  [ OFPT_BARRIER_REQUEST ] = "barrier_request",
+  [ OFPT_BARRIER_REPLY ] = "barrier_reply",
+  [ OFPT_QUEUE_GET_CONFIG_REQUEST ] = "queue_get_config_request",
+  [ OFPT_QUEUE_GET_CONFIG_REPLY ] = "queue_get_config_reply",
+  [ OPENFLOW_STAT_TYPES - 1 ] = "undefined_message_type",
+};
+
+static const char *switch_event_stat_names[ SWITCH_EVENT_STAT_TYPES ] = {
+  "switch_connected",
+  "switch_ready",
+  "switch_disconnected",
+  "undefined_switch_event",
+};
+
+// indexed by type, OPENFLOW_MESSAGE_{SEND,RECEIVE} and result.
+static int openflow_stat_ids[ OPENFLOW_STAT_TYPES ][ 2 ][ 2 ];
+static int switch_event_stat_ids[ SWITCH_EVENT_STAT_TYPES ][ 2 ][ 2 ];
+static int packet_in_handler_stat_id = -1;
+static bool stat_counters_registered = false;
+
+static void register_stat_counters( void );
+
+
 bool
 openflow_application_interface_is_initialized() {
   return openflow_application_interface_initialized;
@@ -168,6 +271,7 @@ init_openflow_application_interface( const char *custom_service_name ) {
     return false;
   }
   memcpy( service_name, custom_service_name, sizeof( service_name ) );
+  service_name_length = strlen( service_name ) + 1;
 
   init_openflow_message();
 
@@ -187,8 +291,17 @@ finalize_openflow_application_interface() {
 
   delete_message_received_callback( service_name, handle_message );
 
+  stop_openflow_event_handler_threads();
+
+  if ( switch_channels != NULL ) {
+    delete_uint64_hash_map( switch_channels );
+    switch_channels = NULL;
+  }
+
   memset( &event_handlers, 0, sizeof( openflow_event_handlers_t ) );
   memset( service_name, '\0', sizeof( service_name ) );
+  service_name_length = 0;
+  stat_counters_registered = false;
 
   openflow_application_interface_initialized = false;
 
@@ -467,8 +580,8 @@ handle_error( const uint64_t datapath_id, buffer *data ) {
   type = ntohs( error_msg->type );
   code = ntohs( error_msg->code );
 
-  body = duplicate_buffer( data );
-  remove_front_buffer( body, offsetof( struct ofp_error_msg, data ) );
+  body = slice_buffer( data, offsetof( struct ofp_error_msg, data ),
+                       data->length - offsetof( struct ofp_error_msg, data ) );
 
   debug( "An error message is received from %#lx "
          "( transaction_id = %#x, type = %u, code = %u, data length = %u ).",
@@ -524,8 +637,8 @@ handle_vendor( const uint64_t datapath_id, buffer *data ) {
   }
 
   if ( body_length > 0 ) {
-    body = duplicate_buffer( data );
-    remove_front_buffer( body, sizeof( struct ofp_vendor_header ) );
+    body = slice_buffer( data, sizeof( struct ofp_vendor_header ),
+                         data->length - sizeof( struct ofp_vendor_header ) );
   }
   else {
     body = NULL;
@@ -709,8 +822,8 @@ handle_packet_in( const uint64_t datapath_id, buffer *data ) {
 
   buffer *body = NULL;
   if ( body_length > 0 ) {
-    body = duplicate_buffer( data );
-    remove_front_buffer( body, offsetof( struct ofp_packet_in, data ) );
+    body = slice_buffer( data, offsetof( struct ofp_packet_in, data ),
+                         data->length - offsetof( struct ofp_packet_in, data ) );
     bool parse_ok = parse_packet( body );
     if ( !parse_ok ) {
       error( "Failed to parse a packet." );
@@ -728,6 +841,11 @@ handle_packet_in( const uint64_t datapath_id, buffer *data ) {
          event_handlers.packet_in_callback,
          event_handlers.packet_in_user_data
   );
+  if ( !stat_counters_registered ) {
+    register_stat_counters();
+  }
+  struct timespec started_at;
+  clock_gettime( CLOCK_MONOTONIC, &started_at );
   if ( event_handlers.simple_packet_in_callback ) {
     packet_in event = {
       datapath_id,
@@ -754,6 +872,11 @@ handle_packet_in( const uint64_t datapath_id, buffer *data ) {
     );
   }
 
+  struct timespec finished_at;
+  clock_gettime( CLOCK_MONOTONIC, &finished_at );
+  int64_t elapsed = ( int64_t ) ( finished_at.tv_sec - started_at.tv_sec ) * 1000000000 + ( finished_at.tv_nsec - started_at.tv_nsec );
+  record_stat_value( packet_in_handler_stat_id, ( uint64_t ) elapsed );
+
   if ( body != NULL ) {
     free_packet( body );
   }
@@ -788,15 +911,16 @@ handle_flow_removed( const uint64_t datapath_id, buffer *data ) {
   packet_count = ntohll( flow_removed->packet_count );
   byte_count = ntohll( flow_removed->byte_count );
 
-  match_to_string( &match, match_string, sizeof( match_string ) );
-
-  debug( "A flow removed message is received from %#" PRIx64
-         " ( transaction_id = %#x, match = [%s], cookie = %#" PRIx64 ", "
-         "priority = %u, reason = %#x, duration_sec = %u, duration_nsec = %u, "
-         "idle_timeout = %u, packet_count = %" PRIu64 ", byte_count = %" PRIu64 " ).",
-         datapath_id, transaction_id, match_string, cookie,
-         priority, reason, duration_sec, duration_nsec,
-         idle_timeout, packet_count, byte_count );
+  if ( LOG_LEVEL_ENABLED( LOG_DEBUG ) ) {
+    match_to_string( &match, match_string, sizeof( match_string ) );
+    debug( "A flow removed message is received from %#" PRIx64
+           " ( transaction_id = %#x, match = [%s], cookie = %#" PRIx64 ", "
+           "priority = %u, reason = %#x, duration_sec = %u, duration_nsec = %u, "
+           "idle_timeout = %u, packet_count = %" PRIu64 ", byte_count = %" PRIu64 " ).",
+           datapath_id, transaction_id, match_string, cookie,
+           priority, reason, duration_sec, duration_nsec,
+           idle_timeout, packet_count, byte_count );
+  }
 
   if ( event_handlers.flow_removed_callback == NULL ) {
     debug( "Callback function for flow removed events is not set." );
@@ -894,8 +1018,8 @@ handle_stats_reply( const uint64_t datapath_id, buffer *data ) {
   }
 
   if ( body_length > 0 ) {
-    body = duplicate_buffer( data );
-    remove_front_buffer( body, offsetof( struct ofp_stats_reply, body ) );
+    body = slice_buffer( data, offsetof( struct ofp_stats_reply, body ),
+                         data->length - offsetof( struct ofp_stats_reply, body ) );
   }
 
   if ( body != NULL ) {
@@ -1145,51 +1269,62 @@ handle_queue_get_config_reply( const uint64_t datapath_id, buffer *data ) {
 }
 
 
+/*
+ * Registers a counter for every message type, direction and result up
+ * front, so that counting a message is just an array lookup.
+ */
 static void
-update_switch_event_stats( uint16_t type, int send_receive, bool result ) {
+register_stat_counters( void ) {
+  const char *directions[] = { "_send", "_receive" };
+  const char *results[] = { "_failed", "_succeeded" };
   char key[ STAT_KEY_LENGTH ];
-  char suffix[ 16 ];
-  char direction[ 16 ];
-  const char *prefix = "openflow_application_interface.";
 
-  memset( suffix, '\0', sizeof( suffix ) );
-
-  if ( result ) {
-    sprintf( suffix, "_succeeded" );
-  }
-  else {
-    sprintf( suffix, "_failed" );
+  int direction, result;
+  for ( direction = OPENFLOW_MESSAGE_SEND; direction <= OPENFLOW_MESSAGE_RECEIVE; direction++ ) {
+    for ( result = 0; result < 2; result++ ) {
+      int i;
+      for ( i = 0; i < OPENFLOW_STAT_TYPES; i++ ) {
+        snprintf( key, sizeof( key ), STAT_KEY_PREFIX "%s%s%s", openflow_stat_names[ i ], directions[ direction ], results[ result ] );
+        openflow_stat_ids[ i ][ direction ][ result ] = register_stat_counter( key );
+      }
+      for ( i = 0; i < SWITCH_EVENT_STAT_TYPES; i++ ) {
+        snprintf( key, sizeof( key ), STAT_KEY_PREFIX "%s%s%s", switch_event_stat_names[ i ], directions[ direction ], results[ result ] );
+        switch_event_stat_ids[ i ][ direction ][ result ] = register_stat_counter( key );
+      }
+    }
   }
+  packet_in_handler_stat_id = register_stat_histogram( STAT_KEY_PREFIX "packet_in_handler_ns" );
 
-  memset( direction, '\0', sizeof( direction ) );
+  stat_counters_registered = true;
+}
 
-  switch ( send_receive ) {
-  case OPENFLOW_MESSAGE_SEND:
-    sprintf( direction, "_send" );
-    break;
-  case OPENFLOW_MESSAGE_RECEIVE:
-    sprintf( direction, "_receive" );
-    break;
-  default:
+
+static void
+update_switch_event_stats( uint16_t type, int send_receive, bool result ) {
+  if ( send_receive != OPENFLOW_MESSAGE_SEND && send_receive != OPENFLOW_MESSAGE_RECEIVE ) {
     return;
   }
+  if ( !stat_counters_registered ) {
+    register_stat_counters();
+  }
 
+  int index;
   switch ( type ) {
   case MESSENGER_OPENFLOW_CONNECTED:
-    snprintf( key, STAT_KEY_LENGTH, "%s%s%s%s", prefix, "switch_connected", direction, suffix );
+    index = 0;
     break;
   case MESSENGER_OPENFLOW_READY:
-    snprintf( key, STAT_KEY_LENGTH, "%s%s%s%s", prefix, "switch_ready", direction, suffix );
+    index = 1;
     break;
   case MESSENGER_OPENFLOW_DISCONNECTED:
-    snprintf( key, STAT_KEY_LENGTH, "%s%s%s%s", prefix, "switch_disconnected", direction, suffix );
+    index = 2;
     break;
   default:
-    snprintf( key, STAT_KEY_LENGTH, "%s%s%s%s", prefix, "undefined_switch_event", direction, suffix );
+    index = SWITCH_EVENT_STAT_TYPES - 1;
     break;
   }
 
-  increment_stat( key );
+  increment_stat_id( switch_event_stat_ids[ index ][ send_receive ][ result ? 1 : 0 ] );
 }
 
 
@@ -1218,19 +1353,7 @@ handle_switch_ready( uint64_t datapath_id ) {
 
 
 static void
-handle_switch_events( uint16_t type, void *data, size_t length ) {
-  uint64_t datapath_id;
-  openflow_service_header_t *message;
-
-  assert( data != NULL );
-  assert( length == sizeof( openflow_service_header_t ) );
-
-  debug( "A switch event is received from remote ( type = %u ).", type );
-
-  message = ( openflow_service_header_t * ) data;
-
-  datapath_id = ntohll( message->datapath_id );
-
+dispatch_switch_event( uint16_t type, uint64_t datapath_id ) {
   switch ( type ) {
   case MESSENGER_OPENFLOW_CONNECTED:
     break;
@@ -1258,140 +1381,51 @@ handle_switch_events( uint16_t type, void *data, size_t length ) {
 
 
 static void
-update_openflow_stats( uint8_t type, int send_receive, bool result ) {
-  char key[ STAT_KEY_LENGTH ];
-  char suffix[ 16 ];
-  char direction[ 16 ];
-  const char *prefix = "openflow_application_interface.";
+handle_switch_events( uint16_t type, void *data, size_t length ) {
+  uint64_t datapath_id;
+  openflow_service_header_t *message;
 
-  memset( suffix, '\0', sizeof( suffix ) );
+  assert( data != NULL );
+  assert( length == sizeof( openflow_service_header_t ) );
 
-  if ( result ) {
-    sprintf( suffix, "_succeeded" );
-  }
-  else {
-    sprintf( suffix, "_failed" );
-  }
+  debug( "A switch event is received from remote ( type = %u ).", type );
 
-  memset( direction, '\0', sizeof( direction ) );
+  message = ( openflow_service_header_t * ) data;
 
-  switch ( send_receive ) {
-  case OPENFLOW_MESSAGE_SEND:
-    sprintf( direction, "_send" );
-    break;
-  case OPENFLOW_MESSAGE_RECEIVE:
-    sprintf( direction, "_receive" );
-    break;
-  default:
+  datapath_id = ntohll( message->datapath_id );
+
+  if ( workers != NULL ) {
+    hand_over_to_worker( type, datapath_id, NULL );
     return;
   }
 
-  switch ( type ) {
-  case OFPT_HELLO:
-    snprintf( key, STAT_KEY_LENGTH, "%s%s%s%s", prefix, "hello", direction, suffix );
-    break;
-  case OFPT_ERROR:
-    snprintf( key, STAT_KEY_LENGTH, "%s%s%s%s", prefix, "error", direction, suffix );
-    break;
-  case OFPT_ECHO_REQUEST:
-    snprintf( key, STAT_KEY_LENGTH, "%s%s%s%s", prefix, "echo_request", direction, suffix );
-    break;
-  case OFPT_ECHO_REPLY:
-    snprintf( key, STAT_KEY_LENGTH, "%s%s%s%s", prefix, "echo_reply", direction, suffix );
-    break;
-  case OFPT_VENDOR:
-    snprintf( key, STAT_KEY_LENGTH, "%s%s%s%s", prefix, "vendor", direction, suffix );
-    break;
-  case OFPT_FEATURES_REQUEST:
-    snprintf( key, STAT_KEY_LENGTH, "%s%s%s%s", prefix, "features_request", direction, suffix );
-    break;
-  case OFPT_FEATURES_REPLY:
-    snprintf( key, STAT_KEY_LENGTH, "%s%s%s%s", prefix, "features_reply", direction, suffix );
-    break;
-  case OFPT_GET_CONFIG_REQUEST:
-    snprintf( key, STAT_KEY_LENGTH, "%s%s%s%s", prefix, "get_config_request", direction, suffix );
-    break;
-  case OFPT_GET_CONFIG_REPLY:
-    snprintf( key, STAT_KEY_LENGTH, "%s%s%s%s", prefix, "get_config_reply", direction, suffix );
-    break;
-  case OFPT_SET_CONFIG:
-    snprintf( key, STAT_KEY_LENGTH, "%s%s%s%s", prefix, "set_config", direction, suffix );
-    break;
-  case OFPT_PACKET_IN:
-    snprintf( key, STAT_KEY_LENGTH, "%s%s%s%s", prefix, "packet_in", direction, suffix );
-    break;
-  case OFPT_FLOW_REMOVED:
-    snprintf( key, STAT_KEY_LENGTH, "%s%s%s%s", prefix, "flow_removed", direction, suffix );
-    break;
-  case OFPT_PORT_STATUS:
-    snprintf( key, STAT_KEY_LENGTH, "%s%s%s%s", prefix, "port_status", direction, suffix );
-    break;
-  case OFPT_PACKET_OUT:
-    snprintf( key, STAT_KEY_LENGTH, "%s%s%s%s", prefix, "packet_out", direction, suffix );
-    break;
-  case OFPT_FLOW_MOD:
-    snprintf( key, STAT_KEY_LENGTH, "%s%s%s%s", prefix, "flow_mod", direction, suffix );
-    break;
-  case OFPT_PORT_MOD:
-    snprintf( key, STAT_KEY_LENGTH, "%s%s%s%s", prefix, "port_mod", direction, suffix );
-    break;
-  case OFPT_STATS_REQUEST:
-    snprintf( key, STAT_KEY_LENGTH, "%s%s%s%s", prefix, "stats_request", direction, suffix );
-    break;
-  case OFPT_STATS_REPLY:
-    snprintf( key, STAT_KEY_LENGTH, "%s%s%s%s", prefix, "stats_reply", direction, suffix );
-    break;
-  case OFPT_BARRIER_REQUEST:
-    snprintf( key, STAT_KEY_LENGTH, "%s%s%s%s", prefix, "barrier_request", direction, suffix );
-    break;
-  case OFPT_BARRIER_REPLY:
-    snprintf( key, STAT_KEY_LENGTH, "%s%s%s%s", prefix, "barrier_reply", direction, suffix );
-    break;
-  case OFPT_QUEUE_GET_CONFIG_REQUEST:
-    snprintf( key, STAT_KEY_LENGTH, "%s%s%s%s", prefix, "queue_get_config_request", direction, suffix );
-    break;
-  case OFPT_QUEUE_GET_CONFIG_REPLY:
-    snprintf( key, STAT_KEY_LENGTH, "%s%s%s%s", prefix, "queue_get_config_reply", direction, suffix );
-    break;
-  default:
-    snprintf( key, STAT_KEY_LENGTH, "%s%s%s%s", prefix, "undefined_message_type", direction, suffix );
-    break;
+  dispatch_switch_event( type, datapath_id );
+}
+
+
+static void
+update_openflow_stats( uint8_t type, int send_receive, bool result ) {
+  if ( send_receive != OPENFLOW_MESSAGE_SEND && send_receive != OPENFLOW_MESSAGE_RECEIVE ) {
+    return;
+  }
+  if ( !stat_counters_registered ) {
+    register_stat_counters();
   }
 
-  increment_stat( key );
+  int index = type < OPENFLOW_STAT_TYPES - 1 ? type : OPENFLOW_STAT_TYPES - 1;
+  increment_stat_id( openflow_stat_ids[ index ][ send_receive ][ result ? 1 : 0 ] );
 }
 
 
 static void
-handle_openflow_message( void *data, size_t length ) {
-  void *p;
+dispatch_openflow_message( uint64_t datapath_id, buffer *buffer ) {
   int ret;
-  uint64_t datapath_id;
-  buffer *buffer;
   struct ofp_header *header;
-  openflow_service_header_t *message;
-
-  assert( data != NULL );
-  assert( length >= ( sizeof( openflow_service_header_t ) + sizeof( struct ofp_header ) ) );
-
-  debug( "An OpenFlow message is received from remote." );
-
-  message = ( openflow_service_header_t * ) data;
-
-  datapath_id = ntohll( message->datapath_id );
-
-  buffer = alloc_buffer_with_length( length );
-
-  assert( buffer != NULL );
-
-  p = append_back_buffer( buffer, length );
-  memcpy( p, data, length );
-  remove_front_buffer( buffer, sizeof( openflow_service_header_t ) );
 
   ret = validate_openflow_message( buffer );
 
   if ( ret < 0 ) {
-    error( "Failed to validate an OpenFlow message ( code = %d, length = %u ).", ret, length );
+    error( "Failed to validate an OpenFlow message ( code = %d, length = %u ).", ret, buffer->length );
     free_buffer( buffer );
 
     return;
@@ -1441,6 +1475,38 @@ handle_openflow_message( void *data, size_t length ) {
 }
 
 
+static void
+handle_openflow_message( void *data, size_t length ) {
+  uint64_t datapath_id;
+  buffer *buffer;
+  openflow_service_header_t *message;
+
+  assert( data != NULL );
+  assert( length >= ( sizeof( openflow_service_header_t ) + sizeof( struct ofp_header ) ) );
+
+  debug( "An OpenFlow message is received from remote." );
+
+  message = ( openflow_service_header_t * ) data;
+
+  datapath_id = ntohll( message->datapath_id );
+
+  // Handlers see the message where the messenger received it.
+  buffer = wrap_buffer( ( char * ) data + sizeof( openflow_service_header_t ),
+                        length - sizeof( openflow_service_header_t ) );
+
+  assert( buffer != NULL );
+
+  if ( workers != NULL ) {
+    // the received data is reused once we return.
+    hand_over_to_worker( MESSENGER_OPENFLOW_MESSAGE, datapath_id, retain_buffer( buffer ) );
+    free_buffer( buffer );
+    return;
+  }
+
+  dispatch_openflow_message( datapath_id, buffer );
+}
+
+
 static void
 handle_message( uint16_t type, void *data, size_t length ) {
   assert( data != NULL );
@@ -1463,11 +1529,56 @@ handle_message( uint16_t type, void *data, size_t length ) {
 }
 
 
+/**
+ * returns the channel to the switch daemon for datapath_id. Channels are
+ * cached so that sending a message needs no service name formatting.
+ */
+static messenger_channel *
+get_switch_channel( const uint64_t datapath_id ) {
+  if ( switch_channels == NULL ) {
+    switch_channels = create_uint64_hash_map( 0 );
+  }
+
+  messenger_channel *channel = lookup_uint64_hash_map_entry( switch_channels, &datapath_id );
+  if ( channel != NULL ) {
+    return channel;
+  }
+
+  char remote_service_name[ MESSENGER_SERVICE_NAME_LENGTH ];
+  memset( remote_service_name, '\0', sizeof( remote_service_name ) );
+  snprintf( remote_service_name, sizeof( remote_service_name ),
+            "switch.%" PRIx64, datapath_id );
+
+  debug( "Opening a channel to %#" PRIx64 " ( remote_service_name = %s ).", datapath_id, remote_service_name );
+
+  channel = open_channel( remote_service_name );
+  if ( channel != NULL ) {
+    insert_uint64_hash_map_entry( switch_channels, &datapath_id, channel );
+  }
+
+  return channel;
+}
+
+
+static bool
+transmit_openflow_message( const uint64_t datapath_id, buffer *buffer ) {
+  messenger_channel *channel = get_switch_channel( datapath_id );
+  bool ret = channel != NULL && send_channel_message( channel, MESSENGER_OPENFLOW_MESSAGE,
+                                                      buffer->data, buffer->length );
+
+  free_buffer( buffer );
+
+  return ret;
+}
+
+
+static void queue_outbound_message( openflow_worker *worker, uint64_t datapath_id, uint8_t type, buffer *data );
+
+
 bool
 send_openflow_message( const uint64_t datapath_id, buffer *message ) {
   bool ret;
   void *data;
-  char remote_service_name[ MESSENGER_SERVICE_NAME_LENGTH ];
   uint16_t header_length;
   buffer *buffer;
   struct ofp_header *ofp;
@@ -1486,32 +1597,29 @@ send_openflow_message( const uint64_t datapath_id, buffer *message ) {
 
   assert( buffer != NULL );
 
-  header_length = ( uint16_t ) ( sizeof( openflow_service_header_t )
-                  + strlen( service_name ) + 1 );
+  header_length = ( uint16_t ) ( sizeof( openflow_service_header_t ) + service_name_length );
 
   header.datapath_id = htonll( datapath_id );
-  header.service_name_length = htons( ( uint16_t ) ( strlen( service_name ) + 1 ) );
+  header.service_name_length = htons( ( uint16_t ) service_name_length );
 
   data = append_front_buffer( buffer, header_length );
-  memset( data, '\0', header_length );
   memcpy( data, &header, sizeof( openflow_service_header_t ) );
   memcpy( ( char * ) data + sizeof( openflow_service_header_t ),
-          service_name, strlen( service_name ) );
-
-  memset( remote_service_name, '\0', sizeof( remote_service_name ) );
-  snprintf( remote_service_name, sizeof( remote_service_name ),
-            "switch.%" PRIx64, datapath_id );
+          service_name, service_name_length );
 
   debug( "Sending an OpenFlow message to %#" PRIx64
-         " ( service_name = %s, remote_service_name = %s, "
+         " ( service_name = %s, "
          "ofp_header = [version = %#x, type = %#x, length = %u, transaction_id = %#x] ).",
-         datapath_id, service_name, remote_service_name,
+         datapath_id, service_name,
          ofp->version, ofp->type, ntohs( ofp->length ), ntohl( ofp->xid ) );
 
-  ret =  send_message( remote_service_name, MESSENGER_OPENFLOW_MESSAGE,
-                       buffer->data, buffer->length );
+  if ( current_worker != NULL ) {
+    // the messenger is not thread safe; let the messenger thread send it.
+    queue_outbound_message( current_worker, datapath_id, ofp->type, buffer );
+    return true;
+  }
 
-  free_buffer( buffer );
+  ret = transmit_openflow_message( datapath_id, buffer );
 
   update_openflow_stats( ofp->type, OPENFLOW_MESSAGE_SEND, ret );
 
@@ -1519,6 +1627,228 @@ send_openflow_message( const uint64_t datapath_id, buffer *message ) {
 }
 
 
+static openflow_event *
+create_openflow_event( uint16_t type, uint64_t datapath_id, buffer *data ) {
+  openflow_event *event = xmalloc( sizeof( openflow_event ) );
+  event->next = NULL;
+  event->type = type;
+  event->datapath_id = datapath_id;
+  event->data = data;
+
+  return event;
+}
+
+
+static openflow_worker *
+lookup_worker( uint64_t datapath_id ) {
+  // multiplicative hashing spreads sequential datapath ids over the threads.
+  uint64_t hash = datapath_id * UINT64_C( 0x9e3779b97f4a7c15 );
+
+  return &workers[ ( hash >> 32 ) % number_of_workers ];
+}
+
+
+static void
+hand_over_to_worker( uint16_t type, uint64_t datapath_id, buffer *data ) {
+  openflow_worker *worker = lookup_worker( datapath_id );
+  openflow_event *event = create_openflow_event( type, datapath_id, data );
+
+  pthread_mutex_lock( &worker->mutex );
+  *worker->inbound_tail = event;
+  worker->inbound_tail = &event->next;
+  pthread_cond_signal( &worker->cond );
+  pthread_mutex_unlock( &worker->mutex );
+}
+
+
+static void *
+run_openflow_worker( void *argument ) {
+  openflow_worker *worker = argument;
+  current_worker = worker;
+
+  pthread_mutex_lock( &worker->mutex );
+  for ( ;; ) {
+    while ( worker->inbound == NULL && !worker->stopping ) {
+      pthread_cond_wait( &worker->cond, &worker->mutex );
+    }
+    if ( worker->inbound == NULL ) {
+      break;
+    }
+    openflow_event *events = worker->inbound;
+    worker->inbound = NULL;
+    worker->inbound_tail = &worker->inbound;
+    pthread_mutex_unlock( &worker->mutex );
+
+    while ( events != NULL ) {
+      openflow_event *next = events->next;
+      if ( events->type == MESSENGER_OPENFLOW_MESSAGE ) {
+        dispatch_openflow_message( events->datapath_id, events->data );
+      }
+      else {
+        dispatch_switch_event( events->type, events->datapath_id );
+      }
+      xfree( events );
+      events = next;
+    }
+
+    pthread_mutex_lock( &worker->mutex );
+  }
+  pthread_mutex_unlock( &worker->mutex );
+
+  current_worker = NULL;
+  // the free lists are per thread and would be lost with it.
+  flush_buffer_pool();
+
+  return NULL;
+}
+
+
+static void
+queue_outbound_message( openflow_worker *worker, uint64_t datapath_id, uint8_t type, buffer *data ) {
+  openflow_event *event = create_openflow_event( type, datapath_id, data );
+
+  pthread_mutex_lock( &worker->mutex );
+  bool was_empty = worker->outbound == NULL;
+  *worker->outbound_tail = event;
+  worker->outbound_tail = &event->next;
+  pthread_mutex_unlock( &worker->mutex );
+
+  if ( was_empty ) {
+    uint64_t one = 1;
+    if ( write( worker->outbound_fd, &one, sizeof( one ) ) != sizeof( one ) ) {
+      warn( "Failed to wake up the messenger thread ( errno = %s [%d] ).", strerror( errno ), errno );
+    }
+  }
+}
+
+
+static void
+flush_outbound_messages( openflow_worker *worker ) {
+  pthread_mutex_lock( &worker->mutex );
+  openflow_event *events = worker->outbound;
+  worker->outbound = NULL;
+  worker->outbound_tail = &worker->outbound;
+  pthread_mutex_unlock( &worker->mutex );
+
+  while ( events != NULL ) {
+    openflow_event *next = events->next;
+    bool ret = transmit_openflow_message( events->datapath_id, events->data );
+    update_openflow_stats( ( uint8_t ) events->type, OPENFLOW_MESSAGE_SEND, ret );
+    xfree( events );
+    events = next;
+  }
+}
+
+
+static void
+on_outbound_messages( int fd, void *data ) {
+  uint64_t count;
+  if ( read( fd, &count, sizeof( count ) ) < 0 && errno != EAGAIN ) {
+    warn( "Failed to read an eventfd ( fd = %d, errno = %s [%d] ).", fd, strerror( errno ), errno );
+  }
+
+  flush_outbound_messages( data );
+}
+
+
+/**
+ * starts number_of_threads threads that run OpenFlow event handlers.
+ * Must be called on the messenger thread after the handlers are set.
+ */
+bool
+start_openflow_event_handler_threads( unsigned int number_of_threads ) {
+  maybe_init_openflow_application_interface();
+  assert( openflow_application_interface_initialized );
+
+  if ( number_of_threads == 0 ) {
+    error( "At least one event handler thread is required." );
+    return false;
+  }
+  if ( workers != NULL ) {
+    error( "Event handler threads are already started." );
+    return false;
+  }
+
+  if ( !stat_counters_registered ) {
+    register_stat_counters();
+  }
+
+  debug( "Starting %u event handler threads.", number_of_threads );
+
+  workers = xcalloc( number_of_threads, sizeof( openflow_worker ) );
+  number_of_workers = 0;
+  unsigned int i;
+  for ( i = 0; i < number_of_threads; i++ ) {
+    openflow_worker *worker = &workers[ i ];
+    pthread_mutex_init( &worker->mutex, NULL );
+    pthread_cond_init( &worker->cond, NULL );
+    worker->inbound_tail = &worker->inbound;
+    worker->outbound_tail = &worker->outbound;
+    worker->outbound_fd = eventfd( 0, EFD_NONBLOCK | EFD_CLOEXEC );
+    if ( worker->outbound_fd < 0 ) {
+      error( "Failed to create an eventfd ( errno = %s [%d] ).", strerror( errno ), errno );
+      break;
+    }
+    if ( !add_fd_event_callback( worker->outbound_fd, on_outbound_messages, NULL, worker ) ) {
+      close( worker->outbound_fd );
+      break;
+    }
+    if ( pthread_create( &worker->thread, NULL, run_openflow_worker, worker ) != 0 ) {
+      error( "Failed to start an event handler thread." );
+      delete_fd_event_callback( worker->outbound_fd );
+      close( worker->outbound_fd );
+      break;
+    }
+    number_of_workers++;
+  }
+
+  if ( number_of_workers < number_of_threads ) {
+    pthread_cond_destroy( &workers[ number_of_workers ].cond );
+    pthread_mutex_destroy( &workers[ number_of_workers ].mutex );
+    stop_openflow_event_handler_threads();
+    return false;
+  }
+
+  return true;
+}
+
+
+/**
+ * waits for the event handler threads to handle queued events, sends
+ * what they have sent, and goes back to handling events on the
+ * messenger thread.
+ */
+void
+stop_openflow_event_handler_threads( void ) {
+  if ( workers == NULL ) {
+    return;
+  }
+
+  debug( "Stopping %u event handler threads.", number_of_workers );
+
+  unsigned int i;
+  for ( i = 0; i < number_of_workers; i++ ) {
+    pthread_mutex_lock( &workers[ i ].mutex );
+    workers[ i ].stopping = true;
+    pthread_cond_signal( &workers[ i ].cond );
+    pthread_mutex_unlock( &workers[ i ].mutex );
+  }
+  for ( i = 0; i < number_of_workers; i++ ) {
+    openflow_worker *worker = &workers[ i ];
+    pthread_join( worker->thread, NULL );
+    flush_outbound_messages( worker );
+    delete_fd_event_callback( worker->outbound_fd );
+    close( worker->outbound_fd );
+    pthread_cond_destroy( &worker->cond );
+    pthread_mutex_destroy( &worker->mutex );
+  }
+
+  xfree( workers );
+  workers = NULL;
+  number_of_workers = 0;
+}
+
+
 /*
  * Local variables:
  * c-basic-offset: 2
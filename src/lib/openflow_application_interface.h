@@ -39,8 +39,32 @@ bool finalize_openflow_application_interface( void );
 bool openflow_application_interface_is_initialized( void );
 
 
+/********************************************************************************
+ * Functions for running event handlers on multiple threads.
+ *
+ * By default all handlers run on the messenger thread. Once
+ * start_openflow_event_handler_threads() is called, messages and switch
+ * events are handled on one of the threads chosen by datapath id:
+ * handlers for the same switch are called in order on the same thread,
+ * while handlers for different switches may run concurrently. Handlers
+ * must therefore lock any state they share across switches. From a
+ * handler thread, only send_openflow_message(), buffer, packet parser,
+ * log and stat functions may be called; messages sent there are queued
+ * for the messenger thread, so send_openflow_message() returns true once
+ * queued. Set the handlers before starting the threads, and start and
+ * stop them on the messenger thread.
+ ********************************************************************************/
+
+bool start_openflow_event_handler_threads( unsigned int number_of_threads );
+void stop_openflow_event_handler_threads( void );
+
+
 /********************************************************************************
  * Event handler definitions.
+ *
+ * Buffers passed to handlers point into the memory the message was
+ * received in, and are valid only until the handler returns. Use
+ * retain_buffer() to keep one longer.
  ********************************************************************************/
 
 typedef struct {
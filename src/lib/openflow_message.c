@@ -26,7 +26,9 @@
 #include <sys/socket.h>
 #include <sys/types.h>
 #include <unistd.h>
+#include "messenger.h"
 #include "openflow_message.h"
+#include "openflow_service_interface.h"
 #include "packet_info.h"
 #include "packet_parser.h"
 #include "wrapper.h"
@@ -73,6 +75,10 @@ extern void mock_debug( const char *format, ... );
                         | OFPPF_AUTONEG | OFPPF_PAUSE | OFPPF_PAUSE_ASYM )
 #define FLOW_MOD_FLAGS ( OFPFF_SEND_FLOW_REM | OFPFF_CHECK_OVERLAP | OFPFF_EMERG )
 
+// Room for an openflow_service_header_t and a service name, which
+// send_openflow_message() puts in front of messages.
+#define OPENFLOW_MESSAGE_HEADROOM ( sizeof( openflow_service_header_t ) + MESSENGER_SERVICE_NAME_LENGTH )
+
 
 static uint32_t transaction_id = 0;
 static pthread_mutex_t transaction_id_mutex = PTHREAD_RECURSIVE_MUTEX_INITIALIZER_NP;
@@ -109,7 +115,7 @@ create_header( const uint32_t transaction_id, const uint8_t type, const uint16_t
 
   assert( length >= sizeof( struct ofp_header ) );
 
-  buffer *buffer = alloc_buffer_with_length( length );
+  buffer *buffer = alloc_buffer_with_headroom( length, OPENFLOW_MESSAGE_HEADROOM );
   assert( buffer != NULL );
 
   void *data = append_back_buffer( buffer, length );
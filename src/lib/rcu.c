@@ -0,0 +1,190 @@
+/*
+ * Copyright (C) 2008-2011 NEC Corporation
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License, version 2, as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+#include <assert.h>
+#include <pthread.h>
+#include <stdint.h>
+#include "rcu.h"
+#include "wrapper.h"
+
+
+typedef struct rcu_reader {
+  uint64_t epoch;
+  struct rcu_reader *next;
+} rcu_reader;
+
+
+typedef struct deferred_free {
+  void *data;
+  void ( *free_function )( void *data );
+  uint64_t epoch;
+  struct deferred_free *next;
+} deferred_free;
+
+
+/*
+ * Each deferred free is stamped with a new global epoch. A reader that
+ * reports a quiescent state copies the global epoch, so once every
+ * reader has copied an epoch at least as new as the stamp, none of them
+ * can still hold a reference obtained before the data was retired.
+ */
+static uint64_t global_epoch = 1;
+static unsigned int number_of_deferred = 0;
+static rcu_reader *readers = NULL;
+static deferred_free *deferred = NULL;
+static pthread_mutex_t readers_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t deferred_mutex = PTHREAD_MUTEX_INITIALIZER;
+static __thread rcu_reader *self = NULL;
+
+
+void
+register_rcu_reader( void ) {
+  if ( self != NULL ) {
+    return;
+  }
+
+  rcu_reader *reader = xmalloc( sizeof( rcu_reader ) );
+  reader->epoch = __atomic_load_n( &global_epoch, __ATOMIC_ACQUIRE );
+
+  pthread_mutex_lock( &readers_mutex );
+  reader->next = readers;
+  readers = reader;
+  pthread_mutex_unlock( &readers_mutex );
+
+  self = reader;
+}
+
+
+void
+unregister_rcu_reader( void ) {
+  if ( self == NULL ) {
+    return;
+  }
+
+  pthread_mutex_lock( &readers_mutex );
+  rcu_reader **r;
+  for ( r = &readers; *r != NULL; r = &( *r )->next ) {
+    if ( *r == self ) {
+      *r = self->next;
+      break;
+    }
+  }
+  pthread_mutex_unlock( &readers_mutex );
+
+  xfree( self );
+  self = NULL;
+}
+
+
+static uint64_t
+oldest_reader_epoch( void ) {
+  uint64_t oldest = UINT64_MAX;
+
+  pthread_mutex_lock( &readers_mutex );
+  rcu_reader *r;
+  for ( r = readers; r != NULL; r = r->next ) {
+    uint64_t epoch = __atomic_load_n( &r->epoch, __ATOMIC_ACQUIRE );
+    if ( epoch < oldest ) {
+      oldest = epoch;
+    }
+  }
+  pthread_mutex_unlock( &readers_mutex );
+
+  return oldest;
+}
+
+
+static void
+reclaim( uint64_t oldest ) {
+  deferred_free *expired = NULL;
+
+  pthread_mutex_lock( &deferred_mutex );
+  deferred_free **d = &deferred;
+  while ( *d != NULL ) {
+    deferred_free *e = *d;
+    if ( e->epoch <= oldest ) {
+      *d = e->next;
+      e->next = expired;
+      expired = e;
+      __atomic_sub_fetch( &number_of_deferred, 1, __ATOMIC_RELAXED );
+    }
+    else {
+      d = &e->next;
+    }
+  }
+  pthread_mutex_unlock( &deferred_mutex );
+
+  while ( expired != NULL ) {
+    deferred_free *e = expired;
+    expired = e->next;
+    e->free_function( e->data );
+    xfree( e );
+  }
+}
+
+
+void
+report_rcu_quiescent_state( void ) {
+  if ( self != NULL ) {
+    __atomic_store_n( &self->epoch, __atomic_load_n( &global_epoch, __ATOMIC_ACQUIRE ), __ATOMIC_RELEASE );
+  }
+
+  if ( __atomic_load_n( &number_of_deferred, __ATOMIC_RELAXED ) == 0 ) {
+    return;
+  }
+  reclaim( oldest_reader_epoch() );
+}
+
+
+void
+defer_rcu_free( void *data, void free_function( void *data ) ) {
+  assert( free_function != NULL );
+
+  if ( data == NULL ) {
+    return;
+  }
+
+  deferred_free *e = xmalloc( sizeof( deferred_free ) );
+  e->data = data;
+  e->free_function = free_function;
+
+  pthread_mutex_lock( &deferred_mutex );
+  e->epoch = __atomic_add_fetch( &global_epoch, 1, __ATOMIC_SEQ_CST );
+  e->next = deferred;
+  deferred = e;
+  __atomic_add_fetch( &number_of_deferred, 1, __ATOMIC_RELAXED );
+  pthread_mutex_unlock( &deferred_mutex );
+}
+
+
+/*
+ * Releases everything still pending. Callers must make sure that no
+ * reader references retired data any more.
+ */
+void
+finalize_rcu( void ) {
+  reclaim( UINT64_MAX );
+}
+
+
+/*
+ * Local variables:
+ * c-basic-offset: 2
+ * indent-tabs-mode: nil
+ * End:
+ */
@@ -0,0 +1,48 @@
+/*
+ * Quiescent-state-based deferred reclamation for read-mostly tables.
+ *
+ * Copyright (C) 2008-2011 NEC Corporation
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License, version 2, as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+#ifndef RCU_H
+#define RCU_H
+
+
+/*
+ * Readers of read-mostly data structures do not synchronize at all.
+ * Instead, every thread that reads them registers itself and reports
+ * a quiescent state (a point where it holds no reference to shared
+ * data) from time to time; the messenger does this once per event
+ * loop iteration. Memory handed to defer_rcu_free() is released only
+ * after every registered thread has reported a quiescent state.
+ */
+void register_rcu_reader( void );
+void unregister_rcu_reader( void );
+void report_rcu_quiescent_state( void );
+void defer_rcu_free( void *data, void free_function( void *data ) );
+void finalize_rcu( void );
+
+
+#endif // RCU_H
+
+
+/*
+ * Local variables:
+ * c-basic-offset: 2
+ * indent-tabs-mode: nil
+ * End:
+ */
@@ -0,0 +1,370 @@
+/*
+ * Copyright (C) 2008-2011 NEC Corporation
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License, version 2, as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+#include <assert.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "log.h"
+#include "shm_ring.h"
+#include "wrapper.h"
+
+
+#ifdef UNIT_TESTING
+
+#ifdef error
+#undef error
+#endif
+#define error mock_error
+void mock_error( const char *format, ... );
+
+#endif // UNIT_TESTING
+
+
+#define SHM_RING_ALIGNMENT 8
+#define SHM_RING_MIN_SIZE 4096
+#define SHM_RING_PADDING UINT32_MAX
+#define SHM_RING_ALIGN( _length ) ( ( ( _length ) + SHM_RING_ALIGNMENT - 1 ) & ~( ( uint64_t ) SHM_RING_ALIGNMENT - 1 ) )
+
+
+/*
+ * Positions are free running byte counters, so that head == tail means
+ * empty and head - tail is the number of bytes in use. Fields written
+ * by each side are kept on separate cache lines.
+ */
+struct shm_ring_header {
+  uint64_t size;
+  struct {
+    uint64_t head;
+    uint32_t waiting;
+  } __attribute__( ( aligned( 64 ) ) ) producer;
+  struct {
+    uint64_t tail;
+    uint32_t waiting;
+  } __attribute__( ( aligned( 64 ) ) ) consumer;
+};
+
+#define SHM_RING_DATA_OFFSET SHM_RING_ALIGN( sizeof( shm_ring_header ) )
+
+
+typedef struct {
+  uint32_t length; // length of the record body or SHM_RING_PADDING
+  uint32_t reserved;
+} shm_ring_record;
+
+
+void
+notify_shm_ring_event( int eventfd ) {
+  uint64_t count = 1;
+  if ( write( eventfd, &count, sizeof( count ) ) < 0 && errno != EAGAIN ) {
+    error( "Failed to notify a ring event ( fd = %d, errno = %s [%d] ).", eventfd, strerror( errno ), errno );
+  }
+}
+
+
+void
+clear_shm_ring_event( int eventfd ) {
+  uint64_t count;
+  if ( read( eventfd, &count, sizeof( count ) ) < 0 && errno != EAGAIN ) {
+    error( "Failed to clear a ring event ( fd = %d, errno = %s [%d] ).", eventfd, strerror( errno ), errno );
+  }
+}
+
+
+/*
+ * Tells the other side that something has changed if it has announced
+ * that it is going idle. The fence orders our position update before
+ * the check of the flag, pairing with the one in wait_shm_ring_*().
+ */
+static void
+wake_up( uint32_t *waiting, int eventfd ) {
+  __atomic_thread_fence( __ATOMIC_SEQ_CST );
+  if ( __atomic_load_n( waiting, __ATOMIC_RELAXED ) != 0
+       && __atomic_exchange_n( waiting, 0, __ATOMIC_SEQ_CST ) != 0 ) {
+    notify_shm_ring_event( eventfd );
+  }
+}
+
+
+static shm_ring *
+map_shm_ring( int memfd, size_t mapped_length ) {
+  void *mapped = mmap( NULL, mapped_length, PROT_READ | PROT_WRITE, MAP_SHARED, memfd, 0 );
+  if ( mapped == MAP_FAILED ) {
+    error( "Failed to map a ring ( fd = %d, errno = %s [%d] ).", memfd, strerror( errno ), errno );
+    return NULL;
+  }
+
+  shm_ring *ring = xmalloc( sizeof( shm_ring ) );
+  ring->memfd = memfd;
+  ring->data_eventfd = -1;
+  ring->space_eventfd = -1;
+  ring->header = mapped;
+  ring->data = ( uint8_t * ) mapped + SHM_RING_DATA_OFFSET;
+  ring->mapped_length = mapped_length;
+  ring->next_tail = 0;
+
+  return ring;
+}
+
+
+shm_ring *
+create_shm_ring( size_t size ) {
+  uint64_t ring_size = SHM_RING_MIN_SIZE;
+  while ( ring_size < size ) {
+    ring_size <<= 1;
+  }
+  size_t mapped_length = ( size_t ) ( SHM_RING_DATA_OFFSET + ring_size );
+
+  int memfd = memfd_create( "trema.shm_ring", MFD_CLOEXEC );
+  if ( memfd < 0 ) {
+    error( "Failed to create a memfd ( errno = %s [%d] ).", strerror( errno ), errno );
+    return NULL;
+  }
+  if ( ftruncate( memfd, ( off_t ) mapped_length ) < 0 ) {
+    error( "Failed to resize a memfd ( fd = %d, errno = %s [%d] ).", memfd, strerror( errno ), errno );
+    close( memfd );
+    return NULL;
+  }
+
+  shm_ring *ring = map_shm_ring( memfd, mapped_length );
+  if ( ring == NULL ) {
+    close( memfd );
+    return NULL;
+  }
+  memset( ring->header, 0, sizeof( shm_ring_header ) );
+  ring->header->size = ring_size;
+  ring->header->consumer.waiting = 1;
+
+  ring->data_eventfd = eventfd( 0, EFD_NONBLOCK | EFD_CLOEXEC );
+  ring->space_eventfd = eventfd( 0, EFD_NONBLOCK | EFD_CLOEXEC );
+  if ( ring->data_eventfd < 0 || ring->space_eventfd < 0 ) {
+    error( "Failed to create an eventfd ( errno = %s [%d] ).", strerror( errno ), errno );
+    delete_shm_ring( ring );
+    return NULL;
+  }
+
+  return ring;
+}
+
+
+/**
+ * maps a ring created by the peer. the ring takes ownership of the fds
+ * even if it fails.
+ */
+shm_ring *
+attach_shm_ring( int memfd, int data_eventfd, int space_eventfd ) {
+  struct stat st;
+  shm_ring *ring = NULL;
+
+  if ( fstat( memfd, &st ) == 0 && ( size_t ) st.st_size > SHM_RING_DATA_OFFSET ) {
+    ring = map_shm_ring( memfd, ( size_t ) st.st_size );
+  }
+  if ( ring == NULL ) {
+    error( "Failed to attach a ring ( fd = %d ).", memfd );
+    close( memfd );
+    close( data_eventfd );
+    close( space_eventfd );
+    return NULL;
+  }
+  ring->data_eventfd = data_eventfd;
+  ring->space_eventfd = space_eventfd;
+
+  uint64_t size = ring->header->size;
+  if ( size < SHM_RING_MIN_SIZE || ( size & ( size - 1 ) ) != 0 || SHM_RING_DATA_OFFSET + size != ring->mapped_length ) {
+    error( "Invalid ring size ( fd = %d, size = %" PRIu64 ", mapped_length = %zu ).", memfd, size, ring->mapped_length );
+    delete_shm_ring( ring );
+    return NULL;
+  }
+
+  return ring;
+}
+
+
+void
+delete_shm_ring( shm_ring *ring ) {
+  assert( ring != NULL );
+
+  munmap( ring->header, ring->mapped_length );
+  close( ring->memfd );
+  if ( ring->data_eventfd >= 0 ) {
+    close( ring->data_eventfd );
+  }
+  if ( ring->space_eventfd >= 0 ) {
+    close( ring->space_eventfd );
+  }
+  xfree( ring );
+}
+
+
+/*
+ * Returns how many bytes a record of record_length occupies when written
+ * at head, including the padding needed to keep it contiguous.
+ */
+static uint64_t
+required_space( shm_ring *ring, uint64_t head, uint64_t record_length ) {
+  uint64_t contiguous = ring->header->size - ( head & ( ring->header->size - 1 ) );
+  return record_length <= contiguous ? record_length : contiguous + record_length;
+}
+
+
+/**
+ * returns the longest record body a ring accepts. A record takes at most
+ * half of the ring, so that it fits wherever the head is once the ring
+ * has drained, even if it has to be wrapped around.
+ */
+size_t
+shm_ring_max_length( shm_ring *ring ) {
+  assert( ring != NULL );
+
+  return ( size_t ) ( ring->header->size / 2 - sizeof( shm_ring_record ) );
+}
+
+
+bool
+write_shm_ring( shm_ring *ring, const void *header, size_t header_length, const void *body, size_t body_length ) {
+  assert( ring != NULL );
+
+  size_t length = header_length + body_length;
+  uint64_t size = ring->header->size;
+  uint64_t record_length = SHM_RING_ALIGN( sizeof( shm_ring_record ) + length );
+  if ( length >= SHM_RING_PADDING || length > shm_ring_max_length( ring ) ) {
+    error( "Too large record for a ring ( length = %zu, ring size = %" PRIu64 " ).", length, size );
+    return false;
+  }
+
+  uint64_t head = ring->header->producer.head;
+  uint64_t tail = __atomic_load_n( &ring->header->consumer.tail, __ATOMIC_ACQUIRE );
+  if ( size - ( head - tail ) < required_space( ring, head, record_length ) ) {
+    return false;
+  }
+
+  uint64_t offset = head & ( size - 1 );
+  shm_ring_record *record = ( shm_ring_record * ) ( ring->data + offset );
+  if ( record_length > size - offset ) {
+    record->length = SHM_RING_PADDING;
+    head += size - offset;
+    record = ( shm_ring_record * ) ring->data;
+  }
+  record->length = ( uint32_t ) length;
+  memcpy( record + 1, header, header_length );
+  if ( body_length > 0 ) {
+    memcpy( ( uint8_t * ) ( record + 1 ) + header_length, body, body_length );
+  }
+  __atomic_store_n( &ring->header->producer.head, head + record_length, __ATOMIC_RELEASE );
+
+  wake_up( &ring->header->consumer.waiting, ring->data_eventfd );
+
+  return true;
+}
+
+
+void *
+peek_shm_ring( shm_ring *ring, size_t *length ) {
+  assert( ring != NULL );
+  assert( length != NULL );
+
+  uint64_t size = ring->header->size;
+  uint64_t tail = ring->header->consumer.tail;
+  uint64_t head = __atomic_load_n( &ring->header->producer.head, __ATOMIC_ACQUIRE );
+  if ( head == tail ) {
+    return NULL;
+  }
+
+  uint64_t offset = tail & ( size - 1 );
+  shm_ring_record *record = ( shm_ring_record * ) ( ring->data + offset );
+  if ( record->length == SHM_RING_PADDING ) {
+    tail += size - offset;
+    record = ( shm_ring_record * ) ring->data;
+  }
+  *length = record->length;
+  ring->next_tail = tail + SHM_RING_ALIGN( sizeof( shm_ring_record ) + record->length );
+
+  return record + 1;
+}
+
+
+void
+consume_shm_ring( shm_ring *ring ) {
+  assert( ring != NULL );
+  assert( ring->next_tail > ring->header->consumer.tail );
+
+  __atomic_store_n( &ring->header->consumer.tail, ring->next_tail, __ATOMIC_RELEASE );
+
+  wake_up( &ring->header->producer.waiting, ring->space_eventfd );
+}
+
+
+bool
+shm_ring_is_empty( shm_ring *ring ) {
+  assert( ring != NULL );
+
+  return __atomic_load_n( &ring->header->producer.head, __ATOMIC_ACQUIRE ) == ring->header->consumer.tail;
+}
+
+
+/**
+ * announces that the consumer is going to sleep on data_eventfd.
+ * returns true if data has arrived in the meantime and the consumer
+ * should go on reading instead.
+ */
+bool
+wait_shm_ring_data( shm_ring *ring ) {
+  assert( ring != NULL );
+
+  __atomic_store_n( &ring->header->consumer.waiting, 1, __ATOMIC_SEQ_CST );
+  if ( shm_ring_is_empty( ring ) ) {
+    return false;
+  }
+  __atomic_store_n( &ring->header->consumer.waiting, 0, __ATOMIC_RELAXED );
+
+  return true;
+}
+
+
+/**
+ * announces that the producer is going to sleep on space_eventfd until
+ * a record body of length fits. returns true if it fits already.
+ */
+bool
+wait_shm_ring_space( shm_ring *ring, size_t length ) {
+  assert( ring != NULL );
+
+  uint64_t record_length = SHM_RING_ALIGN( sizeof( shm_ring_record ) + length );
+  uint64_t head = ring->header->producer.head;
+
+  __atomic_store_n( &ring->header->producer.waiting, 1, __ATOMIC_SEQ_CST );
+  uint64_t tail = __atomic_load_n( &ring->header->consumer.tail, __ATOMIC_ACQUIRE );
+  if ( ring->header->size - ( head - tail ) < required_space( ring, head, record_length ) ) {
+    return false;
+  }
+  __atomic_store_n( &ring->header->producer.waiting, 0, __ATOMIC_RELAXED );
+
+  return true;
+}
+
+
+/*
+ * Local variables:
+ * c-basic-offset: 2
+ * indent-tabs-mode: nil
+ * End:
+ */
@@ -0,0 +1,77 @@
+/*
+ * Single-producer single-consumer ring buffers in shared memory.
+ *
+ * Copyright (C) 2008-2011 NEC Corporation
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License, version 2, as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+#ifndef SHM_RING_H
+#define SHM_RING_H
+
+
+#include <stddef.h>
+#include <stdint.h>
+#include "bool.h"
+
+
+/*
+ * A ring lives in a memfd that is mapped by exactly one producer process
+ * and one consumer process. Records are variable length and are always
+ * contiguous in memory, so the consumer may read them in place.
+ *
+ * Each side sleeps on an eventfd of its own. A side that is about to go
+ * idle announces it with wait_shm_ring_data() or wait_shm_ring_space(),
+ * and the other side writes to its eventfd only in that case, so no
+ * system call is made while both sides are busy.
+ */
+typedef struct shm_ring_header shm_ring_header;
+
+typedef struct {
+  int memfd;
+  int data_eventfd;  // signalled by the producer when data is written
+  int space_eventfd; // signalled by the consumer when space is freed
+  shm_ring_header *header;
+  uint8_t *data;
+  size_t mapped_length;
+  uint64_t next_tail; // consumer position after the peeked record
+} shm_ring;
+
+
+shm_ring *create_shm_ring( size_t size );
+shm_ring *attach_shm_ring( int memfd, int data_eventfd, int space_eventfd );
+void delete_shm_ring( shm_ring *ring );
+
+size_t shm_ring_max_length( shm_ring *ring );
+bool write_shm_ring( shm_ring *ring, const void *header, size_t header_length, const void *body, size_t body_length );
+void *peek_shm_ring( shm_ring *ring, size_t *length );
+void consume_shm_ring( shm_ring *ring );
+bool shm_ring_is_empty( shm_ring *ring );
+
+bool wait_shm_ring_data( shm_ring *ring );
+bool wait_shm_ring_space( shm_ring *ring, size_t length );
+void notify_shm_ring_event( int eventfd );
+void clear_shm_ring_event( int eventfd );
+
+
+#endif // SHM_RING_H
+
+
+/*
+ * Local variables:
+ * c-basic-offset: 2
+ * indent-tabs-mode: nil
+ * End:
+ */
@@ -19,8 +19,18 @@
 
 
 #include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
 #include <inttypes.h>
+#include <limits.h>
 #include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
 #include "bool.h"
 #include "hash_table.h"
 #include "log.h"
@@ -70,11 +80,50 @@ typedef struct {
 } stat_entry;
 
 
+/*
+ * Counters registered with register_stat_counter() are incremented in
+ * a thread-local block without any lock, and folded into the
+ * stat entry of the same key whenever statistics are read. collected
+ * holds the total that has already been added to the entry, and
+ * retired the counts of threads that have exited. Histograms
+ * registered with register_stat_histogram() live in the same block and
+ * are merged across threads when they are read.
+ */
+typedef struct stat_counters {
+  uint64_t values[ STAT_MAX_COUNTERS ];
+  stat_histogram histograms[ STAT_MAX_HISTOGRAMS ];
+  struct stat_counters *next;
+} stat_counters;
+
+static char counter_keys[ STAT_MAX_COUNTERS ][ STAT_KEY_LENGTH ];
+static uint64_t counters_collected[ STAT_MAX_COUNTERS ];
+static uint64_t counters_retired[ STAT_MAX_COUNTERS ];
+static int number_of_counters = 0;
+static char histogram_keys[ STAT_MAX_HISTOGRAMS ][ STAT_KEY_LENGTH ];
+static stat_histogram histograms_retired[ STAT_MAX_HISTOGRAMS ];
+static int number_of_histograms = 0;
+static stat_counters *thread_counters = NULL;
+static pthread_key_t thread_counters_key;
+static pthread_once_t thread_counters_key_once = PTHREAD_ONCE_INIT;
+static __thread stat_counters self_counters;
+static __thread bool self_counters_linked = false;
+
+#define STAT_SEGMENT_COUNTERS_OFFSET sizeof( stat_segment_header )
+#define STAT_SEGMENT_HISTOGRAMS_OFFSET ( STAT_SEGMENT_COUNTERS_OFFSET + sizeof( stat_segment_counter ) * STAT_MAX_COUNTERS )
+#define STAT_SEGMENT_LENGTH ( STAT_SEGMENT_HISTOGRAMS_OFFSET + sizeof( stat_segment_histogram ) * STAT_MAX_HISTOGRAMS )
+#define STAT_SEGMENT_READ_RETRIES 1000
+
+static stat_segment_header *segment = NULL;
+static char segment_path[ PATH_MAX ];
+
+
 static void
 create_stats_table() {
   assert( stats == NULL );
   stats = create_hash( compare_string, hash_string );
   assert( stats != NULL );
+  // stats_table_mutex already serializes every access
+  set_hash_concurrency( stats, HASH_TABLE_UNLOCKED );
 }
 
 
@@ -95,6 +144,104 @@ delete_stats_table() {
 }
 
 
+static void
+retire_thread_counters( void *value ) {
+  stat_counters *counters = value;
+
+  pthread_mutex_lock( &stats_table_mutex );
+  stat_counters **c;
+  for ( c = &thread_counters; *c != NULL; c = &( *c )->next ) {
+    if ( *c == counters ) {
+      *c = counters->next;
+      break;
+    }
+  }
+  int id;
+  for ( id = 0; id < number_of_counters; id++ ) {
+    counters_retired[ id ] += counters->values[ id ];
+  }
+  for ( id = 0; id < number_of_histograms; id++ ) {
+    merge_stat_histogram( &histograms_retired[ id ], &counters->histograms[ id ] );
+  }
+  pthread_mutex_unlock( &stats_table_mutex );
+}
+
+
+static void
+create_thread_counters_key( void ) {
+  pthread_key_create( &thread_counters_key, retire_thread_counters );
+}
+
+
+static void
+link_thread_counters( void ) {
+  pthread_once( &thread_counters_key_once, create_thread_counters_key );
+  pthread_setspecific( thread_counters_key, &self_counters );
+
+  pthread_mutex_lock( &stats_table_mutex );
+  self_counters.next = thread_counters;
+  thread_counters = &self_counters;
+  pthread_mutex_unlock( &stats_table_mutex );
+
+  self_counters_linked = true;
+}
+
+
+// Must be called with stats_table_mutex held.
+static void
+collect_stat_counters( void ) {
+  int id;
+  for ( id = 0; id < number_of_counters; id++ ) {
+    uint64_t total = counters_retired[ id ];
+    stat_counters *c;
+    for ( c = thread_counters; c != NULL; c = c->next ) {
+      total += __atomic_load_n( &c->values[ id ], __ATOMIC_RELAXED );
+    }
+    if ( total == counters_collected[ id ] ) {
+      continue;
+    }
+
+    stat_entry *entry = lookup_hash_entry( stats, counter_keys[ id ] );
+    if ( entry == NULL ) {
+      if ( !add_stat_entry( counter_keys[ id ] ) ) {
+        continue;
+      }
+      entry = lookup_hash_entry( stats, counter_keys[ id ] );
+    }
+    entry->value += total - counters_collected[ id ];
+    counters_collected[ id ] = total;
+  }
+}
+
+
+static void
+clear_thread_values( uint64_t *values, size_t length ) {
+  size_t i;
+  for ( i = 0; i < length; i++ ) {
+    __atomic_store_n( &values[ i ], 0, __ATOMIC_RELAXED );
+  }
+}
+
+
+static void
+reset_stat_counters( void ) {
+  number_of_counters = 0;
+  number_of_histograms = 0;
+  memset( counters_collected, 0, sizeof( counters_collected ) );
+  memset( counters_retired, 0, sizeof( counters_retired ) );
+  memset( histograms_retired, 0, sizeof( histograms_retired ) );
+
+  stat_counters *c;
+  for ( c = thread_counters; c != NULL; c = c->next ) {
+    clear_thread_values( c->values, STAT_MAX_COUNTERS );
+    int id;
+    for ( id = 0; id < STAT_MAX_HISTOGRAMS; id++ ) {
+      clear_thread_values( ( uint64_t * ) &c->histograms[ id ], sizeof( stat_histogram ) / sizeof( uint64_t ) );
+    }
+  }
+}
+
+
 bool
 init_stat() {
   debug( "Initializing statistics collector." );
@@ -119,7 +266,9 @@ finalize_stat() {
   assert( stats != NULL );
 
   pthread_mutex_lock( &stats_table_mutex );
+  close_stat_segment();
   delete_stats_table();
+  reset_stat_counters();
   pthread_mutex_unlock( &stats_table_mutex );
 
   return true;
@@ -177,6 +326,475 @@ increment_stat( const char *key ) {
 }
 
 
+/**
+ * returns an id for a counter named key that increment_stat_id() can
+ * bump without building or hashing the key. Registering the same key
+ * again returns the same id. returns -1 if there is no room left.
+ */
+int
+register_stat_counter( const char *key ) {
+  assert( key != NULL );
+
+  pthread_mutex_lock( &stats_table_mutex );
+
+  int id;
+  for ( id = 0; id < number_of_counters; id++ ) {
+    if ( strcmp( counter_keys[ id ], key ) == 0 ) {
+      pthread_mutex_unlock( &stats_table_mutex );
+      return id;
+    }
+  }
+  if ( number_of_counters == STAT_MAX_COUNTERS ) {
+    error( "Too many statistic counters ( key = %s ).", key );
+    pthread_mutex_unlock( &stats_table_mutex );
+    return -1;
+  }
+
+  id = number_of_counters;
+  strncpy( counter_keys[ id ], key, STAT_KEY_LENGTH );
+  counter_keys[ id ][ STAT_KEY_LENGTH - 1 ] = '\0';
+  counters_collected[ id ] = 0;
+  counters_retired[ id ] = 0;
+  number_of_counters++;
+
+  pthread_mutex_unlock( &stats_table_mutex );
+
+  return id;
+}
+
+
+void
+increment_stat_id( int id ) {
+  add_stat_id( id, 1 );
+}
+
+
+void
+add_stat_id( int id, uint64_t value ) {
+  if ( id < 0 ) {
+    return;
+  }
+  assert( id < STAT_MAX_COUNTERS );
+
+  if ( !self_counters_linked ) {
+    link_thread_counters();
+  }
+  // only this thread writes the slot, so a plain add is not lost.
+  __atomic_store_n( &self_counters.values[ id ], self_counters.values[ id ] + value, __ATOMIC_RELAXED );
+}
+
+
+static int
+histogram_bucket( uint64_t value ) {
+  if ( value < ( 1 << STAT_HISTOGRAM_SUB_BITS ) ) {
+    return ( int ) value;
+  }
+  if ( value >> STAT_HISTOGRAM_MAX_BITS != 0 ) {
+    return STAT_HISTOGRAM_BUCKETS - 1;
+  }
+  int msb = 63 - __builtin_clzll( value );
+  int shift = msb - STAT_HISTOGRAM_SUB_BITS;
+  int sub = ( int ) ( value >> shift ) & ( ( 1 << STAT_HISTOGRAM_SUB_BITS ) - 1 );
+
+  return ( ( shift + 1 ) << STAT_HISTOGRAM_SUB_BITS ) + sub;
+}
+
+
+// the largest value that falls into a bucket.
+static uint64_t
+histogram_bucket_limit( int bucket ) {
+  int shift = ( bucket >> STAT_HISTOGRAM_SUB_BITS ) - 1;
+  if ( shift < 0 ) {
+    return ( uint64_t ) bucket;
+  }
+  uint64_t sub = ( uint64_t ) ( bucket & ( ( 1 << STAT_HISTOGRAM_SUB_BITS ) - 1 ) );
+  uint64_t low = ( ( 1ULL << STAT_HISTOGRAM_SUB_BITS ) | sub ) << shift;
+
+  return low + ( 1ULL << shift ) - 1;
+}
+
+
+/**
+ * returns an id for a histogram named key that record_stat_value() can
+ * add values to. Registering the same key again returns the same id.
+ * returns -1 if there is no room left. Histogram ids are separate from
+ * counter ids.
+ */
+int
+register_stat_histogram( const char *key ) {
+  assert( key != NULL );
+
+  pthread_mutex_lock( &stats_table_mutex );
+
+  int id;
+  for ( id = 0; id < number_of_histograms; id++ ) {
+    if ( strcmp( histogram_keys[ id ], key ) == 0 ) {
+      pthread_mutex_unlock( &stats_table_mutex );
+      return id;
+    }
+  }
+  if ( number_of_histograms == STAT_MAX_HISTOGRAMS ) {
+    error( "Too many statistic histograms ( key = %s ).", key );
+    pthread_mutex_unlock( &stats_table_mutex );
+    return -1;
+  }
+
+  id = number_of_histograms;
+  strncpy( histogram_keys[ id ], key, STAT_KEY_LENGTH );
+  histogram_keys[ id ][ STAT_KEY_LENGTH - 1 ] = '\0';
+  memset( &histograms_retired[ id ], 0, sizeof( stat_histogram ) );
+  number_of_histograms++;
+
+  pthread_mutex_unlock( &stats_table_mutex );
+
+  return id;
+}
+
+
+void
+record_stat_value( int id, uint64_t value ) {
+  if ( id < 0 ) {
+    return;
+  }
+  assert( id < STAT_MAX_HISTOGRAMS );
+
+  if ( !self_counters_linked ) {
+    link_thread_counters();
+  }
+  // only this thread writes the histogram, see increment_stat_id().
+  stat_histogram *h = &self_counters.histograms[ id ];
+  int bucket = histogram_bucket( value );
+  __atomic_store_n( &h->buckets[ bucket ], h->buckets[ bucket ] + 1, __ATOMIC_RELAXED );
+  __atomic_store_n( &h->count, h->count + 1, __ATOMIC_RELAXED );
+  __atomic_store_n( &h->sum, h->sum + value, __ATOMIC_RELAXED );
+  if ( value > h->max ) {
+    __atomic_store_n( &h->max, value, __ATOMIC_RELAXED );
+  }
+}
+
+
+void
+merge_stat_histogram( stat_histogram *to, const stat_histogram *from ) {
+  assert( to != NULL );
+  assert( from != NULL );
+
+  int i;
+  for ( i = 0; i < STAT_HISTOGRAM_BUCKETS; i++ ) {
+    to->buckets[ i ] += __atomic_load_n( &from->buckets[ i ], __ATOMIC_RELAXED );
+  }
+  to->count += __atomic_load_n( &from->count, __ATOMIC_RELAXED );
+  to->sum += __atomic_load_n( &from->sum, __ATOMIC_RELAXED );
+  uint64_t max = __atomic_load_n( &from->max, __ATOMIC_RELAXED );
+  if ( max > to->max ) {
+    to->max = max;
+  }
+}
+
+
+// Must be called with stats_table_mutex held.
+static void
+collect_stat_histogram( int id, stat_histogram *histogram ) {
+  *histogram = histograms_retired[ id ];
+
+  stat_counters *c;
+  for ( c = thread_counters; c != NULL; c = c->next ) {
+    merge_stat_histogram( histogram, &c->histograms[ id ] );
+  }
+  // buckets may be ahead of count while a thread is recording.
+  histogram->count = 0;
+  int i;
+  for ( i = 0; i < STAT_HISTOGRAM_BUCKETS; i++ ) {
+    histogram->count += histogram->buckets[ i ];
+  }
+}
+
+
+/**
+ * merges the values recorded by all threads into histogram. returns
+ * false if id is not a registered histogram.
+ */
+bool
+read_stat_histogram( int id, stat_histogram *histogram ) {
+  assert( histogram != NULL );
+
+  pthread_mutex_lock( &stats_table_mutex );
+
+  if ( id < 0 || id >= number_of_histograms ) {
+    pthread_mutex_unlock( &stats_table_mutex );
+    return false;
+  }
+  collect_stat_histogram( id, histogram );
+
+  pthread_mutex_unlock( &stats_table_mutex );
+
+  return true;
+}
+
+
+/**
+ * returns the value below which percentile percent of the recorded
+ * values fall, rounded up to the end of its bucket but never above the
+ * largest value recorded. returns 0 for an empty histogram.
+ */
+uint64_t
+stat_histogram_percentile( const stat_histogram *histogram, double percentile ) {
+  assert( histogram != NULL );
+
+  if ( histogram->count == 0 ) {
+    return 0;
+  }
+  double position = percentile / 100.0 * ( double ) histogram->count;
+  uint64_t rank = ( uint64_t ) position;
+  if ( ( double ) rank < position || rank == 0 ) {
+    rank++;
+  }
+
+  uint64_t seen = 0;
+  int i;
+  for ( i = 0; i < STAT_HISTOGRAM_BUCKETS; i++ ) {
+    seen += histogram->buckets[ i ];
+    if ( seen >= rank ) {
+      break;
+    }
+  }
+  // the last bucket also holds every value beyond it.
+  if ( i >= STAT_HISTOGRAM_BUCKETS - 1 ) {
+    return histogram->max;
+  }
+  uint64_t limit = histogram_bucket_limit( i );
+
+  return limit < histogram->max ? limit : histogram->max;
+}
+
+
+static void
+stat_segment_path( char *path, const char *directory, const char *name ) {
+  snprintf( path, PATH_MAX, "%s/%s.stats", directory, name );
+  path[ PATH_MAX - 1 ] = '\0';
+}
+
+
+/**
+ * creates the segment that publish_stats() writes to. the segment is
+ * filled in a temporary file and renamed into place, so that a reader
+ * never maps a partially initialized one.
+ */
+bool
+open_stat_segment( const char *directory, const char *name ) {
+  assert( directory != NULL );
+  assert( name != NULL );
+
+  if ( segment != NULL ) {
+    close_stat_segment();
+  }
+
+  char path[ PATH_MAX ];
+  stat_segment_path( path, directory, name );
+  char temporary_path[ PATH_MAX ];
+  int length = snprintf( temporary_path, sizeof( temporary_path ), "%s.%d", path, getpid() );
+  if ( length < 0 || ( size_t ) length >= sizeof( temporary_path ) ) {
+    error( "Too long statistics segment path ( path = %s ).", path );
+    return false;
+  }
+
+  int fd = open( temporary_path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644 );
+  if ( fd < 0 ) {
+    error( "Failed to create a statistics segment ( path = %s, errno = %s [%d] ).", temporary_path, strerror( errno ), errno );
+    return false;
+  }
+  if ( ftruncate( fd, ( off_t ) STAT_SEGMENT_LENGTH ) < 0 ) {
+    error( "Failed to resize a statistics segment ( path = %s, errno = %s [%d] ).", temporary_path, strerror( errno ), errno );
+    close( fd );
+    unlink( temporary_path );
+    return false;
+  }
+  void *mapped = mmap( NULL, STAT_SEGMENT_LENGTH, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0 );
+  close( fd );
+  if ( mapped == MAP_FAILED ) {
+    error( "Failed to map a statistics segment ( path = %s, errno = %s [%d] ).", temporary_path, strerror( errno ), errno );
+    unlink( temporary_path );
+    return false;
+  }
+
+  stat_segment_header *header = mapped;
+  header->magic = STAT_SEGMENT_MAGIC;
+  header->version = STAT_SEGMENT_VERSION;
+  header->pid = ( uint32_t ) getpid();
+  header->key_length = STAT_KEY_LENGTH;
+  header->histogram_buckets = STAT_HISTOGRAM_BUCKETS;
+  header->histogram_sub_bits = STAT_HISTOGRAM_SUB_BITS;
+  header->counters_offset = STAT_SEGMENT_COUNTERS_OFFSET;
+  header->histograms_offset = STAT_SEGMENT_HISTOGRAMS_OFFSET;
+
+  if ( rename( temporary_path, path ) < 0 ) {
+    error( "Failed to rename a statistics segment ( path = %s, errno = %s [%d] ).", path, strerror( errno ), errno );
+    munmap( mapped, STAT_SEGMENT_LENGTH );
+    unlink( temporary_path );
+    return false;
+  }
+  segment = header;
+  strncpy( segment_path, path, PATH_MAX );
+
+  return true;
+}
+
+
+bool
+rename_stat_segment( const char *directory, const char *old, const char *new ) {
+  assert( directory != NULL );
+  assert( old != NULL );
+  assert( new != NULL );
+
+  char old_path[ PATH_MAX ];
+  char new_path[ PATH_MAX ];
+  stat_segment_path( old_path, directory, old );
+  stat_segment_path( new_path, directory, new );
+
+  if ( rename( old_path, new_path ) < 0 ) {
+    error( "Failed to rename a statistics segment from %s to %s ( errno = %s [%d] ).", old_path, new_path, strerror( errno ), errno );
+    return false;
+  }
+  if ( segment != NULL && strcmp( segment_path, old_path ) == 0 ) {
+    strncpy( segment_path, new_path, PATH_MAX );
+  }
+
+  return true;
+}
+
+
+void
+close_stat_segment( void ) {
+  if ( segment == NULL ) {
+    return;
+  }
+
+  munmap( segment, STAT_SEGMENT_LENGTH );
+  segment = NULL;
+  unlink( segment_path );
+  segment_path[ 0 ] = '\0';
+}
+
+
+/**
+ * copies every statistic into the segment opened by
+ * open_stat_segment(). readers are not blocked; they retry if they
+ * raced with this.
+ */
+void
+publish_stats( void ) {
+  if ( segment == NULL ) {
+    return;
+  }
+  assert( stats != NULL );
+
+  pthread_mutex_lock( &stats_table_mutex );
+
+  collect_stat_counters();
+
+  uint64_t sequence = segment->sequence;
+  __atomic_store_n( &segment->sequence, sequence + 1, __ATOMIC_RELAXED );
+  __atomic_thread_fence( __ATOMIC_RELEASE );
+
+  stat_segment_counter *counters = ( stat_segment_counter * ) ( ( char * ) segment + segment->counters_offset );
+  uint32_t n_counters = 0;
+  hash_iterator iter;
+  hash_entry *e;
+  init_hash_iterator( stats, &iter );
+  while ( ( e = iterate_hash_next( &iter ) ) != NULL && n_counters < STAT_MAX_COUNTERS ) {
+    stat_entry *st = e->value;
+    memcpy( counters[ n_counters ].key, st->key, STAT_KEY_LENGTH );
+    counters[ n_counters ].value = st->value;
+    n_counters++;
+  }
+  segment->number_of_counters = n_counters;
+
+  stat_segment_histogram *histograms = ( stat_segment_histogram * ) ( ( char * ) segment + segment->histograms_offset );
+  int id;
+  for ( id = 0; id < number_of_histograms; id++ ) {
+    memcpy( histograms[ id ].key, histogram_keys[ id ], STAT_KEY_LENGTH );
+    collect_stat_histogram( id, &histograms[ id ].histogram );
+  }
+  segment->number_of_histograms = ( uint32_t ) number_of_histograms;
+
+  struct timespec now;
+  clock_gettime( CLOCK_REALTIME, &now );
+  segment->updated_at = ( uint64_t ) now.tv_sec * 1000000000 + ( uint64_t ) now.tv_nsec;
+
+  __atomic_store_n( &segment->sequence, sequence + 2, __ATOMIC_RELEASE );
+
+  pthread_mutex_unlock( &stats_table_mutex );
+}
+
+
+static bool
+valid_stat_segment( const stat_segment_header *header, size_t length ) {
+  return header->magic == STAT_SEGMENT_MAGIC
+         && header->version == STAT_SEGMENT_VERSION
+         && header->key_length == STAT_KEY_LENGTH
+         && header->histogram_buckets == STAT_HISTOGRAM_BUCKETS
+         && header->number_of_counters <= STAT_MAX_COUNTERS
+         && header->number_of_histograms <= STAT_MAX_HISTOGRAMS
+         && header->counters_offset + sizeof( stat_segment_counter ) * header->number_of_counters <= length
+         && header->histograms_offset + sizeof( stat_segment_histogram ) * header->number_of_histograms <= length;
+}
+
+
+/**
+ * returns a consistent copy of the segment published by process name,
+ * or NULL if there is none. the copy must be freed with xfree().
+ */
+stat_segment_header *
+read_stat_segment( const char *directory, const char *name ) {
+  assert( directory != NULL );
+  assert( name != NULL );
+
+  char path[ PATH_MAX ];
+  stat_segment_path( path, directory, name );
+
+  int fd = open( path, O_RDONLY | O_CLOEXEC );
+  if ( fd < 0 ) {
+    return NULL;
+  }
+  struct stat st;
+  if ( fstat( fd, &st ) < 0 || ( size_t ) st.st_size < sizeof( stat_segment_header ) ) {
+    close( fd );
+    return NULL;
+  }
+  size_t length = ( size_t ) st.st_size;
+  void *mapped = mmap( NULL, length, PROT_READ, MAP_SHARED, fd, 0 );
+  close( fd );
+  if ( mapped == MAP_FAILED ) {
+    error( "Failed to map a statistics segment ( path = %s, errno = %s [%d] ).", path, strerror( errno ), errno );
+    return NULL;
+  }
+
+  const stat_segment_header *shared = mapped;
+  stat_segment_header *copy = xmalloc( length );
+  int retries;
+  for ( retries = 0; retries < STAT_SEGMENT_READ_RETRIES; retries++ ) {
+    uint64_t sequence = __atomic_load_n( &shared->sequence, __ATOMIC_ACQUIRE );
+    if ( sequence % 2 == 0 ) {
+      memcpy( copy, shared, length );
+      __atomic_thread_fence( __ATOMIC_ACQUIRE );
+      if ( __atomic_load_n( &shared->sequence, __ATOMIC_RELAXED ) == sequence ) {
+        copy->sequence = sequence;
+        break;
+      }
+    }
+    sched_yield();
+  }
+  munmap( mapped, length );
+
+  if ( retries == STAT_SEGMENT_READ_RETRIES || !valid_stat_segment( copy, length ) ) {
+    error( "Failed to read a statistics segment ( path = %s ).", path );
+    xfree( copy );
+    return NULL;
+  }
+
+  return copy;
+}
+
+
 void
 dump_stats() {
   assert( stats != NULL );
@@ -187,6 +805,8 @@ dump_stats() {
 
   pthread_mutex_lock( &stats_table_mutex );
 
+  collect_stat_counters();
+
   info( "Statistics:" );
 
   init_hash_iterator( stats, &iter );
@@ -196,6 +816,21 @@ dump_stats() {
     n_stats++;
   }
 
+  int id;
+  for ( id = 0; id < number_of_histograms; id++ ) {
+    stat_histogram h;
+    collect_stat_histogram( id, &h );
+    if ( h.count == 0 ) {
+      continue;
+    }
+    info( "%s: count = %" PRIu64 ", mean = %" PRIu64 ", p50 = %" PRIu64 ", p90 = %" PRIu64
+          ", p99 = %" PRIu64 ", p99.9 = %" PRIu64 ", max = %" PRIu64,
+          histogram_keys[ id ], h.count, h.sum / h.count,
+          stat_histogram_percentile( &h, 50 ), stat_histogram_percentile( &h, 90 ),
+          stat_histogram_percentile( &h, 99 ), stat_histogram_percentile( &h, 99.9 ), h.max );
+    n_stats++;
+  }
+
   if ( n_stats == 0 ) {
     info( "No statistics found." );
   }
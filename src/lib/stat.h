@@ -21,15 +21,91 @@
 
 
 #ifndef STAT_H
+#define STAT_H
+
+
+#include <stdint.h>
+#include "bool.h"
 
 
 #define STAT_KEY_LENGTH 256
+#define STAT_MAX_COUNTERS 1024
+#define STAT_MAX_HISTOGRAMS 16
+
+/*
+ * Histograms have log-linear buckets: values below
+ * 2^STAT_HISTOGRAM_SUB_BITS have a bucket each, and every power of two
+ * above is split into 2^STAT_HISTOGRAM_SUB_BITS equal buckets, so a
+ * recorded value is known within 12.5%. Values of
+ * 2^STAT_HISTOGRAM_MAX_BITS (about 18 minutes in nanoseconds) and
+ * above fall into the last bucket.
+ */
+#define STAT_HISTOGRAM_SUB_BITS 3
+#define STAT_HISTOGRAM_MAX_BITS 40
+#define STAT_HISTOGRAM_BUCKETS ( ( STAT_HISTOGRAM_MAX_BITS - STAT_HISTOGRAM_SUB_BITS + 1 ) << STAT_HISTOGRAM_SUB_BITS )
+
+
+typedef struct {
+  uint64_t count;
+  uint64_t sum;
+  uint64_t max;
+  uint64_t buckets[ STAT_HISTOGRAM_BUCKETS ];
+} stat_histogram;
+
+
+/*
+ * Each process publishes its statistics into a file of this layout,
+ * <trema tmp>/<name>.stats, that other processes may map and read
+ * without asking the publisher. Readers copy the segment and retry
+ * unless sequence was the same even number before and after the copy.
+ * Counters and histograms start at the given offsets from the header.
+ */
+#define STAT_SEGMENT_MAGIC 0x54415453 // "STAT"
+#define STAT_SEGMENT_VERSION 1
+
+typedef struct {
+  uint32_t magic;
+  uint32_t version;
+  uint64_t sequence;
+  uint64_t updated_at; // CLOCK_REALTIME in nanoseconds
+  uint32_t pid;
+  uint32_t key_length;
+  uint32_t number_of_counters;
+  uint32_t number_of_histograms;
+  uint32_t histogram_buckets;
+  uint32_t histogram_sub_bits;
+  uint64_t counters_offset;
+  uint64_t histograms_offset;
+} stat_segment_header;
+
+typedef struct {
+  char key[ STAT_KEY_LENGTH ];
+  uint64_t value;
+} stat_segment_counter;
+
+typedef struct {
+  char key[ STAT_KEY_LENGTH ];
+  stat_histogram histogram;
+} stat_segment_histogram;
 
 
 bool init_stat( void );
 bool finalize_stat( void );
 bool add_stat_entry( const char *key );
 void increment_stat( const char *key );
+int register_stat_counter( const char *key );
+void increment_stat_id( int id );
+void add_stat_id( int id, uint64_t value );
+int register_stat_histogram( const char *key );
+void record_stat_value( int id, uint64_t value );
+bool read_stat_histogram( int id, stat_histogram *histogram );
+void merge_stat_histogram( stat_histogram *to, const stat_histogram *from );
+uint64_t stat_histogram_percentile( const stat_histogram *histogram, double percentile );
+bool open_stat_segment( const char *directory, const char *name );
+bool rename_stat_segment( const char *directory, const char *old, const char *new );
+void close_stat_segment( void );
+void publish_stats( void );
+stat_segment_header *read_stat_segment( const char *directory, const char *name );
 void dump_stats();
 
 
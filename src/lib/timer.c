@@ -20,7 +20,11 @@
 
 #include <assert.h>
 #include <errno.h>
-#include "doubly_linked_list.h"
+#include <inttypes.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/timerfd.h>
+#include "hash_map.h"
 #include "log.h"
 #include "timer.h"
 #include "wrapper.h"
@@ -51,44 +55,109 @@ void mock_debug( const char *format, ... );
 #endif // UNIT_TESTING
 
 
+/*
+ * Timers are kept in a hierarchical timing wheel with a resolution of
+ * one millisecond. Level n has TIMER_WHEEL_SLOTS slots that are each
+ * 2^(TIMER_WHEEL_BITS * n) ticks wide, and a timer is filed in the
+ * lowest level whose current rotation contains its expiry tick. When
+ * the wheel enters a new slot of a higher level, the timers in it are
+ * cascaded down, so a timer moves at most TIMER_WHEEL_LEVELS times in
+ * its lifetime. Timers beyond the top level wait in an overflow list.
+ */
+#define TIMER_WHEEL_BITS 6
+#define TIMER_WHEEL_SLOTS ( 1 << TIMER_WHEEL_BITS )
+#define TIMER_WHEEL_MASK ( TIMER_WHEEL_SLOTS - 1 )
+#define TIMER_WHEEL_LEVELS 6
+#define TIMER_WHEEL_SHIFT( _level ) ( ( _level ) * TIMER_WHEEL_BITS )
+
+#define TIMER_OVERFLOW TIMER_WHEEL_LEVELS
+#define TIMER_DETACHED ( TIMER_WHEEL_LEVELS + 1 )
+
+
 typedef struct timer_callback {
   void ( *function )( void *user_data );
   struct timespec expires_at;
   struct timespec interval;
   void *user_data;
+  timer_handle handle;
+  uint64_t expires_tick;
+  uint8_t level;
+  uint8_t slot;
+  bool cancelled;
+  struct timer_callback *next;
+  struct timer_callback **pprev;
 } timer_callback;
 
 
-static dlist_element *timer_callbacks = NULL;
+static timer_callback *timer_wheel[ TIMER_WHEEL_LEVELS ][ TIMER_WHEEL_SLOTS ];
+static uint64_t timer_wheel_occupied[ TIMER_WHEEL_LEVELS ];
+static timer_callback *timer_overflow = NULL;
+static uint64_t current_tick = 0;
+static uint64_hash_map *timer_callbacks = NULL;
+static timer_handle last_timer_handle = 0;
+static timer_callback *executing_timer = NULL;
+static int timer_fd = -1;
+static bool timer_fd_armed = false;
+static struct timespec timer_fd_deadline;
 
 
 bool
 init_timer() {
-  timer_callbacks = create_dlist();
+  memset( timer_wheel, 0, sizeof( timer_wheel ) );
+  memset( timer_wheel_occupied, 0, sizeof( timer_wheel_occupied ) );
+  timer_overflow = NULL;
+  current_tick = 0;
+  executing_timer = NULL;
+  timer_callbacks = create_uint64_hash_map( 0 );
+  timer_fd = timerfd_create( CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC );
+  if ( timer_fd < 0 ) {
+    error( "Failed to create a timerfd ( %s [%d] ).", strerror( errno ), errno );
+  }
+  timer_fd_armed = false;
   return true;
 }
 
 
 bool
 finalize_timer() {
-  dlist_element *e;
-
   debug( "Deleting timer callbacks ( timer_callbacks = %p ).", timer_callbacks );
 
   if ( timer_callbacks != NULL ) {
-    for ( e = timer_callbacks->next; e; e = e->next ) {
-      xfree( e->data );
+    uint64_hash_map_iterator iter;
+    uint64_hash_map_entry *e;
+    init_uint64_hash_map_iterator( timer_callbacks, &iter );
+    while ( ( e = iterate_uint64_hash_map_next( &iter ) ) != NULL ) {
+      xfree( e->value );
     }
-    delete_dlist( timer_callbacks );
+    delete_uint64_hash_map( timer_callbacks );
     timer_callbacks = NULL;
+    memset( timer_wheel, 0, sizeof( timer_wheel ) );
+    memset( timer_wheel_occupied, 0, sizeof( timer_wheel_occupied ) );
+    timer_overflow = NULL;
   }
   else {
     error( "All timer callbacks are already deleted or not created yet." );
   }
+  if ( timer_fd >= 0 ) {
+    close( timer_fd );
+    timer_fd = -1;
+  }
+  timer_fd_armed = false;
   return true;
 }
 
 
+/**
+ * returns an fd that becomes readable when the earliest timer expires,
+ * or -1 if there is none. The event loop only needs to wait on it and
+ * read it; execute_timer_events() arms it again for the next timer.
+ */
+int
+get_timer_fd() {
+  return timer_fd;
+}
+
+
 #define VALID_TIMESPEC( _a )                                    \
   ( ( ( _a )->tv_sec > 0 || ( _a )->tv_nsec > 0 ) ? 1 : 0 )
 
@@ -104,8 +173,199 @@ finalize_timer() {
   while ( 0 )
 
 
+#define TIMESPEC_LESS_THAN( _a, _b )                                                     \
+  ( ( ( _a )->tv_sec < ( _b )->tv_sec )                                                  \
+    || ( ( ( _a )->tv_sec == ( _b )->tv_sec ) && ( ( _a )->tv_nsec < ( _b )->tv_nsec ) ) )
+
+
+// The first tick at or after the given time.
+static uint64_t
+timespec_to_tick( const struct timespec *ts ) {
+  return ( uint64_t ) ts->tv_sec * 1000 + ( uint64_t ) ( ts->tv_nsec + 999999 ) / 1000000;
+}
+
+
+static void
+link_timer( timer_callback **head, timer_callback *callback ) {
+  callback->next = *head;
+  if ( *head != NULL ) {
+    ( *head )->pprev = &callback->next;
+  }
+  callback->pprev = head;
+  *head = callback;
+}
+
+
+static void
+unlink_timer( timer_callback *callback ) {
+  *callback->pprev = callback->next;
+  if ( callback->next != NULL ) {
+    callback->next->pprev = callback->pprev;
+  }
+  if ( callback->level < TIMER_WHEEL_LEVELS && timer_wheel[ callback->level ][ callback->slot ] == NULL ) {
+    timer_wheel_occupied[ callback->level ] &= ~( ( uint64_t ) 1 << callback->slot );
+  }
+  callback->next = NULL;
+  callback->pprev = NULL;
+}
+
+
+static void
+place_timer( timer_callback *callback ) {
+  uint64_t tick = callback->expires_tick < current_tick ? current_tick : callback->expires_tick;
+
+  uint8_t level;
+  for ( level = 0; level < TIMER_WHEEL_LEVELS; level++ ) {
+    if ( ( tick >> TIMER_WHEEL_SHIFT( level + 1 ) ) == ( current_tick >> TIMER_WHEEL_SHIFT( level + 1 ) ) ) {
+      break;
+    }
+  }
+
+  callback->level = level;
+  if ( level == TIMER_OVERFLOW ) {
+    link_timer( &timer_overflow, callback );
+    return;
+  }
+  callback->slot = ( uint8_t ) ( ( tick >> TIMER_WHEEL_SHIFT( level ) ) & TIMER_WHEEL_MASK );
+  link_timer( &timer_wheel[ level ][ callback->slot ], callback );
+  timer_wheel_occupied[ level ] |= ( uint64_t ) 1 << callback->slot;
+}
+
+
+/*
+ * Moves all timers of a slot onto a list of the caller. The list head
+ * must stay where it is while the timers are on it.
+ */
 static void
-on_timer( timer_callback *callback ) {
+detach_timers( timer_callback **head, timer_callback **list ) {
+  *list = *head;
+  *head = NULL;
+  if ( *list == NULL ) {
+    return;
+  }
+  ( *list )->pprev = list;
+
+  timer_callback *callback;
+  for ( callback = *list; callback != NULL; callback = callback->next ) {
+    if ( callback->level < TIMER_WHEEL_LEVELS ) {
+      timer_wheel_occupied[ callback->level ] &= ~( ( uint64_t ) 1 << callback->slot );
+    }
+    callback->level = TIMER_DETACHED;
+  }
+}
+
+
+static void
+cascade_timers( timer_callback **head ) {
+  timer_callback *list;
+  detach_timers( head, &list );
+  while ( list != NULL ) {
+    timer_callback *callback = list;
+    unlink_timer( callback );
+    place_timer( callback );
+  }
+}
+
+
+/*
+ * Moves the wheel forward to tick. No timer may expire before tick, so
+ * only the slot the wheel enters at each level needs to be cascaded.
+ */
+static void
+advance_timer_wheel( uint64_t tick ) {
+  uint64_t previous = current_tick;
+  current_tick = tick;
+
+  if ( ( previous >> TIMER_WHEEL_SHIFT( TIMER_WHEEL_LEVELS ) ) != ( tick >> TIMER_WHEEL_SHIFT( TIMER_WHEEL_LEVELS ) ) ) {
+    cascade_timers( &timer_overflow );
+  }
+  int level;
+  for ( level = TIMER_WHEEL_LEVELS - 1; level > 0; level-- ) {
+    if ( ( previous >> TIMER_WHEEL_SHIFT( level ) ) != ( tick >> TIMER_WHEEL_SHIFT( level ) ) ) {
+      cascade_timers( &timer_wheel[ level ][ ( tick >> TIMER_WHEEL_SHIFT( level ) ) & TIMER_WHEEL_MASK ] );
+    }
+  }
+}
+
+
+/*
+ * Returns the earliest non-empty slot and the first tick it covers.
+ * Every timer in it expires before any timer in the other slots.
+ */
+static timer_callback **
+next_pending_slot( uint64_t *start, int *level ) {
+  for ( *level = 0; *level < TIMER_WHEEL_LEVELS; ( *level )++ ) {
+    unsigned int index = ( unsigned int ) ( ( current_tick >> TIMER_WHEEL_SHIFT( *level ) ) & TIMER_WHEEL_MASK );
+    uint64_t pending = timer_wheel_occupied[ *level ] & ( ~( uint64_t ) 0 << index );
+    if ( pending != 0 ) {
+      unsigned int slot = ( unsigned int ) __builtin_ctzll( pending );
+      uint64_t base = ( current_tick >> TIMER_WHEEL_SHIFT( *level + 1 ) ) << TIMER_WHEEL_SHIFT( *level + 1 );
+      *start = base | ( ( uint64_t ) slot << TIMER_WHEEL_SHIFT( *level ) );
+      return &timer_wheel[ *level ][ slot ];
+    }
+  }
+  if ( timer_overflow != NULL ) {
+    *start = ( ( current_tick >> TIMER_WHEEL_SHIFT( TIMER_WHEEL_LEVELS ) ) + 1 ) << TIMER_WHEEL_SHIFT( TIMER_WHEEL_LEVELS );
+    return &timer_overflow;
+  }
+
+  return NULL;
+}
+
+
+static void
+set_timer_fd( const struct timespec *deadline ) {
+  if ( timer_fd < 0 ) {
+    return;
+  }
+
+  struct itimerspec value;
+  memset( &value, 0, sizeof( value ) );
+  if ( deadline != NULL ) {
+    value.it_value = *deadline;
+    if ( !VALID_TIMESPEC( &value.it_value ) ) {
+      // a zero it_value would disarm the timer.
+      value.it_value.tv_nsec = 1;
+    }
+  }
+  if ( timerfd_settime( timer_fd, TFD_TIMER_ABSTIME, &value, NULL ) < 0 ) {
+    error( "Failed to arm a timerfd ( %s [%d] ).", strerror( errno ), errno );
+    return;
+  }
+  timer_fd_armed = deadline != NULL;
+  if ( deadline != NULL ) {
+    timer_fd_deadline = *deadline;
+  }
+}
+
+
+/*
+ * Arms the timerfd for the earliest timer. Cancelled timers do not
+ * disarm it; the spurious wakeup they may cause ends up here.
+ */
+static void
+update_timer_fd( void ) {
+  struct timespec deadline;
+  if ( !next_timer_deadline( &deadline ) ) {
+    if ( timer_fd_armed ) {
+      set_timer_fd( NULL );
+    }
+    return;
+  }
+  if ( !timer_fd_armed
+    || deadline.tv_sec != timer_fd_deadline.tv_sec || deadline.tv_nsec != timer_fd_deadline.tv_nsec ) {
+    set_timer_fd( &deadline );
+  }
+}
+
+
+/*
+ * Runs a timer. A periodic timer is put on rearmed rather than back
+ * into the wheel, so that it fires at most once per
+ * execute_timer_events() call even if it is behind schedule.
+ */
+static void
+on_timer( timer_callback *callback, timer_callback **rearmed ) {
   assert( callback != NULL );
   assert( callback->function != NULL );
 
@@ -113,19 +373,34 @@ on_timer( timer_callback *callback ) {
          callback->function, callback->expires_at.tv_sec, callback->expires_at.tv_nsec,
          callback->interval.tv_sec, callback->interval.tv_nsec, callback->user_data );
 
-  if ( VALID_TIMESPEC( &callback->expires_at ) ) {
-    callback->function( callback->user_data );
-    if ( VALID_TIMESPEC( &callback->interval ) ) {
-      ADD_TIMESPEC( &callback->expires_at, &callback->interval, &callback->expires_at );
-    }
-    else {
-      callback->expires_at.tv_sec = 0;
-      callback->expires_at.tv_nsec = 0;
-    }
+  executing_timer = callback;
+  callback->function( callback->user_data );
+  executing_timer = NULL;
+
+  if ( callback->cancelled ) {
+    xfree( callback );
+    return;
+  }
+  if ( VALID_TIMESPEC( &callback->interval ) ) {
+    ADD_TIMESPEC( &callback->expires_at, &callback->interval, &callback->expires_at );
+    callback->expires_tick = timespec_to_tick( &callback->expires_at );
     debug( "Set expires_at value to %u.%09u.", callback->expires_at.tv_sec, callback->expires_at.tv_nsec );
+    callback->level = TIMER_DETACHED;
+    link_timer( rearmed, callback );
   }
   else {
-    error( "Invalid expires_at value." );
+    delete_uint64_hash_map_entry( timer_callbacks, &callback->handle );
+    xfree( callback );
+  }
+}
+
+
+static void
+run_expired_timers( timer_callback **expired, timer_callback **rearmed ) {
+  while ( *expired != NULL ) {
+    timer_callback *callback = *expired;
+    unlink_timer( callback );
+    on_timer( callback, rearmed );
   }
 }
 
@@ -133,30 +408,92 @@ on_timer( timer_callback *callback ) {
 void
 execute_timer_events() {
   struct timespec now;
-  timer_callback *callback;
-  dlist_element *element;
 
   debug( "Executing timer events ( timer_callbacks = %p ).", timer_callbacks );
 
   assert( clock_gettime( CLOCK_MONOTONIC, &now ) == 0 );
   assert( timer_callbacks != NULL );
 
-  // TODO: timer_callbacks should be a list which is sorted by expiry time
-  for ( element = timer_callbacks->next; element; element = element->next ) {
-    callback = element->data;
-    if ( ( callback->expires_at.tv_sec < now.tv_sec )
-      || ( ( callback->expires_at.tv_sec == now.tv_sec )
-          && ( callback->expires_at.tv_nsec <= now.tv_nsec ) ) ) {
-      on_timer( callback );
+  uint64_t now_tick = ( uint64_t ) now.tv_sec * 1000 + ( uint64_t ) now.tv_nsec / 1000000;
+  if ( timer_callbacks->length == 0 ) {
+    current_tick = now_tick + 1;
+    if ( timer_fd_armed ) {
+      set_timer_fd( NULL );
+    }
+    return;
+  }
+
+  timer_callback **head;
+  timer_callback *rearmed = NULL;
+  uint64_t start;
+  int level;
+  while ( ( head = next_pending_slot( &start, &level ) ) != NULL && start <= now_tick ) {
+    advance_timer_wheel( start );
+    if ( level != 0 ) {
+      // the slot has just been cascaded into lower levels.
+      continue;
     }
+    timer_callback *expired;
+    detach_timers( head, &expired );
+    advance_timer_wheel( start + 1 );
+    run_expired_timers( &expired, &rearmed );
   }
+  if ( current_tick <= now_tick ) {
+    advance_timer_wheel( now_tick + 1 );
+  }
+
+  // timers that expire within the millisecond that is still going on.
+  timer_callback *expired = NULL;
+  timer_callback *callback = timer_wheel[ 0 ][ current_tick & TIMER_WHEEL_MASK ];
+  while ( callback != NULL ) {
+    timer_callback *next = callback->next;
+    if ( !TIMESPEC_LESS_THAN( &now, &callback->expires_at ) ) {
+      unlink_timer( callback );
+      callback->level = TIMER_DETACHED;
+      link_timer( &expired, callback );
+    }
+    callback = next;
+  }
+  run_expired_timers( &expired, &rearmed );
+
+  while ( rearmed != NULL ) {
+    callback = rearmed;
+    unlink_timer( callback );
+    place_timer( callback );
+  }
+  update_timer_fd();
 }
 
 
 bool
-add_timer_event_callback( struct itimerspec *interval, void ( *callback )( void *user_data ), void *user_data ) {
+next_timer_deadline( struct timespec *deadline ) {
+  assert( deadline != NULL );
+  assert( timer_callbacks != NULL );
+
+  uint64_t start;
+  int level;
+  timer_callback **head = next_pending_slot( &start, &level );
+  if ( head == NULL ) {
+    return false;
+  }
+
+  timer_callback *callback = *head;
+  *deadline = callback->expires_at;
+  for ( callback = callback->next; callback != NULL; callback = callback->next ) {
+    if ( TIMESPEC_LESS_THAN( &callback->expires_at, deadline ) ) {
+      *deadline = callback->expires_at;
+    }
+  }
+
+  return true;
+}
+
+
+timer_handle
+add_timer_event( struct itimerspec *interval, void ( *callback )( void *user_data ), void *user_data ) {
   assert( interval != NULL );
   assert( callback != NULL );
+  assert( timer_callbacks != NULL );
 
   debug( "Adding a timer event callback ( interval = %u.%09u, initial expiration = %u.%09u, callback = %p, user_data = %p ).",
          interval->it_interval.tv_sec, interval->it_interval.tv_nsec,
@@ -173,7 +510,7 @@ add_timer_event_callback( struct itimerspec *interval, void ( *callback )( void
   if ( clock_gettime( CLOCK_MONOTONIC, &now ) != 0 ) {
     error( "Failed to retrieve monotonic time ( %s [%d] ).", strerror( errno ), errno );
     xfree( cb );
-    return false;
+    return 0;
   }
 
   cb->interval = interval->it_interval;
@@ -187,38 +524,81 @@ add_timer_event_callback( struct itimerspec *interval, void ( *callback )( void
   else {
     error( "Timer must not be zero when a timer event is added." );
     xfree( cb );
-    return false;
+    return 0;
   }
+  cb->expires_tick = timespec_to_tick( &cb->expires_at );
 
-  debug( "Set an initial expiration time to %u.%09u.", now.tv_sec, now.tv_nsec );
+  debug( "Set an initial expiration time to %u.%09u.", cb->expires_at.tv_sec, cb->expires_at.tv_nsec );
+
+  if ( timer_callbacks->length == 0 ) {
+    // nothing is armed, so the wheel can jump to the present.
+    current_tick = ( uint64_t ) now.tv_sec * 1000 + ( uint64_t ) now.tv_nsec / 1000000;
+  }
+  cb->handle = ++last_timer_handle;
+  insert_uint64_hash_map_entry( timer_callbacks, &cb->handle, cb );
+  place_timer( cb );
+  if ( !timer_fd_armed || TIMESPEC_LESS_THAN( &cb->expires_at, &timer_fd_deadline ) ) {
+    set_timer_fd( &cb->expires_at );
+  }
+
+  return cb->handle;
+}
 
-  assert( timer_callbacks != NULL );
-  insert_after_dlist( timer_callbacks, cb );
+
+bool
+cancel_timer_event( timer_handle handle ) {
+  debug( "Cancelling a timer event ( handle = %" PRIu64 " ).", handle );
+
+  if ( timer_callbacks == NULL ) {
+    error( "All timer callbacks are already deleted or not created yet." );
+    return false;
+  }
+
+  timer_callback *cb = delete_uint64_hash_map_entry( timer_callbacks, &handle );
+  if ( cb == NULL ) {
+    return false;
+  }
+  if ( cb == executing_timer ) {
+    // freed by on_timer() when the callback returns.
+    cb->cancelled = true;
+    return true;
+  }
+  unlink_timer( cb );
+  xfree( cb );
 
   return true;
 }
 
 
+bool
+add_timer_event_callback( struct itimerspec *interval, void ( *callback )( void *user_data ), void *user_data ) {
+  return add_timer_event( interval, callback, user_data ) != 0;
+}
+
+
+/*
+ * Cancels a timer found by its callback function. This looks at every
+ * armed timer; use cancel_timer_event() where a handle is at hand.
+ */
 bool
 delete_timer_event_callback( void ( *callback )( void *user_data ) ) {
   assert( callback != NULL );
 
   debug( "Deleting a timer event callback ( callback = %p ).", callback );
 
-  dlist_element *e;
-
   if ( timer_callbacks == NULL ) {
     error( "All timer callbacks are already deleted or not created yet." );
     return false;
   }
 
-  for ( e = timer_callbacks->next; e; e = e->next ) {
-    timer_callback *cb = e->data;
+  uint64_hash_map_iterator iter;
+  uint64_hash_map_entry *e;
+  init_uint64_hash_map_iterator( timer_callbacks, &iter );
+  while ( ( e = iterate_uint64_hash_map_next( &iter ) ) != NULL ) {
+    timer_callback *cb = e->value;
     if ( cb->function == callback ) {
       debug( "Deleting a callback ( callback = %p ).", callback );
-      xfree( cb );
-      delete_dlist_element( e );
-      return true;
+      return cancel_timer_event( cb->handle );
     }
   }
 
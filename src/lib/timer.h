@@ -25,12 +25,24 @@
 
 
 #include <stdbool.h>
+#include <stdint.h>
 #include <time.h>
 
 
+/*
+ * Identifies an armed timer. Handles are never reused, so cancelling
+ * a timer that has already expired is harmless. Zero is not a valid
+ * handle.
+ */
+typedef uint64_t timer_handle;
+
+
 bool init_timer( void );
 bool finalize_timer( void );
 
+timer_handle add_timer_event( struct itimerspec *interval, void ( *callback )( void *user_data ), void *user_data );
+bool cancel_timer_event( timer_handle handle );
+
 bool add_timer_event_callback( struct itimerspec *interval, void ( *callback )( void *user_data ), void *user_data );
 bool delete_timer_event_callback( void ( *callback )( void *user_data ) );
 
@@ -38,6 +50,8 @@ bool add_periodic_event_callback( const time_t seconds, void ( *callback )( void
 bool delete_periodic_event_callback( void ( *callback )( void *user_data ) );
 
 void execute_timer_events( void );
+bool next_timer_deadline( struct timespec *deadline );
+int get_timer_fd( void );
 
 
 #endif // TIMER_H
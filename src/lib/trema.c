@@ -68,6 +68,18 @@ void mock_notice( const char *format, ... );
 #define error mock_error
 void mock_error( const char *format, ... );
 
+#ifdef start_async_logging
+#undef start_async_logging
+#endif
+#define start_async_logging mock_start_async_logging
+bool mock_start_async_logging( void );
+
+#ifdef stop_async_logging
+#undef stop_async_logging
+#endif
+#define stop_async_logging mock_stop_async_logging
+void mock_stop_async_logging( void );
+
 #ifdef set_logging_level
 #undef set_logging_level
 #endif
@@ -164,6 +176,24 @@ void mock_stop_messenger_dump();
 #define messenger_dump_enabled mock_messenger_dump_enabled
 bool mock_messenger_dump_enabled();
 
+#ifdef start_messenger_trace
+#undef start_messenger_trace
+#endif
+#define start_messenger_trace mock_start_messenger_trace
+bool mock_start_messenger_trace( const char *path, const char *app_name, size_t ring_size, size_t snapshot_length );
+
+#ifdef stop_messenger_trace
+#undef stop_messenger_trace
+#endif
+#define stop_messenger_trace mock_stop_messenger_trace
+void mock_stop_messenger_trace();
+
+#ifdef messenger_trace_enabled
+#undef messenger_trace_enabled
+#endif
+#define messenger_trace_enabled mock_messenger_trace_enabled
+bool mock_messenger_trace_enabled();
+
 #ifdef die
 #undef die
 #endif
@@ -243,6 +273,30 @@ bool mock_set_external_callback( void ( *callback ) ( void ) );
 #define dump_stats mock_dump_stats
 void mock_dump_stats();
 
+#ifdef open_stat_segment
+#undef open_stat_segment
+#endif
+#define open_stat_segment mock_open_stat_segment
+bool mock_open_stat_segment( const char *directory, const char *name );
+
+#ifdef rename_stat_segment
+#undef rename_stat_segment
+#endif
+#define rename_stat_segment mock_rename_stat_segment
+bool mock_rename_stat_segment( const char *directory, const char *old, const char *new );
+
+#ifdef publish_stats
+#undef publish_stats
+#endif
+#define publish_stats mock_publish_stats
+void mock_publish_stats();
+
+#ifdef add_periodic_event_callback
+#undef add_periodic_event_callback
+#endif
+#define add_periodic_event_callback mock_add_periodic_event_callback
+bool mock_add_periodic_event_callback( const time_t seconds, void ( *callback )( void *user_data ), void *user_data );
+
 #define static
 
 #endif // UNIT_TESTING
@@ -255,6 +309,9 @@ void mock_dump_stats();
 
 static const char TREMA_HOME[] = "TREMA_HOME";
 static const char TREMA_TMP[] = "TREMA_TMP";
+static const char LOGGING_ASYNC[] = "LOGGING_ASYNC";
+static const char MESSENGER_TRACE[] = "MESSENGER_TRACE";
+static const time_t STAT_SEGMENT_PUBLISH_INTERVAL = 1;
 static bool initialized = false;
 static bool started_trema = false;
 static bool run_as_daemon = false;
@@ -423,6 +480,7 @@ finalize_trema() {
   trema_home = NULL;
   xfree( trema_tmp );
   trema_tmp = NULL;
+  stop_async_logging();
 
   initialized = false;
 }
@@ -535,6 +593,14 @@ set_exit_handler() {
 }
 
 
+static void
+publish_stats_periodically( void *user_data ) {
+  UNUSED( user_data );
+
+  publish_stats();
+}
+
+
 static void
 set_dump_stats_as_external_callback() {
   set_external_callback( dump_stats );
@@ -551,9 +617,31 @@ set_usr1_handler() {
 }
 
 
+static void
+toggle_messenger_trace() {
+  if ( messenger_trace_enabled() ) {
+    stop_messenger_trace();
+    return;
+  }
+
+  char path[ PATH_MAX ];
+  snprintf( path, PATH_MAX, "%s/%s.trace", get_trema_tmp(), get_trema_name() );
+  path[ PATH_MAX - 1 ] = '\0';
+  start_messenger_trace( path, get_trema_name(), MESSENGER_TRACE_RING_SIZE, MESSENGER_TRACE_SNAPSHOT_LENGTH );
+}
+
+
+/**
+ * toggles message dumping. With MESSENGER_TRACE set, messages are traced
+ * into TREMA_TMP/<name>.trace instead of being sent to the dump service.
+ * Tracing opens a file, so it is toggled from the main loop.
+ */
 static void
 toggle_messenger_dump() {
-  if ( messenger_dump_enabled() ) {
+  if ( getenv( MESSENGER_TRACE ) != NULL ) {
+    set_external_callback( toggle_messenger_trace );
+  }
+  else if ( messenger_dump_enabled() ) {
     stop_messenger_dump();
   }
   else {
@@ -633,7 +721,13 @@ start_trema() {
   debug( "Starting %s ... (TREMA_HOME = %s)", get_trema_name(), get_trema_home() );
 
   maybe_daemonize();
+  if ( getenv( LOGGING_ASYNC ) != NULL ) {
+    start_async_logging();
+  }
   write_pid( get_trema_tmp(), get_trema_name() );
+  if ( open_stat_segment( get_trema_tmp(), get_trema_name() ) ) {
+    add_periodic_event_callback( STAT_SEGMENT_PUBLISH_INTERVAL, publish_stats_periodically, NULL );
+  }
   started_trema = true;
   start_messenger();
 
@@ -664,6 +758,7 @@ set_trema_name( const char *name ) {
   if ( trema_name != NULL ) {
     if ( started_trema ) {
       rename_pid( get_trema_tmp(), trema_name, name );
+      rename_stat_segment( get_trema_tmp(), trema_name, name );
     }
     xfree( trema_name );
   }
@@ -29,6 +29,7 @@
 #include "byteorder.h"
 #include "checks.h"
 #include "doubly_linked_list.h"
+#include "hash_map.h"
 #include "hash_table.h"
 #include "linked_list.h"
 #include "log.h"
@@ -39,6 +40,7 @@
 #include "openflow_message.h"
 #include "packet_info.h"
 #include "packet_parser.h"
+#include "rcu.h"
 #include "stat.h"
 #include "utility.h"
 #include "wrapper.h"
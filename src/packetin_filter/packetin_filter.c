@@ -142,7 +142,6 @@ handle_packet_in( uint64_t datapath_id, uint32_t transaction_id,
   struct ofp_match ofp_match;   // host order
 
   set_match_from_packet( &ofp_match, in_port, 0, data );
-  match_to_string( &ofp_match, match_str, sizeof( match_str ) );
 
   match_entry *match_entry = lookup_match_entry( &ofp_match );
   if ( match_entry == NULL ) {
@@ -159,14 +158,18 @@ handle_packet_in( uint64_t datapath_id, uint32_t transaction_id,
   message->service_name_length = htons( 0 );
   if ( !send_message( match_entry->service_name, MESSENGER_OPENFLOW_MESSAGE,
                       buf->data, buf->length ) ) {
+    match_to_string( &ofp_match, match_str, sizeof( match_str ) );
     error( "Failed to send a message to %s ( entry_name = %s, match = %s ).",
            match_entry->service_name, match_entry->entry_name, match_str );
     free_buffer( buf );
     return;
   }
 
-  debug( "Sending a message to %s ( entry_name = %s, match = %s ).",
-         match_entry->service_name, match_entry->entry_name, match_str );
+  if ( LOG_LEVEL_ENABLED( LOG_DEBUG ) ) {
+    match_to_string( &ofp_match, match_str, sizeof( match_str ) );
+    debug( "Sending a message to %s ( entry_name = %s, match = %s ).",
+           match_entry->service_name, match_entry->entry_name, match_str );
+  }
 
   free_buffer( buf );
 }
@@ -238,6 +241,8 @@ main( int argc, char *argv[] ) {
   init_trema( &argc, &argv );
 
   init_match_table();
+  // the match table is only accessed from the main loop
+  set_match_table_concurrency( HASH_TABLE_UNLOCKED );
 
   // built-in packetin-filter-rule
   if ( !set_match_type( argc, argv ) ) {
@@ -53,17 +53,11 @@ generate_cookie( void ) {
 }
 
 
-static bool
-compare_cookie( const void *x, const void *y ) {
-  return ( ( memcmp( x, y, sizeof( uint64_t ) ) == 0 ) ? true : false );
-}
-
-
 static unsigned int
-hash_cookie_entry( const void *key ) {
-  const uint64_t *cookie = key;
+hash_application( const void *key ) {
+  const application_entry_t *application = key;
 
-  return ( unsigned int )( ( *cookie >> 32 ) ^ *cookie );
+  return ( unsigned int ) mix_hash_uint64( application->cookie );
 }
 
 
@@ -104,7 +98,7 @@ free_cookie_entry( cookie_entry_t *free_entry ) {
 
 
 static void
-free_cookie_table_walker( void *key, void *value, void *user_data ) {
+free_cookie_table_walker( const uint64_t *key, void *value, void *user_data ) {
   cookie_entry_t *entry = value;
 
   UNUSED( key );
@@ -116,15 +110,15 @@ free_cookie_table_walker( void *key, void *value, void *user_data ) {
 
 void
 init_cookie_table( void ) {
-  cookie_table.global = create_hash( compare_cookie, hash_cookie_entry );
-  cookie_table.application = create_hash( compare_application, hash_cookie_entry );
+  cookie_table.global = create_uint64_hash_map( 0 );
+  cookie_table.application = create_hash( compare_application, hash_application );
 }
 
 
 void
 finalize_cookie_table( void ) {
-  foreach_hash( cookie_table.global, free_cookie_table_walker, NULL );
-  delete_hash( cookie_table.global );
+  foreach_uint64_hash_map( cookie_table.global, free_cookie_table_walker, NULL );
+  delete_uint64_hash_map( cookie_table.global );
   delete_hash( cookie_table.application );
   cookie_table.global = NULL;
   cookie_table.application = NULL;
@@ -148,7 +142,7 @@ insert_cookie_entry( uint64_t *original_cookie, char *service_name, uint16_t fla
   }
 
   new_entry = allocate_cookie_entry( original_cookie, service_name, flags );
-  conflict_entry = insert_hash_entry( cookie_table.global, &new_entry->cookie, new_entry );
+  conflict_entry = insert_uint64_hash_map_entry( cookie_table.global, &new_entry->cookie, new_entry );
   if ( conflict_entry != NULL ) {
     warn( "Conflicted cookie ( cookie = %#" PRIx64 " ).", new_entry->cookie );
     // TODO: delete conflicted cookie entry
@@ -178,7 +172,7 @@ delete_cookie_entry( cookie_entry_t *entry ) {
     return;
   }
 
-  cookie_entry_t *delete_entry_global = delete_hash_entry( cookie_table.global, &entry->cookie );
+  cookie_entry_t *delete_entry_global = delete_uint64_hash_map_entry( cookie_table.global, &entry->cookie );
   if ( delete_entry_global == NULL ) {
     error( "No cookie entry found ( cookie = %#" PRIx64 " ).", entry->cookie );
   }
@@ -206,7 +200,7 @@ delete_cookie_entry( cookie_entry_t *entry ) {
 
 cookie_entry_t *
 lookup_cookie_entry_by_cookie( uint64_t *cookie ) {
-  return lookup_hash_entry( cookie_table.global, cookie );
+  return lookup_uint64_hash_map_entry( cookie_table.global, cookie );
 }
 
 
@@ -235,7 +229,7 @@ age_cookie_entry( cookie_entry_t *entry ) {
           entry->cookie, entry->application.cookie, entry->application.service_name,
           entry->application.flags, entry->reference_count, entry->expire_at );
 
-    delete_hash_entry( cookie_table.global, &entry->cookie );
+    delete_uint64_hash_map_entry( cookie_table.global, &entry->cookie );
     delete_hash_entry( cookie_table.application, &entry->application );
     free_cookie_entry( entry );
   }
@@ -246,11 +240,11 @@ void
 age_cookie_table( void *user_data ) {
   UNUSED( user_data );
 
-  hash_iterator iter;
-  hash_entry *e;
+  uint64_hash_map_iterator iter;
+  uint64_hash_map_entry *e;
 
-  init_hash_iterator( cookie_table.global, &iter );
-  while ( ( e = iterate_hash_next( &iter ) ) != NULL ) {
+  init_uint64_hash_map_iterator( cookie_table.global, &iter );
+  while ( ( e = iterate_uint64_hash_map_next( &iter ) ) != NULL ) {
     age_cookie_entry( e->value );
   }
 }
@@ -267,16 +261,19 @@ dump_cookie_entry( cookie_entry_t *entry ) {
 
 void
 dump_cookie_table( void ) {
-  hash_iterator iter;
-  hash_entry *e;
+  uint64_hash_map_iterator global_iter;
+  uint64_hash_map_entry *global_entry;
 
   info( "#### COOKIE TABLE ####" );
   info( "[global]" );
-  init_hash_iterator( cookie_table.global, &iter );
-  while ( ( e = iterate_hash_next( &iter ) ) != NULL ) {
-    dump_cookie_entry( e->value );
+  init_uint64_hash_map_iterator( cookie_table.global, &global_iter );
+  while ( ( global_entry = iterate_uint64_hash_map_next( &global_iter ) ) != NULL ) {
+    dump_cookie_entry( global_entry->value );
   }
 
+  hash_iterator iter;
+  hash_entry *e;
+
   info( "[application]" );
   init_hash_iterator( cookie_table.application, &iter );
   while ( ( e = iterate_hash_next( &iter ) ) != NULL ) {
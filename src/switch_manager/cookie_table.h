@@ -46,7 +46,7 @@ typedef struct cookie_entry {
 } cookie_entry_t;
 
 typedef struct cookie_table {
-  hash_table *global;
+  uint64_hash_map *global;
   hash_table *application;
 } cookie_table_t;
 
@@ -142,7 +142,7 @@ ofpmsg_recv_error( struct switch_info *sw_info, buffer *buf ) {
             delete_cookie_entry( entry );
           }
           else {
-            error( "No cookie entry found ( cookie = %#" PRIx64 " ).", cookie );
+            LOG_RATE_LIMITED( error, "No cookie entry found ( cookie = %#" PRIx64 " ).", cookie );
           }
         }
         break;
@@ -271,7 +271,7 @@ ofpmsg_recv_flowremoved( struct switch_info *sw_info, buffer *buf ) {
 
   entry = lookup_cookie_entry_by_cookie( &cookie );
   if ( entry == NULL ) {
-    error( "No cookie entry found ( cookie = %#" PRIx64 " ).", cookie );
+    LOG_RATE_LIMITED( error, "No cookie entry found ( cookie = %#" PRIx64 " ).", cookie );
     free_buffer( buf );
     return 0;
   }
@@ -327,7 +327,7 @@ ofpmsg_recv_statsreply( struct switch_info *sw_info, buffer *buf ) {
         flow_stats->cookie = htonll( entry->application.cookie );
       }
       else {
-        warn( "No cookie entry found ( cookie = %#" PRIx64 " ).", cookie );
+        LOG_RATE_LIMITED( warn, "No cookie entry found ( cookie = %#" PRIx64 " ).", cookie );
       }
 
       body_length = body_length - ntohs( flow_stats->length );
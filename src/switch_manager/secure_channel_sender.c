@@ -39,7 +39,12 @@ send_to_secure_channel( struct switch_info *sw_info, buffer *buf ) {
     return -1;
   }
 
-  return ( enqueue_message( sw_info->send_queue, buf ) == true ) ? 0 : -1;
+  if ( !enqueue_message( sw_info->send_queue, buf ) ) {
+    return -1;
+  }
+  set_writable_interest( sw_info->secure_channel_fd, true );
+
+  return 0;
 }
 
 
@@ -72,21 +72,14 @@ service_send_to_reply( char *service_name, uint16_t message_type, uint64_t *data
 void
 service_send_to_application( list_element *service_name_list, uint16_t message_type, uint64_t *datapath_id, buffer *data ) {
   buffer *buf;
-  list_element *list;
-  char *service_name;
 
   if ( service_name_list == NULL ) {
     return;
   }
 
   buf = create_openflow_application_message( datapath_id, data );
-
-  for ( list = service_name_list; list != NULL; list = list->next ) {
-    service_name = list->data;
-    if ( !send_message( service_name, message_type, 
-                        buf->data, buf->length ) ) {
-      error( "Failed to send message." );
-    }
+  if ( !multicast_message( service_name_list, message_type, buf->data, buf->length ) ) {
+    error( "Failed to send message." );
   }
   free_buffer( buf );
 }
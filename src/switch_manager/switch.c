@@ -39,6 +39,7 @@
 #include "secure_channel_sender.h"
 #include "service_interface.h"
 #include "switch.h"
+#include "timer.h"
 #include "xid_table.h"
 
 
@@ -61,6 +62,8 @@ static const time_t COOKIE_TABLE_AGING_INTERVAL = 3600;
 
 static bool age_cookie_table_enabled = false;
 
+static timer_handle state_timeout = 0;
+
 
 void
 usage() {
@@ -149,40 +152,37 @@ service_send_state( struct switch_info *sw_info, uint64_t *dpid, uint16_t tag )
 
 
 static void
-secure_channel_fd_set( fd_set *read_set, fd_set *write_set ) {
-  if ( switch_info.secure_channel_fd < 0 ) {
+secure_channel_read( int fd, void *data ) {
+  UNUSED( fd );
+  UNUSED( data );
+
+  if ( recv_from_secure_channel( &switch_info ) < 0 ) {
+    switch_event_disconnected( &switch_info );
     return;
   }
-  FD_SET( switch_info.secure_channel_fd, read_set );
-  if ( switch_info.send_queue != NULL && switch_info.send_queue->length > 0 ) {
-    FD_SET( switch_info.secure_channel_fd, write_set );
+
+  // the channel is not readable again until new data arrives,
+  // so handle all messages received so far.
+  while ( switch_info.recv_queue != NULL && switch_info.recv_queue->length > 0 ) {
+    int ret = handle_messages_from_secure_channel( &switch_info );
+    if ( ret < 0 ) {
+      stop_messenger();
+      return;
+    }
   }
 }
 
 
 static void
-secure_channel_fd_isset( fd_set *read_set, fd_set *write_set ) {
-  if ( switch_info.secure_channel_fd < 0 ) {
+secure_channel_write( int fd, void *data ) {
+  UNUSED( data );
+
+  if ( flush_secure_channel( &switch_info ) < 0 ) {
+    switch_event_disconnected( &switch_info );
     return;
   }
-  if ( FD_ISSET( switch_info.secure_channel_fd, read_set ) ) {
-    if ( recv_from_secure_channel( &switch_info ) < 0 ) {
-      switch_event_disconnected( &switch_info );
-      return;
-    }
-  }
-  if ( FD_ISSET( switch_info.secure_channel_fd, write_set ) ) {
-    if ( flush_secure_channel( &switch_info ) < 0 ) {
-      switch_event_disconnected( &switch_info );
-      return;
-    }
-  }
-
-  if ( switch_info.recv_queue->length > 0 ) {
-    int ret = handle_messages_from_secure_channel( &switch_info );
-    if ( ret < 0 ) {
-      stop_messenger();
-    }
+  if ( switch_info.send_queue->length == 0 ) {
+    set_writable_interest( fd, false );
   }
 }
 
@@ -197,13 +197,16 @@ switch_set_timeout( long sec, void ( *callback )( void *user_data ), void *user_
   interval.it_value.tv_nsec = 0;
   interval.it_interval.tv_sec = 0;
   interval.it_interval.tv_nsec = 0;
-  add_timer_event_callback( &interval, callback, NULL );
+  state_timeout = add_timer_event( &interval, callback, NULL );
 }
 
 
 static void
-switch_unset_timeout( void ( *callback )( void *user_data ) ) {
-  delete_timer_event_callback( callback );
+switch_unset_timeout( void ) {
+  if ( state_timeout != 0 ) {
+    cancel_timer_event( state_timeout );
+    state_timeout = 0;
+  }
 }
 
 
@@ -215,7 +218,7 @@ switch_event_timeout_hello( void *user_data ) {
     return;
   }
   // delete to hello_wait-timeout timer
-  switch_unset_timeout( switch_event_timeout_hello );
+  switch_unset_timeout();
 
   error( "Hello timeout. state:%d, dpid:%#" PRIx64 ", fd:%d.",
          switch_info.state, switch_info.datapath_id, switch_info.secure_channel_fd );
@@ -231,7 +234,7 @@ switch_event_timeout_features_reply( void *user_data ) {
     return;
   }
   // delete to features_reply_wait-timeout timer
-  switch_unset_timeout( switch_event_timeout_features_reply );
+  switch_unset_timeout();
 
   error( "Features Reply timeout. state:%d, dpid:%#" PRIx64 ", fd:%d.",
          switch_info.state, switch_info.datapath_id, switch_info.secure_channel_fd );
@@ -264,7 +267,7 @@ switch_event_recv_hello( struct switch_info *sw_info ) {
 
   if ( sw_info->state == SWITCH_STATE_WAIT_HELLO ) {
     // cancel to hello_wait-timeout timer
-    switch_unset_timeout( switch_event_timeout_hello );
+    switch_unset_timeout();
 
     ret = ofpmsg_send_featuresrequest( sw_info );
     if ( ret < 0 ) {
@@ -293,7 +296,7 @@ switch_event_recv_featuresreply( struct switch_info *sw_info, uint64_t *dpid ) {
     sw_info->state = SWITCH_STATE_COMPLETED;
 
     // cancel to features_reply_wait-timeout timer
-    switch_unset_timeout( switch_event_timeout_features_reply );
+    switch_unset_timeout();
 
     // TODO: set keepalive-timeout
     snprintf( new_service_name, new_service_name_len, "%s%" PRIx64, SWITCH_MANAGER_PREFIX, sw_info->datapath_id );
@@ -367,6 +370,7 @@ switch_event_disconnected( struct switch_info *sw_info ) {
   }
 
   if ( sw_info->secure_channel_fd >= 0 ) {
+    delete_fd_event_callback( sw_info->secure_channel_fd );
     close( sw_info->secure_channel_fd );
     sw_info->secure_channel_fd = -1;
   }
@@ -499,8 +503,7 @@ main( int argc, char *argv[] ) {
   init_xid_table();
   init_cookie_table();
 
-  set_fd_set_callback( secure_channel_fd_set );
-  set_check_fd_isset_callback( secure_channel_fd_isset );
+  add_fd_event_callback( switch_info.secure_channel_fd, secure_channel_read, secure_channel_write, NULL );
   add_message_received_callback( get_trema_name(), service_recv );
 
   snprintf( management_service_name , MESSENGER_SERVICE_NAME_LENGTH,
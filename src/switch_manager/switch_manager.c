@@ -90,17 +90,11 @@ char *mock_get_current_dir_name( void );
 #define init_trema mock_init_trema
 void mock_init_trema( int *argc, char ***argv );
 
-#ifdef set_fd_set_callback
-#undef set_fd_set_callback
+#ifdef add_fd_event_callback
+#undef add_fd_event_callback
 #endif
-#define set_fd_set_callback mock_set_fd_set_callback
-void mock_set_fd_set_callback( void ( *callback )( fd_set *read_set, fd_set *write_set ) );
-
-#ifdef set_check_fd_isset_callback
-#undef set_check_fd_isset_callback
-#endif
-#define set_check_fd_isset_callback mock_set_check_fd_isset_callback
-void mock_set_check_fd_isset_callback( void ( *callback )( fd_set *read_set, fd_set *write_set ) );
+#define add_fd_event_callback mock_add_fd_event_callback
+bool mock_add_fd_event_callback( int fd, event_fd_callback read_callback, event_fd_callback write_callback, void *data );
 
 #ifdef secure_channel_accept
 #undef secure_channel_accept
@@ -205,26 +199,11 @@ handle_sigchld( int signum ) {
 
 
 static void
-secure_channel_fd_set( fd_set *read_set, fd_set *write_set ) {
-  UNUSED( write_set );
-
-  if ( listener_info.listen_fd < 0 ) {
-    return;
-  }
-  FD_SET( listener_info.listen_fd, read_set );
-}
-
-
-static void
-secure_channel_fd_isset( fd_set *read_set, fd_set *write_set ) {
-  UNUSED( write_set );
+secure_channel_read( int fd, void *data ) {
+  UNUSED( fd );
+  UNUSED( data );
 
-  if ( listener_info.listen_fd < 0 ) {
-    return;
-  }
-  if ( FD_ISSET( listener_info.listen_fd, read_set ) ) {
-    secure_channel_accept( &listener_info );
-  }
+  secure_channel_accept( &listener_info );
 }
 
 
@@ -437,8 +416,6 @@ main( int argc, char *argv[] ) {
   free( startup_dir );
 
   catch_sigchild();
-  set_fd_set_callback( secure_channel_fd_set );
-  set_check_fd_isset_callback( secure_channel_fd_isset );
 
   // listener start (listen socket binding and listen)
   ret = secure_channel_listen_start( &listener_info );
@@ -446,6 +423,7 @@ main( int argc, char *argv[] ) {
     finalize_listener_info( &listener_info );
     exit( EXIT_FAILURE );
   }
+  add_fd_event_callback( listener_info.listen_fd, secure_channel_read, NULL, NULL );
 
   start_trema();
 
@@ -31,7 +31,7 @@ static uint32_t transaction_id = 0U;
 
 typedef struct xid_table {
   xid_entry_t *entries[ XID_MAX_ENTRIES ];
-  hash_table *hash;
+  uint32_hash_map *hash;
   int next_index;
 } xid_table_t;
 
@@ -81,22 +81,10 @@ free_xid_entry( xid_entry_t *free_entry ) {
 }
 
 
-static bool
-compare_xid( const void *x, const void *y ) {
-  return ( ( memcmp( x, y, sizeof( uint32_t ) ) == 0 ) ? true : false );
-}
-
-
-static unsigned int
-hash_xid( const void *key ) {
-  return ( unsigned int ) *( ( const uint32_t * ) key );
-}
-
-
 void
 init_xid_table( void ) {
   memset( &xid_table, 0, sizeof( xid_table_t ) );
-  xid_table.hash = create_hash( compare_xid, hash_xid );
+  xid_table.hash = create_uint32_hash_map( XID_MAX_ENTRIES );
   xid_table.next_index = 0;
 }
 
@@ -109,7 +97,7 @@ finalize_xid_table( void ) {
       xid_table.entries[ i ] = NULL;
     }
   }
-  delete_hash( xid_table.hash );
+  delete_uint32_hash_map( xid_table.hash );
   xid_table.hash = NULL;
   xid_table.next_index = 0;
 }
@@ -131,7 +119,7 @@ insert_xid_entry( uint32_t original_xid, char *service_name ) {
   }
 
   new_entry = allocate_xid_entry( original_xid, service_name, xid_table.next_index );
-  insert_hash_entry( xid_table.hash, &new_entry->xid, new_entry );
+  insert_uint32_hash_map_entry( xid_table.hash, &new_entry->xid, new_entry );
   xid_table.entries[ xid_table.next_index ] = new_entry;
   xid_table.next_index++;
 
@@ -144,7 +132,7 @@ delete_xid_entry( xid_entry_t *delete_entry ) {
   debug( "Deleting xid entry ( xid = %#lx, original_xid = %#lx, service_name = %s, index = %d ).",
          delete_entry->xid, delete_entry->original_xid, delete_entry->service_name, delete_entry->index );
 
-  xid_entry_t *deleted = delete_hash_entry( xid_table.hash, &delete_entry->xid );
+  xid_entry_t *deleted = delete_uint32_hash_map_entry( xid_table.hash, &delete_entry->xid );
 
   if ( deleted == NULL ) {
     error( "Failed to delete xid entry ( xid = %#lx ).", delete_entry->xid );
@@ -159,7 +147,7 @@ delete_xid_entry( xid_entry_t *delete_entry ) {
 
 xid_entry_t *
 lookup_xid_entry( uint32_t xid ) {
-  return lookup_hash_entry( xid_table.hash, &xid );
+  return lookup_uint32_hash_map_entry( xid_table.hash, &xid );
 }
 
 
@@ -172,12 +160,12 @@ dump_xid_entry( xid_entry_t *entry ) {
 
 void
 dump_xid_table( void ) {
-  hash_iterator iter;
-  hash_entry *e;
+  uint32_hash_map_iterator iter;
+  uint32_hash_map_entry *e;
 
   info( "#### XID TABLE ####" );
-  init_hash_iterator( xid_table.hash, &iter );
-  while ( ( e = iterate_hash_next( &iter ) ) != NULL ) {
+  init_uint32_hash_map_iterator( xid_table.hash, &iter );
+  while ( ( e = iterate_uint32_hash_map_next( &iter ) ) != NULL ) {
     dump_xid_entry( e->value );
   }
   info( "#### END ####" );
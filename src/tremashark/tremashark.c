@@ -53,6 +53,8 @@
 
 static char fifo_pathname[ PATH_MAX ];
 static char pcap_file_pathname[ PATH_MAX ];
+static char trace_file_pathname[ PATH_MAX ];
+static bool replay_trace_file = false;
 static bool output_to_pcap_file = false;
 static bool launch_wireshark = true;
 static bool launch_tshark = false;
@@ -122,10 +124,12 @@ write_to_file( buffer *packet ) {
 
 
 /**
- *  callback function to receive message from messenger.
+ *  queue a dumped message whose data was originally original_data_length
+ *  bytes long, of which only the data_length bytes in the header are
+ *  present.
  */
 static void
-dump_message( uint16_t tag, void *data, size_t len ) {
+write_dump_message( uint16_t tag, void *data, size_t len, size_t original_data_length ) {
   char *app_name, *service_name;
   const char *type_str[] = { "sent", "received", "recv-connected", "recv-overflow", "recv-closed",
                              "send-connected", "send-refused", "send-overflow", "send-closed" };
@@ -175,12 +179,18 @@ dump_message( uint16_t tag, void *data, size_t len ) {
   memcpy( pcap_dump_service_name, service_name, ntohs( pcap_dump_hdr->service_name_len ) );
 
   memset( &pcap_header, 0, sizeof( struct pcap_pkthdr ) );
-  gettimeofday( &pcap_header.ts, NULL );
+  if ( replay_trace_file ) {
+    pcap_header.ts.tv_sec = ntohl( dump_hdr->sent_time.sec );
+    pcap_header.ts.tv_usec = ntohl( dump_hdr->sent_time.nsec ) / 1000;
+  }
+  else {
+    gettimeofday( &pcap_header.ts, NULL );
+  }
 
   len -= dump_header_length;
 
   pcap_header.caplen = ( bpf_u_int32 ) ( pcap_dump_header_length + ntohl( pcap_dump_hdr->data_len ) );
-  pcap_header.len = ( bpf_u_int32 ) ( pcap_dump_header_length + ntohl( pcap_dump_hdr->data_len ) );
+  pcap_header.len = ( bpf_u_int32 ) ( pcap_dump_header_length + original_data_length );
 
   packet = create_pcap_packet( &pcap_header, sizeof( struct pcap_pkthdr ),
                                pcap_dump_hdr, pcap_dump_header_length,
@@ -200,12 +210,21 @@ dump_message( uint16_t tag, void *data, size_t len ) {
 
 
 /**
- *  callback function to write pcap packets.
+ *  callback function to receive message from messenger.
  */
 static void
-write_pcap_packet( void *user_data ) {
-  UNUSED( user_data );
+dump_message( uint16_t tag, void *data, size_t len ) {
+  message_dump_header *dump_hdr = data;
+
+  write_dump_message( tag, data, len, ntohl( dump_hdr->data_length ) );
+}
 
+
+/**
+ *  Write queued pcap packets until the queue is empty or writing fails.
+ */
+static int
+write_pcap_packets() {
   for ( ; ; ) {
     buffer *packet;
     queue_return q_ret = pop_pcap_packet( &packet );
@@ -220,19 +239,54 @@ write_pcap_packet( void *user_data ) {
       break;
 
     case WRITE_BUSY:
-      push_pcap_packet_in_front( packet );
-      return;
-
     case WRITE_ERROR:
       push_pcap_packet_in_front( packet );
-      return;
+      return ret;
 
     default:
       assert( 0 );
     }
   }
 
-  return;
+  return WRITE_SUCCESS;
+}
+
+
+/**
+ *  callback function to write pcap packets.
+ */
+static void
+write_pcap_packet( void *user_data ) {
+  UNUSED( user_data );
+
+  write_pcap_packets();
+}
+
+
+/**
+ *  callback function to receive a record from a messenger trace file.
+ */
+static void
+replay_trace_record( uint16_t dump_type, void *data, size_t len, uint32_t original_length, void *user_data ) {
+  UNUSED( user_data );
+
+  write_dump_message( dump_type, data, len, original_length );
+
+  while ( write_pcap_packets() == WRITE_BUSY ) {
+    usleep( 1000 );
+  }
+}
+
+
+/**
+ *  Replay a messenger trace file and quit.
+ */
+static void
+replay_trace() {
+  if ( !read_messenger_trace( trace_file_pathname, replay_trace_record, NULL ) ) {
+    error( "Failed to replay a trace file (%s).", trace_file_pathname );
+  }
+  stop_trema();
 }
 
 
@@ -337,12 +391,13 @@ start_wireshark() {
 
 static void
 print_usage_and_exit() {
-  fprintf( stderr, "Usage: tremashark [-p] [-t] [-w filename] [-s SERVICE_NAME]\n" );
+  fprintf( stderr, "Usage: tremashark [-p] [-t] [-w filename] [-s SERVICE_NAME | -r TRACE_FILE]\n" );
   fprintf( stderr, "  Options:\n" );
   fprintf( stderr, "    -p: do not launch wireshark or tshark\n" );
   fprintf( stderr, "    -t: launch tshark instead of wireshark\n" );
   fprintf( stderr, "    -w: save messages to a pcap file\n" );
   fprintf( stderr, "    -s: specify service name\n" );
+  fprintf( stderr, "    -r: read messages from a messenger trace file instead of the dump service\n" );
   exit( -1 );
 }
 
@@ -358,7 +413,7 @@ main( int argc, char *argv[] ) {
   init_trema( &argc, &argv );
 
   while( 1 ) {
-    opt = getopt( argc, argv, "s:tw:p" );
+    opt = getopt( argc, argv, "s:tw:pr:" );
 
     if( opt < 0 ){
       break;
@@ -385,6 +440,16 @@ main( int argc, char *argv[] ) {
       }
       break;
 
+    case 'r':
+      if( optarg ){
+        strncpy( trace_file_pathname, optarg, PATH_MAX - 1 );
+        replay_trace_file = true;
+      }
+      else {
+        print_usage_and_exit();
+      }
+      break;
+
     case 'w':
       if( optarg ){
         // Save packets to a pcap file
@@ -404,7 +469,13 @@ main( int argc, char *argv[] ) {
   }
 
   // Set an event handler
-  if ( service_name == NULL ) {
+  if ( replay_trace_file ) {
+    if ( service_name != NULL ) {
+      print_usage_and_exit();
+    }
+    set_external_callback( replay_trace );
+  }
+  else if ( service_name == NULL ) {
     add_message_received_callback( DEFAULT_DUMP_SERVICE_NAME, dump_message );
   }
   else {
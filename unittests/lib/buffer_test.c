@@ -44,10 +44,18 @@ typedef struct private_buffer {
   buffer public;
   size_t real_length;
   void *top;
-  pthread_mutex_t *mutex;
+  pthread_mutex_t mutex;
+  struct private_buffer *storage;
+  unsigned int refcount;
+  size_t capacity;
+  struct private_buffer *next;
+  bool borrowed;
 } private_buffer;
 
 
+extern unsigned int max_free_buffers_per_size_class;
+
+
 /********************************************************************************
  * Mock functions.
  ********************************************************************************/
@@ -118,7 +126,7 @@ test_alloc_buffer_succeeds() {
   assert_true( buf != NULL );
   assert_true( mutex_initialized );
 
-  pthread_mutex_t *expected_mutex = ( ( private_buffer * ) buf )->mutex;
+  pthread_mutex_t *expected_mutex = &( ( private_buffer * ) buf )->mutex;
   expect_value( mock_pthread_mutex_lock, mutex, expected_mutex );
   expect_value( mock_pthread_mutex_unlock, mutex, expected_mutex );
   free_buffer( buf );
@@ -131,7 +139,7 @@ test_alloc_buffer_with_length_succeeds() {
   assert_true( buf != NULL );
   assert_true( mutex_initialized );
 
-  pthread_mutex_t *expected_mutex = ( ( private_buffer * ) buf )->mutex;
+  pthread_mutex_t *expected_mutex = &( ( private_buffer * ) buf )->mutex;
   expect_value( mock_pthread_mutex_lock, mutex, expected_mutex );
   expect_value( mock_pthread_mutex_unlock, mutex, expected_mutex );
   free_buffer( buf );
@@ -150,7 +158,7 @@ test_free_buffer_succeeds() {
   buffer *buf = alloc_buffer();
   assert_true( buf != NULL );
 
-  pthread_mutex_t *expected_mutex = ( ( private_buffer * ) buf )->mutex;
+  pthread_mutex_t *expected_mutex = &( ( private_buffer * ) buf )->mutex;
   expect_value( mock_pthread_mutex_lock, mutex, expected_mutex );
   expect_value( mock_pthread_mutex_unlock, mutex, expected_mutex );
   free_buffer( buf );
@@ -168,7 +176,7 @@ test_append_front_buffer_new_alloc_succeeds() {
   buffer *buf = alloc_buffer();
   assert_true( buf != NULL );
 
-  pthread_mutex_t *expected_mutex = ( ( private_buffer * ) buf )->mutex;
+  pthread_mutex_t *expected_mutex = &( ( private_buffer * ) buf )->mutex;
   expect_value( mock_pthread_mutex_lock, mutex, expected_mutex );
   expect_value( mock_pthread_mutex_unlock, mutex, expected_mutex );
   void *data_pointer = append_front_buffer( buf, sizeof( tea ) );
@@ -186,7 +194,7 @@ test_append_front_twice_suceeds() {
   buffer *buf = alloc_buffer_with_length( sizeof( tea ) * 2 );
   assert_true( buf != NULL );
 
-  pthread_mutex_t *expected_mutex = ( ( private_buffer * ) buf )->mutex;
+  pthread_mutex_t *expected_mutex = &( ( private_buffer * ) buf )->mutex;
   expect_value( mock_pthread_mutex_lock, mutex, expected_mutex );
   expect_value( mock_pthread_mutex_unlock, mutex, expected_mutex );
   void *data_pointer = append_front_buffer( buf, sizeof( tea ) );
@@ -215,7 +223,7 @@ test_append_front_buffer_succeeds() {
   buffer *buf = alloc_buffer_with_length( sizeof( tea ) * 2 );
   assert_true( buf != NULL );
 
-  pthread_mutex_t *expected_mutex = ( ( private_buffer * ) buf )->mutex;
+  pthread_mutex_t *expected_mutex = &( ( private_buffer * ) buf )->mutex;
   expect_value( mock_pthread_mutex_lock, mutex, expected_mutex );
   expect_value( mock_pthread_mutex_unlock, mutex, expected_mutex );
   void *data_pointer = append_front_buffer( buf, sizeof( tea ) );
@@ -239,7 +247,7 @@ test_append_front_buffer_resize_succeeds() {
   buffer *buf = alloc_buffer_with_length( sizeof( tea ) );
   assert_true( buf != NULL );
 
-  pthread_mutex_t *expected_mutex = ( ( private_buffer * ) buf )->mutex;
+  pthread_mutex_t *expected_mutex = &( ( private_buffer * ) buf )->mutex;
   expect_value( mock_pthread_mutex_lock, mutex, expected_mutex );
   expect_value( mock_pthread_mutex_unlock, mutex, expected_mutex );
   void *data_pointer = append_front_buffer( buf, sizeof( tea ) * 2 );
@@ -265,7 +273,7 @@ test_append_front_buffer_fails_if_length_is_0() {
 
   expect_assert_failure( append_front_buffer( buf, 0 ) );
 
-  pthread_mutex_t *expected_mutex = ( ( private_buffer * ) buf )->mutex;
+  pthread_mutex_t *expected_mutex = &( ( private_buffer * ) buf )->mutex;
   expect_value( mock_pthread_mutex_lock, mutex, expected_mutex );
   expect_value( mock_pthread_mutex_unlock, mutex, expected_mutex );
   free_buffer( buf );
@@ -276,7 +284,7 @@ test_remove_front_buffer_succeeds() {
   buffer *buf = alloc_buffer_with_length( sizeof( tea ) * 2 );
   assert_true( buf != NULL );
 
-  pthread_mutex_t *expected_mutex = ( ( private_buffer * ) buf )->mutex;
+  pthread_mutex_t *expected_mutex = &( ( private_buffer * ) buf )->mutex;
   expect_value( mock_pthread_mutex_lock, mutex, expected_mutex );
   expect_value( mock_pthread_mutex_unlock, mutex, expected_mutex );
   void *data_pointer = append_front_buffer( buf, sizeof( tea ) * 2 );
@@ -300,7 +308,7 @@ test_remove_front_buffer_text_insert_succeeds() {
   buffer *buf = alloc_buffer_with_length( sizeof( tea ) * 2 );
   assert_true( buf != NULL );
 
-  pthread_mutex_t *expected_mutex = ( ( private_buffer * ) buf )->mutex;
+  pthread_mutex_t *expected_mutex = &( ( private_buffer * ) buf )->mutex;
   expect_value( mock_pthread_mutex_lock, mutex, expected_mutex );
   expect_value( mock_pthread_mutex_unlock, mutex, expected_mutex );
   void *data_pointer = append_front_buffer( buf, sizeof( tea ) * 2 );
@@ -328,7 +336,7 @@ test_remove_front_buffer_all_removed() {
   buffer *buf = alloc_buffer_with_length( sizeof( tea ) );
   assert_true( buf != NULL );
 
-  pthread_mutex_t *expected_mutex = ( ( private_buffer * ) buf )->mutex;
+  pthread_mutex_t *expected_mutex = &( ( private_buffer * ) buf )->mutex;
   expect_value( mock_pthread_mutex_lock, mutex, expected_mutex );
   expect_value( mock_pthread_mutex_unlock, mutex, expected_mutex );
   void *data_pointer = append_front_buffer( buf, sizeof( tea ) );
@@ -352,7 +360,7 @@ test_remove_front_buffer_fails_if_large_length_remove() {
   buffer *buf = alloc_buffer_with_length( sizeof( tea ) * 2 );
   assert_true( buf != NULL );
 
-  pthread_mutex_t *expected_mutex = ( ( private_buffer * ) buf )->mutex;
+  pthread_mutex_t *expected_mutex = &( ( private_buffer * ) buf )->mutex;
   expect_value( mock_pthread_mutex_lock, mutex, expected_mutex );
   expect_value( mock_pthread_mutex_unlock, mutex, expected_mutex );
   void *data_pointer = append_front_buffer( buf, sizeof( tea ) );
@@ -381,7 +389,7 @@ test_remove_front_buffer_fails_if_remove_size_is_0() {
 
   expect_assert_failure( remove_front_buffer( buf, 0 ) );
 
-  pthread_mutex_t *expected_mutex = ( ( private_buffer * ) buf )->mutex;
+  pthread_mutex_t *expected_mutex = &( ( private_buffer * ) buf )->mutex;
   expect_value( mock_pthread_mutex_lock, mutex, expected_mutex );
   expect_value( mock_pthread_mutex_unlock, mutex, expected_mutex );
   free_buffer( buf );
@@ -393,7 +401,7 @@ test_append_back_buffer_succeeds() {
   buffer *buf = alloc_buffer_with_length( sizeof( tea ) * 2 );
   assert_true( buf != NULL );
 
-  pthread_mutex_t *expected_mutex = ( ( private_buffer * ) buf )->mutex;
+  pthread_mutex_t *expected_mutex = &( ( private_buffer * ) buf )->mutex;
   expect_value( mock_pthread_mutex_lock, mutex, expected_mutex );
   expect_value( mock_pthread_mutex_unlock, mutex, expected_mutex );
   void *data_pointer = append_back_buffer( buf, sizeof( tea ) );
@@ -411,7 +419,7 @@ test_append_back_twice_succeeds() {
   buffer *buf = alloc_buffer_with_length( sizeof( tea ) * 3 );
   assert_true( buf != NULL );
 
-  pthread_mutex_t *expected_mutex = ( ( private_buffer * ) buf )->mutex;
+  pthread_mutex_t *expected_mutex = &( ( private_buffer * ) buf )->mutex;
   expect_value( mock_pthread_mutex_lock, mutex, expected_mutex );
   expect_value( mock_pthread_mutex_unlock, mutex, expected_mutex );
   void *data_pointer = append_back_buffer( buf, sizeof( tea ) );
@@ -444,7 +452,7 @@ test_append_back_buffer_resize_succeeds() {
   buffer *buf = alloc_buffer_with_length( sizeof( tea ) );
   assert_true( buf != NULL );
 
-  pthread_mutex_t *expected_mutex = ( ( private_buffer * ) buf )->mutex;
+  pthread_mutex_t *expected_mutex = &( ( private_buffer * ) buf )->mutex;
   expect_value( mock_pthread_mutex_lock, mutex, expected_mutex );
   expect_value( mock_pthread_mutex_unlock, mutex, expected_mutex );
   void *data_pointer = append_back_buffer( buf, sizeof( tea ) * 2 );
@@ -462,7 +470,7 @@ test_append_back_buffer_succeeds_if_initialize_length_is_0() {
   buffer *buf = alloc_buffer();
   assert_true( buf != NULL );
 
-  pthread_mutex_t *expected_mutex = ( ( private_buffer * ) buf )->mutex;
+  pthread_mutex_t *expected_mutex = &( ( private_buffer * ) buf )->mutex;
   expect_value( mock_pthread_mutex_lock, mutex, expected_mutex );
   expect_value( mock_pthread_mutex_unlock, mutex, expected_mutex );
   void *data_pointer = append_back_buffer( buf, sizeof( tea ) );
@@ -488,7 +496,7 @@ test_append_back_buffer_fails_if_length_is_0() {
 
   expect_assert_failure( append_back_buffer( buf, 0 ) );
 
-  pthread_mutex_t *expected_mutex = ( ( private_buffer * ) buf )->mutex;
+  pthread_mutex_t *expected_mutex = &( ( private_buffer * ) buf )->mutex;
   expect_value( mock_pthread_mutex_lock, mutex, expected_mutex );
   expect_value( mock_pthread_mutex_unlock, mutex, expected_mutex );
   free_buffer( buf );
@@ -500,7 +508,7 @@ test_duplicate_buffer_succeeds() {
   buffer *buf = alloc_buffer_with_length( sizeof( tea ) );
   assert_true( buf != NULL );
 
-  pthread_mutex_t *expected_mutex = ( ( private_buffer * ) buf )->mutex;
+  pthread_mutex_t *expected_mutex = &( ( private_buffer * ) buf )->mutex;
   expect_value( mock_pthread_mutex_lock, mutex, expected_mutex );
   expect_value( mock_pthread_mutex_unlock, mutex, expected_mutex );
   buffer *duplicate = duplicate_buffer( buf );
@@ -511,7 +519,7 @@ test_duplicate_buffer_succeeds() {
   expect_value( mock_pthread_mutex_lock, mutex, expected_mutex );
   expect_value( mock_pthread_mutex_unlock, mutex, expected_mutex );
   free_buffer( buf );
-  pthread_mutex_t *expected_duplicate_mutex = ( ( private_buffer * ) duplicate )->mutex;
+  pthread_mutex_t *expected_duplicate_mutex = &( ( private_buffer * ) duplicate )->mutex;
   expect_value( mock_pthread_mutex_lock, mutex, expected_duplicate_mutex );
   expect_value( mock_pthread_mutex_unlock, mutex, expected_duplicate_mutex );
   free_buffer( duplicate );
@@ -524,7 +532,7 @@ test_duplicate_buffer_succeeds_if_initialize_length_is_0() {
   assert_true( buf != NULL );
   assert_true( buf->data == NULL );
 
-  pthread_mutex_t *expected_mutex = ( ( private_buffer * ) buf )->mutex;
+  pthread_mutex_t *expected_mutex = &( ( private_buffer * ) buf )->mutex;
   expect_value( mock_pthread_mutex_lock, mutex, expected_mutex );
   expect_value( mock_pthread_mutex_unlock, mutex, expected_mutex );
   buffer *duplicate = duplicate_buffer( buf );
@@ -536,7 +544,7 @@ test_duplicate_buffer_succeeds_if_initialize_length_is_0() {
   expect_value( mock_pthread_mutex_lock, mutex, expected_mutex );
   expect_value( mock_pthread_mutex_unlock, mutex, expected_mutex );
   free_buffer( buf );
-  pthread_mutex_t *expected_duplicate_mutex = ( ( private_buffer * ) duplicate )->mutex;
+  pthread_mutex_t *expected_duplicate_mutex = &( ( private_buffer * ) duplicate )->mutex;
   expect_value( mock_pthread_mutex_lock, mutex, expected_duplicate_mutex );
   expect_value( mock_pthread_mutex_unlock, mutex, expected_duplicate_mutex );
   free_buffer( duplicate );
@@ -550,7 +558,7 @@ test_duplicate_buffer_fails_if_buffer_is_NULL() {
 
   expect_assert_failure( duplicate_buffer( NULL ) );
 
-  pthread_mutex_t *expected_mutex = ( ( private_buffer * ) buf )->mutex;
+  pthread_mutex_t *expected_mutex = &( ( private_buffer * ) buf )->mutex;
   expect_value( mock_pthread_mutex_lock, mutex, expected_mutex );
   expect_value( mock_pthread_mutex_unlock, mutex, expected_mutex );
   free_buffer( buf );
@@ -574,7 +582,7 @@ static void
 test_dump_buffer() {
   buffer *buf = alloc_buffer();
 
-  pthread_mutex_t *expected_mutex = ( ( private_buffer * ) buf )->mutex;
+  pthread_mutex_t *expected_mutex = &( ( private_buffer * ) buf )->mutex;
   expect_value( mock_pthread_mutex_lock, mutex, expected_mutex );
   expect_value( mock_pthread_mutex_unlock, mutex, expected_mutex );
   void *datap = append_back_buffer( buf, ( size_t ) 1 );
@@ -592,6 +600,316 @@ test_dump_buffer() {
 }
 
 
+static void
+free_buffer_expecting_lock( buffer *buf ) {
+  pthread_mutex_t *expected_mutex = &( ( private_buffer * ) buf )->mutex;
+  expect_value( mock_pthread_mutex_lock, mutex, expected_mutex );
+  expect_value( mock_pthread_mutex_unlock, mutex, expected_mutex );
+  free_buffer( buf );
+}
+
+
+static void
+test_freed_buffer_is_reused() {
+  max_free_buffers_per_size_class = 4;
+
+  buffer *buf = alloc_buffer_with_length( 100 );
+  free_buffer_expecting_lock( buf );
+
+  buffer *reused = alloc_buffer_with_length( 50 );
+  assert_true( reused == buf );
+  assert_true( reused->length == 0 );
+  assert_true( reused->user_data == NULL );
+  free_buffer_expecting_lock( reused );
+
+  flush_buffer_pool();
+  max_free_buffers_per_size_class = 0;
+}
+
+
+static void
+test_freed_buffer_is_not_reused_for_larger_size() {
+  max_free_buffers_per_size_class = 4;
+
+  buffer *buf = alloc_buffer_with_length( 100 );
+  free_buffer_expecting_lock( buf );
+
+  buffer *larger = alloc_buffer_with_length( 1000 );
+  assert_true( larger != buf );
+  free_buffer_expecting_lock( larger );
+
+  flush_buffer_pool();
+  max_free_buffers_per_size_class = 0;
+}
+
+
+static void
+test_large_buffer_is_not_pooled() {
+  max_free_buffers_per_size_class = 4;
+
+  buffer *buf = alloc_buffer_with_length( 100000 );
+  assert_true( ( ( private_buffer * ) buf )->capacity == 100000 );
+  free_buffer_expecting_lock( buf );
+
+  flush_buffer_pool();
+  max_free_buffers_per_size_class = 0;
+}
+
+
+static void
+test_append_back_beyond_embedded_area_keeps_data() {
+  buffer *buf = alloc_buffer_with_length( sizeof( tea ) );
+
+  pthread_mutex_t *expected_mutex = &( ( private_buffer * ) buf )->mutex;
+  expect_value_count( mock_pthread_mutex_lock, mutex, expected_mutex, 2 );
+  expect_value_count( mock_pthread_mutex_unlock, mutex, expected_mutex, 2 );
+  memcpy( append_back_buffer( buf, sizeof( tea ) ), &CEYLON, sizeof( tea ) );
+  append_back_buffer( buf, 1000 );
+
+  assert_true( buf->length == sizeof( tea ) + 1000 );
+  assert_memory_equal( buf->data, &CEYLON, sizeof( tea ) );
+
+  free_buffer_expecting_lock( buf );
+}
+
+
+static void
+test_append_front_buffer_uses_headroom() {
+  buffer *buf = alloc_buffer_with_headroom( sizeof( tea ), sizeof( tea ) );
+  assert_true( buf != NULL );
+  assert_true( buf->length == 0 );
+
+  pthread_mutex_t *expected_mutex = &( ( private_buffer * ) buf )->mutex;
+  expect_value_count( mock_pthread_mutex_lock, mutex, expected_mutex, 2 );
+  expect_value_count( mock_pthread_mutex_unlock, mutex, expected_mutex, 2 );
+  void *body = append_back_buffer( buf, sizeof( tea ) );
+  memcpy( body, &DARJEELING, sizeof( tea ) );
+  void *header = append_front_buffer( buf, sizeof( tea ) );
+
+  assert_true( ( char * ) header + sizeof( tea ) == body );
+  assert_true( buf->length == sizeof( tea ) * 2 );
+  assert_memory_equal( body, &DARJEELING, sizeof( tea ) );
+
+  free_buffer_expecting_lock( buf );
+}
+
+
+static void
+test_append_front_buffer_beyond_headroom_succeeds() {
+  buffer *buf = alloc_buffer_with_headroom( sizeof( tea ), 1 );
+
+  pthread_mutex_t *expected_mutex = &( ( private_buffer * ) buf )->mutex;
+  expect_value_count( mock_pthread_mutex_lock, mutex, expected_mutex, 2 );
+  expect_value_count( mock_pthread_mutex_unlock, mutex, expected_mutex, 2 );
+  memcpy( append_back_buffer( buf, sizeof( tea ) ), &DARJEELING, sizeof( tea ) );
+  memcpy( append_front_buffer( buf, sizeof( tea ) ), &CEYLON, sizeof( tea ) );
+
+  assert_true( buf->length == sizeof( tea ) * 2 );
+  assert_memory_equal( buf->data, &CEYLON, sizeof( tea ) );
+  assert_memory_equal( ( char * ) buf->data + sizeof( tea ), &DARJEELING, sizeof( tea ) );
+
+  free_buffer_expecting_lock( buf );
+}
+
+
+static void
+test_duplicate_buffer_keeps_headroom() {
+  buffer *buf = alloc_buffer_with_headroom( sizeof( tea ), sizeof( tea ) );
+
+  pthread_mutex_t *expected_mutex = &( ( private_buffer * ) buf )->mutex;
+  expect_value_count( mock_pthread_mutex_lock, mutex, expected_mutex, 2 );
+  expect_value_count( mock_pthread_mutex_unlock, mutex, expected_mutex, 2 );
+  memcpy( append_back_buffer( buf, sizeof( tea ) ), &DARJEELING, sizeof( tea ) );
+  buffer *duplicate = duplicate_buffer( buf );
+
+  pthread_mutex_t *expected_duplicate_mutex = &( ( private_buffer * ) duplicate )->mutex;
+  expect_value( mock_pthread_mutex_lock, mutex, expected_duplicate_mutex );
+  expect_value( mock_pthread_mutex_unlock, mutex, expected_duplicate_mutex );
+  void *data = duplicate->data;
+  assert_true( ( char * ) append_front_buffer( duplicate, sizeof( tea ) ) + sizeof( tea ) == data );
+  assert_memory_equal( data, &DARJEELING, sizeof( tea ) );
+
+  free_buffer_expecting_lock( buf );
+  free_buffer_expecting_lock( duplicate );
+}
+
+
+static void
+test_clone_buffer_shares_data() {
+  buffer *buf = alloc_buffer_with_length( sizeof( tea ) );
+
+  pthread_mutex_t *expected_mutex = &( ( private_buffer * ) buf )->mutex;
+  expect_value_count( mock_pthread_mutex_lock, mutex, expected_mutex, 2 );
+  expect_value_count( mock_pthread_mutex_unlock, mutex, expected_mutex, 2 );
+  memcpy( append_back_buffer( buf, sizeof( tea ) ), &CEYLON, sizeof( tea ) );
+  buf->user_data = &DARJEELING;
+  buffer *clone = clone_buffer( buf );
+
+  assert_true( clone != buf );
+  assert_true( clone->data == buf->data );
+  assert_true( clone->length == buf->length );
+  assert_true( clone->user_data == &DARJEELING );
+
+  free_buffer_expecting_lock( buf );
+  assert_memory_equal( clone->data, &CEYLON, sizeof( tea ) );
+  free_buffer_expecting_lock( clone );
+}
+
+
+static void
+test_append_to_clone_copies_data() {
+  buffer *buf = alloc_buffer_with_length( sizeof( tea ) * 2 );
+
+  pthread_mutex_t *expected_mutex = &( ( private_buffer * ) buf )->mutex;
+  expect_value_count( mock_pthread_mutex_lock, mutex, expected_mutex, 2 );
+  expect_value_count( mock_pthread_mutex_unlock, mutex, expected_mutex, 2 );
+  memcpy( append_back_buffer( buf, sizeof( tea ) ), &CEYLON, sizeof( tea ) );
+  buffer *clone = clone_buffer( buf );
+
+  pthread_mutex_t *expected_clone_mutex = &( ( private_buffer * ) clone )->mutex;
+  expect_value_count( mock_pthread_mutex_lock, mutex, expected_clone_mutex, 2 );
+  expect_value_count( mock_pthread_mutex_unlock, mutex, expected_clone_mutex, 2 );
+  memcpy( append_back_buffer( clone, sizeof( tea ) ), &DARJEELING, sizeof( tea ) );
+  memcpy( append_front_buffer( clone, sizeof( tea ) ), &DARJEELING, sizeof( tea ) );
+
+  assert_true( clone->data != buf->data );
+  assert_true( clone->length == sizeof( tea ) * 3 );
+  assert_true( buf->length == sizeof( tea ) );
+  assert_memory_equal( buf->data, &CEYLON, sizeof( tea ) );
+  assert_memory_equal( ( char * ) clone->data + sizeof( tea ), &CEYLON, sizeof( tea ) );
+
+  expect_value( mock_pthread_mutex_lock, mutex, expected_mutex );
+  expect_value( mock_pthread_mutex_unlock, mutex, expected_mutex );
+  memcpy( append_back_buffer( buf, sizeof( tea ) ), &CEYLON, sizeof( tea ) );
+  assert_memory_equal( ( char * ) clone->data + sizeof( tea ) * 2, &DARJEELING, sizeof( tea ) );
+
+  free_buffer_expecting_lock( clone );
+  free_buffer_expecting_lock( buf );
+}
+
+
+static void
+test_slice_buffer_succeeds() {
+  buffer *buf = alloc_buffer_with_length( sizeof( tea ) * 2 );
+
+  pthread_mutex_t *expected_mutex = &( ( private_buffer * ) buf )->mutex;
+  expect_value_count( mock_pthread_mutex_lock, mutex, expected_mutex, 3 );
+  expect_value_count( mock_pthread_mutex_unlock, mutex, expected_mutex, 3 );
+  memcpy( append_back_buffer( buf, sizeof( tea ) ), &CEYLON, sizeof( tea ) );
+  memcpy( append_back_buffer( buf, sizeof( tea ) ), &DARJEELING, sizeof( tea ) );
+  buf->user_data = &CEYLON;
+  buffer *slice = slice_buffer( buf, sizeof( tea ), sizeof( tea ) );
+
+  assert_true( slice->data == ( char * ) buf->data + sizeof( tea ) );
+  assert_true( slice->length == sizeof( tea ) );
+  assert_true( slice->user_data == NULL );
+
+  free_buffer_expecting_lock( buf );
+  assert_memory_equal( slice->data, &DARJEELING, sizeof( tea ) );
+  free_buffer_expecting_lock( slice );
+}
+
+
+static void
+test_slice_buffer_fails_if_out_of_range() {
+  buffer *buf = alloc_buffer_with_length( sizeof( tea ) );
+
+  pthread_mutex_t *expected_mutex = &( ( private_buffer * ) buf )->mutex;
+  expect_value( mock_pthread_mutex_lock, mutex, expected_mutex );
+  expect_value( mock_pthread_mutex_unlock, mutex, expected_mutex );
+  append_back_buffer( buf, sizeof( tea ) );
+
+  expect_assert_failure( slice_buffer( buf, 1, sizeof( tea ) ) );
+
+  free_buffer_expecting_lock( buf );
+}
+
+
+static void
+test_wrap_buffer_points_to_given_data() {
+  tea teas[ 2 ] = { CEYLON, DARJEELING };
+
+  buffer *buf = wrap_buffer( teas, sizeof( teas ) );
+
+  assert_true( buf->data == teas );
+  assert_true( buf->length == sizeof( teas ) );
+  assert_true( buf->user_data == NULL );
+
+  pthread_mutex_t *expected_mutex = &( ( private_buffer * ) buf )->mutex;
+  expect_value( mock_pthread_mutex_lock, mutex, expected_mutex );
+  expect_value( mock_pthread_mutex_unlock, mutex, expected_mutex );
+  buffer *slice = slice_buffer( buf, sizeof( tea ), sizeof( tea ) );
+
+  assert_true( slice->data == &teas[ 1 ] );
+
+  free_buffer_expecting_lock( buf );
+  free_buffer_expecting_lock( slice );
+}
+
+
+static void
+test_append_to_wrapped_buffer_copies_data() {
+  tea teas[ 1 ] = { CEYLON };
+
+  buffer *buf = wrap_buffer( teas, sizeof( teas ) );
+
+  pthread_mutex_t *expected_mutex = &( ( private_buffer * ) buf )->mutex;
+  expect_value_count( mock_pthread_mutex_lock, mutex, expected_mutex, 2 );
+  expect_value_count( mock_pthread_mutex_unlock, mutex, expected_mutex, 2 );
+  remove_front_buffer( buf, sizeof( tea ) );
+  memcpy( append_front_buffer( buf, sizeof( tea ) ), &DARJEELING, sizeof( tea ) );
+
+  assert_true( buf->data != teas );
+  assert_memory_equal( buf->data, &DARJEELING, sizeof( tea ) );
+  assert_memory_equal( teas, &CEYLON, sizeof( tea ) );
+
+  free_buffer_expecting_lock( buf );
+}
+
+
+static void
+test_retain_buffer_copies_wrapped_data() {
+  tea teas[ 1 ] = { CEYLON };
+
+  buffer *buf = wrap_buffer( teas, sizeof( teas ) );
+  buf->user_data = &DARJEELING;
+
+  pthread_mutex_t *expected_mutex = &( ( private_buffer * ) buf )->mutex;
+  expect_value_count( mock_pthread_mutex_lock, mutex, expected_mutex, 2 );
+  expect_value_count( mock_pthread_mutex_unlock, mutex, expected_mutex, 2 );
+  buffer *retained = retain_buffer( buf );
+  free_buffer_expecting_lock( buf );
+  teas[ 0 ] = DARJEELING;
+
+  assert_true( retained->data != teas );
+  assert_true( retained->length == sizeof( tea ) );
+  assert_true( retained->user_data == NULL );
+  assert_memory_equal( retained->data, &CEYLON, sizeof( tea ) );
+
+  free_buffer_expecting_lock( retained );
+}
+
+
+static void
+test_retain_buffer_shares_owned_data() {
+  buffer *buf = alloc_buffer_with_length( sizeof( tea ) );
+
+  pthread_mutex_t *expected_mutex = &( ( private_buffer * ) buf )->mutex;
+  expect_value_count( mock_pthread_mutex_lock, mutex, expected_mutex, 3 );
+  expect_value_count( mock_pthread_mutex_unlock, mutex, expected_mutex, 3 );
+  memcpy( append_back_buffer( buf, sizeof( tea ) ), &CEYLON, sizeof( tea ) );
+  buf->user_data = &DARJEELING;
+  buffer *retained = retain_buffer( buf );
+
+  assert_true( retained->data == buf->data );
+  assert_true( retained->user_data == NULL );
+
+  free_buffer_expecting_lock( buf );
+  assert_memory_equal( retained->data, &CEYLON, sizeof( tea ) );
+  free_buffer_expecting_lock( retained );
+}
+
+
 /********************************************************************************
  * Run tests.
  ********************************************************************************/
@@ -632,6 +950,25 @@ main() {
     unit_test( test_duplicate_buffer_fails_if_buffer_is_NULL ),
 
     unit_test( test_dump_buffer ),
+
+    unit_test( test_freed_buffer_is_reused ),
+    unit_test( test_freed_buffer_is_not_reused_for_larger_size ),
+    unit_test( test_large_buffer_is_not_pooled ),
+    unit_test( test_append_back_beyond_embedded_area_keeps_data ),
+
+    unit_test( test_append_front_buffer_uses_headroom ),
+    unit_test( test_append_front_buffer_beyond_headroom_succeeds ),
+    unit_test( test_duplicate_buffer_keeps_headroom ),
+
+    unit_test( test_clone_buffer_shares_data ),
+    unit_test( test_append_to_clone_copies_data ),
+    unit_test( test_slice_buffer_succeeds ),
+    unit_test( test_slice_buffer_fails_if_out_of_range ),
+
+    unit_test( test_wrap_buffer_points_to_given_data ),
+    unit_test( test_append_to_wrapped_buffer_copies_data ),
+    unit_test( test_retain_buffer_copies_wrapped_data ),
+    unit_test( test_retain_buffer_shares_owned_data ),
   };
   return run_tests( tests );
 }
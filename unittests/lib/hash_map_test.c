@@ -0,0 +1,219 @@
+/*
+ * Unit tests for type-specialized hash maps.
+ *
+ * Copyright (C) 2008-2011 NEC Corporation
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License, version 2, as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "checks.h"
+#include "cmockery.h"
+#include "hash_map.h"
+
+
+static char alpha[] = "alpha";
+static char bravo[] = "bravo";
+
+
+/********************************************************************************
+ * Test functions.
+ ********************************************************************************/
+
+static void
+test_lookup_empty_map_returns_NULL() {
+  uint64_hash_map *map = create_uint64_hash_map( 0 );
+  uint64_t key = 1;
+
+  assert_true( lookup_uint64_hash_map_entry( map, &key ) == NULL );
+
+  delete_uint64_hash_map( map );
+}
+
+
+static void
+test_insert_and_lookup_uint64_key() {
+  uint64_hash_map *map = create_uint64_hash_map( 0 );
+  uint64_t key = 0x123456789abcdefULL;
+
+  assert_true( insert_uint64_hash_map_entry( map, &key, alpha ) == NULL );
+  key = 0x123456789abcdefULL;
+  assert_string_equal( lookup_uint64_hash_map_entry( map, &key ), "alpha" );
+  assert_int_equal( map->length, 1 );
+
+  delete_uint64_hash_map( map );
+}
+
+
+static void
+test_zero_is_a_valid_key() {
+  uint32_hash_map *map = create_uint32_hash_map( 0 );
+  uint32_t key = 0;
+
+  insert_uint32_hash_map_entry( map, &key, alpha );
+  assert_string_equal( lookup_uint32_hash_map_entry( map, &key ), "alpha" );
+
+  delete_uint32_hash_map( map );
+}
+
+
+static void
+test_insert_twice_replaces_value() {
+  uint32_hash_map *map = create_uint32_hash_map( 0 );
+  uint32_t key = 42;
+
+  insert_uint32_hash_map_entry( map, &key, alpha );
+  assert_string_equal( insert_uint32_hash_map_entry( map, &key, bravo ), "alpha" );
+  assert_string_equal( lookup_uint32_hash_map_entry( map, &key ), "bravo" );
+  assert_int_equal( map->length, 1 );
+
+  delete_uint32_hash_map( map );
+}
+
+
+static void
+test_insert_and_lookup_mac_key() {
+  mac_hash_map *map = create_mac_hash_map( 0 );
+  mac_address mac = { { 0x00, 0x11, 0x22, 0x33, 0x44, 0x55 } };
+  mac_address other = { { 0x00, 0x11, 0x22, 0x33, 0x44, 0x56 } };
+
+  insert_mac_hash_map_entry( map, &mac, alpha );
+  assert_string_equal( lookup_mac_hash_map_entry( map, &mac ), "alpha" );
+  assert_true( lookup_mac_hash_map_entry( map, &other ) == NULL );
+
+  delete_mac_hash_map( map );
+}
+
+
+static void
+test_map_grows_and_deletes() {
+  uint64_hash_map *map = create_uint64_hash_map( 0 );
+  unsigned int initial_size = map->number_of_buckets;
+
+  uint64_t i;
+  for ( i = 0; i < 1000; i++ ) {
+    insert_uint64_hash_map_entry( map, &i, ( void * ) ( uintptr_t ) ( i + 1 ) );
+  }
+  assert_int_equal( map->length, 1000 );
+  assert_true( map->number_of_buckets > initial_size );
+
+  for ( i = 0; i < 1000; i += 2 ) {
+    assert_true( delete_uint64_hash_map_entry( map, &i ) == ( void * ) ( uintptr_t ) ( i + 1 ) );
+  }
+  assert_int_equal( map->length, 500 );
+
+  for ( i = 0; i < 1000; i++ ) {
+    void *expected = ( i % 2 == 0 ) ? NULL : ( void * ) ( uintptr_t ) ( i + 1 );
+    assert_true( lookup_uint64_hash_map_entry( map, &i ) == expected );
+  }
+
+  delete_uint64_hash_map( map );
+}
+
+
+static void
+test_iterate_and_delete() {
+  uint64_hash_map *map = create_uint64_hash_map( 0 );
+
+  uint64_t i;
+  uint64_t expected = 0;
+  for ( i = 1; i <= 100; i++ ) {
+    insert_uint64_hash_map_entry( map, &i, ( void * ) ( uintptr_t ) i );
+    expected += i;
+  }
+
+  uint64_t sum = 0;
+  uint64_hash_map_iterator iter;
+  uint64_hash_map_entry *e;
+  init_uint64_hash_map_iterator( map, &iter );
+  while ( ( e = iterate_uint64_hash_map_next( &iter ) ) != NULL ) {
+    sum += e->key;
+    delete_uint64_hash_map_entry( map, &e->key );
+  }
+  assert_true( sum == expected );
+  assert_int_equal( map->length, 0 );
+
+  delete_uint64_hash_map( map );
+}
+
+
+static void
+test_iterate_empty_map() {
+  uint32_hash_map *map = create_uint32_hash_map( 0 );
+  uint32_hash_map_iterator iter;
+
+  init_uint32_hash_map_iterator( map, &iter );
+  assert_true( iterate_uint32_hash_map_next( &iter ) == NULL );
+
+  delete_uint32_hash_map( map );
+}
+
+
+static void
+count_entries( const uint32_t *key, void *value, void *user_data ) {
+  assert_true( ( uintptr_t ) value == *key );
+  ( *( int * ) user_data )++;
+}
+
+
+static void
+test_foreach() {
+  uint32_hash_map *map = create_uint32_hash_map( 16 );
+
+  uint32_t i;
+  for ( i = 1; i <= 10; i++ ) {
+    insert_uint32_hash_map_entry( map, &i, ( void * ) ( uintptr_t ) i );
+  }
+
+  int count = 0;
+  foreach_uint32_hash_map( map, count_entries, &count );
+  assert_int_equal( count, 10 );
+
+  delete_uint32_hash_map( map );
+}
+
+
+/********************************************************************************
+ * Run tests.
+ ********************************************************************************/
+
+int
+main() {
+  const UnitTest tests[] = {
+    unit_test( test_lookup_empty_map_returns_NULL ),
+    unit_test( test_insert_and_lookup_uint64_key ),
+    unit_test( test_zero_is_a_valid_key ),
+    unit_test( test_insert_twice_replaces_value ),
+    unit_test( test_insert_and_lookup_mac_key ),
+    unit_test( test_map_grows_and_deletes ),
+    unit_test( test_iterate_and_delete ),
+    unit_test( test_iterate_empty_map ),
+    unit_test( test_foreach ),
+  };
+  return run_tests( tests );
+}
+
+
+/*
+ * Local variables:
+ * c-basic-offset: 2
+ * indent-tabs-mode: nil
+ * End:
+ */
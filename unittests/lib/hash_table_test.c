@@ -29,6 +29,7 @@
 #include "checks.h"
 #include "cmockery.h"
 #include "hash_table.h"
+#include "rcu.h"
 #include "utility.h"
 
 
@@ -285,6 +286,233 @@ test_iterate_empty_hash() {
 }
 
 
+static unsigned int
+hash_identity( const void *key ) {
+  return ( unsigned int ) ( uintptr_t ) key;
+}
+
+
+static void
+test_create_hash_with_size() {
+  table = create_hash_with_size( compare_string, hash_string, 1000 );
+
+  assert_true( table->number_of_buckets >= 1000 );
+  assert_true( ( table->number_of_buckets & ( table->number_of_buckets - 1 ) ) == 0 );
+
+  insert_hash_entry( table, alpha, alpha );
+  assert_string_equal( lookup_hash_entry( table, alpha ), "alpha" );
+
+  delete_hash( table );
+}
+
+
+static void
+test_small_table_grows() {
+  table = create_hash( compare_atom, hash_identity );
+  unsigned int initial_size = table->number_of_buckets;
+
+  uintptr_t i;
+  for ( i = 1; i <= 1000; i++ ) {
+    insert_hash_entry( table, ( void * ) i, ( void * ) ( i * 2 ) );
+  }
+  assert_true( table->length == 1000 );
+  assert_true( table->number_of_buckets > initial_size );
+
+  for ( i = 1; i <= 1000; i++ ) {
+    assert_true( lookup_hash_entry( table, ( void * ) i ) == ( void * ) ( i * 2 ) );
+  }
+  assert_true( lookup_hash_entry( table, ( void * ) 1001 ) == NULL );
+
+  delete_hash( table );
+}
+
+
+static void
+test_delete_while_growing() {
+  table = create_hash( compare_atom, hash_identity );
+
+  uintptr_t i;
+  for ( i = 1; i <= 501; i++ ) {
+    insert_hash_entry( table, ( void * ) i, ( void * ) i );
+    if ( i % 3 == 0 ) {
+      assert_true( delete_hash_entry( table, ( void * ) ( i - 1 ) ) == ( void * ) ( i - 1 ) );
+    }
+  }
+
+  for ( i = 1; i <= 501; i++ ) {
+    if ( i % 3 == 2 ) {
+      assert_true( lookup_hash_entry( table, ( void * ) i ) == NULL );
+    }
+    else {
+      assert_true( lookup_hash_entry( table, ( void * ) i ) == ( void * ) i );
+    }
+  }
+
+  delete_hash( table );
+}
+
+
+static void
+test_iterate_and_delete_all_while_growing() {
+  table = create_hash( compare_atom, hash_identity );
+
+  uintptr_t i;
+  uintptr_t expected = 0;
+  for ( i = 1; i <= 200; i++ ) {
+    insert_hash_entry( table, ( void * ) i, ( void * ) i );
+    expected += i;
+  }
+
+  uintptr_t sum = 0;
+  hash_iterator iter;
+  hash_entry *e;
+  init_hash_iterator( table, &iter );
+  while ( ( e = iterate_hash_next( &iter ) ) != NULL ) {
+    sum += ( uintptr_t ) e->value;
+    delete_hash_entry( table, e->key );
+  }
+  assert_true( sum == expected );
+  assert_true( table->length == 0 );
+
+  delete_hash( table );
+}
+
+
+static void
+mark_value( void *value, void *user_data ) {
+  uintptr_t *seen = user_data;
+  uintptr_t bit = ( uintptr_t ) 1 << ( uintptr_t ) value;
+
+  assert_true( ( *seen & bit ) == 0 );
+  *seen |= bit;
+}
+
+
+static void
+test_map_after_growth() {
+  table = create_hash( compare_atom, hash_identity );
+
+  uintptr_t i;
+  for ( i = 1; i <= 5; i++ ) {
+    insert_hash_entry( table, ( void * ) 1, ( void * ) i );
+  }
+  for ( i = 2; i <= 100; i++ ) {
+    insert_hash_entry( table, ( void * ) i, ( void * ) i );
+  }
+
+  assert_true( lookup_hash_entry( table, ( void * ) 1 ) == ( void * ) 5 );
+
+  uintptr_t seen = 0;
+  map_hash( table, ( void * ) 1, mark_value, &seen );
+  assert_true( seen == 0x3e );
+
+  for ( i = 5; i >= 1; i-- ) {
+    assert_true( delete_hash_entry( table, ( void * ) 1 ) == ( void * ) i );
+  }
+  assert_true( lookup_hash_entry( table, ( void * ) 1 ) == NULL );
+
+  delete_hash( table );
+}
+
+
+static void
+test_unlocked_table() {
+  table = create_hash( compare_atom, hash_identity );
+  set_hash_concurrency( table, HASH_TABLE_UNLOCKED );
+
+  uintptr_t i;
+  for ( i = 1; i <= 100; i++ ) {
+    insert_hash_entry( table, ( void * ) i, ( void * ) i );
+  }
+  for ( i = 1; i <= 100; i += 2 ) {
+    assert_true( delete_hash_entry( table, ( void * ) i ) == ( void * ) i );
+  }
+  for ( i = 1; i <= 100; i++ ) {
+    assert_true( lookup_hash_entry( table, ( void * ) i ) == ( i % 2 == 0 ? ( void * ) i : NULL ) );
+  }
+  assert_true( table->length == 50 );
+
+  delete_hash( table );
+}
+
+
+static void
+test_set_concurrency_while_growing() {
+  table = create_hash( compare_atom, hash_identity );
+
+  uintptr_t i;
+  for ( i = 1; i <= 7; i++ ) {
+    insert_hash_entry( table, ( void * ) i, ( void * ) i );
+  }
+  set_hash_concurrency( table, HASH_TABLE_READ_MOSTLY );
+  for ( i = 8; i <= 100; i++ ) {
+    insert_hash_entry( table, ( void * ) i, ( void * ) i );
+  }
+  for ( i = 1; i <= 100; i++ ) {
+    assert_true( lookup_hash_entry( table, ( void * ) i ) == ( void * ) i );
+  }
+
+  delete_hash( table );
+  finalize_rcu();
+}
+
+
+static void
+test_read_mostly_table() {
+  table = create_hash( compare_string, hash_string );
+  set_hash_concurrency( table, HASH_TABLE_READ_MOSTLY );
+
+  insert_hash_entry( table, alpha, alpha );
+  insert_hash_entry( table, bravo, bravo );
+  assert_string_equal( insert_hash_entry( table, alpha, charlie ), "alpha" );
+  assert_string_equal( lookup_hash_entry( table, alpha ), "charlie" );
+  assert_string_equal( delete_hash_entry( table, alpha ), "charlie" );
+  assert_string_equal( lookup_hash_entry( table, alpha ), "alpha" );
+  assert_string_equal( delete_hash_entry( table, alpha ), "alpha" );
+  assert_true( lookup_hash_entry( table, alpha ) == NULL );
+  assert_string_equal( lookup_hash_entry( table, bravo ), "bravo" );
+  assert_true( table->length == 1 );
+
+  report_rcu_quiescent_state();
+
+  delete_hash( table );
+  finalize_rcu();
+}
+
+
+static void
+test_read_mostly_iterator_sees_snapshot() {
+  table = create_hash( compare_atom, hash_identity );
+  set_hash_concurrency( table, HASH_TABLE_READ_MOSTLY );
+
+  uintptr_t i;
+  uintptr_t expected = 0;
+  for ( i = 1; i <= 100; i++ ) {
+    insert_hash_entry( table, ( void * ) i, ( void * ) i );
+    expected += i;
+  }
+
+  uintptr_t sum = 0;
+  hash_iterator iter;
+  hash_entry *e;
+  init_hash_iterator( table, &iter );
+  while ( ( e = iterate_hash_next( &iter ) ) != NULL ) {
+    sum += ( uintptr_t ) e->value;
+    delete_hash_entry( table, e->key );
+    insert_hash_entry( table, ( void * ) ( ( uintptr_t ) e->key + 1000 ), e->value );
+  }
+  assert_true( sum == expected );
+  assert_true( table->length == 100 );
+  for ( i = 1; i <= 100; i++ ) {
+    assert_true( lookup_hash_entry( table, ( void * ) i ) == NULL );
+    assert_true( lookup_hash_entry( table, ( void * ) ( i + 1000 ) ) == ( void * ) i );
+  }
+
+  delete_hash( table );
+  finalize_rcu();
+}
+
+
 /********************************************************************************
  * Run tests.
  ********************************************************************************/
@@ -303,6 +531,15 @@ main() {
     unit_test( test_iterator ),
     unit_test( test_multiple_inserts_and_deletes_then_iterate ),
     unit_test( test_iterate_empty_hash ),
+    unit_test( test_create_hash_with_size ),
+    unit_test( test_small_table_grows ),
+    unit_test( test_delete_while_growing ),
+    unit_test( test_iterate_and_delete_all_while_growing ),
+    unit_test( test_map_after_growth ),
+    unit_test( test_unlocked_table ),
+    unit_test( test_set_concurrency_while_growing ),
+    unit_test( test_read_mostly_table ),
+    unit_test( test_read_mostly_iterator_sees_snapshot ),
   };
   return run_tests( tests );
 }
@@ -28,11 +28,23 @@
 #include "log.h"
 
 
+// Test the functions, not the level-checking macros in front of them.
+#pragma push_macro( "debug" )
+#undef notice
+#undef info
+#undef debug
+
+
 extern int level;
 extern void ( *do_log )( int priority, const char *format, va_list ap );
+extern bool async_logging;
+extern bool log_ring_initialized;
+extern uint64_t dropped_log_count;
+extern uint64_t reported_dropped_log_count;
 
 
 int logging_level_from( const char *name );
+void init_log_ring( void );
 
 
 
@@ -110,6 +122,15 @@ reset_do_log() {
 }
 
 
+void
+reset_async_logging() {
+  async_logging = false;
+  log_ring_initialized = false;
+  dropped_log_count = 0;
+  reported_dropped_log_count = 0;
+}
+
+
 /********************************************************************************
  * Initialization tests.
  ********************************************************************************/
@@ -443,6 +464,103 @@ test_output_to_stdout() {
 }
 
 
+/********************************************************************************
+ * Asynchronous logging tests.
+ ********************************************************************************/
+
+void
+test_async_logging_writes_messages_in_order() {
+  init_log( "tetris", false );
+  assert_true( start_async_logging() );
+
+  expect_string( mock_vprintf, output, "first\n" );
+  expect_string( mock_vprintf, output, "second 2\n" );
+  info( "first" );
+  info( "second %d", 2 );
+
+  stop_async_logging();
+}
+
+
+void
+test_async_logging_drops_messages_if_ring_is_full() {
+  init_log( "tetris", false );
+  // no writer thread, so nothing is consumed until flush_log().
+  init_log_ring();
+  async_logging = true;
+
+  int queued = 0;
+  while ( get_dropped_log_count() == 0 ) {
+    info( "message" );
+    queued++;
+  }
+  info( "message" );
+  assert_int_equal( get_dropped_log_count(), 2 );
+
+  expect_string_count( mock_vprintf, output, "message\n", queued - 1 );
+  expect_string( mock_vprintf, output, "2 log messages were dropped.\n" );
+  flush_log();
+}
+
+
+void
+test_critical_is_written_after_queued_messages() {
+  init_log( "tetris", false );
+  init_log_ring();
+  async_logging = true;
+
+  expect_string( mock_vprintf, output, "queued\n" );
+  expect_string( mock_vprintf, output, "critical\n" );
+  info( "queued" );
+  critical( "critical" );
+}
+
+
+void
+test_rate_limited_log_suppresses_burst() {
+  init_log( "tetris", false );
+
+  expect_string_count( mock_vprintf, output, "limited\n", LOG_RATE_LIMIT_BURST );
+  int i;
+  for ( i = 0; i < LOG_RATE_LIMIT_BURST * 2; i++ ) {
+    LOG_RATE_LIMITED( info, "limited" );
+  }
+}
+
+
+/********************************************************************************
+ * Level-checking macro tests.
+ ********************************************************************************/
+
+static int evaluated;
+
+
+static const char *
+evaluate( void ) {
+  evaluated++;
+  return "evaluated";
+}
+
+
+void
+test_log_macro_does_not_evaluate_arguments_below_level() {
+  init_log( "tetris", false );
+  set_logging_level( "info" );
+  evaluated = 0;
+
+#pragma pop_macro( "debug" )
+  debug( "%s", evaluate() );
+  assert_int_equal( evaluated, 0 );
+  assert_false( LOG_LEVEL_ENABLED( LOG_DEBUG ) );
+
+  expect_string( mock_vprintf, output, "evaluated\n" );
+  set_logging_level( "debug" );
+  debug( "%s", evaluate() );
+  assert_int_equal( evaluated, 1 );
+#undef debug
+}
+
+
 /********************************************************************************
  * Run tests.
  ********************************************************************************/
@@ -518,6 +636,17 @@ main() {
     unit_test( test_debug_fail_if_NULL ),
 
     unit_test( test_output_to_stdout ),
+
+    unit_test_setup_teardown( test_async_logging_writes_messages_in_order,
+                              reset_async_logging, reset_async_logging ),
+    unit_test_setup_teardown( test_async_logging_drops_messages_if_ring_is_full,
+                              reset_async_logging, reset_async_logging ),
+    unit_test_setup_teardown( test_critical_is_written_after_queued_messages,
+                              reset_async_logging, reset_async_logging ),
+    unit_test( test_rate_limited_log_suppresses_burst ),
+
+    unit_test_setup_teardown( test_log_macro_does_not_evaluate_arguments_below_level,
+                              reset_logging_level, reset_logging_level ),
   };
   return run_tests( tests );
 }
@@ -29,11 +29,13 @@
 #include "ether.h"
 #include "log.h"
 #include "match_table.h"
+#include "rcu.h"
 
 
 typedef struct match_table {
   hash_table *exact_table; // no wildcards are set
   list_element *wildcard_table; // wildcard flags are set
+  hash_table_concurrency concurrency;
   pthread_mutex_t *mutex;
 } match_table;
 
@@ -751,6 +753,93 @@ test_insert_and_delete_of_exact_all_entry_failed() {
 }
 
 
+static void
+test_insert_lookup_and_delete_in_read_mostly_mode() {
+  setup();
+
+  struct ofp_match lookup_match;
+  match_entry *match_entry;
+
+  init_match_table();
+  set_match_table_concurrency( HASH_TABLE_READ_MOSTLY );
+  assert_true( match_table_head.concurrency == HASH_TABLE_READ_MOSTLY );
+
+  intsert_any_match_entry();
+  intsert_lldp_match_entry();
+  intsert_ipv4_match_entry();
+  intsert_alice_match_entry();
+
+  set_alice_match_entry( &lookup_match );
+  match_entry = lookup_match_entry( &lookup_match );
+  assert_true( match_entry != NULL );
+  assert_string_equal( match_entry->entry_name, ALICE_MATCH_ENTRY_NAME );
+
+  memset( &lookup_match, 0, sizeof( struct ofp_match ) );
+  lookup_match.dl_type = ETH_ETHTYPE_LLDP;
+  match_entry = lookup_match_entry( &lookup_match );
+  assert_true( match_entry != NULL );
+  assert_string_equal( match_entry->entry_name, LLDP_MATCH_ENTRY_NAME );
+
+  delete_lldp_match_entry();
+  delete_alice_match_entry();
+
+  // deleted entries are still readable until a quiescent state is reported
+  assert_string_equal( match_entry->entry_name, LLDP_MATCH_ENTRY_NAME );
+  report_rcu_quiescent_state();
+
+  match_entry = lookup_match_entry( &lookup_match );
+  assert_true( match_entry != NULL );
+  assert_string_equal( match_entry->entry_name, ANY_MATCH_ENTRY_NAME );
+
+  set_alice_match_entry( &lookup_match );
+  match_entry = lookup_match_entry( &lookup_match );
+  assert_true( match_entry != NULL );
+  assert_string_equal( match_entry->entry_name, IPV4_MATCH_ENTRY_NAME );
+
+  delete_any_match_entry();
+  delete_ipv4_match_entry();
+  match_entry = lookup_match_entry( &lookup_match );
+  assert_true( match_entry == NULL );
+
+  finalize_match_table();
+  finalize_rcu();
+
+  teardown();
+}
+
+
+static void
+test_insert_lookup_and_delete_in_unlocked_mode() {
+  setup();
+
+  struct ofp_match lookup_match;
+  match_entry *match_entry;
+
+  init_match_table();
+  set_match_table_concurrency( HASH_TABLE_UNLOCKED );
+
+  intsert_any_match_entry();
+  intsert_bob_match_entry();
+
+  set_bob_match_entry( &lookup_match );
+  match_entry = lookup_match_entry( &lookup_match );
+  assert_true( match_entry != NULL );
+  assert_string_equal( match_entry->entry_name, BOB_MATCH_ENTRY_NAME );
+
+  delete_bob_match_entry();
+  match_entry = lookup_match_entry( &lookup_match );
+  assert_true( match_entry != NULL );
+  assert_string_equal( match_entry->entry_name, ANY_MATCH_ENTRY_NAME );
+
+  delete_any_match_entry();
+  assert_true( lookup_match_entry( &lookup_match ) == NULL );
+
+  finalize_match_table();
+
+  teardown();
+}
+
+
 /*************************************************************************
  * Run tests.
  *************************************************************************/
@@ -776,6 +865,8 @@ main() {
     unit_test( test_insert_and_lookup_of_exact_alice_entry_failed ),
     unit_test( test_delete_of_exact_alice_entry_failed ),
     unit_test( test_insert_and_delete_of_exact_all_entry_failed ),
+    unit_test( test_insert_lookup_and_delete_in_read_mostly_mode ),
+    unit_test( test_insert_lookup_and_delete_in_unlocked_mode ),
   };
 
   return run_tests( tests );
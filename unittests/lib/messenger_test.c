@@ -25,6 +25,7 @@
 #include <linux/limits.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <sys/epoll.h>
 #include <sys/socket.h>
 #include <sys/types.h>
 #include <sys/un.h>
@@ -35,6 +36,7 @@
 #include "doubly_linked_list.h"
 #include "hash_table.h"
 #include "messenger.h"
+#include "shm_ring.h"
 #include "timer.h"
 #include "wrapper.h"
 
@@ -46,6 +48,7 @@ enum {
   MESSAGE_TYPE_NOTIFY,
   MESSAGE_TYPE_REQUEST,
   MESSAGE_TYPE_REPLY,
+  MESSAGE_TYPE_RING_SETUP,
 };
 
 typedef struct message_header {
@@ -64,12 +67,17 @@ typedef struct message_buffer {
 
 typedef struct messenger_socket {
   int fd;
+  struct receive_queue *queue;
+  shm_ring *ring;
+  bool dispatching;
 } messenger_socket;
 
 typedef struct messenger_context {
   uint32_t transaction_id;
-  int life_count;
   void *user_data;
+  timer_handle timeout;
+  request_timeout_callback timeout_callback;
+  struct messenger_context *next_free;
 } messenger_context;
 
 typedef struct receive_queue_callback {
@@ -83,7 +91,8 @@ typedef struct receive_queue {
   int listen_socket;
   struct sockaddr_un listen_addr;
   dlist_element *client_sockets;
-  message_buffer *buffer;
+  struct receive_batch *batch;
+  int dropped_stat_id;
 } receive_queue;
 
 typedef struct send_queue {
@@ -93,23 +102,41 @@ typedef struct send_queue {
   struct timespec reconnect_at;
   struct sockaddr_un server_addr;
   message_buffer *buffer;
+  size_t max_length;
+  size_t high_watermark;
+  size_t low_watermark;
+  send_queue_watermark_callback watermark_callback;
+  void *watermark_user_data;
+  bool above_high_watermark;
+  shm_ring *ring;
+  size_t shared_length;
+  int dropped_stat_id;
 } send_queue;
 
+typedef struct shared_payload {
+  unsigned int refcount;
+  size_t length;
+  uint8_t data[ 0 ];
+} shared_payload;
+
+typedef struct shared_message_entry {
+  message_header entry;
+  message_header header;
+  shared_payload *payload;
+} shared_message_entry;
+
 
 static void send_dump_message( uint16_t dump_type, const char *service_name, const void *data, uint32_t data_len );
 
 static bool run_once( void );
 
-static void on_accept( int fd, receive_queue *queue );
-static void on_recv( int fd, receive_queue *queue );
-static void on_send( int fd, send_queue *queue );
+static void on_accept( int fd, void *data );
+static void on_recv( int fd, void *data );
+static void on_send( int fd, void *data );
 
 static receive_queue *create_receive_queue( const char *service_name );
 static void delete_all_receive_queues( void );
 static void delete_receive_queue( void *service_name, void *queue, void *user_data );
-static int pull_from_recv_queue( receive_queue *queue, uint8_t *message_type, uint16_t *tag, void *data, size_t *len, size_t maxlen );
-static void set_recv_queue_fd_set( fd_set *read_set );
-static void check_recv_queue_fd_isset( fd_set *read_set );
 static void add_recv_queue_client_fd( receive_queue *queue, int fd );
 static int del_recv_queue_client_fd( receive_queue *queue, int fd );
 static void call_message_callbacks( receive_queue *rq, const uint8_t message_type, const uint16_t tag, void *data, size_t len );
@@ -118,10 +145,9 @@ static send_queue *create_send_queue( const char *service_name );
 static int send_queue_connect( send_queue *queue );
 static void delete_all_send_queues( void );
 static void delete_send_queue( send_queue *sq );
+static void flush_send_queue_to_ring( send_queue *sq );
 static void number_of_send_queue( int *connected_count, int *sending_count, int *reconnecting_count, int *closed_count );
 static bool push_message_to_send_queue( const char *service_name, const uint8_t message_type, const uint16_t tag, const void *data, size_t len );
-static void set_send_queue_fd_set( fd_set *read_set, fd_set *write_set );
-static void check_send_queue_fd_isset( fd_set *read_set, fd_set *write_set );
 
 static message_buffer *create_message_buffer( size_t size );
 static bool write_message_buffer( message_buffer *buf, const void *data, size_t len );
@@ -132,11 +158,10 @@ static size_t message_buffer_remain_bytes( message_buffer *buf );
 static void delete_timer_callbacks( void );
 static void execute_timer_events( void );
 
-static messenger_context* insert_context( void *user_data );
+static messenger_context* insert_context( void *user_data, const struct timespec *timeout, request_timeout_callback timeout_callback );
 static messenger_context* get_context( uint32_t transaction_id );
 static void delete_context( messenger_context *context );
 static void delete_context_db( void );
-static void age_context_db( void * );
 
 static const uint32_t messenger_buffer_length;
 
@@ -146,12 +171,12 @@ static bool initialized;
 static bool finalized;
 static hash_table *receive_queues;
 static hash_table *send_queues;
-static hash_table *context_db;
+static messenger_context *contexts;
 static dlist_element *timer_callbacks;
 static char *_dump_service_name;
 static char *_dump_app_name;
-static void ( *external_fd_set )( fd_set *read_set, fd_set *write_set );
-static void ( *external_check_fd_isset )( fd_set *read_set, fd_set *write_set );
+static int epoll_fd;
+static bool shared_memory_transport;
 static uint32_t last_transaction_id;
 
 
@@ -166,6 +191,7 @@ static uint32_t last_transaction_id;
 #define MESSAGE_TYPE1 1234
 #define DUMP_SERVICE_NAME "dump"
 #define DUMP_APP_NAME "appname"
+#define DROPPED_STAT_ID 7
 #define TAG1 1
 #define TAG2 2
 #define CONTEXT_DATA "context data"
@@ -181,11 +207,52 @@ mock_execute_timer_events() {
 }
 
 
+int
+mock_register_stat_counter( const char *key ) {
+  check_expected( key );
+  return DROPPED_STAT_ID;
+}
+
+
+void
+mock_add_stat_id( int id, uint64_t value ) {
+  check_expected( id );
+  check_expected( value );
+}
+
+
 bool
-mock_add_periodic_event_callback( const time_t seconds, void ( *callback )( void *user_data ), void *user_data ) {
-  UNUSED( seconds );
-  UNUSED( callback );
-  UNUSED( user_data );
+mock_next_timer_deadline( struct timespec *deadline ) {
+  UNUSED( deadline );
+  return false;
+}
+
+
+int
+mock_get_timer_fd() {
+  return -1;
+}
+
+
+static timer_handle last_timer_handle = 0;
+static struct timespec last_timer_value;
+static void ( *last_timer_callback )( void *user_data ) = NULL;
+static void *last_timer_user_data = NULL;
+
+timer_handle
+mock_add_timer_event( struct itimerspec *interval, void ( *callback )( void *user_data ), void *user_data ) {
+  last_timer_value = interval->it_value;
+  last_timer_callback = callback;
+  last_timer_user_data = user_data;
+  return ++last_timer_handle;
+}
+
+
+static timer_handle cancelled_timer_handle = 0;
+
+bool
+mock_cancel_timer_event( timer_handle handle ) {
+  cancelled_timer_handle = handle;
   return true;
 }
 
@@ -225,10 +292,10 @@ mock_connect( int sockfd, const struct sockaddr *addr, socklen_t addrlen ) {
 }
 
 
-static bool fail_mock_select = false;
+static bool fail_mock_epoll_wait = false;
 int
-mock_select( int nfds, fd_set *readfds, fd_set *writefds, fd_set *exceptfds, struct timeval *timeout ) {
-  return fail_mock_select ? -1 : select( nfds, readfds, writefds, exceptfds, timeout );
+mock_epoll_wait( int epfd, struct epoll_event *events, int maxevents, int timeout ) {
+  return fail_mock_epoll_wait ? -1 : epoll_wait( epfd, events, maxevents, timeout );
 }
 
 
@@ -331,6 +398,9 @@ static void
 reset_messenger() {
   initialized = false;
   finalized = false;
+  last_timer_callback = NULL;
+  last_timer_user_data = NULL;
+  cancelled_timer_handle = 0;
 }
 
 
@@ -387,7 +457,29 @@ static void
 test_send_then_message_received_callback_is_called() {
   init_messenger( "/tmp" );
 
-  will_return_count( mock_clock_gettime, 0, -1 );
+  const char service_name[] = "Say HELLO";
+
+  expect_value( callback_hello, tag, 43556 );
+  expect_string( callback_hello, data, "HELLO" );
+  expect_value( callback_hello, len, 6 );
+
+  add_message_received_callback( service_name, callback_hello );
+  send_message( service_name, 43556, "HELLO", strlen( "HELLO" ) + 1 );
+  start_messenger();
+
+  delete_message_received_callback( service_name, callback_hello );
+  delete_send_queue( lookup_hash_entry( send_queues, service_name ) );
+
+  finalize_messenger();
+}
+
+
+static void
+test_send_over_socket_then_message_received_callback_is_called() {
+  setenv( "MESSENGER_TRANSPORT", "socket", 1 );
+  init_messenger( "/tmp" );
+  unsetenv( "MESSENGER_TRANSPORT" );
+  assert_false( shared_memory_transport );
 
   const char service_name[] = "Say HELLO";
 
@@ -397,15 +489,757 @@ test_send_then_message_received_callback_is_called() {
 
   add_message_received_callback( service_name, callback_hello );
   send_message( service_name, 43556, "HELLO", strlen( "HELLO" ) + 1 );
+  send_queue *sq = lookup_hash_entry( send_queues, service_name );
+  assert_true( sq->ring == NULL );
+  start_messenger();
+
+  delete_message_received_callback( service_name, callback_hello );
+  delete_send_queue( sq );
+
+  finalize_messenger();
+}
+
+
+static void
+callback_in_ring( uint16_t tag, void *data, size_t len ) {
+  UNUSED( tag );
+  UNUSED( len );
+
+  receive_queue *rq = lookup_hash_entry( receive_queues, "In place" );
+  messenger_socket *client_socket = rq->client_sockets->next->data;
+  shm_ring *ring = client_socket->ring;
+  assert_true( ring != NULL );
+  assert_true( ( uint8_t * ) data > ring->data );
+  assert_true( ( uint8_t * ) data < ( uint8_t * ) ring->header + ring->mapped_length );
+  assert_string_equal( data, "HELLO" );
+
+  stop_messenger();
+}
+
+
+static void
+test_send_channel_message_then_message_received_callback_is_called() {
+  init_messenger( "/tmp" );
+
+  const char service_name[] = "Say HELLO";
+
+  expect_value( callback_hello, tag, 43556 );
+  expect_string( callback_hello, data, "HELLO" );
+  expect_value( callback_hello, len, 6 );
+
+  add_message_received_callback( service_name, callback_hello );
+  messenger_channel *channel = open_channel( service_name );
+  assert_true( channel != NULL );
+  assert_true( open_channel( service_name ) == channel );
+  assert_true( send_channel_message( channel, 43556, "HELLO", strlen( "HELLO" ) + 1 ) );
+  start_messenger();
+
+  delete_message_received_callback( service_name, callback_hello );
+  delete_send_queue( channel );
+
+  finalize_messenger();
+}
+
+
+static void
+test_message_is_dispatched_from_ring_in_place() {
+  init_messenger( "/tmp" );
+
+  const char service_name[] = "In place";
+
+  add_message_received_callback( service_name, callback_in_ring );
+  send_message( service_name, 1, "HELLO", strlen( "HELLO" ) + 1 );
+  start_messenger();
+
+  delete_message_received_callback( service_name, callback_in_ring );
+  delete_send_queue( lookup_hash_entry( send_queues, service_name ) );
+
+  finalize_messenger();
+}
+
+
+static int received_count = 0;
+
+static void
+callback_count( uint16_t tag, void *data, size_t len ) {
+  assert_int_equal( tag, received_count );
+  assert_int_equal( *( int * ) data, received_count );
+  assert_int_equal( ( int ) len, sizeof( int ) );
+
+  if ( ++received_count == 100 ) {
+    stop_messenger();
+  }
+}
+
+
+static void
+test_many_messages_over_socket_are_received_in_order() {
+  setenv( "MESSENGER_TRANSPORT", "socket", 1 );
+  init_messenger( "/tmp" );
+  unsetenv( "MESSENGER_TRANSPORT" );
+
+  const char service_name[] = "Count";
+
+  received_count = 0;
+  add_message_received_callback( service_name, callback_count );
+  int i;
+  for ( i = 0; i < 100; i++ ) {
+    assert_true( send_message( service_name, ( uint16_t ) i, &i, sizeof( int ) ) );
+  }
+  start_messenger();
+  assert_int_equal( received_count, 100 );
+
+  delete_message_received_callback( service_name, callback_count );
+  delete_send_queue( lookup_hash_entry( send_queues, service_name ) );
+
+  finalize_messenger();
+}
+
+
+static void
+callback_count_and_flush( uint16_t tag, void *data, size_t len ) {
+  assert_int_equal( tag, received_count );
+  assert_int_equal( *( int * ) data, received_count );
+  assert_int_equal( ( int ) len, sizeof( int ) );
+
+  if ( ++received_count == 1 ) {
+    // re-enters the event loop while the rest of the batch is pending.
+    int last = 100;
+    assert_true( send_message( "Count", 100, &last, sizeof( int ) ) );
+    flush_messenger();
+  }
+  if ( received_count == 101 ) {
+    stop_messenger();
+  }
+}
+
+
+static void
+test_flush_messenger_in_callback_does_not_redeliver_messages() {
+  setenv( "MESSENGER_TRANSPORT", "socket", 1 );
+  init_messenger( "/tmp" );
+  unsetenv( "MESSENGER_TRANSPORT" );
+
+  const char service_name[] = "Count";
+
+  received_count = 0;
+  add_message_received_callback( service_name, callback_count_and_flush );
+  int i;
+  for ( i = 0; i < 100; i++ ) {
+    assert_true( send_message( service_name, ( uint16_t ) i, &i, sizeof( int ) ) );
+  }
+  start_messenger();
+  assert_int_equal( received_count, 101 );
+
+  delete_message_received_callback( service_name, callback_count_and_flush );
+  delete_send_queue( lookup_hash_entry( send_queues, service_name ) );
+
+  finalize_messenger();
+}
+
+
+static void
+test_send_messages_over_socket_then_callbacks_are_called_in_order() {
+  setenv( "MESSENGER_TRANSPORT", "socket", 1 );
+  init_messenger( "/tmp" );
+  unsetenv( "MESSENGER_TRANSPORT" );
+
+  const char service_name[] = "Count";
+  int values[ 100 ];
+  message_vector messages[ 100 ];
+  int i;
+  for ( i = 0; i < 100; i++ ) {
+    values[ i ] = i;
+    messages[ i ].tag = ( uint16_t ) i;
+    messages[ i ].data = &values[ i ];
+    messages[ i ].len = sizeof( int );
+  }
+
+  received_count = 0;
+  add_message_received_callback( service_name, callback_count );
+  assert_true( send_messages( service_name, messages, 100 ) );
+  start_messenger();
+  assert_int_equal( received_count, 100 );
+
+  delete_message_received_callback( service_name, callback_count );
+  delete_send_queue( lookup_hash_entry( send_queues, service_name ) );
+
+  finalize_messenger();
+}
+
+
+static void
+test_send_messages_queues_nothing_if_all_do_not_fit() {
+  init_messenger( "/tmp" );
+
+  const char service_name[] = "Overflow";
+  static char large[ 60000 ];
+  message_vector messages[ 2 ] = { { 1, large, sizeof( large ) }, { 2, large, sizeof( large ) } };
+
+  add_message_received_callback( service_name, callback_count );
+  assert_true( set_send_queue_max_length( service_name, 100000 ) );
+  expect_string( mock_register_stat_counter, key, "messenger.send_dropped.Overflow" );
+  expect_value( mock_add_stat_id, id, DROPPED_STAT_ID );
+  expect_value( mock_add_stat_id, value, 2 );
+  assert_false( send_messages( service_name, messages, 2 ) );
+  send_queue *sq = lookup_hash_entry( send_queues, service_name );
+  assert_int_equal( sq->buffer->data_length, 0 );
+
+  // the counter is registered only once per send queue.
+  expect_value( mock_add_stat_id, id, DROPPED_STAT_ID );
+  expect_value( mock_add_stat_id, value, 2 );
+  assert_false( send_messages( service_name, messages, 2 ) );
+
+  delete_message_received_callback( service_name, callback_count );
+  delete_send_queue( sq );
+
+  finalize_messenger();
+}
+
+
+static void
+test_message_too_large_for_ring_is_dropped() {
+  init_messenger( "/tmp" );
+
+  const char service_name[] = "Too large";
+  static char large[ 1100000 ];
+
+  expect_value( callback_hello, tag, 2 );
+  expect_string( callback_hello, data, "" );
+  expect_value( callback_hello, len, 1 );
+
+  add_message_received_callback( service_name, callback_hello );
+  assert_true( set_send_queue_max_length( service_name, 2 * sizeof( large ) ) );
+  expect_string( mock_register_stat_counter, key, "messenger.send_dropped.Too large" );
+  expect_value( mock_add_stat_id, id, DROPPED_STAT_ID );
+  expect_value( mock_add_stat_id, value, 1 );
+  assert_true( send_message( service_name, 1, large, sizeof( large ) ) );
+  assert_true( send_message( service_name, 2, "", 1 ) );
+  send_queue *sq = lookup_hash_entry( send_queues, service_name );
+  assert_true( sq->ring != NULL );
   start_messenger();
+  assert_int_equal( sq->buffer->data_length, 0 );
 
   delete_message_received_callback( service_name, callback_hello );
+  delete_send_queue( sq );
+
+  finalize_messenger();
+}
+
+
+/********************************************************************************
+ * Flow control tests.
+ ********************************************************************************/
+
+static void
+callback_watermark( const char *service_name, int watermark, void *user_data ) {
+  check_expected( service_name );
+  check_expected( watermark );
+  check_expected( user_data );
+}
+
+
+static void
+test_watermark_callbacks_are_called() {
+  setenv( "MESSENGER_TRANSPORT", "socket", 1 );
+  init_messenger( "/tmp" );
+  unsetenv( "MESSENGER_TRANSPORT" );
+
+  const char service_name[] = "Count";
+  char user_data[] = "USER DATA";
+
+  received_count = 0;
+  add_message_received_callback( service_name, callback_count );
+  assert_true( set_send_queue_watermarks( service_name, 40, 8, callback_watermark, user_data ) );
+
+  expect_string( callback_watermark, service_name, service_name );
+  expect_value( callback_watermark, watermark, MESSENGER_SEND_QUEUE_HIGH_WATERMARK );
+  expect_value( callback_watermark, user_data, user_data );
+  int i;
+  for ( i = 0; i < 100; i++ ) {
+    assert_true( send_message( service_name, ( uint16_t ) i, &i, sizeof( int ) ) );
+  }
+
+  expect_string( callback_watermark, service_name, service_name );
+  expect_value( callback_watermark, watermark, MESSENGER_SEND_QUEUE_LOW_WATERMARK );
+  expect_value( callback_watermark, user_data, user_data );
+  start_messenger();
+  assert_int_equal( received_count, 100 );
+
+  delete_message_received_callback( service_name, callback_count );
   delete_send_queue( lookup_hash_entry( send_queues, service_name ) );
 
   finalize_messenger();
 }
 
 
+static void
+test_send_queue_grows_up_to_max_length() {
+  setenv( "MESSENGER_TRANSPORT", "socket", 1 );
+  init_messenger( "/tmp" );
+  unsetenv( "MESSENGER_TRANSPORT" );
+
+  const char service_name[] = "Grow";
+  static char large[ 60000 ];
+
+  add_message_received_callback( service_name, callback_count );
+  assert_true( set_send_queue_max_length( service_name, 150000 ) );
+  send_queue *sq = lookup_hash_entry( send_queues, service_name );
+  assert_false( set_send_queue_max_length( service_name, sq->buffer->size - 1 ) );
+
+  assert_true( send_message( service_name, 0, large, sizeof( large ) ) );
+  assert_true( send_message( service_name, 0, large, sizeof( large ) ) );
+  assert_true( sq->buffer->size > 100000 );
+  assert_true( sq->buffer->size <= 150000 );
+  assert_int_equal( sq->buffer->data_length, 2 * ( sizeof( large ) + 8 ) );
+
+  expect_string( mock_register_stat_counter, key, "messenger.send_dropped.Grow" );
+  expect_value( mock_add_stat_id, id, DROPPED_STAT_ID );
+  expect_value( mock_add_stat_id, value, 1 );
+  assert_false( send_message( service_name, 0, large, sizeof( large ) ) );
+
+  delete_message_received_callback( service_name, callback_count );
+  delete_send_queue( sq );
+
+  finalize_messenger();
+}
+
+
+/********************************************************************************
+ * Fd event callback tests.
+ ********************************************************************************/
+
+static void
+callback_readable( int fd, void *data ) {
+  check_expected( fd );
+  check_expected( data );
+
+  char buf[ 1 ];
+  assert_int_equal( read( fd, buf, sizeof( buf ) ), 1 );
+}
+
+
+static void
+callback_writable( int fd, void *data ) {
+  check_expected( fd );
+  check_expected( data );
+
+  assert_true( set_writable_interest( fd, false ) );
+}
+
+
+static void
+test_fd_event_callbacks_are_called_when_ready() {
+  init_messenger( "/tmp" );
+
+  int fds[ 2 ];
+  assert_int_equal( pipe( fds ), 0 );
+  assert_true( add_fd_event_callback( fds[ 0 ], callback_readable, NULL, fds ) );
+  assert_true( add_fd_event_callback( fds[ 1 ], NULL, callback_writable, fds ) );
+
+  assert_true( set_writable_interest( fds[ 1 ], true ) );
+  expect_value( callback_writable, fd, fds[ 1 ] );
+  expect_value( callback_writable, data, fds );
+  assert_true( run_once() );
+
+  assert_int_equal( write( fds[ 1 ], "X", 1 ), 1 );
+  expect_value( callback_readable, fd, fds[ 0 ] );
+  expect_value( callback_readable, data, fds );
+  assert_true( run_once() );
+
+  assert_true( delete_fd_event_callback( fds[ 0 ] ) );
+  assert_true( delete_fd_event_callback( fds[ 1 ] ) );
+  close( fds[ 0 ] );
+  close( fds[ 1 ] );
+
+  finalize_messenger();
+}
+
+
+static void
+test_add_fd_event_callback_twice_fails() {
+  init_messenger( "/tmp" );
+
+  int fds[ 2 ];
+  assert_int_equal( pipe( fds ), 0 );
+  assert_true( add_fd_event_callback( fds[ 0 ], callback_readable, NULL, NULL ) );
+  assert_false( add_fd_event_callback( fds[ 0 ], callback_readable, NULL, NULL ) );
+
+  assert_true( delete_fd_event_callback( fds[ 0 ] ) );
+  assert_false( delete_fd_event_callback( fds[ 0 ] ) );
+  assert_false( set_writable_interest( fds[ 0 ], true ) );
+  close( fds[ 0 ] );
+  close( fds[ 1 ] );
+
+  finalize_messenger();
+}
+
+
+/********************************************************************************
+ * Multicast tests.
+ ********************************************************************************/
+
+static int multicast_received_count = 0;
+
+static void
+callback_multicast( uint16_t tag, void *data, size_t len ) {
+  assert_int_equal( tag, 1234 );
+  assert_string_equal( data, "SHARED" );
+  assert_int_equal( ( int ) len, 7 );
+
+  if ( ++multicast_received_count == 2 ) {
+    stop_messenger();
+  }
+}
+
+
+static void
+multicast_to_two_services( size_t expected_shared_length ) {
+  const char service_a[] = "Multicast A";
+  const char service_b[] = "Multicast B";
+
+  multicast_received_count = 0;
+  add_message_received_callback( service_a, callback_multicast );
+  add_message_received_callback( service_b, callback_multicast );
+
+  list_element *service_names;
+  create_list( &service_names );
+  append_to_tail( &service_names, ( void * ) ( uintptr_t ) service_a );
+  append_to_tail( &service_names, ( void * ) ( uintptr_t ) service_b );
+  assert_true( multicast_message( service_names, 1234, "SHARED", 7 ) );
+  delete_list( service_names );
+
+  send_queue *sq_a = lookup_hash_entry( send_queues, service_a );
+  send_queue *sq_b = lookup_hash_entry( send_queues, service_b );
+  assert_int_equal( sq_a->shared_length, expected_shared_length );
+  assert_int_equal( sq_b->shared_length, expected_shared_length );
+  start_messenger();
+  assert_int_equal( multicast_received_count, 2 );
+  assert_int_equal( sq_a->shared_length, 0 );
+  assert_int_equal( sq_b->shared_length, 0 );
+
+  delete_message_received_callback( service_a, callback_multicast );
+  delete_message_received_callback( service_b, callback_multicast );
+  delete_send_queue( sq_a );
+  delete_send_queue( sq_b );
+}
+
+
+static void
+test_multicast_over_socket_then_message_received_callbacks_are_called() {
+  setenv( "MESSENGER_TRANSPORT", "socket", 1 );
+  init_messenger( "/tmp" );
+  unsetenv( "MESSENGER_TRANSPORT" );
+
+  // Socket send queues refer to a single shared copy until it is sent.
+  multicast_to_two_services( 7 );
+
+  finalize_messenger();
+}
+
+
+static void
+test_multicast_over_ring_then_message_received_callbacks_are_called() {
+  init_messenger( "/tmp" );
+
+  // The message goes straight into the rings.
+  multicast_to_two_services( 0 );
+
+  finalize_messenger();
+}
+
+
+static void
+test_shared_payload_is_flushed_to_ring() {
+  init_messenger( "/tmp" );
+
+  const char service_name[] = "Multicast A";
+  multicast_received_count = 1;
+  add_message_received_callback( service_name, callback_multicast );
+  send_queue *sq = open_channel( service_name );
+  assert_true( sq->ring != NULL );
+
+  // Hide the ring so that the message is queued as if the ring were full.
+  shm_ring *ring = sq->ring;
+  sq->ring = NULL;
+  list_element *service_names;
+  create_list( &service_names );
+  append_to_tail( &service_names, ( void * ) ( uintptr_t ) service_name );
+  assert_true( multicast_message( service_names, 1234, "SHARED", 7 ) );
+  delete_list( service_names );
+  assert_int_equal( sq->shared_length, 7 );
+  sq->ring = ring;
+
+  flush_send_queue_to_ring( sq );
+  assert_int_equal( sq->shared_length, 0 );
+  assert_int_equal( sq->buffer->data_length, 0 );
+  start_messenger();
+  assert_int_equal( multicast_received_count, 2 );
+
+  delete_message_received_callback( service_name, callback_multicast );
+  delete_send_queue( sq );
+
+  finalize_messenger();
+}
+
+
+static void
+test_shared_payload_is_released_when_send_queue_is_deleted() {
+  setenv( "MESSENGER_TRANSPORT", "socket", 1 );
+  init_messenger( "/tmp" );
+  unsetenv( "MESSENGER_TRANSPORT" );
+
+  const char service_name[] = "Never sent";
+  add_message_received_callback( service_name, callback_multicast );
+
+  list_element *service_names;
+  create_list( &service_names );
+  append_to_tail( &service_names, ( void * ) ( uintptr_t ) service_name );
+  assert_true( multicast_message( service_names, 1234, "SHARED", 7 ) );
+  delete_list( service_names );
+
+  // The messenger is never started, so the message is still queued.
+  send_queue *sq = lookup_hash_entry( send_queues, service_name );
+  assert_int_equal( sq->shared_length, 7 );
+
+  delete_message_received_callback( service_name, callback_multicast );
+  finalize_messenger();
+}
+
+
+/********************************************************************************
+ * Request context tests.
+ ********************************************************************************/
+
+static void
+request_timed_out( void *user_data ) {
+  check_expected( user_data );
+}
+
+
+static void
+test_context_is_found_by_transaction_id_until_deleted() {
+  init_messenger( "/tmp" );
+
+  char context_data[] = CONTEXT_DATA;
+  struct timespec timeout = { 3, 500000000 };
+  messenger_context *context = insert_context( context_data, &timeout, NULL );
+  assert_true( context != NULL );
+  assert_true( context->transaction_id != 0 );
+  assert_int_equal( last_timer_value.tv_sec, 3 );
+  assert_int_equal( last_timer_value.tv_nsec, 500000000 );
+  uint32_t transaction_id = context->transaction_id;
+  timer_handle timeout_handle = context->timeout;
+
+  assert_true( get_context( transaction_id ) == context );
+  assert_true( get_context( transaction_id + 1 ) == NULL );
+  delete_context( context );
+  assert_int_equal( cancelled_timer_handle, timeout_handle );
+  assert_true( get_context( transaction_id ) == NULL );
+
+  // The slot is reused under a new transaction id.
+  messenger_context *reused = insert_context( context_data, &timeout, NULL );
+  assert_true( reused == context );
+  assert_true( reused->transaction_id != transaction_id );
+  assert_true( get_context( transaction_id ) == NULL );
+  assert_true( get_context( reused->transaction_id ) == reused );
+
+  finalize_messenger();
+  assert_true( contexts == NULL );
+}
+
+
+static void
+test_timeout_callback_is_called_when_request_times_out() {
+  init_messenger( "/tmp" );
+
+  char context_data[] = CONTEXT_DATA;
+  struct timespec timeout = { 1, 0 };
+  messenger_context *context = insert_context( context_data, &timeout, request_timed_out );
+  uint32_t transaction_id = context->transaction_id;
+
+  expect_string( request_timed_out, user_data, CONTEXT_DATA );
+  last_timer_callback( last_timer_user_data );
+
+  assert_true( get_context( transaction_id ) == NULL );
+  assert_int_equal( cancelled_timer_handle, 0 );
+
+  finalize_messenger();
+}
+
+
+static void
+test_timeout_after_reply_is_ignored() {
+  init_messenger( "/tmp" );
+
+  char context_data[] = CONTEXT_DATA;
+  struct timespec timeout = { 1, 0 };
+  messenger_context *context = insert_context( context_data, &timeout, request_timed_out );
+  void ( *timer_callback )( void *user_data ) = last_timer_callback;
+  void *timer_user_data = last_timer_user_data;
+  delete_context( context );
+
+  // A newer request in the same slot is not affected by the stale timer.
+  context = insert_context( context_data, &timeout, request_timed_out );
+  timer_callback( timer_user_data );
+  assert_true( get_context( context->transaction_id ) == context );
+
+  finalize_messenger();
+}
+
+
+/********************************************************************************
+ * Message trace tests.
+ ********************************************************************************/
+
+#define TRACE_FILE "/tmp/messenger_test.trace"
+
+
+static void
+callback_trace_record( uint16_t dump_type, void *data, size_t len, uint32_t original_length, void *user_data ) {
+  UNUSED( user_data );
+  message_dump_header *dump_hdr = data;
+  char *app_name = ( char * ) ( dump_hdr + 1 );
+  char *service_name = app_name + ntohs( dump_hdr->app_name_length );
+  char *payload = service_name + ntohs( dump_hdr->service_name_length );
+  uint32_t data_length = ntohl( dump_hdr->data_length );
+  assert_int_equal( len, ( size_t ) ( payload - ( char * ) data ) + data_length );
+
+  check_expected( dump_type );
+  check_expected( app_name );
+  check_expected( service_name );
+  check_expected( original_length );
+  check_expected( data_length );
+  if ( data_length > 0 ) {
+    check_expected( payload );
+  }
+}
+
+
+static void
+test_trace_records_are_read_back_in_order() {
+  init_messenger( "/tmp" );
+
+  assert_true( start_messenger_trace( TRACE_FILE, "trace test", 4096, 8 ) );
+  assert_true( messenger_trace_enabled() );
+
+  will_return_count( mock_clock_gettime, 0, 2 );
+  send_dump_message( MESSENGER_DUMP_SENT, "peer", "0123456789", 10 );
+  send_dump_message( MESSENGER_DUMP_SEND_CLOSED, "peer", NULL, 0 );
+
+  expect_value( callback_trace_record, dump_type, MESSENGER_DUMP_SENT );
+  expect_string( callback_trace_record, app_name, "trace test" );
+  expect_string( callback_trace_record, service_name, "peer" );
+  expect_value( callback_trace_record, original_length, 10 );
+  expect_value( callback_trace_record, data_length, 8 );
+  expect_memory( callback_trace_record, payload, "01234567", 8 );
+  expect_value( callback_trace_record, dump_type, MESSENGER_DUMP_SEND_CLOSED );
+  expect_string( callback_trace_record, app_name, "trace test" );
+  expect_string( callback_trace_record, service_name, "peer" );
+  expect_value( callback_trace_record, original_length, 0 );
+  expect_value( callback_trace_record, data_length, 0 );
+  assert_true( read_messenger_trace( TRACE_FILE, callback_trace_record, NULL ) );
+
+  stop_messenger_trace();
+  assert_false( messenger_trace_enabled() );
+  unlink( TRACE_FILE );
+
+  finalize_messenger();
+}
+
+
+static void
+callback_count_trace_records( uint16_t dump_type, void *data, size_t len, uint32_t original_length, void *user_data ) {
+  UNUSED( len );
+  UNUSED( original_length );
+  assert_int_equal( dump_type, MESSENGER_DUMP_RECEIVED );
+
+  message_dump_header *dump_hdr = data;
+  char *payload = ( char * ) ( dump_hdr + 1 ) + ntohs( dump_hdr->app_name_length ) + ntohs( dump_hdr->service_name_length );
+  uint32_t sequence;
+  memcpy( &sequence, payload, sizeof( sequence ) );
+
+  uint32_t *expected = user_data;
+  if ( expected[ 1 ] > 0 ) {
+    assert_int_equal( sequence, expected[ 0 ] + 1 );
+  }
+  expected[ 0 ] = sequence;
+  expected[ 1 ]++;
+}
+
+
+static void
+test_trace_ring_keeps_latest_records_when_wrapped() {
+  init_messenger( "/tmp" );
+
+  assert_true( start_messenger_trace( TRACE_FILE, "trace test", 1024, 64 ) );
+  will_return_count( mock_clock_gettime, 0, 100 );
+  for ( uint32_t i = 0; i < 100; i++ ) {
+    send_dump_message( MESSENGER_DUMP_RECEIVED, "peer", &i, sizeof( i ) );
+  }
+
+  uint32_t last_and_count[ 2 ] = { 0, 0 };
+  assert_true( read_messenger_trace( TRACE_FILE, callback_count_trace_records, last_and_count ) );
+  assert_int_equal( last_and_count[ 0 ], 99 );
+  assert_true( last_and_count[ 1 ] > 1 );
+  assert_true( last_and_count[ 1 ] < 100 );
+
+  stop_messenger_trace();
+  unlink( TRACE_FILE );
+
+  finalize_messenger();
+}
+
+
+static void
+test_trace_ring_forgets_all_records_overwritten_by_a_wrapped_record() {
+  init_messenger( "/tmp" );
+
+  char first_service_name[ 300 ];
+  memset( first_service_name, 'a', sizeof( first_service_name ) - 1 );
+  first_service_name[ sizeof( first_service_name ) - 1 ] = '\0';
+  char second_service_name[ 400 ];
+  memset( second_service_name, 'b', sizeof( second_service_name ) - 1 );
+  second_service_name[ sizeof( second_service_name ) - 1 ] = '\0';
+  char payload[ 200 ];
+  memset( payload, 'x', sizeof( payload ) );
+
+  // The second record does not fit after the first one and, once wrapped,
+  // overwrites the first one and the space left at the end of the ring.
+  assert_true( start_messenger_trace( TRACE_FILE, "trace test", 1024, 200 ) );
+  will_return_count( mock_clock_gettime, 0, 2 );
+  send_dump_message( MESSENGER_DUMP_SENT, first_service_name, payload, sizeof( payload ) );
+  send_dump_message( MESSENGER_DUMP_RECEIVED, second_service_name, payload, sizeof( payload ) );
+
+  expect_value( callback_trace_record, dump_type, MESSENGER_DUMP_RECEIVED );
+  expect_string( callback_trace_record, app_name, "trace test" );
+  expect_string( callback_trace_record, service_name, second_service_name );
+  expect_value( callback_trace_record, original_length, sizeof( payload ) );
+  expect_value( callback_trace_record, data_length, sizeof( payload ) );
+  expect_memory( callback_trace_record, payload, payload, sizeof( payload ) );
+  assert_true( read_messenger_trace( TRACE_FILE, callback_trace_record, NULL ) );
+
+  stop_messenger_trace();
+  unlink( TRACE_FILE );
+
+  finalize_messenger();
+}
+
+
+static void
+test_start_messenger_trace_fails_if_snapshot_length_is_too_long() {
+  assert_false( start_messenger_trace( TRACE_FILE, "trace test", 1024, 65535 ) );
+  assert_false( start_messenger_trace( TRACE_FILE, "trace test", 1024, 512 ) );
+  assert_false( messenger_trace_enabled() );
+}
+
+
+static void
+test_read_messenger_trace_fails_if_no_trace_file() {
+  assert_false( read_messenger_trace( TRACE_FILE, callback_count_trace_records, NULL ) );
+}
+
+
 /********************************************************************************
  * Run tests.
  ********************************************************************************/
@@ -431,6 +1265,88 @@ main() {
     unit_test_setup_teardown( test_send_then_message_received_callback_is_called,
                               reset_messenger,
                               reset_messenger ),
+    unit_test_setup_teardown( test_send_over_socket_then_message_received_callback_is_called,
+                              reset_messenger,
+                              reset_messenger ),
+    unit_test_setup_teardown( test_send_channel_message_then_message_received_callback_is_called,
+                              reset_messenger,
+                              reset_messenger ),
+    unit_test_setup_teardown( test_message_is_dispatched_from_ring_in_place,
+                              reset_messenger,
+                              reset_messenger ),
+    unit_test_setup_teardown( test_many_messages_over_socket_are_received_in_order,
+                              reset_messenger,
+                              reset_messenger ),
+    unit_test_setup_teardown( test_flush_messenger_in_callback_does_not_redeliver_messages,
+                              reset_messenger,
+                              reset_messenger ),
+    unit_test_setup_teardown( test_send_messages_over_socket_then_callbacks_are_called_in_order,
+                              reset_messenger,
+                              reset_messenger ),
+    unit_test_setup_teardown( test_send_messages_queues_nothing_if_all_do_not_fit,
+                              reset_messenger,
+                              reset_messenger ),
+    unit_test_setup_teardown( test_message_too_large_for_ring_is_dropped,
+                              reset_messenger,
+                              reset_messenger ),
+
+    // Flow control tests.
+    unit_test_setup_teardown( test_watermark_callbacks_are_called,
+                              reset_messenger,
+                              reset_messenger ),
+    unit_test_setup_teardown( test_send_queue_grows_up_to_max_length,
+                              reset_messenger,
+                              reset_messenger ),
+
+    // Fd event callback tests.
+    unit_test_setup_teardown( test_fd_event_callbacks_are_called_when_ready,
+                              reset_messenger,
+                              reset_messenger ),
+    unit_test_setup_teardown( test_add_fd_event_callback_twice_fails,
+                              reset_messenger,
+                              reset_messenger ),
+
+    // Multicast tests.
+    unit_test_setup_teardown( test_multicast_over_socket_then_message_received_callbacks_are_called,
+                              reset_messenger,
+                              reset_messenger ),
+    unit_test_setup_teardown( test_multicast_over_ring_then_message_received_callbacks_are_called,
+                              reset_messenger,
+                              reset_messenger ),
+    unit_test_setup_teardown( test_shared_payload_is_flushed_to_ring,
+                              reset_messenger,
+                              reset_messenger ),
+    unit_test_setup_teardown( test_shared_payload_is_released_when_send_queue_is_deleted,
+                              reset_messenger,
+                              reset_messenger ),
+
+    // Request context tests.
+    unit_test_setup_teardown( test_context_is_found_by_transaction_id_until_deleted,
+                              reset_messenger,
+                              reset_messenger ),
+    unit_test_setup_teardown( test_timeout_callback_is_called_when_request_times_out,
+                              reset_messenger,
+                              reset_messenger ),
+    unit_test_setup_teardown( test_timeout_after_reply_is_ignored,
+                              reset_messenger,
+                              reset_messenger ),
+
+    // Message trace tests.
+    unit_test_setup_teardown( test_trace_records_are_read_back_in_order,
+                              reset_messenger,
+                              reset_messenger ),
+    unit_test_setup_teardown( test_trace_ring_keeps_latest_records_when_wrapped,
+                              reset_messenger,
+                              reset_messenger ),
+    unit_test_setup_teardown( test_trace_ring_forgets_all_records_overwritten_by_a_wrapped_record,
+                              reset_messenger,
+                              reset_messenger ),
+    unit_test_setup_teardown( test_start_messenger_trace_fails_if_snapshot_length_is_too_long,
+                              reset_messenger,
+                              reset_messenger ),
+    unit_test_setup_teardown( test_read_messenger_trace_fails_if_no_trace_file,
+                              reset_messenger,
+                              reset_messenger ),
   };
   return run_tests( tests );
 }
@@ -21,12 +21,15 @@
 
 
 #include <openflow.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 #include "bool.h"
 #include "checks.h"
 #include "cmockery_trema.h"
+#include "hash_map.h"
 #include "hash_table.h"
 #include "linked_list.h"
 #include "messenger.h"
@@ -48,6 +51,7 @@ typedef struct {
 extern bool openflow_application_interface_initialized;
 extern openflow_event_handlers_t event_handlers;
 extern char service_name[ MESSENGER_SERVICE_NAME_LENGTH ];
+extern uint64_hash_map *switch_channels;
 extern hash_table *stats;
 
 extern void assert_if_not_initialized();
@@ -65,6 +69,16 @@ extern void dump_buf( const buffer *data );
 extern void handle_switch_events( uint16_t type, void *data, size_t length );
 extern void handle_openflow_message( void *data, size_t length );
 extern void handle_message( uint16_t type, void *data, size_t length );
+extern void collect_stat_counters( void );
+extern unsigned int number_of_workers;
+
+
+static stat_entry *
+lookup_stat_entry( const char *key ) {
+  collect_stat_counters();
+  return lookup_hash_entry( stats, key );
+}
+
 
 
 #define SWITCH_READY_HANDLER ( ( void * ) 0x00020001 )
@@ -122,6 +136,7 @@ static openflow_event_handlers_t EVENT_HANDLERS = {
 };
 static uint64_t DATAPATH_ID = 0x0102030405060708ULL;
 static char REMOTE_SERVICE_NAME[] = "switch.102030405060708";
+static messenger_channel *const CHANNEL = ( messenger_channel * ) 0x1234;
 static const uint32_t TRANSACTION_ID = 0x04030201;
 static const uint32_t VENDOR_ID = 0xccddeeff;
 static const uint8_t MAC_ADDR_X[ OFP_ETH_ALEN ] = { 0x01, 0x02, 0x03, 0x04, 0x05, 0x07 };
@@ -174,11 +189,19 @@ mock_add_message_received_callback( char *service_name,
 }
 
 
+messenger_channel *
+mock_open_channel( const char *service_name ) {
+  check_expected( service_name );
+
+  return ( messenger_channel * ) mock();
+}
+
+
 bool
-mock_send_message( char *service_name, uint16_t tag, void *data, size_t len ) {
+mock_send_channel_message( messenger_channel *channel, uint16_t tag, const void *data, size_t len ) {
   uint32_t tag32 = tag;
 
-  check_expected( service_name );
+  check_expected( channel );
   check_expected( tag32 );
   check_expected( data );
   check_expected( len );
@@ -197,6 +220,42 @@ mock_delete_message_received_callback( char *service_name,
 }
 
 
+#define MAX_EVENT_FDS 4
+
+static int event_fds[ MAX_EVENT_FDS ];
+static event_fd_callback event_fd_read_callbacks[ MAX_EVENT_FDS ];
+static void *event_fd_data[ MAX_EVENT_FDS ];
+static int number_of_event_fds = 0;
+
+bool
+mock_add_fd_event_callback( int fd, event_fd_callback read_callback, event_fd_callback write_callback, void *data ) {
+  assert_true( write_callback == NULL );
+  assert_true( number_of_event_fds < MAX_EVENT_FDS );
+
+  event_fds[ number_of_event_fds ] = fd;
+  event_fd_read_callbacks[ number_of_event_fds ] = read_callback;
+  event_fd_data[ number_of_event_fds ] = data;
+  number_of_event_fds++;
+
+  return true;
+}
+
+
+bool
+mock_delete_fd_event_callback( int fd ) {
+  int i;
+  for ( i = 0; i < number_of_event_fds; i++ ) {
+    if ( event_fds[ i ] == fd ) {
+      event_fds[ i ] = -1;
+      return true;
+    }
+  }
+  fail();
+
+  return false;
+}
+
+
 bool
 mock_parse_packet( buffer *buf ) {
   alloc_packet( buf );
@@ -410,11 +469,18 @@ mock_critical( char *format, ... ) {
 
 static void
 cleanup() {
+  stop_openflow_event_handler_threads();
+  number_of_event_fds = 0;
+
   openflow_application_interface_initialized = false;
   packet_in_handler_called = false;
 
   memset( service_name, 0, sizeof( service_name ) );
   memset( &event_handlers, 0, sizeof( event_handlers ) );
+  if ( switch_channels != NULL ) {
+    delete_uint64_hash_map( switch_channels );
+    switch_channels = NULL;
+  }
   memset( USER_DATA, 'Z', sizeof( USER_DATA ) );
   if ( stats != NULL ) {
     delete_hash( stats );
@@ -621,7 +687,7 @@ test_handle_switch_ready() {
   set_switch_ready_handler( mock_switch_ready_handler, user_data );
   handle_message( MESSENGER_OPENFLOW_READY, data->data, data->length );
 
-  stat_entry *stat = lookup_hash_entry( stats, "openflow_application_interface.switch_ready_receive_succeeded" );
+  stat_entry *stat = lookup_stat_entry( "openflow_application_interface.switch_ready_receive_succeeded" );
   assert_int_equal( ( int ) stat->value, 1 );
 
   free_buffer( data );
@@ -642,7 +708,7 @@ test_handle_switch_ready_with_simple_handler() {
   set_switch_ready_handler( mock_simple_switch_ready_handler, user_data );
   handle_message( MESSENGER_OPENFLOW_READY, data->data, data->length );
 
-  stat_entry *stat = lookup_hash_entry( stats, "openflow_application_interface.switch_ready_receive_succeeded" );
+  stat_entry *stat = lookup_stat_entry( "openflow_application_interface.switch_ready_receive_succeeded" );
   assert_int_equal( ( int ) stat->value, 1 );
 
   free_buffer( data );
@@ -1122,18 +1188,36 @@ test_send_openflow_message() {
           SERVICE_NAME, strlen( SERVICE_NAME ) + 1 );
   memcpy( ( char * ) expected_data + header_length, buffer->data, buffer->length );
 
-  expect_string( mock_send_message, service_name, REMOTE_SERVICE_NAME );
-  expect_value( mock_send_message, tag32, MESSENGER_OPENFLOW_MESSAGE );
-  expect_value( mock_send_message, len, expected_length );
-  expect_memory( mock_send_message, data, expected_data, expected_length );
-  will_return( mock_send_message, true );
+  expect_string( mock_open_channel, service_name, REMOTE_SERVICE_NAME );
+  will_return( mock_open_channel, CHANNEL );
+  expect_value( mock_send_channel_message, channel, CHANNEL );
+  expect_value( mock_send_channel_message, tag32, MESSENGER_OPENFLOW_MESSAGE );
+  expect_value( mock_send_channel_message, len, expected_length );
+  expect_memory( mock_send_channel_message, data, expected_data, expected_length );
+  will_return( mock_send_channel_message, true );
 
   ret = send_openflow_message( DATAPATH_ID, buffer );
   
   assert_true( ret );
-  stat_entry *stat = lookup_hash_entry( stats, "openflow_application_interface.hello_send_succeeded" );
+  stat_entry *stat = lookup_stat_entry( "openflow_application_interface.hello_send_succeeded" );
   assert_int_equal( ( int ) stat->value, 1 );
 
+  // The channel is opened only once per datapath.
+  expect_value( mock_send_channel_message, channel, CHANNEL );
+  expect_value( mock_send_channel_message, tag32, MESSENGER_OPENFLOW_MESSAGE );
+  expect_value( mock_send_channel_message, len, expected_length );
+  expect_memory( mock_send_channel_message, data, expected_data, expected_length );
+  will_return( mock_send_channel_message, true );
+
+  ret = send_openflow_message( DATAPATH_ID, buffer );
+
+  assert_true( ret );
+  stat = lookup_stat_entry( "openflow_application_interface.hello_send_succeeded" );
+  assert_int_equal( ( int ) stat->value, 2 );
+
+  delete_uint64_hash_map( switch_channels );
+  switch_channels = NULL;
+
   free_buffer( buffer );
   free( expected_data );
   free( delete_hash_entry( stats, "openflow_application_interface.hello_send_succeeded" ) );
@@ -2358,7 +2442,7 @@ test_handle_switch_events_if_type_is_MESSENGER_OPENFLOW_CONNECTED() {
 
   handle_switch_events( MESSENGER_OPENFLOW_CONNECTED, data->data, data->length );
 
-  stat_entry *stat = lookup_hash_entry( stats, "openflow_application_interface.switch_connected_receive_succeeded" );
+  stat_entry *stat = lookup_stat_entry( "openflow_application_interface.switch_connected_receive_succeeded" );
   assert_int_equal( ( int ) stat->value, 1 );
 
   free_buffer( data );
@@ -2382,7 +2466,7 @@ test_handle_switch_events_if_type_is_MESSENGER_OPENFLOW_DISCONNECTED() {
   set_switch_disconnected_handler( mock_switch_disconnected_handler, SWITCH_DISCONNECTED_USER_DATA );
   handle_switch_events( MESSENGER_OPENFLOW_DISCONNECTED, data->data, data->length );
 
-  stat_entry *stat = lookup_hash_entry( stats, "openflow_application_interface.switch_disconnected_receive_succeeded" );
+  stat_entry *stat = lookup_stat_entry( "openflow_application_interface.switch_disconnected_receive_succeeded" );
   assert_int_equal( ( int ) stat->value, 1 );
 
   free_buffer( data );
@@ -2431,7 +2515,7 @@ test_handle_switch_events_if_unhandled_message_type() {
   // FIXME
   handle_switch_events( MESSENGER_OPENFLOW_MESSAGE, data->data, data->length );
 
-  stat_entry *stat = lookup_hash_entry( stats, "openflow_application_interface.undefined_switch_event_receive_succeeded" );
+  stat_entry *stat = lookup_stat_entry( "openflow_application_interface.undefined_switch_event_receive_succeeded" );
   assert_int_equal( ( int ) stat->value, 1 );
 
   free_buffer( data );
@@ -2473,7 +2557,7 @@ test_handle_openflow_message() {
     set_error_handler( mock_error_handler, USER_DATA );
     handle_openflow_message( buffer->data, buffer->length );
 
-    stat = lookup_hash_entry( stats, "openflow_application_interface.error_receive_succeeded" );
+    stat = lookup_stat_entry( "openflow_application_interface.error_receive_succeeded" );
     assert_int_equal( ( int ) stat->value, 1 );
 
     free_buffer( data );
@@ -2503,7 +2587,7 @@ test_handle_openflow_message() {
     set_vendor_handler( mock_vendor_handler, USER_DATA );
     handle_openflow_message( buffer->data, buffer->length );
 
-    stat = lookup_hash_entry( stats, "openflow_application_interface.vendor_receive_succeeded" );
+    stat = lookup_stat_entry( "openflow_application_interface.vendor_receive_succeeded" );
     assert_int_equal( ( int ) stat->value, 1 );
 
     free_buffer( data );
@@ -2567,7 +2651,7 @@ test_handle_openflow_message() {
     set_features_reply_handler( mock_features_reply_handler, USER_DATA );
     handle_openflow_message( buffer->data, buffer->length );
 
-    stat = lookup_hash_entry( stats, "openflow_application_interface.features_reply_receive_succeeded" );
+    stat = lookup_stat_entry( "openflow_application_interface.features_reply_receive_succeeded" );
     assert_int_equal( ( int ) stat->value, 1 );
 
     free( phy_port[0] );
@@ -2596,7 +2680,7 @@ test_handle_openflow_message() {
     set_get_config_reply_handler( mock_get_config_reply_handler, USER_DATA );
     handle_openflow_message( buffer->data, buffer->length );
 
-    stat = lookup_hash_entry( stats, "openflow_application_interface.get_config_reply_receive_succeeded" );
+    stat = lookup_stat_entry( "openflow_application_interface.get_config_reply_receive_succeeded" );
     assert_int_equal( ( int ) stat->value, 1 );
 
     free_buffer( buffer );
@@ -2637,7 +2721,7 @@ test_handle_openflow_message() {
     set_packet_in_handler( mock_packet_in_handler, USER_DATA );
     handle_openflow_message( buffer->data, buffer->length );
 
-    stat = lookup_hash_entry( stats, "openflow_application_interface.packet_in_receive_succeeded" );
+    stat = lookup_stat_entry( "openflow_application_interface.packet_in_receive_succeeded" );
     assert_int_equal( ( int ) stat->value, 1 );
 
     free_buffer( data );
@@ -2679,7 +2763,7 @@ test_handle_openflow_message() {
     set_flow_removed_handler( mock_flow_removed_handler, USER_DATA );
     handle_openflow_message( buffer->data, buffer->length );
 
-    stat = lookup_hash_entry( stats, "openflow_application_interface.flow_removed_receive_succeeded" );
+    stat = lookup_stat_entry( "openflow_application_interface.flow_removed_receive_succeeded" );
     assert_int_equal( ( int ) stat->value, 1 );
 
     free_buffer( buffer );
@@ -2716,7 +2800,7 @@ test_handle_openflow_message() {
     set_port_status_handler( mock_port_status_handler, USER_DATA );
     handle_openflow_message( buffer->data, buffer->length );
 
-    stat = lookup_hash_entry( stats, "openflow_application_interface.port_status_receive_succeeded" );
+    stat = lookup_stat_entry( "openflow_application_interface.port_status_receive_succeeded" );
     assert_int_equal( ( int ) stat->value, 1 );
 
     free_buffer( buffer );
@@ -2769,7 +2853,7 @@ test_handle_openflow_message() {
     set_stats_reply_handler( mock_stats_reply_handler, USER_DATA );
     handle_openflow_message( buffer->data, buffer->length );
 
-    stat = lookup_hash_entry( stats, "openflow_application_interface.stats_reply_receive_succeeded" );
+    stat = lookup_stat_entry( "openflow_application_interface.stats_reply_receive_succeeded" );
     assert_int_equal( ( int ) stat->value, 1 );
 
     free_buffer( buffer );
@@ -2791,7 +2875,7 @@ test_handle_openflow_message() {
     set_barrier_reply_handler( mock_barrier_reply_handler, USER_DATA );
     handle_openflow_message( buffer->data, buffer->length );
 
-    stat = lookup_hash_entry( stats, "openflow_application_interface.barrier_reply_receive_succeeded" );
+    stat = lookup_stat_entry( "openflow_application_interface.barrier_reply_receive_succeeded" );
     assert_int_equal( ( int ) stat->value, 1 );
 
     free_buffer( buffer );
@@ -2842,7 +2926,7 @@ test_handle_openflow_message() {
     set_queue_get_config_reply_handler( mock_queue_get_config_reply_handler, USER_DATA );
     handle_openflow_message( buffer->data, buffer->length );
 
-    stat = lookup_hash_entry( stats, "openflow_application_interface.queue_get_config_reply_receive_succeeded" );
+    stat = lookup_stat_entry( "openflow_application_interface.queue_get_config_reply_receive_succeeded" );
     assert_int_equal( ( int ) stat->value, 1 );
 
     free( queue[ 0 ] );
@@ -2949,7 +3033,7 @@ test_handle_message_if_type_is_MESSENGER_OPENFLOW_MESSAGE() {
   set_barrier_reply_handler( mock_barrier_reply_handler, BARRIER_REPLY_USER_DATA );
   handle_message( MESSENGER_OPENFLOW_MESSAGE, data->data, data->length );
 
-  stat_entry *stat = lookup_hash_entry( stats, "openflow_application_interface.barrier_reply_receive_succeeded" );
+  stat_entry *stat = lookup_stat_entry( "openflow_application_interface.barrier_reply_receive_succeeded" );
   assert_int_equal( ( int ) stat->value, 1 );
 
 
@@ -2968,7 +3052,7 @@ test_handle_message_if_type_is_MESSENGER_OPENFLOW_CONNECTED() {
 
   handle_message( MESSENGER_OPENFLOW_CONNECTED, data->data, data->length );
 
-  stat_entry *stat = lookup_hash_entry( stats, "openflow_application_interface.switch_connected_receive_succeeded" );
+  stat_entry *stat = lookup_stat_entry( "openflow_application_interface.switch_connected_receive_succeeded" );
   assert_int_equal( ( int ) stat->value, 1 );
 
   free_buffer( data );
@@ -2992,7 +3076,7 @@ test_handle_message_if_type_is_MESSENGER_OPENFLOW_DISCONNECTED() {
   set_switch_disconnected_handler( mock_switch_disconnected_handler, SWITCH_DISCONNECTED_USER_DATA );
   handle_message( MESSENGER_OPENFLOW_DISCONNECTED, data->data, data->length );
 
-  stat_entry *stat = lookup_hash_entry( stats, "openflow_application_interface.switch_disconnected_receive_succeeded" );
+  stat_entry *stat = lookup_stat_entry( "openflow_application_interface.switch_disconnected_receive_succeeded" );
   assert_int_equal( ( int ) stat->value, 1 );
 
   free_buffer( data );
@@ -3028,7 +3112,7 @@ test_handle_message_if_unhandled_message_type() {
   // FIXME
   handle_message( MESSENGER_OPENFLOW_DISCONNECTED + 1, data->data, data->length );
 
-  stat_entry *stat = lookup_hash_entry( stats, "openflow_application_interface.undefined_switch_event_receive_succeeded" );
+  stat_entry *stat = lookup_stat_entry( "openflow_application_interface.undefined_switch_event_receive_succeeded" );
   assert_int_equal( ( int ) stat->value, 1 );
 
   free_buffer( data );
@@ -3036,6 +3120,182 @@ test_handle_message_if_unhandled_message_type() {
 }
 
 
+static const void *received_packet_data = NULL;
+
+
+static void
+record_packet_in_data( packet_in event ) {
+  received_packet_data = event.data->data;
+}
+
+
+static void
+test_handle_message_passes_received_data_without_copy() {
+  buffer *data = alloc_buffer_with_length( 64 );
+  append_back_buffer( data, 64 );
+  buffer *message = create_packet_in( TRANSACTION_ID, 0x01020304, 64, 1, OFPR_NO_MATCH, data );
+  openflow_service_header_t *header = append_front_buffer( message, sizeof( openflow_service_header_t ) );
+  header->datapath_id = htonll( DATAPATH_ID );
+
+  received_packet_data = NULL;
+  will_return( mock_parse_packet, true );
+
+  set_packet_in_handler( record_packet_in_data, NULL );
+  handle_message( MESSENGER_OPENFLOW_MESSAGE, message->data, message->length );
+
+  assert_true( received_packet_data == ( char * ) message->data + sizeof( openflow_service_header_t ) + offsetof( struct ofp_packet_in, data ) );
+
+  free_buffer( data );
+  free_buffer( message );
+}
+
+
+/********************************************************************************
+ * start_openflow_event_handler_threads() tests.
+ ********************************************************************************/
+
+#define WORKER_TEST_SWITCHES 16
+
+static pthread_mutex_t worker_test_mutex = PTHREAD_MUTEX_INITIALIZER;
+static int worker_test_sequence = 0;
+static int switch_ready_sequence[ WORKER_TEST_SWITCHES ];
+static int switch_disconnected_sequence[ WORKER_TEST_SWITCHES ];
+static pthread_t switch_ready_thread[ WORKER_TEST_SWITCHES ];
+static pthread_t switch_disconnected_thread[ WORKER_TEST_SWITCHES ];
+static volatile bool hello_sent = false;
+
+
+static void
+record_switch_ready( uint64_t datapath_id, void *user_data ) {
+  UNUSED( user_data );
+
+  pthread_mutex_lock( &worker_test_mutex );
+  switch_ready_sequence[ datapath_id ] = ++worker_test_sequence;
+  switch_ready_thread[ datapath_id ] = pthread_self();
+  pthread_mutex_unlock( &worker_test_mutex );
+}
+
+
+static void
+record_switch_disconnected( uint64_t datapath_id, void *user_data ) {
+  UNUSED( user_data );
+
+  pthread_mutex_lock( &worker_test_mutex );
+  switch_disconnected_sequence[ datapath_id ] = ++worker_test_sequence;
+  switch_disconnected_thread[ datapath_id ] = pthread_self();
+  pthread_mutex_unlock( &worker_test_mutex );
+}
+
+
+static void
+send_hello_on_switch_ready( uint64_t datapath_id, void *user_data ) {
+  UNUSED( user_data );
+
+  buffer *hello = create_hello( TRANSACTION_ID );
+  assert_true( send_openflow_message( datapath_id, hello ) );
+  free_buffer( hello );
+
+  hello_sent = true;
+}
+
+
+static void
+send_switch_event( uint16_t type, uint64_t datapath_id ) {
+  openflow_service_header_t header;
+  memset( &header, 0, sizeof( header ) );
+  header.datapath_id = htonll( datapath_id );
+
+  handle_message( type, &header, sizeof( header ) );
+}
+
+
+static void
+test_start_openflow_event_handler_threads_if_number_of_threads_is_zero() {
+  assert_false( start_openflow_event_handler_threads( 0 ) );
+  assert_int_equal( ( int ) number_of_workers, 0 );
+  assert_int_equal( number_of_event_fds, 0 );
+}
+
+
+static void
+test_start_openflow_event_handler_threads_if_already_started() {
+  assert_true( start_openflow_event_handler_threads( 2 ) );
+  assert_false( start_openflow_event_handler_threads( 2 ) );
+  assert_int_equal( ( int ) number_of_workers, 2 );
+  assert_int_equal( number_of_event_fds, 2 );
+
+  stop_openflow_event_handler_threads();
+
+  assert_int_equal( ( int ) number_of_workers, 0 );
+  assert_int_equal( event_fds[ 0 ], -1 );
+  assert_int_equal( event_fds[ 1 ], -1 );
+}
+
+
+static void
+test_switch_events_are_handled_in_order_per_datapath_on_event_handler_threads() {
+  worker_test_sequence = 0;
+  memset( switch_ready_sequence, 0, sizeof( switch_ready_sequence ) );
+  memset( switch_disconnected_sequence, 0, sizeof( switch_disconnected_sequence ) );
+
+  set_switch_ready_handler( record_switch_ready, NULL );
+  set_switch_disconnected_handler( record_switch_disconnected, NULL );
+
+  assert_true( start_openflow_event_handler_threads( 4 ) );
+
+  uint64_t datapath_id;
+  for ( datapath_id = 0; datapath_id < WORKER_TEST_SWITCHES; datapath_id++ ) {
+    send_switch_event( MESSENGER_OPENFLOW_READY, datapath_id );
+  }
+  for ( datapath_id = 0; datapath_id < WORKER_TEST_SWITCHES; datapath_id++ ) {
+    send_switch_event( MESSENGER_OPENFLOW_DISCONNECTED, datapath_id );
+  }
+
+  stop_openflow_event_handler_threads();
+
+  for ( datapath_id = 0; datapath_id < WORKER_TEST_SWITCHES; datapath_id++ ) {
+    assert_true( switch_ready_sequence[ datapath_id ] > 0 );
+    assert_true( switch_ready_sequence[ datapath_id ] < switch_disconnected_sequence[ datapath_id ] );
+    assert_true( pthread_equal( switch_ready_thread[ datapath_id ], switch_disconnected_thread[ datapath_id ] ) );
+    assert_false( pthread_equal( switch_ready_thread[ datapath_id ], pthread_self() ) );
+  }
+  assert_int_equal( worker_test_sequence, WORKER_TEST_SWITCHES * 2 );
+}
+
+
+static void
+test_send_openflow_message_from_event_handler_thread() {
+  size_t expected_length = sizeof( openflow_service_header_t ) + strlen( SERVICE_NAME ) + 1 + sizeof( struct ofp_header );
+
+  hello_sent = false;
+  set_switch_ready_handler( send_hello_on_switch_ready, NULL );
+
+  assert_true( start_openflow_event_handler_threads( 1 ) );
+  assert_int_equal( number_of_event_fds, 1 );
+
+  send_switch_event( MESSENGER_OPENFLOW_READY, DATAPATH_ID );
+  while ( !hello_sent ) {
+    usleep( 1000 );
+  }
+
+  // sent from the messenger thread once the eventfd becomes readable.
+  expect_string( mock_open_channel, service_name, REMOTE_SERVICE_NAME );
+  will_return( mock_open_channel, CHANNEL );
+  expect_value( mock_send_channel_message, channel, CHANNEL );
+  expect_value( mock_send_channel_message, tag32, MESSENGER_OPENFLOW_MESSAGE );
+  expect_not_value( mock_send_channel_message, data, NULL );
+  expect_value( mock_send_channel_message, len, expected_length );
+  will_return( mock_send_channel_message, true );
+
+  event_fd_read_callbacks[ 0 ]( event_fds[ 0 ], event_fd_data[ 0 ] );
+
+  stop_openflow_event_handler_threads();
+
+  delete_uint64_hash_map( switch_channels );
+  switch_channels = NULL;
+}
+
+
 /********************************************************************************
  * Run tests.
  ********************************************************************************/
@@ -3179,6 +3439,13 @@ main() {
     unit_test_setup_teardown( test_handle_message_if_message_is_NULL, init, cleanup ),
     unit_test_setup_teardown( test_handle_message_if_message_length_is_zero, init, cleanup ),
     unit_test_setup_teardown( test_handle_message_if_unhandled_message_type, init, cleanup ),
+
+    // start_openflow_event_handler_threads() tests.
+    unit_test_setup_teardown( test_start_openflow_event_handler_threads_if_number_of_threads_is_zero, init, cleanup ),
+    unit_test_setup_teardown( test_start_openflow_event_handler_threads_if_already_started, init, cleanup ),
+    unit_test_setup_teardown( test_switch_events_are_handled_in_order_per_datapath_on_event_handler_threads, init, cleanup ),
+    unit_test_setup_teardown( test_send_openflow_message_from_event_handler_thread, init, cleanup ),
+    unit_test_setup_teardown( test_handle_message_passes_received_data_without_copy, init, cleanup ),
   };
   return run_tests( tests );
 }
@@ -0,0 +1,168 @@
+/*
+ * Unit tests for deferred reclamation of read-mostly data.
+ *
+ * Copyright (C) 2008-2011 NEC Corporation
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License, version 2, as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+#include <pthread.h>
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "checks.h"
+#include "cmockery.h"
+#include "rcu.h"
+
+
+static int freed;
+
+
+static void
+count_free( void *data ) {
+  UNUSED( data );
+  freed++;
+}
+
+
+static char data[] = "data";
+
+
+/********************************************************************************
+ * Other reader thread.
+ ********************************************************************************/
+
+static pthread_barrier_t barrier;
+
+
+static void *
+other_reader( void *arg ) {
+  UNUSED( arg );
+
+  register_rcu_reader();
+  pthread_barrier_wait( &barrier ); // registered
+  pthread_barrier_wait( &barrier ); // data retired by the main thread
+  report_rcu_quiescent_state();
+  pthread_barrier_wait( &barrier ); // quiescent state reported
+  unregister_rcu_reader();
+
+  return NULL;
+}
+
+
+/********************************************************************************
+ * Test functions.
+ ********************************************************************************/
+
+static void
+test_defer_without_readers_frees_on_next_report() {
+  freed = 0;
+
+  defer_rcu_free( data, count_free );
+  assert_int_equal( freed, 0 );
+
+  report_rcu_quiescent_state();
+  assert_int_equal( freed, 1 );
+}
+
+
+static void
+test_defer_waits_for_registered_reader() {
+  freed = 0;
+  register_rcu_reader();
+
+  defer_rcu_free( data, count_free );
+  assert_int_equal( freed, 0 );
+
+  report_rcu_quiescent_state();
+  assert_int_equal( freed, 1 );
+
+  unregister_rcu_reader();
+}
+
+
+static void
+test_defer_waits_for_all_readers() {
+  freed = 0;
+  pthread_barrier_init( &barrier, NULL, 2 );
+  pthread_t thread;
+  pthread_create( &thread, NULL, other_reader, NULL );
+
+  register_rcu_reader();
+  pthread_barrier_wait( &barrier );
+
+  defer_rcu_free( data, count_free );
+  report_rcu_quiescent_state();
+  assert_int_equal( freed, 0 );
+
+  pthread_barrier_wait( &barrier );
+  pthread_barrier_wait( &barrier );
+  assert_int_equal( freed, 1 );
+
+  pthread_join( thread, NULL );
+  pthread_barrier_destroy( &barrier );
+  unregister_rcu_reader();
+}
+
+
+static void
+test_defer_NULL_is_ignored() {
+  freed = 0;
+
+  defer_rcu_free( NULL, count_free );
+  report_rcu_quiescent_state();
+  assert_int_equal( freed, 0 );
+}
+
+
+static void
+test_finalize_frees_everything() {
+  freed = 0;
+  register_rcu_reader();
+
+  defer_rcu_free( data, count_free );
+  defer_rcu_free( data, count_free );
+  finalize_rcu();
+  assert_int_equal( freed, 2 );
+
+  unregister_rcu_reader();
+}
+
+
+/********************************************************************************
+ * Run tests.
+ ********************************************************************************/
+
+int
+main() {
+  const UnitTest tests[] = {
+    unit_test( test_defer_without_readers_frees_on_next_report ),
+    unit_test( test_defer_waits_for_registered_reader ),
+    unit_test( test_defer_waits_for_all_readers ),
+    unit_test( test_defer_NULL_is_ignored ),
+    unit_test( test_finalize_frees_everything ),
+  };
+  return run_tests( tests );
+}
+
+
+/*
+ * Local variables:
+ * c-basic-offset: 2
+ * indent-tabs-mode: nil
+ * End:
+ */
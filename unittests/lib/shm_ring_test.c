@@ -0,0 +1,237 @@
+/*
+ * Unit tests for shared-memory rings.
+ *
+ * Copyright (C) 2008-2011 NEC Corporation
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License, version 2, as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "checks.h"
+#include "cmockery.h"
+#include "shm_ring.h"
+
+
+static const char header[] = "HEADER";
+static const char body[] = "BODY";
+
+
+/********************************************************************************
+ * Mocks.
+ ********************************************************************************/
+
+void
+mock_error( const char *format, ... ) {
+  UNUSED( format );
+}
+
+
+/********************************************************************************
+ * Helpers.
+ ********************************************************************************/
+
+static bool
+event_is_signalled( int eventfd ) {
+  uint64_t count;
+  return read( eventfd, &count, sizeof( count ) ) == sizeof( count );
+}
+
+
+static void
+assert_next_record( shm_ring *ring, const char *expected ) {
+  size_t length;
+  char *record = peek_shm_ring( ring, &length );
+  assert_true( record != NULL );
+  assert_int_equal( length, strlen( expected ) + 1 );
+  assert_string_equal( record, expected );
+  consume_shm_ring( ring );
+}
+
+
+/********************************************************************************
+ * Test functions.
+ ********************************************************************************/
+
+static void
+test_write_and_read_a_record() {
+  shm_ring *ring = create_shm_ring( 0 );
+  assert_true( ring != NULL );
+  assert_true( shm_ring_is_empty( ring ) );
+
+  size_t length;
+  assert_true( peek_shm_ring( ring, &length ) == NULL );
+
+  assert_true( write_shm_ring( ring, header, strlen( header ), body, sizeof( body ) ) );
+  assert_false( shm_ring_is_empty( ring ) );
+  assert_next_record( ring, "HEADERBODY" );
+  assert_true( shm_ring_is_empty( ring ) );
+
+  delete_shm_ring( ring );
+}
+
+
+static void
+test_records_wrap_around() {
+  shm_ring *ring = create_shm_ring( 4096 );
+  char record[ 1000 ];
+
+  int i;
+  for ( i = 0; i < 100; i++ ) {
+    memset( record, 'a' + i % 26, sizeof( record ) - 1 );
+    record[ sizeof( record ) - 1 ] = '\0';
+    assert_true( write_shm_ring( ring, record, sizeof( record ), NULL, 0 ) );
+    assert_true( write_shm_ring( ring, record, sizeof( record ), NULL, 0 ) );
+    assert_next_record( ring, record );
+    assert_next_record( ring, record );
+  }
+  assert_true( shm_ring_is_empty( ring ) );
+
+  delete_shm_ring( ring );
+}
+
+
+static void
+test_write_fails_when_full() {
+  shm_ring *ring = create_shm_ring( 4096 );
+  char record[ 1000 ];
+  memset( record, 'x', sizeof( record ) - 1 );
+  record[ sizeof( record ) - 1 ] = '\0';
+
+  int written = 0;
+  while ( write_shm_ring( ring, record, sizeof( record ), NULL, 0 ) ) {
+    written++;
+  }
+  assert_int_equal( written, 4 );
+  assert_false( wait_shm_ring_space( ring, sizeof( record ) ) );
+  assert_false( event_is_signalled( ring->space_eventfd ) );
+
+  assert_next_record( ring, record );
+  assert_true( event_is_signalled( ring->space_eventfd ) );
+  assert_true( wait_shm_ring_space( ring, sizeof( record ) ) );
+  assert_true( write_shm_ring( ring, record, sizeof( record ), NULL, 0 ) );
+
+  delete_shm_ring( ring );
+}
+
+
+static void
+test_write_fails_if_record_is_larger_than_ring() {
+  shm_ring *ring = create_shm_ring( 4096 );
+  char *record = calloc( 1, 8192 );
+
+  assert_false( write_shm_ring( ring, record, 8192, NULL, 0 ) );
+  assert_true( shm_ring_is_empty( ring ) );
+
+  free( record );
+  delete_shm_ring( ring );
+}
+
+
+static void
+test_record_of_max_length_fits_after_wrap_around() {
+  shm_ring *ring = create_shm_ring( 4096 );
+  size_t max_length = shm_ring_max_length( ring );
+  char *record = calloc( 1, max_length + 1 );
+  memset( record, 'x', max_length - 1 );
+
+  assert_false( write_shm_ring( ring, record, max_length + 1, NULL, 0 ) );
+
+  // Leave the head just past the middle of the ring so that the next
+  // record has to be wrapped around.
+  char small[] = "small";
+  assert_true( write_shm_ring( ring, record, max_length, NULL, 0 ) );
+  assert_true( write_shm_ring( ring, small, sizeof( small ), NULL, 0 ) );
+  assert_next_record( ring, record );
+  assert_next_record( ring, small );
+
+  assert_true( wait_shm_ring_space( ring, max_length ) );
+  assert_true( write_shm_ring( ring, record, max_length, NULL, 0 ) );
+  assert_next_record( ring, record );
+  assert_true( shm_ring_is_empty( ring ) );
+
+  free( record );
+  delete_shm_ring( ring );
+}
+
+
+static void
+test_producer_wakes_up_waiting_consumer_only() {
+  shm_ring *ring = create_shm_ring( 0 );
+
+  // A new ring has no data, so the consumer is waiting.
+  assert_true( write_shm_ring( ring, header, sizeof( header ), NULL, 0 ) );
+  assert_true( event_is_signalled( ring->data_eventfd ) );
+  assert_true( write_shm_ring( ring, header, sizeof( header ), NULL, 0 ) );
+  assert_false( event_is_signalled( ring->data_eventfd ) );
+
+  assert_true( wait_shm_ring_data( ring ) );
+  assert_next_record( ring, header );
+  assert_next_record( ring, header );
+  assert_false( wait_shm_ring_data( ring ) );
+
+  assert_true( write_shm_ring( ring, header, sizeof( header ), NULL, 0 ) );
+  assert_true( event_is_signalled( ring->data_eventfd ) );
+
+  delete_shm_ring( ring );
+}
+
+
+static void
+test_attach_ring() {
+  shm_ring *producer = create_shm_ring( 0 );
+  shm_ring *consumer = attach_shm_ring( dup( producer->memfd ), dup( producer->data_eventfd ), dup( producer->space_eventfd ) );
+  assert_true( consumer != NULL );
+
+  assert_true( write_shm_ring( producer, header, sizeof( header ), NULL, 0 ) );
+  assert_true( event_is_signalled( consumer->data_eventfd ) );
+  assert_next_record( consumer, header );
+  assert_true( shm_ring_is_empty( consumer ) );
+
+  delete_shm_ring( consumer );
+  delete_shm_ring( producer );
+}
+
+
+/********************************************************************************
+ * Run tests.
+ ********************************************************************************/
+
+int
+main() {
+  const UnitTest tests[] = {
+    unit_test( test_write_and_read_a_record ),
+    unit_test( test_records_wrap_around ),
+    unit_test( test_write_fails_when_full ),
+    unit_test( test_write_fails_if_record_is_larger_than_ring ),
+    unit_test( test_record_of_max_length_fits_after_wrap_around ),
+    unit_test( test_producer_wakes_up_waiting_consumer_only ),
+    unit_test( test_attach_ring ),
+  };
+  return run_tests( tests );
+}
+
+
+/*
+ * Local variables:
+ * c-basic-offset: 2
+ * indent-tabs-mode: nil
+ * End:
+ */
@@ -20,10 +20,12 @@
  */
 
 
+#include <pthread.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 #include "trema.h"
 #include "cmockery_trema.h"
 
@@ -212,6 +214,289 @@ test_increment_stat_fails_if_not_initialized() {
 }
 
 
+/********************************************************************************
+ * register_stat_counter() and increment_stat_id() tests.
+ ********************************************************************************/
+
+static void
+test_register_stat_counter_returns_same_id_for_same_key() {
+  assert_true( init_stat() );
+
+  int id = register_stat_counter( "key" );
+  assert_true( id >= 0 );
+  assert_int_equal( register_stat_counter( "key" ), id );
+  assert_true( register_stat_counter( "another key" ) != id );
+
+  assert_true( finalize_stat() );
+}
+
+
+static void
+test_increment_stat_id_is_collected_on_dump() {
+  assert_true( init_stat() );
+
+  int id = register_stat_counter( "key" );
+  increment_stat_id( id );
+  increment_stat_id( id );
+  increment_stat( "key" );
+  assert_true( lookup_hash_entry( stats, "key" ) != NULL );
+
+  expect_string( mock_info, message, "Statistics:" );
+  expect_string( mock_info, message, "key: 3" );
+  dump_stats();
+
+  increment_stat_id( id );
+  expect_string( mock_info, message, "Statistics:" );
+  expect_string( mock_info, message, "key: 4" );
+  dump_stats();
+
+  assert_true( finalize_stat() );
+}
+
+
+static void
+test_increment_stat_id_ignores_invalid_id() {
+  assert_true( init_stat() );
+
+  increment_stat_id( -1 );
+
+  expect_string( mock_info, message, "Statistics:" );
+  expect_string( mock_info, message, "No statistics found." );
+  dump_stats();
+
+  assert_true( finalize_stat() );
+}
+
+
+static void
+test_add_stat_id_adds_value() {
+  assert_true( init_stat() );
+
+  int id = register_stat_counter( "key" );
+  add_stat_id( id, 5 );
+  increment_stat_id( id );
+  add_stat_id( -1, 5 );
+
+  expect_string( mock_info, message, "Statistics:" );
+  expect_string( mock_info, message, "key: 6" );
+  dump_stats();
+
+  assert_true( finalize_stat() );
+}
+
+
+static void *
+increment_stat_id_in_thread( void *arg ) {
+  int id = *( int * ) arg;
+  int i;
+  for ( i = 0; i < 1000; i++ ) {
+    increment_stat_id( id );
+  }
+  return NULL;
+}
+
+
+static void
+test_increment_stat_id_keeps_counts_of_exited_threads() {
+  assert_true( init_stat() );
+
+  int id = register_stat_counter( "key" );
+  pthread_t threads[ 2 ];
+  int i;
+  for ( i = 0; i < 2; i++ ) {
+    assert_int_equal( pthread_create( &threads[ i ], NULL, increment_stat_id_in_thread, &id ), 0 );
+  }
+  for ( i = 0; i < 2; i++ ) {
+    assert_int_equal( pthread_join( threads[ i ], NULL ), 0 );
+  }
+  increment_stat_id( id );
+
+  expect_string( mock_info, message, "Statistics:" );
+  expect_string( mock_info, message, "key: 2001" );
+  dump_stats();
+
+  assert_true( finalize_stat() );
+}
+
+
+/********************************************************************************
+ * register_stat_histogram() and record_stat_value() tests.
+ ********************************************************************************/
+
+static void
+test_register_stat_histogram_returns_same_id_for_same_key() {
+  assert_true( init_stat() );
+
+  int id = register_stat_histogram( "latency" );
+  assert_true( id >= 0 );
+  assert_int_equal( register_stat_histogram( "latency" ), id );
+  assert_true( register_stat_histogram( "another latency" ) != id );
+
+  assert_true( finalize_stat() );
+}
+
+
+static void
+test_record_stat_value_is_read_back() {
+  assert_true( init_stat() );
+
+  int id = register_stat_histogram( "latency" );
+  uint64_t value;
+  for ( value = 1; value <= 100; value++ ) {
+    record_stat_value( id, value );
+  }
+
+  stat_histogram h;
+  assert_true( read_stat_histogram( id, &h ) );
+  assert_int_equal( h.count, 100 );
+  assert_int_equal( h.sum, 5050 );
+  assert_int_equal( h.max, 100 );
+  assert_int_equal( stat_histogram_percentile( &h, 0 ), 1 );
+  assert_int_equal( stat_histogram_percentile( &h, 5 ), 5 );
+  // 50 falls into [ 48, 51 ], 99 into [ 96, 103 ].
+  assert_int_equal( stat_histogram_percentile( &h, 50 ), 51 );
+  assert_int_equal( stat_histogram_percentile( &h, 99 ), 100 );
+  assert_int_equal( stat_histogram_percentile( &h, 100 ), 100 );
+
+  assert_false( read_stat_histogram( id + 2, &h ) );
+
+  assert_true( finalize_stat() );
+}
+
+
+static void
+test_stat_histogram_percentile_is_within_bucket_precision() {
+  assert_true( init_stat() );
+
+  int id = register_stat_histogram( "latency" );
+  record_stat_value( id, 1000000 );
+  record_stat_value( id, 1ULL << 50 );
+
+  stat_histogram h;
+  assert_true( read_stat_histogram( id, &h ) );
+  uint64_t p50 = stat_histogram_percentile( &h, 50 );
+  assert_true( p50 >= 1000000 && p50 < 1125000 );
+  assert_int_equal( stat_histogram_percentile( &h, 100 ), 1ULL << 50 );
+
+  assert_true( finalize_stat() );
+}
+
+
+static void
+test_merge_stat_histogram() {
+  stat_histogram a, b;
+  memset( &a, 0, sizeof( a ) );
+  memset( &b, 0, sizeof( b ) );
+  a.count = 1;
+  a.sum = 3;
+  a.max = 3;
+  a.buckets[ 3 ] = 1;
+  b.count = 2;
+  b.sum = 12;
+  b.max = 7;
+  b.buckets[ 5 ] = 1;
+  b.buckets[ 7 ] = 1;
+
+  merge_stat_histogram( &a, &b );
+  assert_int_equal( a.count, 3 );
+  assert_int_equal( a.sum, 15 );
+  assert_int_equal( a.max, 7 );
+  assert_int_equal( stat_histogram_percentile( &a, 50 ), 5 );
+}
+
+
+static void *
+record_stat_value_in_thread( void *arg ) {
+  int id = *( int * ) arg;
+  int i;
+  for ( i = 0; i < 1000; i++ ) {
+    record_stat_value( id, 10 );
+  }
+  return NULL;
+}
+
+
+static void
+test_dump_stats_prints_percentiles_of_all_threads() {
+  assert_true( init_stat() );
+
+  int id = register_stat_histogram( "latency" );
+  pthread_t thread;
+  assert_int_equal( pthread_create( &thread, NULL, record_stat_value_in_thread, &id ), 0 );
+  assert_int_equal( pthread_join( thread, NULL ), 0 );
+  record_stat_value( id, 10 );
+  record_stat_value( -1, 10 );
+
+  expect_string( mock_info, message, "Statistics:" );
+  expect_string( mock_info, message, "latency: count = 1001, mean = 10, p50 = 10, p90 = 10, p99 = 10, p99.9 = 10, max = 10" );
+  dump_stats();
+
+  assert_true( finalize_stat() );
+}
+
+
+/********************************************************************************
+ * Statistics segment tests.
+ ********************************************************************************/
+
+static void
+test_publish_stats_writes_segment() {
+  assert_true( init_stat() );
+  assert_true( open_stat_segment( "/tmp", "stat_test" ) );
+
+  increment_stat( "key" );
+  int id = register_stat_histogram( "latency" );
+  record_stat_value( id, 10 );
+  publish_stats();
+
+  stat_segment_header *header = read_stat_segment( "/tmp", "stat_test" );
+  assert_true( header != NULL );
+  assert_int_equal( header->magic, STAT_SEGMENT_MAGIC );
+  assert_int_equal( header->version, STAT_SEGMENT_VERSION );
+  assert_int_equal( header->pid, getpid() );
+  assert_int_equal( header->sequence, 2 );
+  assert_true( header->updated_at > 0 );
+
+  assert_int_equal( header->number_of_counters, 1 );
+  stat_segment_counter *counter = ( stat_segment_counter * ) ( ( char * ) header + header->counters_offset );
+  assert_string_equal( counter->key, "key" );
+  assert_int_equal( counter->value, 1 );
+
+  assert_int_equal( header->number_of_histograms, 1 );
+  stat_segment_histogram *histogram = ( stat_segment_histogram * ) ( ( char * ) header + header->histograms_offset );
+  assert_string_equal( histogram->key, "latency" );
+  assert_int_equal( histogram->histogram.count, 1 );
+  assert_int_equal( histogram->histogram.max, 10 );
+  xfree( header );
+
+  assert_true( finalize_stat() );
+  assert_true( read_stat_segment( "/tmp", "stat_test" ) == NULL );
+}
+
+
+static void
+test_rename_stat_segment() {
+  assert_true( init_stat() );
+  assert_true( open_stat_segment( "/tmp", "stat_test" ) );
+
+  assert_true( rename_stat_segment( "/tmp", "stat_test", "stat_test_renamed" ) );
+  assert_true( read_stat_segment( "/tmp", "stat_test" ) == NULL );
+  stat_segment_header *header = read_stat_segment( "/tmp", "stat_test_renamed" );
+  assert_true( header != NULL );
+  assert_int_equal( header->number_of_counters, 0 );
+  xfree( header );
+
+  assert_true( finalize_stat() );
+  assert_true( read_stat_segment( "/tmp", "stat_test_renamed" ) == NULL );
+}
+
+
+static void
+test_read_stat_segment_fails_without_segment() {
+  assert_true( read_stat_segment( "/tmp", "no_such_stat_test" ) == NULL );
+}
+
+
 /********************************************************************************
  * dump_stats() tests.
  ********************************************************************************/
@@ -274,6 +559,25 @@ main() {
     unit_test_setup_teardown( test_increment_stat_fails_if_key_is_NULL, reset, reset ),
     unit_test_setup_teardown( test_increment_stat_fails_if_not_initialized, reset, reset ),
 
+    // register_stat_counter() and increment_stat_id() tests.
+    unit_test_setup_teardown( test_register_stat_counter_returns_same_id_for_same_key, reset, reset ),
+    unit_test_setup_teardown( test_increment_stat_id_is_collected_on_dump, reset, reset ),
+    unit_test_setup_teardown( test_increment_stat_id_ignores_invalid_id, reset, reset ),
+    unit_test_setup_teardown( test_add_stat_id_adds_value, reset, reset ),
+    unit_test_setup_teardown( test_increment_stat_id_keeps_counts_of_exited_threads, reset, reset ),
+
+    // histogram tests.
+    unit_test_setup_teardown( test_register_stat_histogram_returns_same_id_for_same_key, reset, reset ),
+    unit_test_setup_teardown( test_record_stat_value_is_read_back, reset, reset ),
+    unit_test_setup_teardown( test_stat_histogram_percentile_is_within_bucket_precision, reset, reset ),
+    unit_test( test_merge_stat_histogram ),
+    unit_test_setup_teardown( test_dump_stats_prints_percentiles_of_all_threads, reset, reset ),
+
+    // statistics segment tests.
+    unit_test_setup_teardown( test_publish_stats_writes_segment, reset, reset ),
+    unit_test_setup_teardown( test_rename_stat_segment, reset, reset ),
+    unit_test( test_read_stat_segment_fails_without_segment ),
+
     // dump_sats() tests.
     unit_test_setup_teardown( test_dump_stats_succeeds, reset, reset ),
     unit_test_setup_teardown( test_dump_stats_succeeds_without_entries, reset, reset ),
@@ -15,8 +15,6 @@
  * GNU General Public License for more details.
  *
  * You should have received a copy of the GNU General Public License along
- * with this program; if not, write to the Free Software Foundation, Inc.,
- * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
  */
 
 
@@ -27,7 +25,7 @@
 #include <sys/stat.h>
 #include "checks.h"
 #include "cmockery_trema.h"
-#include "doubly_linked_list.h"
+#include "hash_map.h"
 #include "timer.h"
 
 
@@ -41,10 +39,23 @@ typedef struct timer_callback {
   struct timespec expires_at;
   struct timespec interval;
   void *user_data;
+  timer_handle handle;
+  uint64_t expires_tick;
+  uint8_t level;
+  uint8_t slot;
+  bool cancelled;
+  struct timer_callback *next;
+  struct timer_callback **pprev;
 } timer_callback;
 
 
-extern dlist_element *timer_callbacks;
+extern uint64_hash_map *timer_callbacks;
+
+static struct timespec now;
+
+#define MAX_FIRED 16
+static int fired[ MAX_FIRED ];
+static int fired_count;
 
 
 /********************************************************************************
@@ -54,8 +65,8 @@ extern dlist_element *timer_callbacks;
 int
 mock_clock_gettime( clockid_t clk_id, struct timespec *tp ) {
   UNUSED( clk_id );
-  UNUSED( tp );
 
+  *tp = now;
   return ( int ) mock();
 }
 
@@ -80,12 +91,12 @@ mock_debug( const char *format, ... ) {
 
 static timer_callback *
 find_timer_callback( void ( *callback )( void *user_data ) ) {
-  dlist_element *e;
-  timer_callback *cb;
+  uint64_hash_map_iterator iter;
+  uint64_hash_map_entry *e;
 
-  cb = NULL;
-  for ( e = timer_callbacks->next; e; e = e->next ) {
-    cb = e->data;
+  init_uint64_hash_map_iterator( timer_callbacks, &iter );
+  while ( ( e = iterate_uint64_hash_map_next( &iter ) ) != NULL ) {
+    timer_callback *cb = e->value;
     if ( cb->function == callback ) {
       return cb;
     }
@@ -94,6 +105,39 @@ find_timer_callback( void ( *callback )( void *user_data ) ) {
 }
 
 
+static void
+set_now( time_t sec, long nsec ) {
+  now.tv_sec = sec;
+  now.tv_nsec = nsec;
+}
+
+
+static timer_handle
+add_timer( time_t sec, long nsec, time_t interval_sec, void ( *callback )( void *user_data ), void *user_data ) {
+  struct itimerspec interval;
+  interval.it_value.tv_sec = sec;
+  interval.it_value.tv_nsec = nsec;
+  interval.it_interval.tv_sec = interval_sec;
+  interval.it_interval.tv_nsec = 0;
+  return add_timer_event( &interval, callback, user_data );
+}
+
+
+static void
+record_timer_event( void *user_data ) {
+  assert_true( fired_count < MAX_FIRED );
+  fired[ fired_count++ ] = ( int ) ( intptr_t ) user_data;
+}
+
+
+static void
+run_timers_at( time_t sec, long nsec ) {
+  set_now( sec, nsec );
+  fired_count = 0;
+  execute_timer_events();
+}
+
+
 /********************************************************************************
  * Tests
  ********************************************************************************/
@@ -172,6 +216,206 @@ test_add_timer_event_callback_fail_with_invalid_timespec() {
 }
 
 
+static void
+test_next_timer_deadline() {
+  init_timer();
+
+  struct timespec deadline;
+  assert_false( next_timer_deadline( &deadline ) );
+
+  will_return_count( mock_clock_gettime, 0, -1 );
+  set_now( 10, 0 );
+  timer_handle later = add_timer( 0, 500, 0, mock_timer_event_callback, NULL );
+  timer_handle sooner = add_timer( 0, 100, 0, mock_timer_event_callback, NULL );
+
+  assert_true( next_timer_deadline( &deadline ) );
+  assert_int_equal( deadline.tv_sec, 10 );
+  assert_int_equal( deadline.tv_nsec, 100 );
+
+  assert_true( cancel_timer_event( sooner ) );
+  assert_true( next_timer_deadline( &deadline ) );
+  assert_int_equal( deadline.tv_sec, 10 );
+  assert_int_equal( deadline.tv_nsec, 500 );
+
+  assert_true( cancel_timer_event( later ) );
+  assert_false( next_timer_deadline( &deadline ) );
+
+  finalize_timer();
+}
+
+
+static void
+test_execute_timer_events_in_expiry_order() {
+  init_timer();
+
+  will_return_count( mock_clock_gettime, 0, -1 );
+  set_now( 100, 0 );
+  add_timer( 0, 300000000, 0, record_timer_event, ( void * ) 3 );
+  add_timer( 0, 100000000, 0, record_timer_event, ( void * ) 1 );
+  add_timer( 0, 200000000, 0, record_timer_event, ( void * ) 2 );
+
+  run_timers_at( 100, 99999999 );
+  assert_int_equal( fired_count, 0 );
+
+  run_timers_at( 100, 250000000 );
+  assert_int_equal( fired_count, 2 );
+  assert_int_equal( fired[ 0 ], 1 );
+  assert_int_equal( fired[ 1 ], 2 );
+
+  run_timers_at( 101, 0 );
+  assert_int_equal( fired_count, 1 );
+  assert_int_equal( fired[ 0 ], 3 );
+
+  // one-shot timers are gone once they have expired.
+  assert_int_equal( timer_callbacks->length, 0 );
+
+  finalize_timer();
+}
+
+
+static void
+test_periodic_timer_is_rearmed() {
+  init_timer();
+
+  will_return_count( mock_clock_gettime, 0, -1 );
+  set_now( 100, 0 );
+  timer_handle handle = add_timer( 0, 0, 2, record_timer_event, ( void * ) 1 );
+
+  run_timers_at( 101, 999999999 );
+  assert_int_equal( fired_count, 0 );
+  run_timers_at( 102, 0 );
+  assert_int_equal( fired_count, 1 );
+  run_timers_at( 103, 0 );
+  assert_int_equal( fired_count, 0 );
+  run_timers_at( 104, 0 );
+  assert_int_equal( fired_count, 1 );
+
+  struct timespec deadline;
+  assert_true( next_timer_deadline( &deadline ) );
+  assert_int_equal( deadline.tv_sec, 106 );
+  assert_int_equal( deadline.tv_nsec, 0 );
+
+  assert_true( cancel_timer_event( handle ) );
+  run_timers_at( 106, 0 );
+  assert_int_equal( fired_count, 0 );
+
+  finalize_timer();
+}
+
+
+static void
+test_far_timers_cascade_down() {
+  init_timer();
+
+  will_return_count( mock_clock_gettime, 0, -1 );
+  set_now( 1000, 0 );
+  add_timer( 3600, 0, 0, record_timer_event, ( void * ) 2 );
+  add_timer( 0, 1000000, 0, record_timer_event, ( void * ) 1 );
+  add_timer( 100000000, 0, 0, record_timer_event, ( void * ) 3 );
+
+  run_timers_at( 1000, 1000000 );
+  assert_int_equal( fired_count, 1 );
+  assert_int_equal( fired[ 0 ], 1 );
+
+  run_timers_at( 4599, 999999999 );
+  assert_int_equal( fired_count, 0 );
+  run_timers_at( 4600, 0 );
+  assert_int_equal( fired_count, 1 );
+  assert_int_equal( fired[ 0 ], 2 );
+
+  struct timespec deadline;
+  assert_true( next_timer_deadline( &deadline ) );
+  assert_int_equal( deadline.tv_sec, 100001000 );
+
+  run_timers_at( 100000999, 999000000 );
+  assert_int_equal( fired_count, 0 );
+  run_timers_at( 100001000, 0 );
+  assert_int_equal( fired_count, 1 );
+  assert_int_equal( fired[ 0 ], 3 );
+
+  finalize_timer();
+}
+
+
+static void
+test_timer_expires_within_a_millisecond() {
+  init_timer();
+
+  will_return_count( mock_clock_gettime, 0, -1 );
+  set_now( 100, 0 );
+  add_timer( 0, 500000, 0, record_timer_event, ( void * ) 1 );
+  add_timer( 0, 900000, 0, record_timer_event, ( void * ) 2 );
+
+  run_timers_at( 100, 499999 );
+  assert_int_equal( fired_count, 0 );
+  run_timers_at( 100, 600000 );
+  assert_int_equal( fired_count, 1 );
+  assert_int_equal( fired[ 0 ], 1 );
+  run_timers_at( 100, 900000 );
+  assert_int_equal( fired_count, 1 );
+  assert_int_equal( fired[ 0 ], 2 );
+
+  finalize_timer();
+}
+
+
+static void
+test_timer_fd() {
+  init_timer();
+
+  assert_true( get_timer_fd() >= 0 );
+
+  finalize_timer();
+  assert_int_equal( get_timer_fd(), -1 );
+}
+
+
+static timer_handle self_cancelling_timer;
+
+
+static void
+cancel_itself( void *user_data ) {
+  record_timer_event( user_data );
+  assert_true( cancel_timer_event( self_cancelling_timer ) );
+}
+
+
+static void
+test_cancel_timer_event_in_its_callback() {
+  init_timer();
+
+  will_return_count( mock_clock_gettime, 0, -1 );
+  set_now( 100, 0 );
+  self_cancelling_timer = add_timer( 0, 0, 1, cancel_itself, ( void * ) 1 );
+
+  run_timers_at( 101, 0 );
+  assert_int_equal( fired_count, 1 );
+  assert_int_equal( timer_callbacks->length, 0 );
+  assert_false( cancel_timer_event( self_cancelling_timer ) );
+
+  run_timers_at( 102, 0 );
+  assert_int_equal( fired_count, 0 );
+
+  finalize_timer();
+}
+
+
+static void
+test_cancel_expired_timer_event() {
+  init_timer();
+
+  will_return_count( mock_clock_gettime, 0, -1 );
+  set_now( 100, 0 );
+  timer_handle handle = add_timer( 1, 0, 0, record_timer_event, ( void * ) 1 );
+
+  run_timers_at( 101, 0 );
+  assert_int_equal( fired_count, 1 );
+  assert_false( cancel_timer_event( handle ) );
+
+  finalize_timer();
+}
+
+
 static void
 test_nonexistent_timer_event_callback() {
   assert_false( delete_timer_event_callback( mock_timer_event_callback ) );
@@ -200,6 +444,14 @@ main() {
     unit_test( test_timer_event_callback ),
     unit_test( test_periodic_event_callback ),
     unit_test( test_add_timer_event_callback_fail_with_invalid_timespec ),
+    unit_test( test_next_timer_deadline ),
+    unit_test( test_execute_timer_events_in_expiry_order ),
+    unit_test( test_periodic_timer_is_rearmed ),
+    unit_test( test_far_timers_cascade_down ),
+    unit_test( test_timer_expires_within_a_millisecond ),
+    unit_test( test_timer_fd ),
+    unit_test( test_cancel_timer_event_in_its_callback ),
+    unit_test( test_cancel_expired_timer_event ),
     unit_test( test_nonexistent_timer_event_callback ),
     unit_test( test_clock_gettime_fail_einval ),
   };
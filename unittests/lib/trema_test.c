@@ -227,6 +227,31 @@ mock_messenger_dump_enabled() {
 }
 
 
+static bool messenger_trace_started = false;
+
+bool
+mock_start_messenger_trace( const char *path, const char *app_name, size_t ring_size, size_t snapshot_length ) {
+  UNUSED( path );
+  UNUSED( app_name );
+  UNUSED( ring_size );
+  UNUSED( snapshot_length );
+  messenger_trace_started = true;
+  return true;
+}
+
+
+void
+mock_stop_messenger_trace() {
+  messenger_trace_started = false;
+}
+
+
+bool
+mock_messenger_trace_enabled() {
+  return messenger_trace_started;
+}
+
+
 void
 mock_die( char *format, ... ) {
   va_list args;
@@ -314,6 +339,53 @@ mock_dump_stats() {
 }
 
 
+bool
+mock_open_stat_segment( const char *directory, const char *name ) {
+  UNUSED( directory );
+  UNUSED( name );
+
+  return true;
+}
+
+
+bool
+mock_rename_stat_segment( const char *directory, const char *old, const char *new ) {
+  UNUSED( directory );
+  UNUSED( old );
+  UNUSED( new );
+
+  return true;
+}
+
+
+bool
+mock_start_async_logging( void ) {
+  return true;
+}
+
+
+void
+mock_stop_async_logging( void ) {
+  // do nothing
+}
+
+
+void
+mock_publish_stats() {
+  // do nothing
+}
+
+
+bool
+mock_add_periodic_event_callback( const time_t seconds, void ( *callback )( void *user_data ), void *user_data ) {
+  UNUSED( seconds );
+  UNUSED( callback );
+  UNUSED( user_data );
+
+  return true;
+}
+
+
 bool
 mock_init_timer() {
   // Do nothing.